@@ -0,0 +1,113 @@
+/*	Alloaudio --
+    Audio facilities for large multichannel systems
+
+    Copyright (C) 2014. AlloSphere Research Group, Media Arts & Technology, UCSB.
+    Copyright (C) 2014. The Regents of the University of California.
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+        Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+        Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+        Neither the name of the University of California nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+
+
+    File description:
+    Bank of biquad filters processing several channels at once with SIMD
+*/
+
+#ifndef INC_AL_BIQUADBANK_HPP
+#define INC_AL_BIQUADBANK_HPP
+
+#include <vector>
+
+namespace al {
+
+/** \addtogroup alloaudio
+ *  @{
+ */
+
+/** Bank of biquad filters sharing the same coefficients, one per channel.
+ *
+ * Channels are filtered in groups of width() channels, one channel per SIMD
+ * lane, so that the recursion of each filter is computed for a whole group
+ * with a few vector instructions per sample. Blocks passed to process() hold
+ * the samples of one group interleaved: sample i of channel
+ * (group * width() + k) is at block[i * width() + k].
+ *
+ * Samples are always float. The filter state and arithmetic are float by
+ * default, or double for low cutoff frequencies at high sample rates, where
+ * float recursions lose precision.
+ */
+class BiquadBank
+{
+public:
+	/**
+	 * @param numChannels number of channels
+	 * @param doubleState whether to filter with double precision
+	 */
+	BiquadBank(int numChannels = 0, bool doubleState = false);
+
+	/** Number of channels filtered together, e.g. 4 with SSE or 8 with AVX */
+	static int width();
+
+	/** Set the number of channels. This clears the filter state. */
+	void channels(int numChannels);
+	int channels() const { return m_numChnls; }
+
+	/** Number of groups of width() channels */
+	int groups() const { return (m_numChnls + width() - 1) / width(); }
+
+	/** Set whether to filter with double precision. This clears the filter state. */
+	void doubleState(bool on);
+	bool doubleState() const { return m_double; }
+
+	/** Set coefficients of y[n] = a0 x[n] + a1 x[n-1] + a2 x[n-2] - b1 y[n-1] - b2 y[n-2] */
+	void coefs(double a0, double a1, double a2, double b1, double b2);
+
+	/** Set coefficients of a 2nd order Butterworth low or high pass filter.
+	 * These are the same as those of butter_set_fc().
+	 */
+	void butterworth(double fc, double sampleRate, bool lowpass);
+
+	/** Clear the filter state */
+	void reset();
+
+	/** Filter a block of one group of channels, interleaved as described above.
+	 * in and out may be the same block.
+	 */
+	void process(int group, const float *in, float *out, int numFrames);
+
+private:
+	int m_numChnls;
+	bool m_double;
+	double m_coefs[5];
+	std::vector<float> m_stateF;	// x1, x2, y1, y2 of each group
+	std::vector<double> m_stateD;
+};
+
+/** @} */
+
+} // al::
+
+#endif
@@ -53,10 +53,9 @@
 #include "allocore/types/al_MsgQueue.hpp"
 #include "allocore/protocol/al_OSC.hpp"
 #include "allocore/system/al_Thread.hpp"
+#include "alloaudio/al_BiquadBank.hpp"
 
 
-typedef struct BUTTER_ BUTTER;
-
 namespace al {
 
 typedef enum {
@@ -150,6 +149,19 @@ class OutputMaster : public osc::Recv, public al::AudioCallback
 
     void setBassManagementMode(bass_mgmt_mode_t mode);
 
+    /** Run the bass management filters with double instead of single precision.
+     * This is slower but more accurate for low cross-over frequencies at high
+     * sample rates. It resets the filters, so should be set before processing.
+     */
+    void setBassManagementDoublePrecision(bool on);
+
+    /** Set the largest number of frames per buffer passed to onAudioCB(). This
+     * allocates the bass management buffers, which are never resized in the audio
+     * callback, so it should be set before processing. Larger buffers are processed
+     * in several parts. The default is 512 frames.
+     */
+    void setFramesPerBuffer(int frames);
+
     /** Specify which channel indeces are subwoofers for the purpose of bass management.
      * Currently a maximum of 4 subwoofers are supported.
      */
@@ -235,14 +247,17 @@ private:
     pthread_mutex_t m_meterMutex;
     pthread_cond_t m_meterCond;
 
-    /* bass management filters */
-    std::vector<BUTTER *> m_lopass1, m_lopass2, m_hipass1, m_hipass2;
+    /* bass management filters, for groups of BiquadBank::width() channels */
+    BiquadBank m_lopass1, m_lopass2, m_hipass1, m_hipass2;
+    std::vector<float> m_groupBuf, m_lowBuf, m_highBuf, m_bassBuf; /* interleaved by group */
+    int m_framesPerBuffer; /* frames the buffers above hold */
 
     double m_framesPerSec; // Sample rate
 
     int chanIsSubwoofer(int index);
     void initializeData();
     void allocateChannels(int numChnls);
+    void processFrames(AudioIOData &io, int offset, int nframes, float master_gain);
     static void *meterThreadFunc(void *arg);
 
     struct OSCHandler : public osc::PacketHandler{
@@ -0,0 +1,125 @@
+/*	Alloaudio --
+    Audio facilities for large multichannel systems
+
+    Copyright (C) 2014. AlloSphere Research Group, Media Arts & Technology, UCSB.
+    Copyright (C) 2014. The Regents of the University of California.
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+        Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+        Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+        Neither the name of the University of California nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+
+
+    File description:
+    Disk streaming service shared by all buffered sound files
+*/
+
+#ifndef INC_AL_SOUNDFILESTREAMER_HPP
+#define INC_AL_SOUNDFILESTREAMER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace al {
+
+class SoundFileBuffered;
+
+/** \addtogroup alloaudio
+ *  @{
+ */
+
+/** Streams all open SoundFileBuffered files from disk with a few I/O threads.
+ *
+ * The I/O threads poll the files every serviceInterval() seconds, or sooner
+ * when a file seeks, and always refill first the file that will run out of
+ * buffered frames soonest, given the rate at which it is being read. Each
+ * file is filled up to readAhead() seconds of its consumption rate, so that
+ * files read faster get larger read-ahead. Reading a file from the audio
+ * thread only updates atomic counters: it never wakes or waits for an I/O
+ * thread.
+ *
+ * Files use the global() streamer unless given another one.
+ */
+class SoundFileStreamer
+{
+public:
+	/**
+	 * @param numThreads number of I/O threads, started with the first file
+	 */
+	SoundFileStreamer(int numThreads = 2);
+
+	/** Stops the I/O threads. All files must have been closed. */
+	~SoundFileStreamer();
+
+	/** Number of I/O threads */
+	int numThreads() const { return m_numThreads; }
+
+	/** Number of files being streamed */
+	int numFiles() const;
+
+	/** Set the time, in seconds of consumption, buffered ahead of each file */
+	void readAhead(double seconds) { m_readAhead = seconds; }
+	double readAhead() const { return m_readAhead; }
+
+	/** Set the longest time, in seconds, between two refills when idle */
+	void serviceInterval(double seconds) { m_serviceInterval = seconds; }
+	double serviceInterval() const { return m_serviceInterval; }
+
+	/** Total number of underruns of the files being streamed */
+	int underruns() const;
+
+	/** Streamer shared by the application, with two I/O threads */
+	static SoundFileStreamer& global();
+
+private:
+	friend class SoundFileBuffered;
+
+	void add(SoundFileBuffered *file);
+	void remove(SoundFileBuffered *file); // waits until the file is not being serviced
+	void wake(); // does not lock, may be called from the audio thread
+	void run();
+
+	// Next file to service, or null if none needs it
+	SoundFileBuffered *next();
+
+	int m_numThreads;
+	std::atomic<double> m_readAhead;
+	std::atomic<double> m_serviceInterval;
+	std::vector<SoundFileBuffered *> m_files;
+	std::vector<std::thread> m_threads;
+	mutable std::mutex m_lock;
+	std::condition_variable m_condVar;	// wakes I/O threads
+	std::condition_variable m_serviced;	// signals the end of a service
+	bool m_running;
+};
+
+/** @} */
+
+} // namespace al
+
+#endif // INC_AL_SOUNDFILESTREAMER_HPP
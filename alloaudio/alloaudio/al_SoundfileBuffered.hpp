@@ -2,14 +2,14 @@
 #define SOUNDFILEBUFFERED_H
 
 
-#include <mutex>
-#include <thread>
-#include <condition_variable>
-#include <memory>
 #include <atomic>
+#include <string>
+#include <vector>
 
 #include "Gamma/SoundFile.h"
+#include "allocore/system/pstdint.h"
 #include "allocore/types/al_SingleRWRingBuffer.hpp"
+#include "alloaudio/al_SoundFileStreamer.hpp"
 
 
 
@@ -24,11 +24,20 @@ namespace al
 /// \brief Read a soundfile with buffering on a low priority thread
 ///
 /// The SoundFileBuffered class is a wrapper around Gamma's SoundFile class.
-/// It reads the soundfile in a separate thread and reading is done from a
-/// lock-free ring buffer. This is the ideal way of reading a soundfile
-/// within an audio callback as it will provide the most efficient mechanism
-/// for low latency, high efficiency and drop-out free soundfile access.
+/// The soundfile is read by the I/O threads of a SoundFileStreamer, shared by
+/// all open files, and reading is done from a lock-free ring buffer. This is
+/// the ideal way of reading a soundfile within an audio callback as it will
+/// provide the most efficient mechanism for low latency, high efficiency and
+/// drop-out free soundfile access.
 ///
+/// The first frames of the loop region (by default the whole file) are kept
+/// in memory, so that seeking into them is sample accurate without waiting
+/// for the disk, and looping does not need to seek on disk. Loops shorter
+/// than the head play from memory.
+///
+/// read(), seek(), loopRegion() and the statistics should be called from the
+/// same thread, usually the audio thread. Seeks and loop changes are handed to
+/// the streamer and do not block or touch the disk.
 ///
 class SoundFileBuffered
 {
@@ -36,16 +45,19 @@ public:
 	///
 	/// \param fullPath The full path to the audio file
 	/// \param loop set to true if you want the sound file to start over when finished
-	/// \param bufferFrames the size of the ring buffer. Set to larger if experiencing dropouts or if planning to read more samples, e.g. the audio buffer size is large.
+	/// \param bufferFrames the largest number of frames read at once. The ring buffer holds at least four times this, and twice the read-ahead of the streamer.
+	/// \param streamer the streamer reading the file, or null for SoundFileStreamer::global()
 	///
-	SoundFileBuffered(std::string fullPath, bool loop = false, int bufferFrames = 1024);
+	SoundFileBuffered(std::string fullPath, bool loop = false, int bufferFrames = 1024,
+	                  SoundFileStreamer *streamer = nullptr);
 	~SoundFileBuffered();
 
 	///
 	/// \brief Read samples from the audio file
 	/// \param buffer pre-allocated buffer of at least numFrames*channels() size
 	/// \param numFrames number of frames to read
-	/// \return the number of frames actually read.
+	/// \return the number of frames actually read. This is less than
+	/// numFrames at the end of a file that does not loop, or on underrun.
 	///
 	int read(float *buffer, int numFrames);
 
@@ -87,29 +99,107 @@ public:
 	///
 	void setReadCallback(CallbackFunc func, void *userData);
 
-    void seek(int frame);
+	///
+	/// \brief Continue reading from a frame
+	///
+	/// The next read() starts exactly at frame. If the frame is in the
+	/// preloaded head of the loop region, reading continues without a gap;
+	/// otherwise read() may underrun until the streamer has read from the new
+	/// position.
+	///
+	void seek(int frame);
+
+	///
+	/// \brief Set the region played when looping
+	///
+	/// Playing continues from the current position, or from beginFrame if
+	/// the current position is past the end of a looping region. Like seek(),
+	/// the change is applied by the streamer, which reads the head of the new
+	/// region, so read() may underrun until it has caught up.
+	///
+	/// \param beginFrame first frame of the loop
+	/// \param endFrame frame after the last frame of the loop
+	///
+	void loopRegion(int beginFrame, int endFrame);
+	int loopBegin() const { return mLoopBegin; }
+	int loopEnd() const { return mLoopEnd; }
+
+	///
+	/// \brief Position of the next frame read
+	///
+	int currentPosition();
+
+	/// Number of read() calls that returned fewer frames than requested
+	/// before the end of the file
+	int underruns() const { return mUnderruns.load(); }
 
-    int currentPosition();
+	/// Number of frames missing from the reads that underran
+	int underrunFrames() const { return mUnderrunFrames.load(); }
 
 private:
-	bool mRunning;
+	friend class SoundFileStreamer;
+
+	// Streamer interface
+	bool needsService(double now, double &secondsLeft);
+	int targetFrames() const;
+	void service();
+	void loadHead();
+	int writeFrames(const float *frames, int numFrames);
+	void advance(int numFrames);
+
+	SoundFileStreamer *mStreamer;
 	bool mLoop;
-	std::atomic<int> mRepeats;
-    std::atomic<int> mSeek;
-    std::atomic<int> mCurPos; // Updated once per read buffer
-	std::mutex mLock;
-	std::condition_variable mCondVar;
-	std::thread *mReaderThread;
-	SingleRWRingBuffer *mRingBuffer;
 	int mBufferFrames;
+	int mCapacity;		// ring buffer size, in frames
+	int mChunkFrames;	// size of mFileBuffer, in frames
+	int mLoopBegin, mLoopEnd;	// loop region seen by the reader
+	SingleRWRingBuffer *mRingBuffer;
 
 	gam::SoundFile mSf;
 	CallbackFunc mReadCallback;
 	void *mCallbackData;
 
-	float *mFileBuffer; // Buffer to copy file samples to (in the reader thread before passing to ring buffer)
-
-	static void readFunction(SoundFileBuffered *obj);
+	float *mFileBuffer; // Buffer to copy file samples to (in the I/O thread before passing to ring buffer)
+
+	// Head of the loop region, written by the streamer before mHeadReady and
+	// when it handles a loop change
+	std::vector<float> mHead;
+	int mHeadFrames;
+	std::atomic<bool> mHeadReady;
+
+	// Seek requests of the reader and replies of the streamer. Frames are
+	// counted since the ring buffer was created: the data of a seek starts
+	// after mSeekStart frames and the file ended after mEndFrames frames.
+	std::atomic<int> mSeekRequest;
+	std::atomic<int> mSeekFrame;
+	std::atomic<int64_t> mLoopRequest;	// loop region, begin << 32 | end
+	std::atomic<int> mSeekAck;
+	std::atomic<int64_t> mSeekStart;
+	std::atomic<int64_t> mEndFrames;
+	std::atomic<int64_t> mConsumed;		// frames returned by read()
+
+	// Streamer state, only used by the I/O thread servicing the file
+	bool mBusy;				// being serviced, guarded by the streamer lock
+	int mSeekHandled;
+	int mWriteBegin, mWriteEnd;	// loop region being written
+	int mWritePos;			// file position of next frame written
+	int mFilePos;			// file position of mSf
+	bool mEnded;
+	int64_t mFramesWritten;
+	int64_t mLastConsumed;
+	double mLastTime;
+	double mRate;			// consumption rate, in frames/second
+
+	// Reader state
+	int mRequest;
+	int64_t mFramesRead;
+	int mHeadPos;			// position in head being played, or -1
+	int mHeadRequest;		// request that loads the current head
+	int mPosition;
+	std::atomic<int> mCurPos;
+	std::atomic<int> mRepeats;
+	std::atomic<int> mUnderruns;
+	std::atomic<int> mUnderrunFrames;
 };
 
 /** @} */
@@ -0,0 +1,128 @@
+/*
+Alloaudio Example: OutputMaster benchmark
+
+Description:
+This measures the time OutputMaster takes to process a block of 256 frames
+on 64 channels with full bass management and metering, and the share of the
+block duration at 48 kHz that this uses. It compares the previous scalar
+processing, which converted each channel to double and ran the butter.h
+filters one channel at a time, with the BiquadBank filters, which run
+BiquadBank::width() channels per SIMD vector, in single and double precision.
+
+*/
+
+#include <cstdio>
+#include <vector>
+
+#include "alloaudio/al_OutputMaster.hpp"
+#include "alloaudio/butter.h"
+#include "allocore/system/al_Time.hpp"
+
+using namespace al;
+
+static const int CHANNELS = 64;
+static const int FRAMES = 256;
+static const int BLOCKS = 2000;
+static const double SR = 48000;
+
+// The previous processing of OutputMaster::onAudioCB in BASSMODE_FULL
+struct ScalarOutputMaster {
+	std::vector<BUTTER *> lp1, lp2, hp1, hp2;
+	std::vector<float> meters;
+
+	ScalarOutputMaster(): meters(CHANNELS, 0.f){
+		for (int c = 0; c < CHANNELS; c++) {
+			lp1.push_back(butter_create(SR, BUTTER_LP));
+			lp2.push_back(butter_create(SR, BUTTER_LP));
+			hp1.push_back(butter_create(SR, BUTTER_HP));
+			hp2.push_back(butter_create(SR, BUTTER_HP));
+		}
+	}
+
+	~ScalarOutputMaster(){
+		for (int c = 0; c < CHANNELS; c++) {
+			butter_free(lp1[c]); butter_free(lp2[c]);
+			butter_free(hp1[c]); butter_free(hp2[c]);
+		}
+	}
+
+	void process(AudioIOData& io){
+		int nframes = io.framesPerBuffer();
+		double bass_buf[nframes], filt_out[nframes], filt_low[nframes];
+		double in_buf[nframes], filt_temp[nframes];
+		for (int i = 0; i < nframes; i++) bass_buf[i] = 0;
+		for (int c = 0; c < CHANNELS; c++) {
+			float *out = io.outBuffer(c);
+			for (int i = 0; i < nframes; i++) in_buf[i] = out[i];
+			butter_next(lp1[c], in_buf, filt_temp, nframes);
+			butter_next(lp2[c], filt_temp, filt_low, nframes);
+			butter_next(hp1[c], in_buf, filt_temp, nframes);
+			butter_next(hp2[c], filt_temp, filt_out, nframes);
+			for (int i = 0; i < nframes; i++) in_buf[i] = filt_out[i];
+			for (int i = 0; i < nframes; i++) bass_buf[i] += filt_low[i];
+			for (int i = 0; i < nframes; i++) {
+				out[i] = in_buf[i] * 0.5;
+				if (out[i] > 1.0) out[i] = 1.0;
+			}
+		}
+		float *sw = io.outBuffer(CHANNELS - 1);
+		for (int i = 0; i < nframes; i++) sw[i] = bass_buf[i];
+		for (int c = 0; c < CHANNELS; c++) {
+			float *out = io.outBuffer(c);
+			for (int i = 0; i < nframes; i++) {
+				if (meters[c] < out[i]) meters[c] = out[i];
+			}
+		}
+	}
+};
+
+void fill(AudioIOData& io, int block){
+	for (int c = 0; c < CHANNELS; c++) {
+		float *out = io.outBuffer(c);
+		for (int i = 0; i < FRAMES; i++) {
+			out[i] = ((block * FRAMES + i) * (c + 7) % 201) * 0.005f - 0.5f;
+		}
+	}
+}
+
+void report(const char * name, double sec){
+	double usPerBlock = sec / BLOCKS * 1e6;
+	printf("%-24s %10.1f %10.2f\n", name, usPerBlock, usPerBlock * 1e-6 / (FRAMES / SR) * 100);
+}
+
+int main(){
+	AudioIO io(FRAMES, SR, NULL, NULL, CHANNELS, 0);
+	printf("\n%d channels x %d frames, BiquadBank::width() = %d\n\n",
+		CHANNELS, FRAMES, BiquadBank::width());
+	printf("                         us/block   %% of block\n");
+
+	{
+		ScalarOutputMaster om;
+		al_sec sec = 0;
+		for (int b = 0; b < BLOCKS; b++) {
+			fill(io, b);
+			al_sec t0 = al_steady_time();
+			om.process(io);
+			sec += al_steady_time() - t0;
+		}
+		report("scalar double", sec);
+	}
+
+	for (int precision = 0; precision < 2; precision++) {
+		OutputMaster om(CHANNELS, SR, "", -1);
+		om.setMasterGain(1.0);
+		for (int c = 0; c < CHANNELS; c++) om.setGain(c, 0.5);
+		om.setBassManagementDoublePrecision(precision == 1);
+		om.setBassManagementMode(BASSMODE_FULL);
+		om.setMeterOn(true);
+		al_sec sec = 0;
+		for (int b = 0; b < BLOCKS; b++) {
+			fill(io, b);
+			al_sec t0 = al_steady_time();
+			om.onAudioCB(io);
+			sec += al_steady_time() - t0;
+		}
+		report(precision ? "BiquadBank double" : "BiquadBank float", sec);
+	}
+	return 0;
+}
@@ -0,0 +1,98 @@
+/*
+Alloaudio Example: Streaming many sound files
+
+Description:
+This plays 128 looping sound files at once, as a large scene would, reading a
+block of 256 frames from each of them at the pace of a 48 kHz audio callback
+for a few seconds. All files are read from disk by the I/O threads of a single
+SoundFileStreamer. For 1, 2 and 4 I/O threads it reports the number of
+underruns, the frames missing from them, and the process CPU time.
+
+The files are written to the temporary directory before playing.
+
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "alloaudio/al_SoundfileBuffered.hpp"
+#include "allocore/system/al_Time.hpp"
+
+using namespace al;
+
+static const int FILES = 128;
+static const int CHANNELS = 2;
+static const int FRAMES = 256;
+static const double SR = 48000;
+static const double SECONDS = 3;
+
+std::string filePath(int i)
+{
+	return "/tmp/alloaudio_stream_" + std::to_string(i) + ".wav";
+}
+
+void writeFiles()
+{
+	for (int i = 0; i < FILES; i++) {
+		// Files of different lengths, to loop at different times
+		int numFrames = int(SR) / 2 + i * 300;
+		std::vector<float> samples(numFrames * CHANNELS);
+		for (size_t j = 0; j < samples.size(); j++) {
+			samples[j] = 0.5 * sin(j * (i + 1) * 0.001);
+		}
+		gam::SoundFile sf(filePath(i));
+		sf.format(gam::SoundFile::WAV).encoding(gam::SoundFile::PCM_16);
+		sf.channels(CHANNELS).frameRate(SR);
+		sf.openWrite();
+		sf.write(&samples[0], numFrames);
+		sf.close();
+	}
+}
+
+void play(int numThreads)
+{
+	SoundFileStreamer streamer(numThreads);
+	std::vector<SoundFileBuffered *> files;
+	for (int i = 0; i < FILES; i++) {
+		files.push_back(new SoundFileBuffered(filePath(i), true, FRAMES, &streamer));
+	}
+	al_sleep(0.2); // Let the streamer fill the buffers
+
+	std::vector<float> buffer(FRAMES * CHANNELS);
+	int underrunFrames = 0;
+	std::clock_t cpu0 = std::clock();
+	al_sec start = al_time();
+	int blocks = int(SECONDS * SR / FRAMES);
+	for (int b = 0; b < blocks; b++) {
+		for (auto file : files) {
+			file->read(&buffer[0], FRAMES);
+		}
+		al_sleep_until(start + (b + 1) * FRAMES / SR);
+	}
+	double cpu = double(std::clock() - cpu0) / CLOCKS_PER_SEC;
+
+	int underruns = streamer.underruns();
+	for (auto file : files) {
+		underrunFrames += file->underrunFrames();
+		delete file;
+	}
+	printf("%10d %12d %14d %10.1f\n", numThreads, underruns, underrunFrames,
+	       cpu / SECONDS * 100);
+}
+
+int main()
+{
+	writeFiles();
+	printf("\n%d files, %d frames per block\n\n", FILES, FRAMES);
+	printf("I/O threads   underruns   missing frames   CPU %%\n");
+	play(1);
+	play(2);
+	play(4);
+	for (int i = 0; i < FILES; i++) {
+		remove(filePath(i).c_str());
+	}
+	return 0;
+}
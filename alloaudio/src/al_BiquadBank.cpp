@@ -0,0 +1,248 @@
+#include <math.h>
+
+#include "alloaudio/al_BiquadBank.hpp"
+
+#if defined(__AVX__)
+	#include <immintrin.h>
+	#define AL_BIQUAD_AVX
+#elif defined(__SSE2__) || defined(_M_X64)
+	#include <emmintrin.h>
+	#define AL_BIQUAD_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	#include <arm_neon.h>
+	#define AL_BIQUAD_NEON
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846	/* pi */
+#endif
+
+using namespace al;
+
+namespace {
+
+// Vector operations for the biquad recursion. Each provides the lane
+// count N, loads and stores of N float samples, and arithmetic in the
+// state type T.
+
+#if defined(AL_BIQUAD_AVX)
+enum { WIDTH = 8 };
+
+struct VecF {
+	typedef float T; typedef __m256 V; enum { N = 8 };
+	static V set1(T v){ return _mm256_set1_ps(v); }
+	static V load(const T *p){ return _mm256_loadu_ps(p); }
+	static void store(T *p, V v){ _mm256_storeu_ps(p, v); }
+	static V loadf(const float *p){ return _mm256_loadu_ps(p); }
+	static void storef(float *p, V v){ _mm256_storeu_ps(p, v); }
+	static V add(V a, V b){ return _mm256_add_ps(a, b); }
+	static V sub(V a, V b){ return _mm256_sub_ps(a, b); }
+	static V mul(V a, V b){ return _mm256_mul_ps(a, b); }
+};
+
+struct VecD {
+	typedef double T; typedef __m256d V; enum { N = 4 };
+	static V set1(T v){ return _mm256_set1_pd(v); }
+	static V load(const T *p){ return _mm256_loadu_pd(p); }
+	static void store(T *p, V v){ _mm256_storeu_pd(p, v); }
+	static V loadf(const float *p){ return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+	static void storef(float *p, V v){ _mm_storeu_ps(p, _mm256_cvtpd_ps(v)); }
+	static V add(V a, V b){ return _mm256_add_pd(a, b); }
+	static V sub(V a, V b){ return _mm256_sub_pd(a, b); }
+	static V mul(V a, V b){ return _mm256_mul_pd(a, b); }
+};
+
+#elif defined(AL_BIQUAD_SSE2)
+enum { WIDTH = 4 };
+
+struct VecF {
+	typedef float T; typedef __m128 V; enum { N = 4 };
+	static V set1(T v){ return _mm_set1_ps(v); }
+	static V load(const T *p){ return _mm_loadu_ps(p); }
+	static void store(T *p, V v){ _mm_storeu_ps(p, v); }
+	static V loadf(const float *p){ return _mm_loadu_ps(p); }
+	static void storef(float *p, V v){ _mm_storeu_ps(p, v); }
+	static V add(V a, V b){ return _mm_add_ps(a, b); }
+	static V sub(V a, V b){ return _mm_sub_ps(a, b); }
+	static V mul(V a, V b){ return _mm_mul_ps(a, b); }
+};
+
+struct VecD {
+	typedef double T; typedef __m128d V; enum { N = 2 };
+	static V set1(T v){ return _mm_set1_pd(v); }
+	static V load(const T *p){ return _mm_loadu_pd(p); }
+	static void store(T *p, V v){ _mm_storeu_pd(p, v); }
+	static V loadf(const float *p){
+		return _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd((const double *)p)));
+	}
+	static void storef(float *p, V v){ _mm_store_sd((double *)p, _mm_castps_pd(_mm_cvtpd_ps(v))); }
+	static V add(V a, V b){ return _mm_add_pd(a, b); }
+	static V sub(V a, V b){ return _mm_sub_pd(a, b); }
+	static V mul(V a, V b){ return _mm_mul_pd(a, b); }
+};
+
+#elif defined(AL_BIQUAD_NEON)
+enum { WIDTH = 4 };
+
+struct VecF {
+	typedef float T; typedef float32x4_t V; enum { N = 4 };
+	static V set1(T v){ return vdupq_n_f32(v); }
+	static V load(const T *p){ return vld1q_f32(p); }
+	static void store(T *p, V v){ vst1q_f32(p, v); }
+	static V loadf(const float *p){ return vld1q_f32(p); }
+	static void storef(float *p, V v){ vst1q_f32(p, v); }
+	static V add(V a, V b){ return vaddq_f32(a, b); }
+	static V sub(V a, V b){ return vsubq_f32(a, b); }
+	static V mul(V a, V b){ return vmulq_f32(a, b); }
+};
+
+struct VecD {
+	typedef double T; typedef float64x2_t V; enum { N = 2 };
+	static V set1(T v){ return vdupq_n_f64(v); }
+	static V load(const T *p){ return vld1q_f64(p); }
+	static void store(T *p, V v){ vst1q_f64(p, v); }
+	static V loadf(const float *p){ return vcvt_f64_f32(vld1_f32(p)); }
+	static void storef(float *p, V v){ vst1_f32(p, vcvt_f32_f64(v)); }
+	static V add(V a, V b){ return vaddq_f64(a, b); }
+	static V sub(V a, V b){ return vsubq_f64(a, b); }
+	static V mul(V a, V b){ return vmulq_f64(a, b); }
+};
+
+#else
+enum { WIDTH = 4 };
+
+struct VecF {
+	typedef float T; typedef float V; enum { N = 1 };
+	static V set1(T v){ return v; }
+	static V load(const T *p){ return *p; }
+	static void store(T *p, V v){ *p = v; }
+	static V loadf(const float *p){ return *p; }
+	static void storef(float *p, V v){ *p = v; }
+	static V add(V a, V b){ return a + b; }
+	static V sub(V a, V b){ return a - b; }
+	static V mul(V a, V b){ return a * b; }
+};
+
+struct VecD {
+	typedef double T; typedef double V; enum { N = 1 };
+	static V set1(T v){ return v; }
+	static V load(const T *p){ return *p; }
+	static void store(T *p, V v){ *p = v; }
+	static V loadf(const float *p){ return *p; }
+	static void storef(float *p, V v){ *p = float(v); }
+	static V add(V a, V b){ return a + b; }
+	static V sub(V a, V b){ return a - b; }
+	static V mul(V a, V b){ return a * b; }
+};
+#endif
+
+// Filter one group of WIDTH channels, as WIDTH/N vectors
+template <class Ops>
+void filterGroup(const double *coefs, typename Ops::T *state,
+	const float *in, float *out, int numFrames)
+{
+	typedef typename Ops::V V;
+	enum { K = WIDTH / Ops::N };
+	const V a0 = Ops::set1(coefs[0]);
+	const V a1 = Ops::set1(coefs[1]);
+	const V a2 = Ops::set1(coefs[2]);
+	const V b1 = Ops::set1(coefs[3]);
+	const V b2 = Ops::set1(coefs[4]);
+
+	V x1[K], x2[K], y1[K], y2[K];
+	for (int k = 0; k < K; k++) {
+		x1[k] = Ops::load(state + 0 * WIDTH + k * Ops::N);
+		x2[k] = Ops::load(state + 1 * WIDTH + k * Ops::N);
+		y1[k] = Ops::load(state + 2 * WIDTH + k * Ops::N);
+		y2[k] = Ops::load(state + 3 * WIDTH + k * Ops::N);
+	}
+	for (int i = 0; i < numFrames; i++) {
+		for (int k = 0; k < K; k++) {
+			V x = Ops::loadf(in + k * Ops::N);
+			V y = Ops::add(Ops::add(Ops::mul(a0, x), Ops::mul(a1, x1[k])), Ops::mul(a2, x2[k]));
+			y = Ops::sub(y, Ops::add(Ops::mul(b1, y1[k]), Ops::mul(b2, y2[k])));
+			x2[k] = x1[k]; x1[k] = x;
+			y2[k] = y1[k]; y1[k] = y;
+			Ops::storef(out + k * Ops::N, y);
+		}
+		in += WIDTH;
+		out += WIDTH;
+	}
+	for (int k = 0; k < K; k++) {
+		Ops::store(state + 0 * WIDTH + k * Ops::N, x1[k]);
+		Ops::store(state + 1 * WIDTH + k * Ops::N, x2[k]);
+		Ops::store(state + 2 * WIDTH + k * Ops::N, y1[k]);
+		Ops::store(state + 3 * WIDTH + k * Ops::N, y2[k]);
+	}
+}
+
+} // namespace
+
+
+BiquadBank::BiquadBank(int numChannels, bool doubleState)
+	: m_numChnls(0), m_double(doubleState)
+{
+	coefs(1, 0, 0, 0, 0);
+	channels(numChannels);
+}
+
+int BiquadBank::width()
+{
+	return WIDTH;
+}
+
+void BiquadBank::channels(int numChannels)
+{
+	m_numChnls = numChannels > 0 ? numChannels : 0;
+	reset();
+}
+
+void BiquadBank::doubleState(bool on)
+{
+	m_double = on;
+	reset();
+}
+
+void BiquadBank::coefs(double a0, double a1, double a2, double b1, double b2)
+{
+	m_coefs[0] = a0;
+	m_coefs[1] = a1;
+	m_coefs[2] = a2;
+	m_coefs[3] = b1;
+	m_coefs[4] = b2;
+}
+
+void BiquadBank::butterworth(double fc, double sampleRate, bool lowpass)
+{
+	double lambda = tan(fc * M_PI / sampleRate);
+	if (lowpass) {
+		lambda = 1 / lambda;
+	}
+	double lambda_2 = lambda * lambda;
+	double a0 = 1.0/(1.0 + (sqrt(2.0)*lambda) + (lambda_2));
+	double b2 = a0 * (1.0 - (sqrt(2.0)*lambda) + (lambda_2));
+	if (lowpass) {
+		coefs(a0, 2.0 * a0, a0, 2.0 * a0 * (1.0 - lambda_2), b2);
+	} else {
+		coefs(a0, -2.0 * a0, a0, 2.0 * a0 * (lambda_2 - 1.0), b2);
+	}
+}
+
+void BiquadBank::reset()
+{
+	int size = groups() * 4 * WIDTH;
+	m_stateF.assign(m_double ? 0 : size, 0.f);
+	m_stateD.assign(m_double ? size : 0, 0.0);
+}
+
+void BiquadBank::process(int group, const float *in, float *out, int numFrames)
+{
+	if (group < 0 || group >= groups()) {
+		return;
+	}
+	if (m_double) {
+		filterGroup<VecD>(m_coefs, &m_stateD[group * 4 * WIDTH], in, out, numFrames);
+	} else {
+		filterGroup<VecF>(m_coefs, &m_stateF[group * 4 * WIDTH], in, out, numFrames);
+	}
+}
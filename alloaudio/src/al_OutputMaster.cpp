@@ -1,12 +1,12 @@
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 
 #include "alloaudio/al_OutputMaster.hpp"
 #include "allocore/system/al_Time.hpp"
 
-#include "alloaudio/butter.h"
-
 //#include "firfilter.h"
 
 using namespace al;
@@ -21,6 +21,7 @@ OutputMaster::OutputMaster(int num_chnls, double sampleRate, const char *address
 	pthread_mutex_init(&m_meterMutex, NULL);
 	pthread_cond_init(&m_meterCond, NULL);
 	allocateChannels(m_numChnls);
+	setFramesPerBuffer(512);
 	initializeData();
 
 	if (port < 0) {
@@ -32,8 +33,8 @@ OutputMaster::OutputMaster(int num_chnls, double sampleRate, const char *address
 			std::cout << "Probably another program is already listening on that port." << std::endl;
 		} else {
 			handler(OutputMaster::msghandler);
-			timeout(0.1); // set receiver to block with timeout
-			start();
+			timeout(0.1); // polling period where reactors are not supported
+			start(SocketReactor::global());
 		}
 	}
 	if (m_sendPort > 0 && strlen(sendAddress) > 1) {
@@ -44,12 +45,6 @@ OutputMaster::OutputMaster(int num_chnls, double sampleRate, const char *address
 
 OutputMaster::~OutputMaster()
 {
-	for (int i = 0; i < m_numChnls; i++) {
-		butter_free(m_lopass1[i]);
-		butter_free(m_lopass2[i]);
-		butter_free(m_hipass1[i]);
-		butter_free(m_hipass2[i]);
-	}
 	stop(); /* Stops OSC listener */
 	m_runMeterThread = 0;
 	pthread_cond_signal(&m_meterCond);
@@ -88,14 +83,11 @@ void OutputMaster::setMeterUpdateFreq(double freq)
 
 void OutputMaster::setBassManagementFreq(double frequency)
 {
-	int i;
 	if (frequency > 0) {
-		for (i = 0; i < m_numChnls; i++) {
-			butter_set_fc(m_lopass1[i], frequency);
-			butter_set_fc(m_lopass2[i], frequency);
-			butter_set_fc(m_hipass1[i], frequency);
-			butter_set_fc(m_hipass2[i], frequency);
-		}
+		m_lopass1.butterworth(frequency, m_framesPerSec, true);
+		m_lopass2.butterworth(frequency, m_framesPerSec, true);
+		m_hipass1.butterworth(frequency, m_framesPerSec, false);
+		m_hipass2.butterworth(frequency, m_framesPerSec, false);
 	}
 }
 
@@ -106,6 +98,24 @@ void OutputMaster::setBassManagementMode(bass_mgmt_mode_t mode)
 	}
 }
 
+void OutputMaster::setBassManagementDoublePrecision(bool on)
+{
+	m_lopass1.doubleState(on);
+	m_lopass2.doubleState(on);
+	m_hipass1.doubleState(on);
+	m_hipass2.doubleState(on);
+}
+
+void OutputMaster::setFramesPerBuffer(int frames)
+{
+	const int W = BiquadBank::width();
+	m_framesPerBuffer = std::max(frames, 1);
+	m_groupBuf.resize(m_framesPerBuffer * W);
+	m_lowBuf.resize(m_framesPerBuffer * W);
+	m_highBuf.resize(m_framesPerBuffer * W);
+	m_bassBuf.resize(m_framesPerBuffer * W);
+}
+
 void OutputMaster::setSwIndeces(int i1, int i2, int i3, int i4)
 {
 	swIndex[0] = i1;
@@ -131,99 +141,124 @@ int OutputMaster::getNumChnls()
 
 void OutputMaster::onAudioCB(AudioIOData &io)
 {
-	int i, chan = 0;
 	int nframes = io.framesPerBuffer();
-	double bass_buf[nframes];
-	double filt_out[nframes];
-	double filt_low[nframes];
-	double in_buf[nframes];
-	double master_gain;
+	float master_gain;
 
 	m_parameterQueue.update(0);
 	master_gain = m_masterGain * (m_muteAll ? 0.0 : 1.0);
-	memset(bass_buf, 0, nframes * sizeof(double));
-	for (chan = 0; chan < m_numChnls; chan++) {
-		double gain = master_gain * m_gains[chan];
-		const float *in = io.outBuffer(chan);  // Yes, the input here is the output from previous runs for the io object
-		float *out = io.outBuffer(chan);
-		double filt_temp[nframes];
-		double *buf = bass_buf;
+	/* buffers larger than the bass management buffers are processed in parts */
+	for (int offset = 0; offset < nframes; offset += m_framesPerBuffer) {
+		processFrames(io, offset, std::min(m_framesPerBuffer, nframes - offset), master_gain);
+	}
+	if (m_meterOn) {
+		m_meterCounter += nframes;
+		if (m_meterCounter >= m_meterUpdateSamples) {
+			m_meterBuffer.write( (char *) m_meters.data(), sizeof(float) * m_numChnls);
+			memset(m_meters.data(), 0, sizeof(float) * m_numChnls);
+			m_meterCounter = 0; // A little jitter but efficient
+			pthread_cond_signal(&m_meterCond);
+		}
+	}
+}
 
-		for (i = 0; i < nframes; i++) {
-			in_buf[i] = *in++;
+void OutputMaster::processFrames(AudioIOData &io, int offset, int nframes, float master_gain)
+{
+	const int W = BiquadBank::width();
+	int i, k, group;
+	bool bass = m_BassManagementMode != BASSMODE_NONE;
+	float *block = m_groupBuf.data();
+	float *bass_buf = m_bassBuf.data();
+	memset(bass_buf, 0, nframes * W * sizeof(float));
+
+	/* Each group of W channels is interleaved into a block, so that the filters
+	   process one channel per SIMD lane. */
+	for (group = 0; group < m_lopass1.groups(); group++) {
+		int chan0 = group * W;
+		int nchans = std::min(W, m_numChnls - chan0);
+		for (k = 0; k < W; k++) {
+			if (k < nchans) {
+				const float *in = io.outBuffer(chan0 + k) + offset;  // Yes, the input here is the output from previous runs for the io object
+				for (i = 0; i < nframes; i++) {
+					block[i * W + k] = in[i];
+				}
+			} else {
+				for (i = 0; i < nframes; i++) {
+					block[i * W + k] = 0.f;
+				}
+			}
 		}
+
+		const float *filt_low = block;
+		const float *filt_out = block;
 		switch (m_BassManagementMode) {
-		case BASSMODE_NONE:
-			break;
-		case BASSMODE_MIX:
-			for (i = 0; i < nframes; i++) {
-				filt_low[i] = in_buf[i];
-			}
-			break;
 		case BASSMODE_LOWPASS:
-			butter_next(m_lopass1[chan], in_buf, filt_temp, nframes);
-			butter_next(m_lopass2[chan], filt_temp, filt_low, nframes);
+			m_lopass1.process(group, block, m_lowBuf.data(), nframes);
+			m_lopass2.process(group, m_lowBuf.data(), m_lowBuf.data(), nframes);
+			filt_low = m_lowBuf.data();
 			break;
 		case BASSMODE_HIGHPASS:
-			for (i = 0; i < nframes; i++) {
-				filt_low[i] = in_buf[i];
-			}
-			butter_next(m_hipass1[chan], in_buf, filt_temp, nframes);
-			butter_next(m_hipass2[chan], filt_temp, filt_out, nframes);
-			for (i = 0; i < nframes; i++) {
-				in_buf[i] = filt_out[i];
-			}
+			m_hipass1.process(group, block, m_highBuf.data(), nframes);
+			m_hipass2.process(group, m_highBuf.data(), m_highBuf.data(), nframes);
+			filt_out = m_highBuf.data();
 			break;
 		case BASSMODE_FULL:
-			butter_next(m_lopass1[chan], in_buf, filt_temp, nframes);
-			butter_next(m_lopass2[chan], filt_temp, filt_low, nframes);
-			butter_next(m_hipass1[chan], in_buf, filt_temp, nframes);
-			butter_next(m_hipass2[chan], filt_temp, filt_out, nframes);
-			for (i = 0; i < nframes; i++) {
-				in_buf[i] = filt_out[i]; /* a bit inefficient to copy here, but makes code simpler below */
-			}
+			m_lopass1.process(group, block, m_lowBuf.data(), nframes);
+			m_lopass2.process(group, m_lowBuf.data(), m_lowBuf.data(), nframes);
+			m_hipass1.process(group, block, m_highBuf.data(), nframes);
+			m_hipass2.process(group, m_highBuf.data(), m_highBuf.data(), nframes);
+			filt_low = m_lowBuf.data();
+			filt_out = m_highBuf.data();
 			break;
 		default:
 			break;
 		}
-		for (i = 0; i < nframes; i++) { /* accumulate SW signal */
-			*buf++ += filt_low[i];
-		}
-		for (i = 0; i < nframes; i++) {
-			*out = in_buf[i] * gain;
-			if (m_clipperOn && *out > master_gain) {
-				*out = master_gain;
+		if (bass) { /* accumulate SW signal, per lane */
+			for (i = 0; i < nframes * W; i++) {
+				bass_buf[i] += filt_low[i];
 			}
-			out++;
 		}
-	}
-	if (m_BassManagementMode != BASSMODE_NONE) {
-		int sw;
-		for(sw = 0; sw < 4; sw++) {
-			if (swIndex[sw] < 0) continue;
-			float *out = io.outBuffer(swIndex[sw]);
-			memset(out, 0, nframes * sizeof(float));
+
+		/* gain, clipping and metering in one pass */
+		for (k = 0; k < nchans; k++) {
+			int chan = chan0 + k;
+			float gain = master_gain * m_gains[chan];
+			float *out = io.outBuffer(chan) + offset;
+			float peak = m_meters[chan];
 			for (i = 0; i < nframes; i++) {
-				*out++ = bass_buf[i];
+				float v = filt_out[i * W + k] * gain;
+				if (m_clipperOn && v > master_gain) {
+					v = master_gain;
+				}
+				if (peak < v) {
+					peak = v;
+				}
+				out[i] = v;
+			}
+			if (m_meterOn && !chanIsSubwoofer(chan)) {
+				m_meters[chan] = peak;
 			}
 		}
 	}
-	if (m_meterOn) {
-		for (chan = 0; chan < m_numChnls; chan++) {
-			float *out = io.outBuffer(chan);
-			for (i = 0; i < nframes; i++) {
-				if (m_meters[chan] < *out) {
-					m_meters[chan] = *out;
-				}
-				out++;
+	if (bass) {
+		for (i = 0; i < nframes; i++) {
+			float sum = 0.f;
+			for (k = 0; k < W; k++) {
+				sum += bass_buf[i * W + k];
 			}
+			bass_buf[i] = sum;
 		}
-		m_meterCounter += nframes;
-		if (m_meterCounter >= m_meterUpdateSamples) {
-			m_meterBuffer.write( (char *) m_meters.data(), sizeof(float) * m_numChnls);
-			memset(m_meters.data(), 0, sizeof(float) * m_numChnls);
-			m_meterCounter = 0; // A little jitter but efficient
-			pthread_cond_signal(&m_meterCond);
+		for (int sw = 0; sw < 4; sw++) {
+			if (swIndex[sw] < 0) continue;
+			float *out = io.outBuffer(swIndex[sw]) + offset;
+			memcpy(out, bass_buf, nframes * sizeof(float));
+			if (m_meterOn) {
+				float &peak = m_meters[swIndex[sw]];
+				for (i = 0; i < nframes; i++) {
+					if (peak < out[i]) {
+						peak = out[i];
+					}
+				}
+			}
 		}
 	}
 }
@@ -316,20 +351,16 @@ void OutputMaster::allocateChannels(int numChnls)
 {
 	m_gains.resize(numChnls);
 	m_meters.resize(numChnls);
-	m_lopass1.resize(numChnls);
-	m_lopass2.resize(numChnls);
-	m_hipass1.resize(numChnls);
-	m_hipass2.resize(numChnls);
+	m_lopass1.channels(numChnls);
+	m_lopass2.channels(numChnls);
+	m_hipass1.channels(numChnls);
+	m_hipass2.channels(numChnls);
 	swIndex[0] = numChnls - 1;
 	swIndex[1] =  swIndex[2] = swIndex[3] = -1;
 
 	for (int i = 0; i < numChnls; i++) {
 		m_gains[i] = 1.0;
 		m_meters[i] = 0;
-		m_lopass1[i] = butter_create(m_framesPerSec, BUTTER_LP);
-		m_lopass2[i] = butter_create(m_framesPerSec, BUTTER_LP);
-		m_hipass1[i] = butter_create(m_framesPerSec, BUTTER_HP);
-		m_hipass2[i] = butter_create(m_framesPerSec, BUTTER_HP);
 	}
 }
 
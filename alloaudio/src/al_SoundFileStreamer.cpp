@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <chrono>
+
+#include "allocore/system/al_Time.hpp"
+#include "alloaudio/al_SoundFileStreamer.hpp"
+#include "alloaudio/al_SoundfileBuffered.hpp"
+
+using namespace al;
+
+SoundFileStreamer::SoundFileStreamer(int numThreads) :
+	m_numThreads(numThreads > 0 ? numThreads : 1),
+	m_readAhead(0.25),
+	m_serviceInterval(0.005),
+	m_running(false)
+{
+}
+
+SoundFileStreamer::~SoundFileStreamer()
+{
+	{
+		std::lock_guard<std::mutex> lk(m_lock);
+		m_running = false;
+	}
+	m_condVar.notify_all();
+	for (auto &thread : m_threads) {
+		thread.join();
+	}
+}
+
+int SoundFileStreamer::numFiles() const
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+	return m_files.size();
+}
+
+int SoundFileStreamer::underruns() const
+{
+	std::lock_guard<std::mutex> lk(m_lock);
+	int count = 0;
+	for (auto file : m_files) {
+		count += file->underruns();
+	}
+	return count;
+}
+
+SoundFileStreamer& SoundFileStreamer::global()
+{
+	static SoundFileStreamer *streamer = new SoundFileStreamer(2);
+	return *streamer;
+}
+
+void SoundFileStreamer::add(SoundFileBuffered *file)
+{
+	{
+		std::lock_guard<std::mutex> lk(m_lock);
+		m_files.push_back(file);
+		if (!m_running) {
+			m_running = true;
+			for (int i = 0; i < m_numThreads; i++) {
+				m_threads.push_back(std::thread(&SoundFileStreamer::run, this));
+			}
+		}
+	}
+	m_condVar.notify_one();
+}
+
+void SoundFileStreamer::remove(SoundFileBuffered *file)
+{
+	std::unique_lock<std::mutex> lk(m_lock);
+	m_serviced.wait(lk, [file]{ return !file->mBusy; });
+	m_files.erase(std::remove(m_files.begin(), m_files.end(), file), m_files.end());
+}
+
+void SoundFileStreamer::wake()
+{
+	// Without the lock a wake up can be missed, which only delays the
+	// service until the next poll
+	m_condVar.notify_one();
+}
+
+void SoundFileStreamer::run()
+{
+	std::unique_lock<std::mutex> lk(m_lock);
+	while (m_running) {
+		SoundFileBuffered *file = next();
+		if (!file) {
+			m_condVar.wait_for(lk, std::chrono::duration<double>(m_serviceInterval.load()));
+			continue;
+		}
+		file->mBusy = true;
+		lk.unlock();
+		file->service();
+		lk.lock();
+		file->mBusy = false;
+		m_serviced.notify_all();
+	}
+}
+
+SoundFileBuffered *SoundFileStreamer::next()
+{
+	double now = al_steady_time();
+	SoundFileBuffered *mostUrgent = nullptr;
+	double leastLeft = 0;
+	for (auto file : m_files) {
+		double left;
+		if (!file->mBusy && file->needsService(now, left)
+		        && (!mostUrgent || left < leastLeft)) {
+			mostUrgent = file;
+			leastLeft = left;
+		}
+	}
+	return mostUrgent;
+}
@@ -1,32 +1,79 @@
+#include <algorithm>
+
 #include "alloaudio/al_SoundfileBuffered.hpp"
 
 using namespace al;
 
-SoundFileBuffered::SoundFileBuffered(std::string fullPath, bool loop, int bufferFrames) :
-    mRunning(true),
+// Length of the head of the loop region kept in memory, in addition to the
+// read buffer. This covers the time taken by the streamer to refill after a
+// seek into the head.
+static const double HEAD_SECONDS = 0.1;
+
+// Largest number of frames read from the file at once
+static const int CHUNK_FRAMES = 4096;
+
+SoundFileBuffered::SoundFileBuffered(std::string fullPath, bool loop, int bufferFrames,
+                                     SoundFileStreamer *streamer) :
+    mStreamer(streamer ? streamer : &SoundFileStreamer::global()),
     mLoop(loop),
-    mRepeats(0),
-    mSeek(-1),
-    mCurPos(0),
     mBufferFrames(bufferFrames),
-    mReadCallback(0)
+    mCapacity(0),
+    mChunkFrames(0),
+    mLoopBegin(0),
+    mLoopEnd(0),
+    mRingBuffer(nullptr),
+    mReadCallback(0),
+    mCallbackData(nullptr),
+    mFileBuffer(nullptr),
+    mHeadFrames(0),
+    mHeadReady(false),
+    mSeekRequest(0),
+    mSeekFrame(0),
+    mLoopRequest(0),
+    mSeekAck(0),
+    mSeekStart(0),
+    mEndFrames(-1),
+    mConsumed(0),
+    mBusy(false),
+    mSeekHandled(0),
+    mWriteBegin(0),
+    mWriteEnd(0),
+    mWritePos(0),
+    mFilePos(0),
+    mEnded(false),
+    mFramesWritten(0),
+    mLastConsumed(0),
+    mLastTime(0),
+    mRate(0),
+    mRequest(0),
+    mFramesRead(0),
+    mHeadPos(-1),
+    mHeadRequest(0),
+    mPosition(0),
+    mCurPos(0),
+    mRepeats(0),
+    mUnderruns(0),
+    mUnderrunFrames(0)
 {
 	mSf.path(fullPath);
 	mSf.openRead();
 	if (mSf.opened()) {
-		mRingBuffer = new SingleRWRingBuffer(mBufferFrames * channels() * sizeof(float));
-		mReaderThread = new std::thread(readFunction, this);
-		mFileBuffer = new float[mBufferFrames * channels()];
+		double rate = frameRate() > 0 ? frameRate() : 44100.0;
+		mLoopEnd = mWriteEnd = frames();
+		mLoopRequest = mLoopEnd;
+		mRate = rate;
+		mCapacity = std::max(4 * mBufferFrames, int(2 * mStreamer->readAhead() * rate));
+		mChunkFrames = std::min(CHUNK_FRAMES, mCapacity);
+		mRingBuffer = new SingleRWRingBuffer(mCapacity * channels() * sizeof(float));
+		mFileBuffer = new float[mChunkFrames * channels()];
+		mStreamer->add(this);
 	}
 }
 
 SoundFileBuffered::~SoundFileBuffered()
 {
 	if (mSf.opened()) {
-		mRunning = false;
-		mCondVar.notify_one();
-		mReaderThread->join();
-		delete mReaderThread;
+		mStreamer->remove(this);
 		delete mRingBuffer;
 		delete[] mFileBuffer;
 	}
@@ -35,12 +82,63 @@ SoundFileBuffered::~SoundFileBuffered()
 
 int SoundFileBuffered::read(float *buffer, int numFrames)
 {
-	int bytesRead = mRingBuffer->read((char *) buffer, numFrames * channels() * sizeof(float));
-	if (bytesRead != numFrames * channels() * sizeof(float)) {
-		// TODO: handle underrun
+	if (!opened()) {
+		return 0;
+	}
+	const int numChannels = channels();
+	const int frameBytes = numChannels * sizeof(float);
+	int framesRead = 0;
+	while (framesRead < numFrames) {
+		float *out = buffer + framesRead * numChannels;
+		int framesLeft = numFrames - framesRead;
+		if (mHeadPos >= 0) { // Play the head from memory after a seek into it
+			int n = std::min(framesLeft, mHeadFrames - mHeadPos);
+			std::copy(&mHead[mHeadPos * numChannels], &mHead[(mHeadPos + n) * numChannels], out);
+			mHeadPos += n;
+			if (mHeadPos >= mHeadFrames) {
+				// A loop that fits in the head keeps playing from memory
+				bool headLoops = mLoop && mLoopBegin + mHeadFrames >= mLoopEnd;
+				mHeadPos = headLoops ? 0 : -1;
+			}
+			framesRead += n;
+			advance(n);
+			continue;
+		}
+		if (mSeekAck.load(std::memory_order_acquire) != mRequest) {
+			break; // The streamer has not handled the last seek yet
+		}
+		int available = mRingBuffer->readSpace() / frameBytes;
+		int64_t seekStart = mSeekStart.load(std::memory_order_relaxed);
+		if (mFramesRead < seekStart) { // Drop frames buffered before the seek
+			int n = int(std::min<int64_t>(available, seekStart - mFramesRead));
+			mRingBuffer->commitRead(mRingBuffer->peekRead(n * frameBytes).size());
+			mFramesRead += n;
+			if (mFramesRead < seekStart) {
+				break;
+			}
+			continue;
+		}
+		int n = std::min(framesLeft, available);
+		if (n == 0) {
+			break;
+		}
+		mRingBuffer->read((char *) out, n * frameBytes);
+		mFramesRead += n;
+		framesRead += n;
+		advance(n);
+	}
+	if (framesRead < numFrames) {
+		int64_t endFrames = mEndFrames.load(std::memory_order_acquire);
+		bool ended = mHeadPos < 0 && mSeekAck.load() == mRequest
+		        && endFrames >= 0 && mFramesRead >= endFrames;
+		if (!ended) {
+			mUnderruns++;
+			mUnderrunFrames += numFrames - framesRead;
+		}
 	}
-	mCondVar.notify_one();
-	return bytesRead / (channels() * sizeof(float));
+	mConsumed.store(mConsumed.load(std::memory_order_relaxed) + framesRead,
+	                std::memory_order_relaxed);
+	return framesRead;
 }
 
 bool SoundFileBuffered::opened() const
@@ -48,34 +146,140 @@ bool SoundFileBuffered::opened() const
 	return mSf.opened();
 }
 
-void SoundFileBuffered::readFunction(SoundFileBuffered  *obj)
+void SoundFileBuffered::advance(int numFrames)
 {
-	while (obj->mRunning) {
-		std::unique_lock<std::mutex> lk(obj->mLock);
-		obj->mCondVar.wait(lk);
-		int framesToRead = obj->mRingBuffer->writeSpace() / (obj->channels() * sizeof(float));
-	int framesRead = obj->mSf.read(obj->mFileBuffer, framesToRead);
-	std::atomic_fetch_add(&(obj->mCurPos), framesRead);
-	int seek = obj->mSeek.load();
-	if (seek >= 0) { // Process seek request
-	    obj->mSf.seek(seek, SEEK_SET);
-	    obj->mSeek.store(-1);
+	mPosition += numFrames;
+	if (mLoop) {
+		while (mPosition >= mLoopEnd) {
+			mPosition -= mLoopEnd - mLoopBegin;
+			mRepeats++;
+		}
+	} else if (mPosition > frames()) {
+		mPosition = frames();
 	}
-	if (framesRead != framesToRead) { // Final incomplete buffer in the file
-	    framesRead += obj->mSf.read(obj->mFileBuffer + framesRead, framesToRead - framesRead);
-	    if (obj->mLoop) {
-		obj->mSf.seek(0, SEEK_SET);
-		std::atomic_fetch_add(&(obj->mRepeats), 1);
-	    }
+	mCurPos.store(mPosition);
+}
+
+bool SoundFileBuffered::needsService(double now, double &secondsLeft)
+{
+	if (!mHeadReady.load(std::memory_order_relaxed)
+	        || mSeekRequest.load(std::memory_order_relaxed) != mSeekHandled) {
+		secondsLeft = -1;
+		return true;
 	}
-	int written = obj->mRingBuffer->write((const char*) obj->mFileBuffer, framesRead * sizeof(float) * obj->channels());
-	//		if (written != framesRead * sizeof(float) * obj->channels()) {
-	//			// TODO handle overrun
-	//		}
-	if (obj->mReadCallback) {
-	    obj->mReadCallback(obj->mFileBuffer, obj->mSf.channels(), framesRead, obj->mCallbackData);
+	if (mEnded) {
+		return false;
 	}
-	lk.unlock();
+	// Smoothed rate at which read() consumes frames
+	if (now - mLastTime >= 0.05) {
+		int64_t consumed = mConsumed.load(std::memory_order_relaxed);
+		if (mLastTime > 0) {
+			double rate = (consumed - mLastConsumed) / (now - mLastTime);
+			mRate += 0.5 * (rate - mRate);
+		}
+		mLastConsumed = consumed;
+		mLastTime = now;
+	}
+	int target = targetFrames();
+	int available = mRingBuffer->readSpace() / (channels() * sizeof(float));
+	secondsLeft = available / std::max(mRate, 1.0);
+	return target - available >= std::min(mChunkFrames, target / 2);
+}
+
+int SoundFileBuffered::targetFrames() const
+{
+	// Read ahead by the consumption rate, but not less than a quarter of the
+	// frame rate, so that a file resuming after a pause does not underrun
+	// before the rate estimate catches up
+	double rate = std::max(mRate, 0.25 * frameRate());
+	int target = int(rate * mStreamer->readAhead());
+	return std::min(std::max(target, 2 * mBufferFrames), mCapacity);
+}
+
+void SoundFileBuffered::loadHead()
+{
+	const int numChannels = channels();
+	int headFrames = int(HEAD_SECONDS * frameRate()) + mBufferFrames;
+	headFrames = std::max(0, std::min(headFrames, mWriteEnd - mWriteBegin));
+	mHead.resize(headFrames * numChannels);
+	mSf.seek(mWriteBegin, SEEK_SET);
+	mHeadFrames = headFrames > 0 ? mSf.read(&mHead[0], headFrames) : 0;
+	mFilePos = mWriteBegin + mHeadFrames;
+	mHeadReady.store(true, std::memory_order_release);
+}
+
+int SoundFileBuffered::writeFrames(const float *frames, int numFrames)
+{
+	mRingBuffer->write((const char *) frames, numFrames * channels() * sizeof(float));
+	if (mReadCallback) {
+		mReadCallback(const_cast<float *>(frames), channels(), numFrames, mCallbackData);
+	}
+	mWritePos += numFrames;
+	mFramesWritten += numFrames;
+	return numFrames;
+}
+
+void SoundFileBuffered::service()
+{
+	int request = mSeekRequest.load(std::memory_order_acquire);
+	bool headReady = mHeadReady.load(std::memory_order_relaxed);
+	if (request != mSeekHandled) { // Process loop change
+		int64_t region = mLoopRequest.load(std::memory_order_relaxed);
+		int begin = int(region >> 32);
+		int end = int(region & 0xffffffff);
+		if (begin != mWriteBegin || end != mWriteEnd) {
+			mWriteBegin = begin;
+			mWriteEnd = end;
+			headReady = false;
+		}
+	}
+	if (!headReady) {
+		loadHead();
+	}
+	if (request != mSeekHandled) { // Process seek request
+		mWritePos = mSeekFrame.load(std::memory_order_relaxed);
+		mEnded = false;
+		mEndFrames.store(-1, std::memory_order_relaxed);
+		mSeekStart.store(mFramesWritten, std::memory_order_relaxed);
+		mSeekHandled = request;
+		mSeekAck.store(request, std::memory_order_release);
+	}
+	if (mEnded) {
+		return;
+	}
+	const int numChannels = channels();
+	const int frameBytes = numChannels * sizeof(float);
+	int framesToWrite = std::min(targetFrames() - int(mRingBuffer->readSpace() / frameBytes),
+	                             int(mRingBuffer->writeSpace() / frameBytes));
+	while (framesToWrite > 0) {
+		int end = mLoop ? mWriteEnd : frames();
+		if (mWritePos >= end) {
+			if (!mLoop) {
+				mEnded = true;
+				mEndFrames.store(mFramesWritten, std::memory_order_release);
+				break;
+			}
+			mWritePos = mWriteBegin;
+		}
+		int n = std::min(std::min(framesToWrite, end - mWritePos), mChunkFrames);
+		int headPos = mWritePos - mWriteBegin;
+		if (headPos >= 0 && headPos < mHeadFrames) { // Copy from the head in memory
+			n = std::min(n, mHeadFrames - headPos);
+			framesToWrite -= writeFrames(&mHead[headPos * numChannels], n);
+			continue;
+		}
+		if (mFilePos != mWritePos) {
+			mSf.seek(mWritePos, SEEK_SET);
+			mFilePos = mWritePos;
+		}
+		int framesRead = mSf.read(mFileBuffer, n);
+		if (framesRead <= 0) { // Final incomplete buffer in the file
+			mEnded = true;
+			mEndFrames.store(mFramesWritten, std::memory_order_release);
+			break;
+		}
+		mFilePos += framesRead;
+		framesToWrite -= writeFrames(mFileBuffer, framesRead);
 	}
 }
 
@@ -140,23 +344,55 @@ int SoundFileBuffered::repeats()
 
 void SoundFileBuffered::setReadCallback(SoundFileBuffered::CallbackFunc func, void *userData)
 {
-        mReadCallback = func;
-    mCallbackData = userData;
+	mReadCallback = func;
+	mCallbackData = userData;
 }
 
 void SoundFileBuffered::seek(int frame)
 {
-    if (frame < 0) {
-        frame = 0;
-    }
-    if (frame >= frames()) {
-        frame = frames() - 1;
-    }
-    mSeek.store(frame);
-    mCurPos.store(frame);
+	if (frame < 0) {
+		frame = 0;
+	}
+	if (frame >= frames()) {
+		frame = frames() - 1;
+	}
+	if (mLoop && frame >= mLoopEnd) {
+		frame = mLoopBegin;
+	}
+	mPosition = frame;
+	mCurPos.store(frame);
+	// A seek into the head plays it from memory while the streamer continues
+	// from the end of the head, once the streamer has loaded the head of the
+	// current loop region
+	mHeadPos = -1;
+	if (mSeekAck.load(std::memory_order_acquire) - mHeadRequest >= 0
+	        && mHeadReady.load(std::memory_order_acquire)
+	        && frame >= mLoopBegin && frame < mLoopBegin + mHeadFrames) {
+		mHeadPos = frame - mLoopBegin;
+		frame = mLoopBegin + mHeadFrames;
+	}
+	mSeekFrame.store(frame, std::memory_order_relaxed);
+	mSeekRequest.store(++mRequest, std::memory_order_release);
+	mStreamer->wake();
+}
+
+void SoundFileBuffered::loopRegion(int beginFrame, int endFrame)
+{
+	if (!opened()) {
+		return;
+	}
+	beginFrame = std::max(0, std::min(beginFrame, frames() - 1));
+	endFrame = std::max(beginFrame + 1, std::min(endFrame, frames()));
+	mLoopBegin = beginFrame;
+	mLoopEnd = endFrame;
+	mLoopRequest.store((int64_t(beginFrame) << 32) | endFrame, std::memory_order_relaxed);
+	// The streamer reloads the head when it handles the seek below, so the
+	// head is not played from memory until then
+	mHeadRequest = mRequest + 1;
+	seek(mPosition);
 }
 
 int SoundFileBuffered::currentPosition()
 {
-    return mCurPos.load();
+	return mCurPos.load();
 }
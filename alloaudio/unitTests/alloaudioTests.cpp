@@ -6,6 +6,8 @@
 //#include <iostream>
 
 #include "alloaudio/al_OutputMaster.hpp"
+#include "alloaudio/al_SoundfileBuffered.hpp"
+#include "alloaudio/butter.h"
 #include "allocore/system/al_Time.hpp"
 
 
@@ -33,7 +35,7 @@ void ut_gains(void)
     float *in_0 = io.outBuffer(0);
     float *in_1 = io.outBuffer(1);
 
-	io.processAudio();
+	outmaster.onAudioCB(io);
 
 	float *out_0 = io.outBuffer(0);
 	float *out_1 = io.outBuffer(1);
@@ -48,7 +50,7 @@ void ut_gains(void)
 		in_0[i] = 1.0/(i + 1);
 		in_1[i] = i/4.0;
 	}
-	io.processAudio();
+	outmaster.onAudioCB(io);
 
 	out_0 = io.outBuffer(0);
 	out_1 = io.outBuffer(1);
@@ -79,7 +81,7 @@ void ut_meter_values(void)
         in_0[i] = 1.0/(i + 2);
         in_1[i] = i/4.0;
     }
-	io.processAudio();
+	outmaster.onAudioCB(io);
 
     float meterValues[2];
     outmaster.getMeterValues(meterValues);
@@ -107,7 +109,7 @@ void ut_clipper(void)
 		in_0[i] = 0.8 * (i + 1);
 		in_1[i] = 0.6 * (i + 1);
 	}
-	io.processAudio();
+	outmaster.onAudioCB(io);
 
 	float *out_0 = io.outBuffer(0);
 	float *out_1 = io.outBuffer(1);
@@ -120,6 +122,82 @@ void ut_clipper(void)
 	}
 }
 
+void ut_bass_management(bool doublePrecision, double tolerance, int framesPerBuffer)
+{
+	// A number of channels that does not fill the last group of filters
+	const int nchans = 13, nframes = 64, nblocks = 8;
+	al::AudioIO io(nframes, 44100.0, NULL, NULL, nchans, 0);
+	al::OutputMaster outmaster(io.channelsOut(), io.framesPerSecond(), "", -1);
+	outmaster.setClipperOn(false);
+	outmaster.setMasterGain(1.0);
+	outmaster.setMeterOn(true);
+	outmaster.setMeterUpdateFreq(44100.0 / (nframes * nblocks));
+	outmaster.setFramesPerBuffer(framesPerBuffer);
+	outmaster.setBassManagementDoublePrecision(doublePrecision);
+	outmaster.setBassManagementMode(al::BASSMODE_FULL);
+	outmaster.setBassManagementFreq(120);
+	for (int c = 0; c < nchans; c++) {
+		outmaster.setGain(c, 0.5 + 0.05 * c);
+	}
+
+	// Reference with the scalar filters
+	BUTTER *lp1[nchans], *lp2[nchans], *hp1[nchans], *hp2[nchans];
+	for (int c = 0; c < nchans; c++) {
+		lp1[c] = butter_create(44100, BUTTER_LP); butter_set_fc(lp1[c], 120);
+		lp2[c] = butter_create(44100, BUTTER_LP); butter_set_fc(lp2[c], 120);
+		hp1[c] = butter_create(44100, BUTTER_HP); butter_set_fc(hp1[c], 120);
+		hp2[c] = butter_create(44100, BUTTER_HP); butter_set_fc(hp2[c], 120);
+	}
+
+	float peaks[nchans] = {0};
+	unsigned seed = 1;
+	for (int b = 0; b < nblocks; b++) {
+		double in[nchans][nframes], low[nframes], high[nframes], temp[nframes];
+		double bass[nframes] = {0}, expected[nchans][nframes];
+		for (int c = 0; c < nchans; c++) {
+			for (int i = 0; i < nframes; i++) {
+				seed = seed * 1664525 + 1013904223;
+				io.outBuffer(c)[i] = in[c][i] = (seed >> 8) / double(1 << 24) - 0.5;
+			}
+			butter_next(lp1[c], in[c], temp, nframes);
+			butter_next(lp2[c], temp, low, nframes);
+			butter_next(hp1[c], in[c], temp, nframes);
+			butter_next(hp2[c], temp, high, nframes);
+			for (int i = 0; i < nframes; i++) {
+				bass[i] += low[i];
+				expected[c][i] = high[i] * (0.5 + 0.05 * c);
+			}
+		}
+		for (int i = 0; i < nframes; i++) {
+			expected[nchans - 1][i] = bass[i];
+		}
+
+		outmaster.onAudioCB(io);
+		for (int c = 0; c < nchans; c++) {
+			for (int i = 0; i < nframes; i++) {
+				assert(fabs(io.outBuffer(c)[i] - expected[c][i]) < tolerance);
+				if (peaks[c] < expected[c][i]) peaks[c] = expected[c][i];
+			}
+		}
+	}
+
+	float meterValues[nchans];
+	assert(outmaster.getMeterValues(meterValues) == nchans * sizeof(float));
+	for (int c = 0; c < nchans; c++) {
+		assert(fabs(meterValues[c] - peaks[c]) < tolerance);
+		butter_free(lp1[c]); butter_free(lp2[c]);
+		butter_free(hp1[c]); butter_free(hp2[c]);
+	}
+}
+
+void ut_bass_management(void)
+{
+	ut_bass_management(false, 1e-4, 512);
+	ut_bass_management(true, 1e-6, 512);
+	// Buffers larger than the bass management buffers are processed in parts
+	ut_bass_management(false, 1e-4, 24);
+}
+
 void ut_osc_gain(void)
 {
 	al::AudioIO io(4, 44100.0, NULL, NULL, 2, 2);
@@ -142,7 +220,7 @@ void ut_osc_gain(void)
 		in_0[i] = 0.5 * (i + 1);
 		in_1[i] = 0.4 * (i + 1);
 	}
-	io.processAudio();
+	outmaster.onAudioCB(io);
 	float *out_0 = io.outBuffer(0);
 	float *out_1 = io.outBuffer(1);
 	for (int i = 0; i < 4; i++) {
@@ -160,7 +238,7 @@ void ut_osc_gain(void)
 		in_0[i] = 1.0 * (i + 1);
 		in_1[i] = 1.0 * (i + 1);
 	}
-	io.processAudio();
+	outmaster.onAudioCB(io);
 	assert(out_0[0] - 0.09 < 1e-07f);
 	assert(out_1[0] - 0.08 < 1e-07f);
 	for (int i = 1; i < 4; i++) {
@@ -178,7 +256,7 @@ void ut_osc_gain(void)
 		in_0[i] = 1.0 * (i + 1);
 		in_1[i] = 1.0 * (i + 1);
 	}
-	io.processAudio();
+	outmaster.onAudioCB(io);
 	for (int i = 0; i < 4; i++) {
 		assert(out_0[i] == 0.0);
 		assert(out_1[i] == 0.0);
@@ -247,7 +325,7 @@ void ut_osc_meters()
 	r.timeout(0.1);
 	r.start();
 
-	io.processAudio();
+	outmaster.onAudioCB(io);
 	al_sleep_nsec(1000000); // Wait for messages to arrive
 	r.stop();
 	assert(meterValues[0] == 0.0);
@@ -261,7 +339,7 @@ void ut_osc_meters()
 	}
 	outmaster.setMeterAddrHasChannel(true);
 	r.start();
-	io.processAudio();
+	outmaster.onAudioCB(io);
 	al_sleep_nsec(1000000); // Wait for messages to arrive
 	r.stop();
 	assert(meterValues[0] == 0.75);
@@ -270,6 +348,100 @@ void ut_osc_meters()
 	assert(meterValues2[1] == 0.0);
 }
 
+// Read until numFrames frames have arrived, waiting on underruns
+int read_frames(al::SoundFileBuffered &sf, float *buffer, int numFrames)
+{
+	int framesRead = 0;
+	for (int tries = 0; tries < 2000 && framesRead < numFrames; tries++) {
+		framesRead += sf.read(buffer + framesRead * sf.channels(), numFrames - framesRead);
+		if (framesRead < numFrames) {
+			al_sleep_nsec(1000000);
+		}
+	}
+	return framesRead;
+}
+
+void ut_soundfile_streaming()
+{
+	const int frames = 20000;
+	const char *path = "streamer_test.wav";
+	{
+		gam::SoundFile out(path);
+		out.format(gam::SoundFile::WAV).encoding(gam::SoundFile::FLOAT);
+		out.channels(2).frameRate(44100);
+		assert(out.openWrite());
+		float frame[2];
+		for (int i = 0; i < frames; i++) {
+			frame[0] = i / 32768.0f;
+			frame[1] = -i / 32768.0f;
+			out.write(frame, 1);
+		}
+		out.close();
+	}
+
+	al::SoundFileStreamer streamer(2);
+	{
+		al::SoundFileBuffered sf(path, true, 256, &streamer);
+		assert(sf.opened());
+		assert(sf.frames() == frames);
+		assert(streamer.numFiles() == 1);
+		float buffer[512 * 2];
+
+		// Continuous reading through the end of the loop
+		int pos = 0;
+		for (int block = 0; block < 100; block++) {
+			assert(read_frames(sf, buffer, 256) == 256);
+			for (int i = 0; i < 256; i++) {
+				assert(buffer[2 * i] == pos / 32768.0f);
+				assert(buffer[2 * i + 1] == -pos / 32768.0f);
+				pos = (pos + 1) % frames;
+			}
+		}
+		assert(sf.repeats() == 1);
+		assert(sf.currentPosition() == pos);
+
+		// Seeking into the preloaded head does not wait for the streamer
+		sf.seek(100);
+		assert(sf.read(buffer, 512) == 512);
+		for (int i = 0; i < 512; i++) {
+			assert(buffer[2 * i] == (100 + i) / 32768.0f);
+		}
+		assert(read_frames(sf, buffer, 512) == 512);
+		assert(buffer[0] == 612 / 32768.0f);
+
+		// Seeking elsewhere is sample accurate once the streamer has caught up
+		sf.seek(15001);
+		assert(read_frames(sf, buffer, 512) == 512);
+		for (int i = 0; i < 512; i++) {
+			assert(buffer[2 * i] == (15001 + i) / 32768.0f);
+		}
+
+		// Loop region, applied by the streamer. Playing past its end continues
+		// from its beginning.
+		sf.loopRegion(1000, 3000);
+		assert(read_frames(sf, buffer, 256) == 256);
+		for (int i = 0; i < 256; i++) {
+			assert(buffer[2 * i] == (1000 + i) / 32768.0f);
+		}
+		sf.seek(2900);
+		assert(sf.read(buffer, 256) == 256); // In the head, which covers the whole region
+		assert(buffer[0] == 2900 / 32768.0f);
+		assert(buffer[2 * 100] == 1000 / 32768.0f);
+		assert(sf.currentPosition() == 1156);
+
+		// The end of a file that does not loop is not an underrun
+		al::SoundFileBuffered once(path, false, 256, &streamer);
+		once.seek(frames - 300);
+		assert(read_frames(once, buffer, 300) == 300);
+		int underruns = once.underruns();
+		assert(once.read(buffer, 256) == 0);
+		assert(once.underruns() == underruns);
+		assert(once.currentPosition() == frames);
+	}
+	assert(streamer.numFiles() == 0);
+	remove(path);
+}
+
 
 #define RUNTEST(Name)\
 	printf("%s ", #Name);\
@@ -283,8 +455,10 @@ int main()
 	RUNTEST(gains);
 	RUNTEST(meter_values);
 	RUNTEST(clipper);
+	RUNTEST(bass_management);
 	RUNTEST(osc_gain);
 	RUNTEST(osc_meters);
+	RUNTEST(soundfile_streaming);
 
 	return 0;
 }
@@ -58,6 +58,7 @@
 #include "allocore/io/al_ControlNav.hpp"
 #include "allocore/io/al_File.hpp"
 #include "allocore/io/al_Socket.hpp"
+#include "allocore/io/al_SocketReactor.hpp"
 #include "allocore/io/al_Window.hpp"
 #include "allocore/math/al_Analysis.hpp"
 #include "allocore/math/al_Complex.hpp"
@@ -89,6 +90,7 @@
 #include "allocore/system/al_MainLoop.hpp"
 #include "allocore/system/al_Printing.hpp"
 #include "allocore/system/al_Thread.hpp"
+#include "allocore/system/al_TaskPool.hpp"
 #include "allocore/system/al_Time.hpp"
 #include "allocore/types/al_Buffer.hpp"
 #include "allocore/types/al_Conversion.hpp"
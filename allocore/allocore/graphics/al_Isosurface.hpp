@@ -217,6 +217,35 @@ public:
 			mrc.header().cella[0]/glUnitLength, mrc.header().cella[1]/glUnitLength, mrc.header().cella[2]/glUnitLength);
 	}
 
+	/// Incrementally update isosurface from scalar field
+
+	/// The cells are divided into bricks that each own a range of the vertex,
+	/// normal and index buffers. Only bricks marked with markDirty() and, if
+	/// diffField is true, bricks whose field values changed since the last
+	/// update are extracted again. A brick is patched into its range in place
+	/// or, if it outgrew the range, appended to the end of the buffers. Unused
+	/// parts of ranges hold degenerate triangles and are reclaimed by
+	/// compacting the buffers once they make up half of the mesh.
+	///
+	/// Vertices on brick faces are duplicated and normals are computed from
+	/// the field gradient so that bricks are independent of each other. The
+	/// vertex action is not called. The field dimensions, cell lengths and
+	/// level must be set beforehand; changing them causes a full extraction.
+	void update(const float * scalarField, bool diffField=false);
+
+	/// Mark field points [x0,x1) x [y0,y1) x [z0,z1) as changed for update()
+	void markDirty(int x0, int y0, int z0, int x1, int y1, int z1);
+
+	/// Mark the whole field as changed for update()
+	void markDirty();
+
+	/// Set number of cells along each side of a brick used by update()
+	Isosurface& brickSize(int cells);
+
+	/// Get number of bricks extracted by the last update()
+	int numUpdatedBricks() const { return mNumUpdatedBricks; }
+
+
 	void vertexAction(VertexAction& a){ mVertexAction = &a; }
 
 	const bool inBox() const { return mInBox; }
@@ -254,10 +283,40 @@ protected:
 	bool mNormalize;			// whether to normalize normals
 	bool mInBox;
 
+	// Range of the mesh buffers owned by a brick in incremental mode
+	struct Brick{
+		int vertexStart, vertexCount, vertexCapacity;
+		int indexStart, indexCount, indexCapacity;
+		bool dirty;
+	};
+
+	std::vector<Brick> mBricks;
+	std::vector<float> mPrevField;		// field at last update, for diffing
+	std::vector<int> mBrickEdgeToVertex;// edge to vertex map within a brick
+	std::vector<int> mBrickEdges;		// edges used by current brick
+	std::vector<Vertex> mBrickVertices;	// vertices of current brick
+	std::vector<Normal> mBrickNormals;	// normals of current brick
+	std::vector<int> mBrickIndices;		// triangles of current brick
+	int mBrickEdgeIDOffsets[12];		// mEdgeIDOffsets within a brick
+	int mBrickSize;						// cells along side of brick
+	int mNumBricks[3];					// bricks in x, y, and z directions
+	int mBrickFieldDims[3];				// field dimensions of brick layout
+	double mBrickL[3];					// cell lengths of brick layout
+	float mBrickLevel;					// isolevel of brick layout
+	bool mBrickNormalsOn;				// whether brick layout has normals
+	int mDeadVertices, mDeadIndices;	// unused buffer elements
+	int mNumUpdatedBricks;
+
+	int cellCase(const float * vals) const;
 	EdgeVertex calcIntersection(int nX, int nY, int nZ, int nEdgeNo, const float * vals) const;
 	void addEdgeVertex(int x, int y, int z, int cellID, int edge, const float * vals);
 
 	void compressTriangles();
+
+	void resetBricks();
+	void extractBrick(int brick, const float * field);
+	void placeBrick(int brick);
+	void compactBricks();
 };
 
 
@@ -44,8 +44,10 @@
 	Graham Wakefield, 2010, grrrwaaa@gmail.com
 */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <string>
+#include <vector>
 #include "allocore/math/al_Vec.hpp"
 #include "allocore/math/al_Mat.hpp"
 #include "allocore/types/al_Buffer.hpp"
@@ -81,6 +83,27 @@ public:
 	typedef Buffer<Index>		Indices;
 
 
+	/// Vertex adjacency of a triangle mesh
+
+	/// The per-vertex tables are in compressed sparse row (CSR) form: the
+	/// entries of vertex i are in the range [offsets[i], offsets[i+1]).
+	struct Adjacency{
+		std::vector<TriFace> triangles;	///< Vertex indices of each triangle
+		std::vector<int> neighborOffsets;///< Start of each vertex's neighbors, plus end
+		std::vector<int> neighbors;		///< Unique adjacent vertices, in ascending order
+		std::vector<int> faceOffsets;	///< Start of each vertex's faces, plus end
+		std::vector<int> faces;			///< Triangles using vertex, in ascending order
+
+		int numVertices() const { return neighborOffsets.empty() ? 0 : int(neighborOffsets.size())-1; }
+		int numNeighbors(int i) const { return neighborOffsets[i+1] - neighborOffsets[i]; }
+		const int * neighborsBegin(int i) const { return neighbors.data() + neighborOffsets[i]; }
+		const int * neighborsEnd(int i) const { return neighbors.data() + neighborOffsets[i+1]; }
+		int numFaces(int i) const { return faceOffsets[i+1] - faceOffsets[i]; }
+		const int * facesBegin(int i) const { return faces.data() + faceOffsets[i]; }
+		const int * facesEnd(int i) const { return faces.data() + faceOffsets[i+1]; }
+	};
+
+
 	/// @param[in] primitive	renderer-dependent primitive number
 	Mesh(int primitive=0);
 
@@ -100,8 +123,26 @@ public:
 	// destructive edits to internal vertices:
 
 	/// Generates indices for a set of vertices
+
+	/// Vertices with identical positions are merged; the first occurrence
+	/// supplies the attributes. This is the same as weld(0, false).
 	void compress();
 
+	/// Merges duplicate vertices and indexes the result
+
+	/// Each vertex is merged into the first earlier vertex whose position, and
+	/// optionally normal, color and texture coordinates, are within a
+	/// tolerance of its own. Indices are generated, or remapped if the mesh
+	/// already has them. Positions are hashed on a grid so this runs in
+	/// linear time; attribute buffers are compacted in place.
+	///
+	/// @param[in] eps			maximum difference per component for vertices
+	///							to be merged; 0 merges only identical vertices
+	/// @param[in] attributes	whether normals, colors and texture coordinates
+	///							must also match for vertices to be merged
+	/// \returns number of vertices after welding
+	int weld(float eps=0, bool attributes=true);
+
 	/// Convert indices (if any) to flat vertex buffers
 	void decompress();
 
@@ -162,7 +203,9 @@ public:
 	/// assuming the drawing primitive is either triangles or a triangle strip.
 	/// Averaged vertex normals are generated if indices are present and, for
 	/// triangles only, face normals are generated if no indices are present.
-	/// This will replace any normals currently in use.
+	/// This will replace any normals currently in use. Averaged normals are
+	/// gathered in parallel if the adjacency is already cached (e.g. by
+	/// smooth()) and otherwise summed serially over the faces.
 	///
 	/// @param[in] normalize			whether to normalize normals
 	/// @param[in] equalWeightPerFace	whether to use an equal weighting of
@@ -202,11 +245,20 @@ public:
 	///								If false, surface faces normal vector of curve.
 	void ribbonize(float * widths, int widthsStride=1, bool faceBinormal=false);
 
+	/// Get vertex adjacency of triangles
+
+	/// The adjacency is built from the triangles or triangle strip on first
+	/// use and cached. It is rebuilt after the indices have been accessed
+	/// through the non-const indices(), or the number of vertices or the
+	/// primitive have changed. This is not thread-safe.
+	const Adjacency& adjacency() const;
+
 	/// Smooths a triangle mesh
 
 	/// This smooths a triangle mesh using Laplacian (low-pass) filtering.
 	/// New vertex positions are a weighted sum of their nearest neighbors. 
-	/// The number of vertices is not changed.
+	/// The number of vertices is not changed. Vertices are processed in
+	/// parallel using the cached adjacency.
 	/// @param[in] amount		interpolation fraction between original and smoothed result
 	/// @param[in] weighting	0 = equal weight, 1 = inverse distance weight
 	void smooth(float amount=1, int weighting=0);
@@ -225,7 +277,7 @@ public:
 
 
 	/// Set geometric primitive
-	Mesh& primitive(int prim){ mPrimitive=prim; return *this; }
+	Mesh& primitive(int prim){ mPrimitive=prim; mAdjacencyDirty=true; return *this; }
 
 	/// Set stroke size
 
@@ -369,7 +421,7 @@ public:
 	TexCoord1s& texCoord1s(){ return mTexCoord1s; }
 	TexCoord2s& texCoord2s(){ return mTexCoord2s; }
 	TexCoord3s& texCoord3s(){ return mTexCoord3s; }
-	Indices& indices(){ return mIndices; }
+	Indices& indices(){ mAdjacencyDirty=true; return mIndices; }
 
 
 	/// Save mesh to file
@@ -423,6 +475,10 @@ protected:
 	int mPrimitive;
 	float mStroke = -1.f;
 
+	// Cached adjacency, invalidated by index and primitive mutators
+	mutable Adjacency mAdjacency;
+	mutable bool mAdjacencyDirty = true;
+
 public:
 	/// \deprecated
 	bool exportSTL(const char * filePath, const char * solidName = "") const;
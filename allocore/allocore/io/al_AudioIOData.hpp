@@ -44,6 +44,7 @@
 */
 
 #include <cassert>
+#include <climits>
 #include <cstdio>
 #include <string>
 
@@ -120,7 +121,9 @@ public:
 	typedef enum { PORTAUDIO, RTAUDIO, DUMMY } Backend;
 
 	/// Iterate frame counter, returning true while more frames
-	bool operator()() const { return (++mFrame) < framesPerBuffer(); }
+	bool operator()() const {
+		return (++mFrame) < framesPerBuffer() && mFrame < mFrameEnd;
+	}
 
 	/// Get current frame number
 	int frame() const { return mFrame; }
@@ -184,6 +187,8 @@ public:
 
 	void user(void* v) { mUser = v; }      ///< Set user data
 	void frame(int v) { mFrame = v - 1; }  ///< Set frame count for next iteration
+	/// Stop iterating before frame v, or at the end of the buffer if v < 0
+	void frameEnd(int v) { mFrameEnd = v < 0 ? INT_MAX : v; }
 	void zeroBus();                        ///< Zeros all the bus buffers
 	void zeroOut();  ///< Zeros all the internal output buffers
 
@@ -196,6 +201,7 @@ public:
 protected:
 	void* mUser;  // User specified data
 	mutable int mFrame;
+	int mFrameEnd;
 	int mFramesPerBuffer;
 	double mFramesPerSecond;
 	float *mBufI, *mBufO, *mBufB;  // input, output, and aux buffers
@@ -55,6 +55,14 @@ namespace al{
 class Socket{
 public:
 
+	/// Buffer for one datagram of a batch
+	struct Datagram{
+		char * data;		///< Data to send, or buffer to receive into
+		size_t capacity;	///< Size of receive buffer
+		size_t size;		///< Bytes to send, or bytes received
+		char from[16];		///< IPv4 address of the sender of a received datagram
+	};
+
 	/// Bit masks for specifying a transmission protocol
 	enum{
 		// IPv4/v6 protocols
@@ -94,6 +102,9 @@ public:
 	/// Returns whether socket is open
 	bool opened() const;
 
+	/// Get native socket handle, or -1 if not open
+	int handle() const;
+
 	/// Get IP address string
 	const std::string& address() const;
 
@@ -152,6 +163,28 @@ public:
 	/// \returns bytes sent
 	size_t send(const char * buffer, size_t len);
 
+	/// Read several datagrams with as few system calls as possible
+
+	/// This waits (according to the timeout) for the first datagram only and
+	/// then takes the datagrams already queued, up to count. On Linux, up to
+	/// 64 datagrams are read with a single call to recvmmsg. Elsewhere, one
+	/// datagram is read per call with the APR backend.
+	///
+	/// @param[in,out] dgrams	Buffers to receive into; sizes are set
+	/// @param[in] count		Number of buffers
+	/// \returns number of datagrams received
+	int recvBatch(Datagram * dgrams, int count);
+
+	/// Send several datagrams with as few system calls as possible
+
+	/// On Linux, the datagrams are sent with sendmmsg. Elsewhere, the APR
+	/// backend sends them one by one.
+	///
+	/// @param[in] dgrams		Datagrams to send
+	/// @param[in] count		Number of datagrams
+	/// \returns number of datagrams sent
+	int sendBatch(const Datagram * dgrams, int count);
+
 
 	/// Listen for incoming connections from remote clients
 
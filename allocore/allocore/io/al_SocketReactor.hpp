@@ -0,0 +1,126 @@
+#ifndef INCLUDE_AL_SOCKET_REACTOR_HPP
+#define INCLUDE_AL_SOCKET_REACTOR_HPP
+
+/*	Allocore --
+	Multimedia / virtual environment application class library
+
+	Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology, UCSB.
+	Copyright (C) 2012. The Regents of the University of California.
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+		Redistributions of source code must retain the above copyright notice,
+		this list of conditions and the following disclaimer.
+
+		Redistributions in binary form must reproduce the above copyright
+		notice, this list of conditions and the following disclaimer in the
+		documentation and/or other materials provided with the distribution.
+
+		Neither the name of the University of California nor the names of its
+		contributors may be used to endorse or promote products derived from
+		this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+
+
+	File description:
+	Event loop dispatching socket events to handlers on a few I/O threads
+*/
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "allocore/io/al_Socket.hpp"
+
+namespace al{
+
+/// Event loop waiting on many sockets with a few threads
+
+/// Instead of dedicating a thread to each socket that polls or blocks on
+/// it, sockets are added to a reactor with a handler. The I/O threads of the
+/// reactor wait for any of the sockets to become readable (with epoll on
+/// Linux and poll on other POSIX systems) and call the handler of that
+/// socket, which should then read the data without blocking. A handler is
+/// never called on two threads at once, and it is not called again until
+/// it returns. Handlers of different sockets run concurrently if the reactor
+/// has more than one I/O thread.
+///
+/// Reactors are not supported on Windows; add() then returns false.
+///
+/// @ingroup allocore
+class SocketReactor{
+public:
+
+	typedef std::function<void(Socket& socket)> Handler;
+
+	/// @param[in] numThreads	Number of I/O threads
+	SocketReactor(int numThreads=1);
+
+	/// Stops the I/O threads
+	~SocketReactor();
+
+	/// Get number of I/O threads
+	int numThreads() const { return mNumThreads; }
+
+	/// Get number of sockets
+	int size() const;
+
+	/// Call a handler whenever a socket has data to read
+
+	/// The I/O threads are started when the first socket is added.
+	/// \returns whether the socket could be added
+	bool add(Socket& socket, const Handler& handler);
+
+	/// Stop calling the handler of a socket
+
+	/// When this returns, the handler is not running (unless remove is called
+	/// from the handler itself) and will not be called again.
+	void remove(Socket& socket);
+
+	/// Stop the I/O threads; sockets stay added until removed
+	void stop();
+
+	/// Get a reactor with one I/O thread shared by the whole application
+	static SocketReactor& global();
+
+private:
+	struct Entry;
+	struct Backend;
+	typedef std::shared_ptr<Entry> EntryPtr;
+
+	int mNumThreads;
+	std::unique_ptr<Backend> mBackend;
+	std::vector<std::thread> mThreads;
+	std::unordered_map<uint64_t, EntryPtr> mEntries;	// by id
+	std::unordered_map<Socket *, uint64_t> mIDs;
+	mutable std::mutex mMutex;
+	uint64_t mNextID;
+	std::atomic<bool> mRunning;
+
+	bool start();
+	void run();
+	void dispatch(uint64_t id);
+
+	SocketReactor(const SocketReactor&);
+	SocketReactor& operator=(const SocketReactor&);
+};
+
+} // al::
+
+#endif
@@ -44,9 +44,11 @@
 
 */
 
+#include <string.h>
 #include <string>
 #include <vector>
 #include "allocore/io/al_Socket.hpp"
+#include "allocore/io/al_SocketReactor.hpp"
 #include "allocore/system/al_Thread.hpp"
 
 namespace al{
@@ -228,6 +230,202 @@ protected:
 	char mSenderAddr[32];
 };
 
+/// Characters in a buffer, not owned and not necessarily null-terminated
+///
+/// @ingroup allocore
+struct StringView{
+	StringView(): data(""), size(0){}
+	StringView(const char * data_, int size_): data(data_), size(size_){}
+
+	const char * begin() const { return data; }
+	const char * end() const { return data + size; }
+	bool empty() const { return 0 == size; }
+	char operator[](int i) const { return data[i]; }
+
+	/// Whether the characters equal a C-string
+	bool operator== (const char * v) const { return !strncmp(data, v, size) && !v[size]; }
+	bool operator!= (const char * v) const { return !(*this == v); }
+
+	/// Copy characters into a string
+	std::string str() const { return std::string(data, size); }
+
+	const char * data;
+	int size;
+};
+
+
+/// Inbound OSC message read in place from a packet buffer
+
+/// Unlike Message, a view does not copy anything or allocate memory. The
+/// address pattern and type tags refer to the packet buffer, so a view is
+/// only valid as long as the buffer is. Malformed messages and arguments of
+/// the wrong type are reported through return values instead of
+/// exceptions.
+///
+/// @ingroup allocore
+class MessageView{
+public:
+
+	MessageView();
+
+	/// Parse a message
+
+	/// @param[in] message		raw OSC message bytes
+	/// @param[in] size			number of bytes in message
+	/// @param[in] timeTag		time tag of message (inherited from bundle)
+	/// @param[in] senderAddr	IP address of sender
+	/// \returns whether the message is well formed
+	bool parse(const char * message, int size, const TimeTag& timeTag=1, const char * senderAddr = nullptr);
+
+	/// Get raw message bytes
+	const char * data() const { return mData; }
+
+	/// Get number of bytes in message
+	int size() const { return mSize; }
+
+	/// Get time tag
+	const TimeTag& timeTag() const { return mTimeTag; }
+
+	/// Get address pattern
+	const StringView& addressPattern() const { return mAddressPattern; }
+
+	/// Get type tags, without the leading comma
+	const StringView& typeTags() const { return mTypeTags; }
+
+	/// Get IP address of sender, or an empty string
+	const char * senderAddress() const { return mSenderAddr ? mSenderAddr : ""; }
+
+	/// Get number of arguments
+	int numArgs() const { return mTypeTags.size; }
+
+	/// Whether all extractions since the last resetStream() succeeded
+	bool good() const { return mGood; }
+
+	/// Reset stream for converting from raw message bytes to types
+	MessageView& resetStream();
+
+	/// Skip next stream element
+	MessageView& skip();
+
+	// Extracting an element of the wrong type or past the end of the
+	// arguments leaves the value untouched and clears good().
+	MessageView& operator>> (int& v);			///< Extract next stream element as integer
+	MessageView& operator>> (float& v);			///< Extract next stream element as float
+	MessageView& operator>> (double& v);		///< Extract next stream element as double
+	MessageView& operator>> (char& v);			///< Extract next stream element as char
+	MessageView& operator>> (const char*& v);	///< Extract next stream element as C-string
+	MessageView& operator>> (StringView& v);	///< Extract next stream element as string
+	MessageView& operator>> (Blob& v);			///< Extract next stream element as Blob
+
+	/// Pretty-print message information
+	void print() const;
+
+private:
+	const char * mData;
+	int mSize;
+	TimeTag mTimeTag;
+	const char * mSenderAddr;
+	StringView mAddressPattern;
+	StringView mTypeTags;
+	const char * mArgs;
+	int mArgsSize;
+	int mTag;		// index of next type tag
+	int mPos;		// offset of next argument
+	bool mGood;
+
+	const char * next(char tag, int bytes);
+};
+
+
+/// Outbound OSC packet written directly into a caller-provided buffer
+
+/// The builder has the same interface as Packet, but it never allocates
+/// memory or throws. If the buffer is too small, or bundles and messages are
+/// not properly nested, ok() turns false and the following elements are
+/// ignored. While a message is built, its type tags are kept at the end of
+/// the buffer, so it needs a few more bytes than the finished packet.
+///
+/// @ingroup allocore
+class PacketBuilder{
+public:
+
+	/// @param[in] buffer		buffer to write packet into
+	/// @param[in] capacity		size, in bytes, of the buffer
+	PacketBuilder(char * buffer, int capacity);
+
+	const char * data() const { return mBuffer; }	///< Get raw packet data
+	int size() const { return mSize; }				///< Get number of bytes of packet data
+	int capacity() const { return mCapacity; }		///< Get size of buffer
+
+	/// Whether the packet is complete and everything fit into the buffer
+	bool ok() const { return mOK && 0 == mDepth && !mInMessage; }
+
+	/// Begin a new bundle
+	PacketBuilder& beginBundle(TimeTag timeTag=1);
+
+	/// End bundle
+	PacketBuilder& endBundle();
+
+	/// Start a new message
+	PacketBuilder& beginMessage(const char * addressPattern);
+
+	/// End message
+	PacketBuilder& endMessage();
+
+	/// Add message with any number of arguments
+	template <class... Args>
+	PacketBuilder& addMessage(const char * addr, const Args&... args){
+		beginMessage(addr); add(args...); return endMessage();
+	}
+
+	PacketBuilder& operator<< (int v);					///< Add integer to message
+	PacketBuilder& operator<< (unsigned v);				///< Add integer to message
+	PacketBuilder& operator<< (float v);				///< Add float to message
+	PacketBuilder& operator<< (double v);				///< Add double to message
+	PacketBuilder& operator<< (char v);					///< Add char to message
+	PacketBuilder& operator<< (const char* v);			///< Add C-string to message
+	PacketBuilder& operator<< (const std::string& v);	///< Add string to message
+	PacketBuilder& operator<< (const StringView& v);	///< Add string to message
+	PacketBuilder& operator<< (const Blob& v);			///< Add Blob to message
+
+	/// Clear current packet contents
+	PacketBuilder& clear();
+
+private:
+	enum { MAX_DEPTH = 8 };
+	char * mBuffer;
+	int mCapacity;
+	int mSize;
+	int mTagsSize;			// type tags, written backwards from end of buffer
+	int mArgsBegin;			// offset of first argument of current message
+	int mDepth;				// number of open bundles
+	int mElementBegin[MAX_DEPTH+1];	// offsets of open bundle element sizes
+	bool mInMessage;
+	bool mOK;
+
+	void add(){}
+	template <class A, class... Args>
+	void add(const A& a, const Args&... args){ (*this) << a; add(args...); }
+
+	char * reserve(char tag, int bytes);
+	void beginElement();
+	void endElement();
+	PacketBuilder& addString(char tag, const char * v, int len);
+};
+
+
+
+/// Whether an address pattern contains any OSC wildcards
+bool isPattern(const std::string& addressPattern);
+
+/// Whether an address matches an OSC address pattern
+
+/// Besides plain characters, the pattern may contain the wildcards '?' (any
+/// character but '/'), '*' (any characters but '/'), '[abc]' or '[a-z]' (any
+/// character of a set), '[!abc]' (any character not in a set) and
+/// '{foo,bar}' (any of a list of strings).
+bool matchPattern(const char * addressPattern, const char * address);
+
 
 
 /// Interface for classes that can be registered as handlers with a osc::Recv server object
@@ -241,6 +439,13 @@ public:
 	/// Called for each message contained in packet
 	virtual void onMessage(Message& m) = 0;
 
+	/// Called for each message contained in packet, before it is copied
+
+	/// The default implementation constructs a Message and calls
+	/// onMessage(Message&). Handlers that override this instead read
+	/// messages without any memory allocation.
+	virtual void onMessageView(MessageView& m);
+
 	// FIXME: For backwards compatibility. Remove when updating API
 	void parse(const char *packet, int size, TimeTag timeTag=1) {
 		parse(packet, size, timeTag, nullptr);
@@ -270,7 +475,7 @@ public:
 /// @ingroup allocore
 class Send : public SocketClient, public Packet{
 public:
-	Send(){}
+	Send(): mMTU(0), mMaxDatagrams(0){}
 
 	/// @param[in] port		Port number (valid range is 0-65535)
 	/// @param[in] address	IP address
@@ -278,6 +483,30 @@ public:
 	/// @param[in] size 	Packet buffer size
 	Send(uint16_t port, const char * address = "localhost", al_sec timeout=0, int size=1024);
 
+	virtual ~Send(){ flush(); }
+
+	/// Coalesce sent packets into bundles
+
+	/// With coalescing on, send() does not send packets right away. They are
+	/// appended to a bundle (with an immediate time tag) until the bundle
+	/// would exceed the MTU; then a new bundle is started. flush() sends all
+	/// pending bundles at once with Socket::sendBatch(), so call it after each
+	/// frame of messages. A bundle holding a single packet is sent as the
+	/// packet alone. Packets larger than the MTU are sent on their own. The
+	/// buffer size of the receiving Recv must be at least the MTU.
+	///
+	/// @param[in] mtu			Maximum size of a datagram, in bytes (e.g. 1472
+	///							for IPv4 over Ethernet), or 0 to send every
+	///							packet immediately (default)
+	/// @param[in] maxDatagrams	Number of pending bundles that triggers a flush
+	Send& coalesce(int mtu, int maxDatagrams=64);
+
+	/// Get MTU used for coalescing, or 0 if packets are sent immediately
+	int mtu() const { return mMTU; }
+
+	/// Send the pending bundles and return the number of datagrams sent
+	int flush();
+
 	/// Send and clear current packet contents
 	int send();
 
@@ -330,6 +559,14 @@ public:
 	int send(const std::string& addr, const A& a, const B& b, const C& c, const D& d, const E& e, const F& f, const G& g){
 		addMessage(addr, a,b,c,d,e,f,g); return send();
 	}
+
+private:
+	int mMTU;
+	int mMaxDatagrams;
+	std::vector<char> mBatchData;
+	std::vector<Socket::Datagram> mBatch;
+
+	int queue(const char * data, int size);
 };
 
 
@@ -356,13 +593,22 @@ public:
 	/// Get current received packet data
 	const char * data() const { return &mBuffer[0]; }
 
-	/// Set size of internal buffer
-	void bufferSize(int n){ mBuffer.resize(n); }
+	/// Set size of internal buffer, per packet
+	void bufferSize(int n){ mBufferSize = n; mBuffer.resize(mBufferSize * mBatchSize); }
+
+	/// Set maximum number of packets read by one call to recv()
+	void batchSize(int n){ mBatchSize = n > 0 ? n : 1; bufferSize(mBufferSize); }
+
+	/// Get maximum number of packets read by one call to recv()
+	int batchSize() const { return mBatchSize; }
 
 	/// Set packet handling routine
 	Recv& handler(PacketHandler& v){ mHandler = &v; return *this; }
 
-	/// Check for an OSC packet and call handler
+	/// Check for OSC packets and call handler
+
+	/// This waits for one packet and then also reads the packets already
+	/// queued, up to batchSize(), with a single system call on Linux.
 	/// returns bytes read
 	/// note: use while(recv()){} to ensure queue is fully flushed.
 	int recv();
@@ -373,13 +619,25 @@ public:
 	/// Returns whether the thread was started successfully.
 	bool start();
 
+	/// Call recv() from the I/O threads of a reactor when packets arrive
+
+	/// Many receivers can share the threads of one reactor, which also wakes
+	/// up as soon as a packet arrives instead of polling with the timeout.
+	/// Falls back to start() when the reactor is not supported.
+	/// Returns whether packets will be received in the background.
+	bool start(SocketReactor& reactor);
+
 	/// Stop the background polling
 	void stop();
 
 protected:
 	PacketHandler * mHandler;
 	std::vector<char> mBuffer;
+	std::vector<Socket::Datagram> mDatagrams;
+	int mBufferSize;
+	int mBatchSize;
 	al::Thread mThread;
+	SocketReactor * mReactor;
 	bool mBackground;
 };
 
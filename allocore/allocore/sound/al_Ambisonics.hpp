@@ -95,15 +95,25 @@
 
 namespace al{
 
+/// Ambisonic channel ordering and normalization
+enum AmbiConvention {
+	AMBI_FUMA,			///< Furse-Malham channels and weights, up to 3rd order
+	AMBI_ACN_SN3D		///< ACN channel order and SN3D normalization (AmbiX), up to 7th order
+};
+
 /// Ambisonic base class
 ///
 /// @ingroup allocore
 class AmbiBase{
 public:
 
-	/// @param[in] dim		number of spatial dimensions (2 or 3)
-	/// @param[in] order	highest spherical harmonic order
-	AmbiBase(int dim, int order);
+	/// Highest supported order
+	enum { MAX_ORDER = 7, MAX_CHANNELS = (MAX_ORDER+1)*(MAX_ORDER+1) };
+
+	/// @param[in] dim			number of spatial dimensions (2 or 3)
+	/// @param[in] order		highest spherical harmonic order
+	/// @param[in] convention	channel ordering and normalization
+	AmbiBase(int dim, int order, AmbiConvention convention=AMBI_FUMA);
 
 	virtual ~AmbiBase();
 
@@ -113,13 +123,16 @@ public:
 	/// Get order
 	int order() const { return mOrder; }
 
+	/// Get channel ordering and normalization
+	AmbiConvention convention() const { return mConvention; }
+
 	/// Get Ambisonic channel weights
 	const float * weights() const { return mWeights; }
 
 	/// Returns total number of Ambisonic domain (B-format) channels
 	int channels() const { return mChannels; }
 
-	/// Set the order
+	/// Set the order, up to MAX_ORDER
 	void order(int order);
 
 	/// Called whenever the number of Ambisonic channels changes
@@ -140,6 +153,26 @@ public:
 	/// (x,y,z unit vector in the listener's coordinate frame)
 	static void encodeWeightsFuMa16(float * ws, float x, float y, float z);
 
+	/// Compute ACN/SN3D spherical harmonic weights from a direction vector
+
+	/// The harmonics are computed by recurrence up to MAX_ORDER. The weights
+	/// are the regular solid harmonics of (x,y,z), which are the spherical
+	/// harmonics for a unit vector and only W for a zero vector. In 2D, only
+	/// the circular harmonics are computed, in the order W, sin(A), cos(A),
+	/// sin(2A), cos(2A), ..., each with unit amplitude.
+	static void encodeWeightsACN(float * ws, int dim, int order, float x, float y, float z);
+
+	/// Compute ACN/SN3D spherical harmonic weights from azimuth and elevation
+	/// in radians
+	static void encodeWeightsACN(float * ws, int dim, int order, float azimuth, float elevation);
+
+	/// Compute weights of the given convention from a direction vector
+	static void encodeWeights(float * ws, AmbiConvention convention, int dim, int order, float x, float y, float z);
+
+	/// Compute weights of the given convention from azimuth and elevation
+	/// in radians
+	static void encodeWeights(float * ws, AmbiConvention convention, int dim, int order, float azimuth, float elevation);
+
 	static int orderToChannels(int dim, int order);
 	static int orderToChannelsH(int orderH);
 	static int orderToChannelsV(int orderV);
@@ -149,8 +182,9 @@ public:
 
 protected:
 	int mDim;			// dimensions - 2d or 3d
-	int mOrder;			// order - 0th, 1st, 2nd, or 3rd
+	int mOrder;			// order - 0th to MAX_ORDER
 	int mChannels;		// cached for efficiency
+	AmbiConvention mConvention;
 	float * mWeights;	// weights for each ambi channel
 
 	template<typename T>
@@ -174,11 +208,19 @@ public:
 	/// @param[in] order		highest spherical harmonic order
 	/// @param[in] numSpeakers	number of speakers
 	/// @param[in] flavor		decoding algorithm
-	AmbiDecode(int dim, int order, int numSpeakers, int flavor=1);
+	/// @param[in] convention	channel ordering and normalization
+	AmbiDecode(int dim, int order, int numSpeakers, int flavor=1, AmbiConvention convention=AMBI_FUMA);
 
 	virtual ~AmbiDecode();
 
 
+	/// Decode a buffer
+
+	/// This is a matrix multiply of the decode matrix by the Ambisonic
+	/// channels, done over tiles of frames that stay in cache and four
+	/// speakers at a time, with SIMD over frames. The decoded signals are
+	/// added to the device channels of the speakers.
+	///
 	/// @param[out] dec				output time domain buffers (non-interleaved)
 	/// @param[in] enc				input Ambisonic domain buffers (non-interleaved)
 	/// @param[in] numDecFrames	number of frames in time domain buffers
@@ -192,8 +234,14 @@ public:
 
 	void setConfiguration(AmbiDecodeConfig &config) {mConfig = config;}
 
+	/// Get decode matrix entry
+
+	/// With AMBI_FUMA, this is the channel weight of the speaker direction.
+	/// With AMBI_ACN_SN3D, it also includes the flavor weight of the order
+	/// and the normalization of a sampling decoder, so that the speaker
+	/// gains of a source sum to about its W.
 	float decodeWeight(int speaker, int channel) const {
-		return /*mWeights[channel] **/ mDecodeMatrix[speaker * channels() + channel];
+		return mDecodeMatrix[speaker * channels() + channel] * mDecodeScale[channel];
 	}
 
 	/// Returns decode flavor
@@ -232,7 +280,8 @@ protected:
 	int mFlavor;				// decode flavor
 	float * mDecodeMatrix;		// deccoding matrix for each ambi channel & speaker
 								// cols are channels and rows are speakers
-	float mWOrder[5];			// weights for each order
+	float mWOrder[MAX_ORDER+1];	// weights for each order
+	float mDecodeScale[MAX_CHANNELS];	// scaling of decode matrix columns
     Speakers* mSpeakers;
     //float * mPositions;		// speakers' azimuths + elevations
 	//float * mFrame;			// an ambisonic channel frame used for decode(int)
@@ -242,7 +291,11 @@ protected:
 
 	float decode(float * encFrame, int encNumChannels, int speakerNum);	// is this useful?
 
+	// Decode weights of a speaker, with offset and discarding applied
+	void speakerWeights(int speaker, float * weights) const;
+
 	static float flavorWeights[4][5][5];
+	static float flavorWeight(int flavor, int degree, int order);
 
 	AmbiDecodeConfig mConfig;
 };
@@ -257,7 +310,9 @@ public:
 
 	/// @param[in] dim			number of spatial dimensions (2 or 3)
 	/// @param[in] order		highest spherical harmonic order
-	AmbiEncode(int dim, int order) : AmbiBase(dim, order) {}
+	/// @param[in] convention	channel ordering and normalization
+	AmbiEncode(int dim, int order, AmbiConvention convention=AMBI_FUMA)
+	:	AmbiBase(dim, order, convention) {}
 
 //	/// Encode input sample and set decoder frame.
 //	void encode   (const AmbiDecode &dec, float input);
@@ -280,6 +335,18 @@ public:
 	/// @param numFrames	number of frames to encode
 	void encode(float * ambiChans, const float * input, int numFrames);
 
+	/// Encode buffer of a moving source
+
+	/// The weights ramp linearly from prevWeights, the weights used for
+	/// the previous buffer, to the current weights, which are reached at
+	/// the last frame.
+	///
+	/// @param ambiChans	Ambisonic domain channels (non-interleaved)
+	/// @param input		time-domain sample buffer to encode
+	/// @param numFrames	number of frames to encode
+	/// @param prevWeights	weights of previous buffer, one per channel
+	void encode(float * ambiChans, const float * input, int numFrames, const float * prevWeights) const;
+
 	/// Encode a buffer of samples
 
 	/// @param[in] ambiChans	Ambisonic domain channels (non-interleaved)
@@ -304,7 +371,8 @@ public:
 class AmbisonicsSpatializer : public Spatializer {
 public:
 
-	AmbisonicsSpatializer(SpeakerLayout &sl, int dim, int order, int flavor=1);
+	AmbisonicsSpatializer(SpeakerLayout &sl, int dim, int order, int flavor=1,
+	                      AmbiConvention convention=AMBI_FUMA);
 
 	virtual void compile(Listener& l) override;
 
@@ -322,6 +390,20 @@ public:
 	                          const float& sample,
 	                          const int& frameIndex) override;
 
+	/// Allocate the encoding weights of the previous buffer of a source
+	virtual void initSourceState(SpatializerState& state) const override;
+
+	/// Encode buffer with weights ramping from the previous buffer of the source
+	virtual void renderSourceBuffer(AudioIOData& io, SoundSource& src,
+	                                SpatializerState& state,
+	                                const Pose& listeningPose,
+	                                const float *samples,
+	                                const int& numFrames
+	                                ) override;
+
+	/// Decode the Ambisonic channels of all sources
+	virtual void finalize(AudioIOData& io) override;
+
 	void numSpeakers(int num);
 
 	void setSpeakerLayout(SpeakerLayout& sl);
@@ -330,10 +412,10 @@ public:
 
 	float * ambiChans(unsigned channel=0);
 
-
-//	virtual void finalize(AudioIOData& io) override;
-
 private:
+	// Set encoder direction from the pose of a source relative to the listener
+	void direction(const Pose& listeningPose);
+
 	AmbiDecode mDecoder;
 	AmbiEncode mEncoder;
 	std::vector<float> mAmbiDomainChannels;
@@ -358,40 +440,23 @@ inline int AmbiBase::orderToChannelsV(int orderV){ return orderV * orderV; }
 
 inline int AmbiBase::channelsToOrder(int channels)
 {
-	int order = -1;
-	switch(channels) {
-	case 3:
-	case 4:
-		order = 1;
-		break;
-	case 9:
-		order = 2;
-		break;
-	case 16:
-		order = 3;
-		break;
-	default:
-		order = -1;
-	}
-	return order;
+	int dim = channelsToDimensions(channels);
+	if(dim == 3) return channelsToUniformOrder(channels);
+	if(dim == 2) return (channels - 1) >> 1;
+	return -1;
 }
 
 inline int AmbiBase::channelsToDimensions(int channels)
 {
-	int dim = 3;
-	switch(channels) {
-	case 3:
-		dim = 2;
-		break;
-	case 4:
-	case 9:
-	case 16:
-		dim = 3;
-		break;
-	default:
-		dim = -1;
+	// 3D has (order+1)^2 channels, 2D has 2*order+1 (9 is taken as 3D)
+	int order3 = channelsToUniformOrder(channels);
+	if(channels >= 4 && (order3+1)*(order3+1) == channels && order3 <= MAX_ORDER){
+		return 3;
+	}
+	if(channels >= 3 && (channels & 1) && ((channels - 1) >> 1) <= MAX_ORDER){
+		return 2;
 	}
-	return dim;
+	return -1;
 }
 
 template<typename T>
@@ -432,11 +497,11 @@ inline float AmbiDecode::decode(float * encFrame, int encNumChannels, int speake
 //}
 
 inline void AmbiEncode::direction(float az, float el){
-	AmbiBase::encodeWeightsFuMa(mWeights, mDim, mOrder, az, el);
+	AmbiBase::encodeWeights(mWeights, mConvention, mDim, mOrder, az, el);
 }
 
 inline void AmbiEncode::direction(float x, float y, float z){
-	AmbiBase::encodeWeightsFuMa(mWeights, mDim, mOrder, x,y,z);
+	AmbiBase::encodeWeights(mWeights, mConvention, mDim, mOrder, x,y,z);
 }
 
 inline void AmbiEncode::encode(float * ambiChans, int numFrames, int timeIndex, float timeSample) const {
@@ -445,6 +510,9 @@ inline void AmbiEncode::encode(float * ambiChans, int numFrames, int timeIndex,
 	// This requires only a simple jump per time sample.
 	#define CS(chanindex) case chanindex: ambiChans[chanindex*numFrames+timeIndex] += weights()[chanindex] * timeSample;
 	int ch = channels()-1;
+	for(; ch >= 16; --ch){
+		ambiChans[ch*numFrames+timeIndex] += weights()[ch] * timeSample;
+	}
 	switch(ch){
 		CS(15) CS(14) CS(13) CS(12) CS(11) CS(10) CS( 9) CS( 8)
 		CS( 7) CS( 6) CS( 5) CS( 4) CS( 3) CS( 2) CS( 1) CS( 0)
@@ -48,6 +48,7 @@
 #include <cstring>
 #include <vector>
 #include <list>
+#include <map>
 #include <iostream>
 
 #include "allocore/types/al_Buffer.hpp"
@@ -91,6 +92,88 @@ class SoundSource;
 
 
 
+/// Sparse matrix routing speaker gains to output channels
+
+/// Panners compute one gain per speaker of a layout. The matrix maps these
+/// gains to device channels, with channels reassigned to other outputs
+/// (e.g. VBAP phantom channels) resolved once when it is set up, and mixes
+/// a source into the outputs. Buffers are mixed with gains that ramp
+/// linearly from the gains of the previous block to avoid zipper noise.
+///
+/// @ingroup allocore
+class GainMatrix {
+public:
+
+	/// Output gains of a source for a listener from the previous block
+	struct State {
+		const GainMatrix * matrix = nullptr;
+		std::vector<float> gains;	// one per output of matrix
+		std::vector<float> next;	// gains of current block
+		bool fresh = true;			// no block rendered yet
+	};
+
+	/// Set routing of speakers to their device channels
+
+	/// @param[in] speakers		speaker layout
+	/// @param[in] reassigned	map from a device channel to the channels its
+	///							signal is distributed to instead. The gain of
+	///							each of the n channels is 1/sqrt(n) to keep
+	///							the power constant.
+	void setup(const Speakers& speakers,
+	           const std::map<int, std::vector<int> >& reassigned = std::map<int, std::vector<int> >());
+
+	/// Returns number of speakers routed
+	int numSpeakers() const { return mRowStarts.empty() ? 0 : mRowStarts.size() - 1; }
+
+	/// Returns number of distinct output channels
+	int numOutputs() const { return mOutputs.size(); }
+
+	/// Allocate gains of a state for the outputs of this matrix
+
+	/// renderBuffer() only allocates if the state was not initialized for
+	/// this matrix or if the matrix was set up again with other outputs.
+	void initState(State& state) const;
+
+	/// Mix a buffer into the outputs
+
+	/// @param[in] io			output buffers
+	/// @param[in] state		gains of the previous block, updated with the
+	///							current gains. If null, gains do not ramp.
+	///							There must be one state per source and
+	///							listener.
+	/// @param[in] samples		source samples
+	/// @param[in] numFrames	number of frames
+	/// @param[in] gains		speaker gains
+	/// @param[in] numGains		number of speaker gains
+	/// @param[in] speakers		speaker index for each gain; if null, the
+	///							gains are for speakers 0 to numGains-1
+	void renderBuffer(AudioIOData& io, State * state,
+	                  const float * samples, int numFrames,
+	                  const float * gains, int numGains,
+	                  const int * speakers = nullptr) const;
+
+	/// Mix a single sample into the outputs
+	void renderSample(AudioIOData& io, float sample, int frameIndex,
+	                  const float * gains, int numGains,
+	                  const int * speakers = nullptr) const;
+
+private:
+	// Entries of speaker s are [mRowStarts[s], mRowStarts[s+1])
+	std::vector<unsigned> mRowStarts;
+	std::vector<unsigned> mEntryOutputs;	// index into mOutputs
+	std::vector<float> mEntryWeights;
+	std::vector<int> mOutputs;				// device channels
+};
+
+
+/// State of a spatializer for a source and a listener, kept between blocks
+struct SpatializerState {
+	GainMatrix::State gains;	///< output gains, for panners mixing through a GainMatrix
+	std::vector<float> weights;	///< weights of the previous block, for other spatializers
+};
+
+
+
 /// Base class for an object (listener or source) in an audio scene
 
 /// This contains a "pose" to represent the position and orientation of a
@@ -146,14 +229,18 @@ public:
 
 	void updateHistory(int numFrames);
 
+	/// Get index of listener in its scene
+	unsigned index() const { return mIndex; }
+
 protected:
 	friend class AudioScene;
 
-	Listener(int numFrames, Spatializer *spatializer);
+	Listener(int numFrames, Spatializer *spatializer, unsigned index = 0);
 
 	void numFrames(unsigned v);
 
 	Spatializer * mSpatializer;
+	unsigned mIndex;
 	std::vector<Quatd> mQuatHistory;// buffer of interpolated orientations
 	Quatd mQuatPrev;				// orientation in previous block
 	bool mIsCompiled;
@@ -196,32 +283,7 @@ public:
 
 		float s = 0.0f;
 		double dist = listeningPose.vec().mag(); //Compute distance in world-space units
-		Vec3d relDirection = posHistory()[0] - listeningPose.vec();
-
-		Quatd srcRot = listeningPose.quat();
-		relDirection = srcRot.rotate(relDirection);
-		double distanceToSample = 0;
-		double samplesAgo = 1024; // TODO how can we set a better default
-		if(dopplerType() == DOPPLER_SYMMETRICAL) {
-			distanceToSample = mSampleRate / mSpeedOfSound;
-			samplesAgo = dist * distanceToSample;
-		} else if(dopplerType() == DOPPLER_PHYSICAL) {
-			// FIXME AC Can we use the current pose here for distance or should we calculate from listener history?
-			double prevDistance = (posHistory()[1] - listeningPose.vec()).mag();
-			double sourceVel = (dist - prevDistance)*mSampleRate; //positive when moving away, negative moving toward
-//			if(sourceVel == -mSpeedOfSound) sourceVel -= 0.001; //prevent divide by 0 / inf freq
-			double sumSpeed = mSpeedOfSound + sourceVel;
-			if (sumSpeed < 0.001) { sumSpeed = 0.001; }
-
-			distanceToSample = fabs(mSampleRate / sumSpeed);
-			samplesAgo = dist * distanceToSample;
-		}
-		updateHistory();
-
-//		// Add on time delay (in samples) - only needed if the source is rendered per buffer
-		if(!usePerSampleProcessing()) {
-			samplesAgo -= mFrameCounter++;
-		}
+		double samplesAgo = nextReadIndex(listeningPose, dist);
 
 		// Is our delay line big enough?
 		if(samplesAgo <= maxIndex()){
@@ -242,20 +304,42 @@ public:
 		return getNextSample(l.pose());
 	}
 
+	/// Get a block of samples as heard from a listener
+
+	/// This produces the same output as calling getNextSample() size times,
+	/// but computes all the delay-line read positions first and then reads
+	/// them using a vectorized kernel (see readSamples()).
 	void getBuffer(Listener &l, float *buffer, const int size) {
-		frame(0);
-		for (int i = 0; i < size; i++) {
-			*buffer++ = getNextSample(l);
-		}
+		getBuffer(l.pose(), buffer, size);
 	}
 
 	void getBuffer(Pose listeningPose, float *buffer, const int size) {
 		frame(0);
-		for (int i = 0; i < size; i++) {
-			*buffer++ = getNextSample(listeningPose);
-		}
+		if(mReadIndices.size() < unsigned(size)) mReadIndices.resize(size);
+		float gain = readIndices(listeningPose, &mReadIndices[0], size);
+		readSamples(buffer, &mReadIndices[0], size, gain);
 	}
 
+	/// Compute delay-line read indices for a block of samples
+
+	/// This performs the Doppler computation of size successive calls to
+	/// getNextSample() without reading from the delay-line.
+	/// @param[in]  listeningPose	pose of source relative to listener
+	/// @param[out] indices			fractional read indices (samples ago)
+	/// @param[in]  size			number of samples
+	/// \returns distance attenuation gain for the block
+	double readIndices(const Pose& listeningPose, double * indices, int size);
+
+	/// Read a block of samples from the delay-line with cubic interpolation
+
+	/// Indices greater than maxIndex() produce silence. This uses SSE2, AVX2
+	/// or NEON when available and matches readSample() within float rounding.
+	/// @param[out] out		output samples
+	/// @param[in]  indices	read indices as returned by readIndices()
+	/// @param[in]  size	number of samples
+	/// @param[in]  gain	gain applied to all samples
+	void readSamples(float * out, const double * indices, int size, float gain) const;
+
 	void frame(int v) { mFrameCounter = v; }
 
 	/// Read sample from delay-line using linear interpolation
@@ -323,18 +407,62 @@ public:
 	/// Set speed of sound for computation in m/s
 	void setSpeedOfSound(float speedOfSound) {mSpeedOfSound = speedOfSound; }
 
-	void cachedIndex(unsigned int v){ mCachedIndex = v; } // FIXME: For VBAP. There should be a better place for this
-	unsigned int cachedIndex(){ return mCachedIndex; }
+	void cachedIndex(unsigned int v){ mCachedIndex = v; } ///< Set index cached by the spatializer (e.g. VBAP triplet)
+	unsigned int cachedIndex(){ return mCachedIndex; } ///< Get index cached by the spatializer
+
+	/// Get state of the spatializer of a listener for this source
+
+	/// The states of the listeners of a scene are allocated by
+	/// AudioScene::addSource() and AudioScene::createListener().
+	SpatializerState& spatializerState(const Listener& l){
+		if(mSpatializerStates.size() <= l.index()) mSpatializerStates.resize(l.index() + 1);
+		return mSpatializerStates[l.index()];
+	}
 
 private:
+	// Doppler delay in samples based on the current position history
+	double dopplerDelay(const Pose& listeningPose, double dist) const {
+		double distanceToSample = 0;
+		double samplesAgo = 1024; // TODO how can we set a better default
+		if(dopplerType() == DOPPLER_SYMMETRICAL) {
+			distanceToSample = mSampleRate / mSpeedOfSound;
+			samplesAgo = dist * distanceToSample;
+		} else if(dopplerType() == DOPPLER_PHYSICAL) {
+			// FIXME AC Can we use the current pose here for distance or should we calculate from listener history?
+			double prevDistance = (posHistory()[1] - listeningPose.vec()).mag();
+			double sourceVel = (dist - prevDistance)*mSampleRate; //positive when moving away, negative moving toward
+//			if(sourceVel == -mSpeedOfSound) sourceVel -= 0.001; //prevent divide by 0 / inf freq
+			double sumSpeed = mSpeedOfSound + sourceVel;
+			if (sumSpeed < 0.001) { sumSpeed = 0.001; }
+
+			distanceToSample = fabs(mSampleRate / sumSpeed);
+			samplesAgo = dist * distanceToSample;
+		}
+		return samplesAgo;
+	}
+
+	// Advance source history and return next read index (samples ago)
+	double nextReadIndex(const Pose& listeningPose, double dist){
+		double samplesAgo = dopplerDelay(listeningPose, dist);
+		updateHistory();
+
+//		// Add on time delay (in samples) - only needed if the source is rendered per buffer
+		if(!usePerSampleProcessing()) {
+			samplesAgo -= mFrameCounter++;
+		}
+		return samplesAgo;
+	}
+
 	RingBuffer<float> mSound;		// spherical wave around position
 	bool mUseAtten;
 	DopplerType mDopplerType;
 	bool mUsePerSampleProcessing;
     unsigned int mCachedIndex; // for VBAP with multiple sources
+	std::vector<SpatializerState> mSpatializerStates;	// one per listener
 	float mSampleRate;
 	float mSpeedOfSound;
 	int mFrameCounter;
+	std::vector<double> mReadIndices;	// read indices for getBuffer()
 
 	BiQuadNX presenceFilter; //used for presence filtering and spatial modulation BW control
 };
@@ -370,6 +498,36 @@ public:
 	                          const float& sample,
 	                          const int& frameIndex) = 0;
 
+	/// Allocate the state of a source used by renderSourceBuffer()
+
+	/// AudioScene calls this when a source or a listener is added, so that
+	/// rendering does not allocate.
+	virtual void initSourceState(SpatializerState& /*state*/) const {}
+
+	/// Render audio buffer of a source in position
+
+	/// AudioScene calls this for every source and listener. Spatializers can
+	/// override it to keep state between blocks in the state of the source for
+	/// the listener. By default, this calls renderBuffer().
+	virtual void renderSourceBuffer(AudioIOData& io, SoundSource& /*src*/,
+	                                SpatializerState& /*state*/,
+	                                const Pose& listeningPose,
+	                                const float *samples,
+	                                const int& numFrames
+	                                ){
+		renderBuffer(io, listeningPose, samples, numFrames);
+	}
+
+	/// Render audio sample of a source in position
+
+	/// By default, this calls renderSample().
+	virtual void renderSourceSample(AudioIOData& io, SoundSource& /*src*/,
+	                                const Pose& listeningPose,
+	                                const float& sample,
+	                                const int& frameIndex){
+		renderSample(io, listeningPose, sample, frameIndex);
+	}
+
 	/// Called once per listener, after sources are rendered. ex. ambisonics decode
 	virtual void finalize(AudioIOData& io){}
 
@@ -385,6 +543,14 @@ public:
 	/// Enable Spatializaion(true by default)
 	void setEnabled(bool _enable) {mEnabled = _enable;}
 
+	/// Returns whether rendering can be performed concurrently
+
+	/// A spatializer that only reads its own state from renderBuffer() and
+	/// renderSample() may be called from several threads at once, each with
+	/// its own AudioIOData. Otherwise, a multithreaded AudioScene only reads
+	/// the sources in parallel and spatializes them on the calling thread.
+	virtual bool concurrentRender() const { return false; }
+
 protected:
 	/// Render each source per sample
 	virtual void perform(AudioIOData& io,
@@ -478,12 +644,51 @@ public:
 		mPerSampleProcessing = shouldUsePerSampleProcessing;
 	}
 
+	/// Set number of threads used to render sources (1 by default)
+
+	/// When greater than one, the sources are split into contiguous groups
+	/// which are rendered concurrently by a TaskPool of n threads dedicated to
+	/// the scene, one of which is the thread calling render(). Each thread mixes into its
+	/// own speaker accumulators which are then summed in group order, so the
+	/// output does not depend on thread scheduling.
+	/// This should not be called while render() is running.
+	void numThreads(int n);
+
+	/// Get number of threads used to render sources
+	int numThreads() const { return mNumThreads; }
+
+	/// Set priority of the threads helping render(), in [0, 99]
+
+	/// A value greater than 0 makes the threads "real-time", like the audio
+	/// thread usually is. Returns whether the priority could be set.
+	bool threadPriority(int v);
+
 protected:
+	class RenderPool;
+
 	Listeners mListeners;
 	Sources mSources;
 	int mNumFrames;				// audio frames per block
 	std::vector<float> mBuffer;	// temporary frame buffer
 	bool mPerSampleProcessing;
+
+	// Multithreaded rendering
+	RenderPool * mRenderPool;
+	int mNumThreads;
+	int mThreadPriority;
+	std::vector<SoundSource *> mSourceArray;	// random access copy of mSources
+	std::vector<float> mSourceSamples;	// source samples, when not concurrent
+	std::vector<Pose> mSourcePoses;		// relative poses, when not concurrent
+	Listener * mRenderListener;			// listener currently rendered
+	bool mRenderConcurrent;				// whether spatializer renders in parallel
+
+	void renderSerial(AudioIOData& io);
+	void renderParallel(AudioIOData& io);
+	void renderGroup(AudioIOData& accum, int group, int numGroups);
+
+private:
+	AudioScene(const AudioScene&);
+	AudioScene& operator=(const AudioScene&);
 };
 
 } // al::
@@ -58,13 +58,20 @@ public:
 	/// @param[in] focus	Amplitude focus to nearby speakers
 	Dbap(const SpeakerLayout &sl, float focus = 1.f);
 
-	void compile(Listener& listener);
+	virtual void compile(Listener& listener) override;
 
-	///Per Sample Processing
-	void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample);
+	/// Per Sample Processing
+	virtual void renderSample(AudioIOData& io, const Pose& reldir, const float& sample, const int& frameIndex) override;
 
 	/// Per Buffer Processing
-	void perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, float *samples);
+	virtual void renderBuffer(AudioIOData& io, const Pose& reldir, const float *samples, const int& numFrames) override;
+
+	virtual void initSourceState(SpatializerState& state) const override { mGainMatrix.initState(state.gains); }
+
+	/// Per Buffer Processing, with gains interpolated from the previous block of the source
+	virtual void renderSourceBuffer(AudioIOData& io, SoundSource& src, SpatializerState& state, const Pose& reldir, const float *samples, const int& numFrames) override;
+
+	virtual bool concurrentRender() const override { return true; }
 
 	/// focus is an exponent determining the amplitude focus to nearby speakers.
 
@@ -72,14 +79,19 @@ public:
 	///A denser speaker layout my benefit from a high focus > 1, and a sparse layout may benefit from focus < 1
 	void setFocus(float focus) { mFocus = focus; }
 
-	void print();
+	virtual void print() override;
 
 private:
 	Listener * mListener;
 	Vec3f mSpeakerVecs[DBAP_MAX_NUM_SPEAKERS];
-	int mDeviceChannels[DBAP_MAX_NUM_SPEAKERS];
 	int mNumSpeakers;
 	float mFocus;
+	GainMatrix mGainMatrix;
+
+	void setupSpeakers();
+
+	// Compute speaker gains for a source, returns number of gains
+	int computeGains(const Pose& reldir, float * gains) const;
 };
 
 
@@ -30,6 +30,11 @@ public:
 		mListener = &listener;
 	}
 
+	// When not panning, the output is overwritten rather than mixed
+	virtual bool concurrentRender() const override {
+		return numSpeakers == 2 && mEnabled;
+	}
+
 	///Per Sample Processing
 	virtual void renderSample(AudioIOData& io, const Pose& listeningPose, const float& sample, const int& frameIndex) override
 	{
@@ -91,10 +91,11 @@ public:
 	/// \param assignedOutputs the list of channel indeces for signal reassignment
 	///
 	/// Signals that should go out to phantom channels will be distributed among
-	/// the channels listed in the assignedOutputs vector. This can be useful to
-	/// force triangulation in unusual situations (e.g. three rings on a
-	/// sphere...) but it can also be used creatively to make an area in space
-	/// be reassigned somewhere else, or to a wider number of speakers.
+	/// the channels listed in the assignedOutputs vector with equal power.
+	/// This can be useful to force triangulation in unusual situations (e.g.
+	/// three rings on a sphere...) but it can also be used creatively to make
+	/// an area in space be reassigned somewhere else, or to a wider number of
+	/// speakers.
 	///
 	void makePhantomChannel(int channelIndex, std::vector<int> assignedOutputs);
 
@@ -103,6 +104,15 @@ public:
 	virtual void renderSample(AudioIOData& io, const Pose& reldir, const float& sample, const int& frameIndex) override;
 	virtual void renderBuffer(AudioIOData& io, const Pose& reldir, const float *samples, const int& numFrames) override;
 
+	/// Render sample, starting the triplet search from the source's cached triplet
+	virtual void renderSourceSample(AudioIOData& io, SoundSource& src, const Pose& reldir, const float& sample, const int& frameIndex) override;
+	virtual void initSourceState(SpatializerState& state) const override { mGainMatrix.initState(state.gains); }
+
+	/// Render buffer, starting the triplet search from the source's cached triplet
+	virtual void renderSourceBuffer(AudioIOData& io, SoundSource& src, SpatializerState& state, const Pose& reldir, const float *samples, const int& numFrames) override;
+
+	virtual bool concurrentRender() const override { return true; }
+
 	virtual void print() override;
 
 	/// Manually add a triple from indeces to speakers
@@ -112,11 +122,35 @@ public:
 	//Returns vector of triplets
 	std::vector<SpeakerTriple> triplets() const;
 
+	/// Set whether to use the direction lookup table to find triplets
+
+	/// The table divides the sphere into azimuth/elevation cells and lists
+	/// for every cell the triplets that can contain a direction inside it.
+	/// When disabled, all triplets are searched linearly.
+	/// The table is rebuilt on compile() after adding triplets manually.
+	void useLookupTable(bool v){ mUseLookupTable = v; }
+
+	/// Find the triplet containing a direction
+
+	/// @param[in]  vec		direction in panner coordinates
+	/// @param[in]  hint	triplet to test first, e.g. the last triplet found
+	///						for a source. Ignored if out of range.
+	/// @param[out] gains	unnormalized gains for the triplet found
+	/// \returns index of the first triplet containing the direction or -1
+	int findTriplet(const Vec3d& vec, int hint, Vec3d& gains);
+
 private:
 	std::vector<SpeakerTriple> mTriplets;
 	std::map<int, std::vector<int> > mPhantomChannels;
 	Listener* mListener;
 	bool mIs3D;
+	GainMatrix mGainMatrix;	// speakers to outputs with phantom channels resolved
+
+	// Direction lookup table; cell c lists triplets
+	// mCellTriplets[mCellStarts[c]] ... mCellTriplets[mCellStarts[c+1]-1]
+	std::vector<unsigned> mCellStarts;
+	std::vector<unsigned> mCellTriplets;
+	bool mUseLookupTable;
 
 	//	void setIs3D(bool is3D){mIs3D = is3D;}
 
@@ -130,6 +164,18 @@ private:
 
 	bool isCrossing(Vec3d c, Vec3d li, Vec3d lj, Vec3d ln, Vec3d lm);
 
+	/// Build direction lookup table from current triplets
+	void buildLookupTable();
+
+	int lookupCell(const Vec3d& vec) const;
+
+	bool containsDirection(const Vec3d& gains) const {
+		return (gains[0] >= 0) && (gains[1] >= 0) && (!mIs3D || (gains[2] >= 0));
+	}
+
+	int renderTripletBuffer(AudioIOData& io, const Pose& reldir, const float *samples, const int& numFrames, int hint, GainMatrix::State * state);
+	int renderTripletSample(AudioIOData& io, const Pose& reldir, const float& sample, const int& frameIndex, int hint);
+
 	/// Manually add triplet of speakers, in case not set automatically
 	void addTriple(const SpeakerTriple& st);
 
@@ -204,6 +204,30 @@ public:
 		Results mObjects;
 	};
 
+	/**
+		Results of batched queries
+
+		The results of query i are the first count(i) of the maxResults
+		entries starting at i*maxResults, sorted by increasing distance.
+	*/
+	struct Neighbors {
+		uint32_t maxResults;
+		std::vector<uint32_t> counts;
+		std::vector<uint32_t> ids;
+		std::vector<double> distancesSquared;
+
+		Neighbors() : maxResults(0) {}
+
+		/// get number of queries:
+		uint32_t size() const { return counts.size(); }
+		/// get number of results of a query:
+		uint32_t count(uint32_t i) const { return counts[i]; }
+		/// get object id of each result of a query:
+		uint32_t id(uint32_t i, uint32_t j) const { return ids[i*maxResults + j]; }
+		double distanceSquared(uint32_t i, uint32_t j) const { return distancesSquared[i*maxResults + j]; }
+		double distance(uint32_t i, uint32_t j) const { return sqrt(distanceSquared(i,j)); }
+	};
+
 	/**
 		Construct a HashSpace
 		locations will range from [0..2^resolution)
@@ -241,6 +265,48 @@ public:
 	/// the objectId can be reused later via move()
 	HashSpace& remove(uint32_t objectId);
 
+	/**
+		Replace all objects with one object per position and sort them
+
+		The id of each object is its index in the positions array. Objects
+		are counting sorted by voxel into a contiguous cell-ordered array
+		used by the batched queries below, and linked into their voxels for
+		move() and Query. The work is split into numThreads parts run on
+		the shared TaskPool (0 uses one part per thread of the pool).
+	*/
+	void rebuild(const Vec3d * positions, uint32_t count, int numThreads=0);
+	void rebuild(const Vec3f * positions, uint32_t count, int numThreads=0);
+
+	/// sort the current objects into the cell-ordered array again,
+	/// e.g. after calls to move() or remove()
+	void rebuild(int numThreads=0);
+
+	/**
+		Find the nearest objects to many points at once
+
+		The batched queries search the cell-ordered array built by the
+		last rebuild() and are split into numThreads parts run on the
+		shared TaskPool. Unlike Query, which stops at the first maxResults
+		objects it meets, they return the maxResults nearest objects
+		sorted by distance.
+
+		@param results up to maxResults nearest objects per point
+		@param points points to search around
+		@param count number of points
+		@param maxResults maximum number of objects to find per point
+		@param numThreads number of parts, 0 uses one per thread of the pool
+	*/
+	void queryNearest(Neighbors& results, const Vec3d * points, uint32_t count, uint32_t maxResults, int numThreads=0) const;
+
+	/// find the nearest other objects to every object
+	void queryNearest(Neighbors& results, uint32_t maxResults, int numThreads=0) const;
+
+	/// find up to maxResults nearest objects within a radius of many points at once
+	void queryRadius(Neighbors& results, const Vec3d * points, uint32_t count, double radius, uint32_t maxResults, int numThreads=0) const;
+
+	/// find up to maxResults nearest other objects within a radius of every object
+	void queryRadius(Neighbors& results, double radius, uint32_t maxResults, int numThreads=0) const;
+
 	/// wrap an absolute position within the space:
 	double wrap(double x) const { return wrap(x, dim()); }
 	template<typename T>
@@ -316,6 +382,18 @@ protected:
 	/// a baked array mapping distance to mVoxelIndices offsets
 	std::vector<uint32_t> mDistanceToVoxelIndices;
 	std::vector<uint32_t> mVoxelIndicesToDistance;
+
+	/// objects sorted by voxel for batched queries:
+	/// voxel v holds mSortedIds[mCellStart[v] .. mCellStart[v+1])
+	std::vector<uint32_t> mCellStart;
+	std::vector<uint32_t> mSortedIds;
+	std::vector<Vec3d> mSortedPos;
+	std::vector<uint32_t> mCellCounts;	// per-thread counting sort scratch
+
+	template<typename T>
+	void rebuildFrom(const Vec<3,T> * positions, uint32_t count, int numThreads);
+	void sortObjects(int numThreads, bool relink);
+	void query(Neighbors& results, const Vec3d * points, uint32_t count, double radius, uint32_t maxResults, int numThreads) const;
 };
 
 
@@ -0,0 +1,195 @@
+#ifndef INCLUDE_AL_TASK_POOL_HPP
+#define INCLUDE_AL_TASK_POOL_HPP
+
+/*	Allocore --
+	Multimedia / virtual environment application class library
+
+	Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology, UCSB.
+	Copyright (C) 2012. The Regents of the University of California.
+	All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+		Redistributions of source code must retain the above copyright notice,
+		this list of conditions and the following disclaimer.
+
+		Redistributions in binary form must reproduce the above copyright
+		notice, this list of conditions and the following disclaimer in the
+		documentation and/or other materials provided with the distribution.
+
+		Neither the name of the University of California nor the names of its
+		contributors may be used to endorse or promote products derived from
+		this software without specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+
+
+	File description:
+	Persistent pool of worker threads running tasks and parallel loops
+*/
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace al{
+
+/// Persistent pool of worker threads
+
+/// Worker threads are created once and sleep while there is no work, so
+/// handing out tasks costs far less than starting threads. Each worker has its
+/// own queue of tasks; it runs its newest tasks first and, when its queue is
+/// empty, steals the oldest tasks of the other queues. Threads waiting on
+/// tasks of the pool (in parallelFor or TaskGroup::wait) run queued tasks
+/// instead of blocking, so loops and groups may be nested.
+///
+/// @ingroup allocore
+class TaskPool{
+public:
+
+	/// Unit of work
+	typedef std::function<void()> Task;
+
+	/// @param[in] numThreads	number of threads running tasks, counting the
+	///							thread waiting on them. If 0, the number of
+	///							hardware threads is used.
+	TaskPool(int numThreads = 0);
+
+	~TaskPool();
+
+
+	/// Get number of threads running tasks, counting the waiting thread
+	int size() const { return mWorkers.size() + 1; }
+
+	/// Set priority of worker threads
+
+	/// @param[in] v	priority of threads in [0, 99]. A value greater than 0
+	///					makes the threads "real-time".
+	/// \returns whether the priority could be set on all workers
+	bool priority(int v);
+
+	/// Pin each worker thread to its own CPU
+
+	/// Worker i runs on CPU firstCPU + i + 1 (modulo the number of CPUs), as
+	/// the thread waiting on the workers is expected to run on firstCPU.
+	/// \returns whether all workers could be pinned
+	bool pin(int firstCPU = 0);
+
+
+	/// Queue a task to be run by any thread of the pool
+
+	/// A pool without worker threads runs the task right away.
+	///
+	void submit(const Task& task);
+
+	/// Run one queued task on the calling thread
+
+	/// \returns whether a task was run
+	///
+	bool runOne();
+
+	/// Call func(begin, end) on sub-ranges of [begin, end) across the pool
+
+	/// The range is split into at most a few chunks per thread, each holding
+	/// about grain indices or more. Chunks are handed out dynamically, so uneven
+	/// work balances out. A range of a single chunk is run on the calling
+	/// thread. Returns once all chunks have been processed.
+	void parallelFor(int begin, int end, int grain,
+		const std::function<void(int begin, int end)>& func);
+
+	/// Call func(i) for i in [0, n) across the pool, each on its own task
+	void parallelFor(int n, const std::function<void(int i)>& func){
+		parallelFor(0, n, 1, [&func](int b, int e){ for(int i=b; i<e; ++i) func(i); });
+	}
+
+
+	/// Get shared pool with one thread per hardware thread
+	static TaskPool& global();
+
+private:
+	struct Queue;
+	struct Worker;
+
+	std::vector<Worker *> mWorkers;
+	std::vector<Queue *> mQueues;	// one per worker, the last for other threads
+	std::atomic<int> mQueued;		// tasks in all queues
+	std::atomic<int> mSleeping;		// workers waiting on mWake
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	bool mQuit;
+
+	bool pop(int queue, Task& task);
+	bool steal(int thief, Task& task);
+	void workerLoop(int index);
+	int queueIndex() const;
+
+	TaskPool(const TaskPool&);
+	TaskPool& operator=(const TaskPool&);
+};
+
+
+
+/// Set of tasks that can be waited on as a whole
+
+/// Tasks added with run() are queued on the pool right away. A continuation
+/// set with then() is queued once all tasks of the group have finished,
+/// including tasks added by other tasks of the group. The destructor waits for
+/// the group to finish.
+///
+/// @ingroup allocore
+class TaskGroup{
+public:
+	typedef TaskPool::Task Task;
+
+	/// @param[in] pool		pool running the tasks
+	TaskGroup(TaskPool& pool = TaskPool::global());
+
+	~TaskGroup(){ wait(); }
+
+	/// Add a task to the group
+	TaskGroup& run(const Task& task);
+
+	/// Set a task to run after all tasks of the group have finished
+
+	/// If the group has already finished, the continuation is queued right
+	/// away. wait() also waits for the continuation.
+	TaskGroup& then(const Task& task);
+
+	/// Whether all tasks of the group, and its continuation, have finished
+	bool done() const { return mPending.load(std::memory_order_acquire) == 0; }
+
+	/// Wait for all tasks and the continuation to finish
+
+	/// The calling thread runs queued tasks of the pool while waiting.
+	///
+	void wait();
+
+private:
+	TaskPool& mPool;
+	std::atomic<int> mPending;
+	std::mutex mMutex;
+	Task mContinuation;
+
+	void finish();
+
+	TaskGroup(const TaskGroup&);
+	TaskGroup& operator=(const TaskGroup&);
+};
+
+} // al::
+
+#endif
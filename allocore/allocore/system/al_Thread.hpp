@@ -140,6 +140,10 @@ protected:
 
 
 /// Multiple threads acting as a single work unit
+
+/// The threads are created on every call to start(). Work split up
+/// repeatedly, e.g. every frame, is better run on a TaskPool whose threads
+/// persist between calls.
 ///
 /// @ingroup allocore
 template <class ThreadFunction>
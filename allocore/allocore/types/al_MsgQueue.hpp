@@ -43,41 +43,28 @@
 */
 
 #include <string.h>
+#include <atomic>
 #include <list>
+#include <vector>
 
 #include "allocore/system/al_Config.h"
 
 namespace al {
 
 ///
-/// \brief The MsgQueue class
+/// \brief Typed send() wrappers for the message queues
+///
+/// The wrappers pack a function and its arguments and pass them to the
+/// sched() method of Queue, returning its Result.
 ///
 /// @ingroup allocore
-class MsgQueue {
+template <class Queue, class Result = void>
+class MsgSender {
 public:
 
-	typedef void (*msg_func)(al_sec t, char * args);
-	typedef void * (*malloc_func)(size_t size);
-	typedef void (*free_func)(void * ptr);
-
-	MsgQueue(int size = 128, malloc_func mfunc = NULL, free_func ffunc = NULL);
-	~MsgQueue();
-
-	// for truly accurate scheduling, always use this as logical time:
-	al_sec now() const { return mNow; }
-
-	// trigger registered callbacks
-	void update(al_sec until, bool defer = false);
-	void advance(al_sec period, bool defer = false) { update(mNow + period, defer); }
-
-	void clear();
-
-	// how many messages are scheduled?
-	int len() const { return mLen; }
-
 	// template wrappers for multi-argument functions
 	// be sure to cast the send arguments to exactly match the function argument types!
-	void send(al_sec at, void (*f)(al_sec t)) {
+	Result send(al_sec at, void (*f)(al_sec t)) {
 		struct Data {
 			void (*f)(al_sec t);
 			static void call(al_sec t, char * args) {
@@ -86,11 +73,11 @@ public:
 			}
 		};
 		Data data = { f };
-		sched(at, &Data::call, (char *)(&data), sizeof(Data));
+		return queue().sched(at, &Data::call, (char *)(&data), sizeof(Data));
 	}
 
 	template<typename A1>
-	void send(al_sec at, void (*f)(al_sec t, A1 a1), A1 a1) {
+	Result send(al_sec at, void (*f)(al_sec t, A1 a1), A1 a1) {
 		struct Data {
 			void (*f)(al_sec t, A1 a1);
 			A1 a1;
@@ -100,11 +87,11 @@ public:
 			}
 		};
 		Data data = { f, a1 };
-		sched(at, &Data::call, (char *)(&data), sizeof(Data));
+		return queue().sched(at, &Data::call, (char *)(&data), sizeof(Data));
 	}
 
 	template<typename A1, typename A2>
-	void send(al_sec at, void (*f)(al_sec t, A1 a1, A2 a2), A1 a1, A2 a2) {
+	Result send(al_sec at, void (*f)(al_sec t, A1 a1, A2 a2), A1 a1, A2 a2) {
 		struct Data {
 			void (*f)(al_sec t, A1 a1, A2 a2);
 			A1 a1; A2 a2;
@@ -114,11 +101,11 @@ public:
 			}
 		};
 		Data data = { f, a1, a2 };
-		sched(at, &Data::call, (char *)(&data), sizeof(Data));
+		return queue().sched(at, &Data::call, (char *)(&data), sizeof(Data));
 	}
 
 	template<typename A1, typename A2, typename A3>
-	void send(al_sec at, void (*f)(al_sec t, A1 a1, A2 a2, A3 a3), A1 a1, A2 a2, A3 a3) {
+	Result send(al_sec at, void (*f)(al_sec t, A1 a1, A2 a2, A3 a3), A1 a1, A2 a2, A3 a3) {
 		struct Data {
 			void (*f)(al_sec t, A1 a1, A2 a2, A3 a3);
 			A1 a1; A2 a2; A3 a3;
@@ -128,11 +115,11 @@ public:
 			}
 		};
 		Data data = { f, a1, a2, a3 };
-		sched(at, &Data::call, (char *)(&data), sizeof(Data));
+		return queue().sched(at, &Data::call, (char *)(&data), sizeof(Data));
 	}
 
 	template<typename A1, typename A2, typename A3, typename A4>
-	void send(al_sec at, void (*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4 ), A1 a1, A2 a2, A3 a3, A4 a4 ) {
+	Result send(al_sec at, void (*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4 ), A1 a1, A2 a2, A3 a3, A4 a4 ) {
 		struct Data {
 			void (*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4 );
 			A1 a1; A2 a2; A3 a3; A4 a4;
@@ -142,11 +129,11 @@ public:
 			}
 		};
 		Data data = { f, a1, a2, a3, a4 };
-		sched(at, &Data::call, (char *)(&data), sizeof(Data));
+		return queue().sched(at, &Data::call, (char *)(&data), sizeof(Data));
 	}
 
 	template<typename A1, typename A2, typename A3, typename A4, typename A5>
-	void send(al_sec at, void (*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5), A1 a1, A2 a2, A3 a3, A4 a4, A5 a5) {
+	Result send(al_sec at, void (*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5), A1 a1, A2 a2, A3 a3, A4 a4, A5 a5) {
 		struct Data {
 			void (*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5);
 			A1 a1; A2 a2; A3 a3; A4 a4; A5 a5;
@@ -156,11 +143,11 @@ public:
 			}
 		};
 		Data data = { f, a1, a2, a3, a4, a5 };
-		sched(at, &Data::call, (char *)(&data), sizeof(Data));
+		return queue().sched(at, &Data::call, (char *)(&data), sizeof(Data));
 	}
 
 	template<typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-	void send(al_sec at, void (*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6), A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6) {
+	Result send(al_sec at, void (*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6), A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6) {
 		struct Data {
 			void (*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6);
 			A1 a1; A2 a2; A3 a3; A4 a4; A5 a5; A6 a6;
@@ -170,14 +157,14 @@ public:
 			}
 		};
 		Data data = { f, a1, a2, a3, a4, a5, a6 };
-		sched(at, &Data::call, (char *)(&data), sizeof(Data));
+		return queue().sched(at, &Data::call, (char *)(&data), sizeof(Data));
 	}
 
 	/*
 		Equivalents for object->method calls:
 	*/
 	template<typename T>
-	void send(al_sec at, T * self, void (T::*f)(al_sec t)) {
+	Result send(al_sec at, T * self, void (T::*f)(al_sec t)) {
 		struct Data {
 			T * self;
 			void (T::*f)(al_sec t);
@@ -187,11 +174,11 @@ public:
 			}
 		};
 		Data data = { self, f };
-		sched(at, &Data::call, (char *)(&data), sizeof(Data));
+		return queue().sched(at, &Data::call, (char *)(&data), sizeof(Data));
 	}
 
 	template<typename T, typename A1>
-	void send(al_sec at, T * self, void (T::*f)(al_sec t, A1 a1), A1 a1) {
+	Result send(al_sec at, T * self, void (T::*f)(al_sec t, A1 a1), A1 a1) {
 		struct Data {
 			T * self;
 			void (T::*f)(al_sec t, A1 a1);
@@ -202,11 +189,11 @@ public:
 			}
 		};
 		Data data = { self, f, a1 };
-		sched(at, &Data::call, (char *)(&data), sizeof(Data));
+		return queue().sched(at, &Data::call, (char *)(&data), sizeof(Data));
 	}
 
 	template<typename T, typename A1, typename A2>
-	void send(al_sec at, T * self, void (T::*f)(al_sec t, A1 a1, A2 a2), A1 a1, A2 a2) {
+	Result send(al_sec at, T * self, void (T::*f)(al_sec t, A1 a1, A2 a2), A1 a1, A2 a2) {
 		struct Data {
 			T * self;
 			void (T::*f)(al_sec t, A1 a1, A2 a2);
@@ -217,11 +204,11 @@ public:
 			}
 		};
 		Data data = { self, f, a1, a2 };
-		sched(at, &Data::call, (char *)(&data), sizeof(Data));
+		return queue().sched(at, &Data::call, (char *)(&data), sizeof(Data));
 	}
 
 	template<typename T, typename A1, typename A2, typename A3>
-	void send(al_sec at, T * self, void (T::*f)(al_sec t, A1 a1, A2 a2, A3 a3), A1 a1, A2 a2, A3 a3) {
+	Result send(al_sec at, T * self, void (T::*f)(al_sec t, A1 a1, A2 a2, A3 a3), A1 a1, A2 a2, A3 a3) {
 		struct Data {
 			T * self;
 			void (T::*f)(al_sec t, A1 a1, A2 a2, A3 a3);
@@ -232,11 +219,11 @@ public:
 			}
 		};
 		Data data = { self, f, a1, a2, a3 };
-		sched(at, &Data::call, (char *)(&data), sizeof(Data));
+		return queue().sched(at, &Data::call, (char *)(&data), sizeof(Data));
 	}
 
 	template<typename T, typename A1, typename A2, typename A3, typename A4>
-	void send(al_sec at, T * self, void (T::*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4 ), A1 a1, A2 a2, A3 a3, A4 a4 ) {
+	Result send(al_sec at, T * self, void (T::*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4 ), A1 a1, A2 a2, A3 a3, A4 a4 ) {
 		struct Data {
 			T * self;
 			void (T::*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4 );
@@ -247,11 +234,11 @@ public:
 			}
 		};
 		Data data = { self, f, a1, a2, a3, a4 };
-		sched(at, &Data::call, (char *)(&data), sizeof(Data));
+		return queue().sched(at, &Data::call, (char *)(&data), sizeof(Data));
 	}
 
 	template<typename T, typename A1, typename A2, typename A3, typename A4, typename A5>
-	void send(al_sec at, T * self, void (T::*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5), A1 a1, A2 a2, A3 a3, A4 a4, A5 a5) {
+	Result send(al_sec at, T * self, void (T::*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5), A1 a1, A2 a2, A3 a3, A4 a4, A5 a5) {
 		struct Data {
 			T * self;
 			void (T::*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5);
@@ -262,11 +249,11 @@ public:
 			}
 		};
 		Data data = { self, f, a1, a2, a3, a4, a5 };
-		sched(at, &Data::call, (char *)(&data), sizeof(Data));
+		return queue().sched(at, &Data::call, (char *)(&data), sizeof(Data));
 	}
 
 	template<typename T, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-	void send(al_sec at, T * self, void (T::*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6), A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6) {
+	Result send(al_sec at, T * self, void (T::*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6), A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6) {
 		struct Data {
 			T * self;
 			void (T::*f)(al_sec t, A1 a1, A2 a2, A3 a3, A4 a4, A5 a5, A6 a6);
@@ -277,9 +264,40 @@ public:
 			}
 		};
 		Data data = { self, f, a1, a2, a3, a4, a5, a6 };
-		sched(at, &Data::call, (char *)(&data), sizeof(Data));
+		return queue().sched(at, &Data::call, (char *)(&data), sizeof(Data));
 	}
 
+private:
+	Queue& queue(){ return *static_cast<Queue *>(this); }
+};
+
+
+
+///
+/// \brief The MsgQueue class
+///
+/// @ingroup allocore
+class MsgQueue : public MsgSender<MsgQueue> {
+public:
+
+	typedef void (*msg_func)(al_sec t, char * args);
+	typedef void * (*malloc_func)(size_t size);
+	typedef void (*free_func)(void * ptr);
+
+	MsgQueue(int size = 128, malloc_func mfunc = NULL, free_func ffunc = NULL);
+	~MsgQueue();
+
+	// for truly accurate scheduling, always use this as logical time:
+	al_sec now() const { return mNow; }
+
+	// trigger registered callbacks
+	void update(al_sec until, bool defer = false);
+	void advance(al_sec period, bool defer = false) { update(mNow + period, defer); }
+
+	void clear();
+
+	// how many messages are scheduled?
+	int len() const { return mLen; }
 
 	// generic method to schedule a callback
 	void sched(al_sec at, msg_func func, char * data, size_t size);
@@ -313,6 +331,97 @@ protected:
 };
 
 
+
+///
+/// \brief Message queue accepting messages from many threads
+///
+/// Like MsgQueue, this calls scheduled functions in time order from update(),
+/// but messages can be sent from any number of threads at once without
+/// locks. Messages are stored in a slab of cells allocated on construction,
+/// so neither sending nor update() allocates memory or blocks, making it
+/// safe to schedule events into an audio thread.
+///
+/// Messages with the same time are called in the order they were received
+/// and messages sent from a callback are called from the next update(). If
+/// the slab is full or the arguments are larger than MAX_ARGS_SIZE, send()
+/// and sched() return false and the message is dropped.
+///
+/// update(), clear(), now() and len() must only be called from a single
+/// consumer thread.
+///
+/// @ingroup allocore
+class ConcurrentMsgQueue : public MsgSender<ConcurrentMsgQueue, bool> {
+public:
+
+	typedef void (*msg_func)(al_sec t, char * args);
+
+	enum { MAX_ARGS_SIZE = 88 };
+
+	/// @param[in] size		maximum number of pending messages
+	ConcurrentMsgQueue(int size = 1024);
+
+	/// Get logical time of messages being called
+	al_sec now() const { return mNow; }
+
+	/// Call all messages scheduled up to time until (consumer thread)
+	void update(al_sec until);
+	void advance(al_sec period) { update(mNow + period); }
+
+	/// Drop all pending messages and reset clock (consumer thread)
+	void clear();
+
+	/// Returns number of messages received by the consumer and not yet called
+	int len() const { return mHeapSize; }
+
+	/// Returns maximum number of pending messages
+	int size() const { return mCells.size(); }
+
+	/// Schedule a callback (any thread)
+
+	/// \returns whether the message was scheduled
+	bool sched(al_sec at, msg_func func, char * data, size_t size);
+
+protected:
+
+	static const uint32_t NIL = 0xffffffff;
+
+	struct Cell {
+		std::atomic<uint32_t> next;
+		uint64_t seq;				// order of arrival, for equal times
+		al_sec t;
+		msg_func func;
+		char args[MAX_ARGS_SIZE];
+	};
+
+	std::vector<Cell> mCells;
+
+	// Free cells; index in low bits and a tag in high bits to avoid ABA
+	std::atomic<uint64_t> mFree;
+	char mPad0[64];
+
+	// Sent cells, most recent first
+	std::atomic<uint32_t> mInbox;
+	char mPad1[64];
+
+	// Consumer state: binary min heap of received cells
+	std::vector<uint32_t> mHeap;
+	int mHeapSize;
+	uint64_t mSeq;
+	al_sec mNow;
+
+	uint32_t popFree();
+	void pushFree(uint32_t i);
+	void receive();
+	bool before(uint32_t a, uint32_t b) const;
+	void heapPush(uint32_t i);
+	uint32_t heapPop();
+
+private:
+	ConcurrentMsgQueue(const ConcurrentMsgQueue&);
+	ConcurrentMsgQueue& operator=(const ConcurrentMsgQueue&);
+};
+
+
 } // al::
 
 #endif // include guard
@@ -42,6 +42,7 @@
 	Graham Wakefield, 2010, grrrwaaa@gmail.com
 */
 
+#include <atomic>
 #include <cstring>
 
 #include "allocore/system/pstdint.h"
@@ -53,12 +54,40 @@ namespace al {
  * a reader, one a writer. There is no locking in this ring buffer,
  * so it is ideal to pass data to and from a high priority thread
  * like an audio thread.
+ *
+ * The read and write positions are atomic: the writer publishes data with
+ * release semantics and the reader acquires it (and vice versa for freed
+ * space). Each position lives on its own cache line together with the last
+ * value of the other position seen by its thread, so the two threads only
+ * share a cache line when one runs out of data or space.
+ *
+ * Besides copying with write() and read(), data can be accessed in place:
+ * prepareWrite() and peekRead() return a Span of up to two contiguous
+ * regions of the buffer, made visible to the other thread with
+ * commitWrite() and commitRead().
  */
 
 /// @ingroup allocore
 class SingleRWRingBuffer {
 public:
 
+	/// A region of the buffer, split in two when it wraps around the end
+	struct Span {
+		char * data1;	///< First contiguous region
+		size_t size1;	///< Size of first region, in bytes
+		char * data2;	///< Second region, at the start of the buffer
+		size_t size2;	///< Size of second region, in bytes
+
+		/// Total size, in bytes
+		size_t size() const { return size1 + size2; }
+
+		/// Copy bytes from src into the span; sz must not exceed size()
+		void copyFrom(const char * src, size_t sz) const;
+
+		/// Copy bytes from the span into dst; sz must not exceed size()
+		void copyTo(char * dst, size_t sz) const;
+	};
+
     /** Allocate ringbuffer.
         Actual size rounded up to next power of 2. */
 	SingleRWRingBuffer(size_t sz=256);
@@ -90,18 +119,72 @@ public:
 	*/
 	size_t peek(char * dst, size_t sz);
 
-    /** Clear any data in the ringbuffer
+    /** Get space to write up to sz bytes in place (writer thread only).
+        The span may be smaller than sz if the buffer is full.
+        Data written is not visible to the reader until commitWrite().
+	*/
+	Span prepareWrite(size_t sz);
+
+    /** Make sz bytes from the last prepareWrite() visible to the reader.
+	*/
+	void commitWrite(size_t sz);
+
+    /** Get up to sz bytes of data in place (reader thread only).
+        The data remains in the buffer until commitRead().
+	*/
+	Span peekRead(size_t sz);
+
+    /** Release sz bytes from the last peekRead() back to the writer.
+	*/
+	void commitRead(size_t sz);
+
+    /** Clear any data in the ringbuffer (reader thread only)
 	*/
     void clear()
     {
-        mRead = mWrite;
+        mReaderWrite = mWrite.load(std::memory_order_acquire);
+        mRead.store(mReaderWrite, std::memory_order_release);
     }
 
 protected:
 
+	// Full lines of padding keep the fields of each thread on their own
+	// cache lines whatever the alignment of the buffer
+	enum { CACHE_LINE_SIZE = 64 };
+
 	size_t mSize, mWrap;
-	size_t mRead, mWrite;
 	char * mData;
+	char mPad0[CACHE_LINE_SIZE];
+
+	// Reader thread
+	std::atomic<size_t> mRead;
+	size_t mReaderWrite;		// last write position seen by reader
+	char mPad1[CACHE_LINE_SIZE];
+
+	// Writer thread
+	std::atomic<size_t> mWrite;
+	size_t mWriterRead;			// last read position seen by writer
+	char mPad2[CACHE_LINE_SIZE];
+
+	Span span(size_t pos, size_t sz) const {
+		size_t end = pos + sz;
+		if (end <= mSize) {
+			return { mData+pos, sz, mData, 0 };
+		}
+		return { mData+pos, mSize-pos, mData, end-mSize };
+	}
+
+	size_t writeSpace(size_t r, size_t w) const {
+		return (mWrap + r - w) & mWrap;
+	}
+
+	size_t readSpace(size_t r, size_t w) const {
+		return (mSize + (w - r)) & mWrap;
+	}
+
+private:
+	SingleRWRingBuffer(const SingleRWRingBuffer&);
+	SingleRWRingBuffer& operator=(const SingleRWRingBuffer&);
 };
 
 
@@ -115,11 +198,31 @@ inline uint32_t next_power_of_two(uint32_t v){
 	return v+1;
 }
 
+inline void SingleRWRingBuffer::Span :: copyFrom(const char * src, size_t sz) const {
+	if (sz <= size1) {
+		memcpy(data1, src, sz);
+	} else {
+		memcpy(data1, src, size1);
+		memcpy(data2, src+size1, sz-size1);
+	}
+}
+
+inline void SingleRWRingBuffer::Span :: copyTo(char * dst, size_t sz) const {
+	if (sz <= size1) {
+		memcpy(dst, data1, sz);
+	} else {
+		memcpy(dst, data1, size1);
+		memcpy(dst+size1, data2, sz-size1);
+	}
+}
+
 inline SingleRWRingBuffer :: SingleRWRingBuffer(size_t sz)
 :	mSize(next_power_of_two(sz)),
 	mWrap(mSize-1),
 	mRead(0),
-	mWrite(0)
+	mReaderWrite(0),
+	mWrite(0),
+	mWriterRead(0)
 {
 	mData = new char[mSize];
 }
@@ -129,76 +232,72 @@ inline SingleRWRingBuffer :: ~SingleRWRingBuffer() {
 }
 
 inline size_t SingleRWRingBuffer :: writeSpace() const {
-	const size_t r = mRead;
-	const size_t w = mWrite;
-	if (r==w) return mWrap;
-	return ((mSize + (r - w)) & mWrap) - 1;
+	const size_t r = mRead.load(std::memory_order_acquire);
+	const size_t w = mWrite.load(std::memory_order_acquire);
+	return writeSpace(r, w);
 }
 
 inline size_t SingleRWRingBuffer :: readSpace() const {
-	const size_t r = mRead;
-	const size_t w = mWrite;
-	return (mSize + (w - r)) & mWrap;
+	const size_t r = mRead.load(std::memory_order_acquire);
+	const size_t w = mWrite.load(std::memory_order_acquire);
+	return readSpace(r, w);
 }
 
-inline size_t SingleRWRingBuffer :: write(const char * src, size_t sz) {
-	size_t space = writeSpace();
-	sz = sz > space ? space : sz;
-	if (sz == 0) return 0;
+inline SingleRWRingBuffer::Span SingleRWRingBuffer :: prepareWrite(size_t sz) {
+	const size_t w = mWrite.load(std::memory_order_relaxed);
+	size_t space = writeSpace(mWriterRead, w);
+	if (space < sz) {
+		// Only look at the reader's position when running out of space
+		mWriterRead = mRead.load(std::memory_order_acquire);
+		space = writeSpace(mWriterRead, w);
+	}
+	return span(w, sz > space ? space : sz);
+}
 
-	size_t w = mWrite;
-	size_t end = w + sz;
+inline void SingleRWRingBuffer :: commitWrite(size_t sz) {
+	const size_t w = mWrite.load(std::memory_order_relaxed);
+	mWrite.store((w + sz) & mWrap, std::memory_order_release);
+}
 
-	if (end < mSize) {
-		memcpy(mData+w, src, sz);
-	} else {
-		size_t split = mSize-w;
-		end &= mWrap;
-		memcpy(mData+w, src, split);
-		memcpy(mData, src+split, end);
+inline SingleRWRingBuffer::Span SingleRWRingBuffer :: peekRead(size_t sz) {
+	const size_t r = mRead.load(std::memory_order_relaxed);
+	size_t space = readSpace(r, mReaderWrite);
+	if (space < sz) {
+		// Only look at the writer's position when running out of data
+		mReaderWrite = mWrite.load(std::memory_order_acquire);
+		space = readSpace(r, mReaderWrite);
 	}
+	return span(r, sz > space ? space : sz);
+}
+
+inline void SingleRWRingBuffer :: commitRead(size_t sz) {
+	const size_t r = mRead.load(std::memory_order_relaxed);
+	mRead.store((r + sz) & mWrap, std::memory_order_release);
+}
 
-	mWrite = end;
+inline size_t SingleRWRingBuffer :: write(const char * src, size_t sz) {
+	Span s = prepareWrite(sz);
+	sz = s.size();
+	if (sz == 0) return 0;
+	s.copyFrom(src, sz);
+	commitWrite(sz);
 	return sz;
 }
 
 inline size_t SingleRWRingBuffer :: read(char * dst, size_t sz) {
-	size_t space = readSpace();
-	sz = sz > space ? space : sz;
+	Span s = peekRead(sz);
+	sz = s.size();
 	if (sz == 0) return 0;
-
-	size_t r = mRead;
-	size_t end = r + sz;
-
-	if (end < mSize) {
-		memcpy(dst, mData+r, sz);
-	} else {
-		size_t split = mSize-r;
-		end &= mWrap;
-		memcpy(dst, mData+r, split);
-		memcpy(dst+split, mData, end);
-	}
-
-	mRead = end;
+	s.copyTo(dst, sz);
+	commitRead(sz);
 	return sz;
 }
 
 inline size_t SingleRWRingBuffer :: peek(char * dst, size_t sz) {
-	size_t space = readSpace();
-	sz = sz > space ? space : sz;
+	Span s = peekRead(sz);
+	sz = s.size();
 	if (sz == 0) return 0;
-
-	size_t r = mRead;
-	size_t end = r + sz;
-
-	if (end < mSize) {
-		memcpy(dst, mData+r, sz);
-	} else {
-		size_t split = mSize-r;
-		end &= mWrap;
-		memcpy(dst, mData+r, split);
-		memcpy(dst+split, mData, end);
-	}
+	s.copyTo(dst, sz);
     return sz;
 }
 
@@ -42,9 +42,14 @@
 */
 
 #include <string>
+#include <map>
 #include <mutex>
+#include <unordered_map>
 #include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <vector>
 #include <float.h>
 
 #include "allocore/protocol/al_OSC.hpp"
@@ -96,6 +101,99 @@ protected:
 private:
 };
 
+/**
+ * @brief Whether a parameter type is stored without locks
+ *
+ * Types listed here are copied as a sequence of 32-bit words by
+ * ParameterValue, so they must be trivially copyable.
+ */
+template <class T> struct ParameterLockFree { enum { value = false }; };
+template <> struct ParameterLockFree<float> { enum { value = true }; };
+template <int N> struct ParameterLockFree<Vec<N,float> > { enum { value = true }; };
+
+/**
+ * @brief Storage for a parameter value shared between threads
+ *
+ * Types marked in ParameterLockFree are kept in two copies guarded by a
+ * sequence number. A writer makes the number odd, updates the first copy,
+ * makes the number even and updates the second copy. A reader copies the
+ * copy selected by the number and retries only if the number changed in the
+ * meantime, i.e. if a writer made progress. So load() never waits for a
+ * writer, even one that was preempted in the middle of a store, and never
+ * returns a value with parts of two different stores. Writers are
+ * serialized with a mutex.
+ *
+ * Other types (e.g. std::string) are protected by the mutex; load() returns
+ * a cached copy if a writer holds it.
+ */
+template <class T, bool LockFree = ParameterLockFree<T>::value>
+class ParameterValue {
+public:
+	ParameterValue(){}
+
+	void store(const T& value){
+		std::lock_guard<std::mutex> lock(mMutex);
+		mValue = value;
+	}
+
+	T load() const {
+		if (mMutex.try_lock()) {
+			mValueCache = mValue;
+			mMutex.unlock();
+		}
+		return mValueCache;
+	}
+
+private:
+	mutable std::mutex mMutex;
+	T mValue;
+	mutable T mValueCache;
+};
+
+template <class T>
+class ParameterValue<T, true> {
+public:
+	ParameterValue(): mSeq(0){
+		for(int i=0; i<WORDS; ++i){ mWords[0][i] = 0; mWords[1][i] = 0; }
+	}
+
+	void store(const T& value){
+		uint32_t words[WORDS] = {0};
+		memcpy(words, &value, sizeof(T));
+		std::lock_guard<std::mutex> lock(mWriteLock);
+		unsigned seq = mSeq.load(std::memory_order_relaxed);
+		// Readers use the second copy while the first one is updated
+		mSeq.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for(int i=0; i<WORDS; ++i) mWords[0][i].store(words[i], std::memory_order_relaxed);
+		// and the first one while the second one is updated
+		mSeq.store(seq + 2, std::memory_order_release);
+		std::atomic_thread_fence(std::memory_order_release);
+		for(int i=0; i<WORDS; ++i) mWords[1][i].store(words[i], std::memory_order_relaxed);
+	}
+
+	T load() const {
+		uint32_t words[WORDS];
+		unsigned seq, seq2;
+		do {
+			seq = mSeq.load(std::memory_order_acquire);
+			const std::atomic<uint32_t> * src = mWords[seq & 1];
+			for(int i=0; i<WORDS; ++i) words[i] = src[i].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			seq2 = mSeq.load(std::memory_order_relaxed);
+		} while(seq != seq2);
+		T value;
+		memcpy(&value, words, sizeof(T));
+		return value;
+	}
+
+private:
+	enum { WORDS = (sizeof(T) + 3) / 4 };
+	std::atomic<unsigned> mSeq;
+	std::atomic<uint32_t> mWords[2][WORDS];
+	std::mutex mWriteLock;
+};
+
 template<class ParameterType>
 class ParameterWrapper{
 public:
@@ -109,9 +207,11 @@ public:
    * @param min Minimum value for the parameter
    * @param max Maximum value for the parameter
    *
-   * The mechanism used to protect data is locking a mutex within the set() function
-   * and doing try_lock() on the mutex to update a cached value in the get()
-   * function. In the worst case this might incur some jitter when reading the value.
+   * The value is kept in a ParameterValue. For float, Vec3f and Vec4f, get()
+   * never blocks and never returns a partially written value, so it can be
+   * called from the audio thread. For other types, set() locks a mutex and
+   * get() does try_lock() on it to update a cached value, which in the worst
+   * case might incur some jitter when reading the value.
    */
 	ParameterWrapper(std::string parameterName, std::string group,
 	          ParameterType defaultValue,
@@ -146,13 +246,11 @@ public:
 	virtual void setNoCalls(ParameterType value, void *blockReceiver = NULL);
 
 	/**
-	 * @brief set the parameter's value forcing a lock
+	 * @brief store the parameter's value without clamping or calling callbacks
 	 */
 	inline void setLocking(ParameterType value)
 	{
-		mMutex.lock();
-		mValue = value;
-		mMutex.unlock();
+		mValue.store(value);
 	}
 
 	/**
@@ -260,18 +358,16 @@ protected:
 	std::vector<void *> mCallbackUdata;
 
 private:
-	std::mutex mMutex;
-	ParameterType mValue;
-	ParameterType mValueCache;
+	ParameterValue<ParameterType> mValue;
 };
 
 
 /**
  * @brief The Parameter class
  *
- * The Parameter class offers a simple way to encapsulate float values. It is
- * not inherently thread safe, but since floats are atomic on most platforms
- * it is safe in practice.
+ * The Parameter class offers a simple way to encapsulate float values. The
+ * value is stored in an atomic float, so it can be set and read from any
+ * thread without locking.
  *
  * Parameters are created with:
  * @code
@@ -312,8 +408,8 @@ public:
    * @param max Maximum value for the parameter
    *
    * This Parameter class is designed for parameters that can be expressed as a
-   * single float. It realies on float being atomic on the platform so there
-   * is no locking. This is a safe assumption for most platforms today.
+   * single float. The value is stored in an atomic float so there is no
+   * locking.
    */
 	Parameter(std::string parameterName, std::string Group,
 	          float defaultValue,
@@ -325,7 +421,7 @@ public:
 	Parameter(const al::Parameter& param) :
 	    ParameterWrapper<float>(param)
 	{
-		mFloatValue = param.mFloatValue;
+		mFloatValue = param.mFloatValue.load();
 	}
 
 	/**
@@ -357,7 +453,7 @@ public:
 	float operator= (const float value) { this->set(value); return value; }
 
 private:
-	float mFloatValue;
+	std::atomic<float> mFloatValue;
 };
 
 class ParameterBool : public Parameter
@@ -374,8 +470,8 @@ public:
    * @param max Value when on/true
    *
    * This ParameterBool class is designed for boolean parameters that have
-   * float values for on or off states. It relies on floats being atomic on
-   * the platform.
+   * float values for on or off states. The value is stored in an atomic
+   * float.
    */
 	ParameterBool(std::string parameterName, std::string Group,
 	          float defaultValue,
@@ -413,13 +509,15 @@ public:
 	float operator= (const float value) { this->set(value); return value; }
 
 private:
-	float mFloatValue;
+	std::atomic<float> mFloatValue;
 };
 
-// These three types are blocking, should not be used in time-critical contexts
-// like the audio callback. The classes were explicitly defined to overcome
-// the issues related to the > and < operators needed when validating minumum
-// and maximum values for the parameter
+// ParameterString is blocking and should not be set or read in time-critical
+// contexts like the audio callback. ParameterVec3 and ParameterVec4 can be
+// read from the audio callback without blocking (see ParameterValue). The
+// classes were explicitly defined to overcome the issues related to the > and
+// < operators needed when validating minumum and maximum values for the
+// parameter
 class ParameterString: public ParameterWrapper<std::string>
 {
 public:
@@ -548,11 +646,19 @@ public:
  * Parameter objects that are registered with a ParameterServer will receive 
  * incoming messages on their OSC address.
  *
+ * Parameters are looked up in a table keyed by address, so the cost of a
+ * message does not grow with the number of parameters. Messages whose
+ * address is an OSC pattern (e.g. "/synth/voice[1-4]/amp" or
+ * "/mixer/{left,right}/gain") set every parameter whose address matches.
+ * Only the addresses starting with the part of the pattern before its first
+ * wildcard are checked.
+ *
  * @ingroup allocore
  */
 class ParameterServer : public osc::PacketHandler, public OSCNotifier
 {
 	friend class PresetServer; // To be able to take over the OSC server
+	friend class ParameterSnapshot; // To read the registered parameters
 public:
 	/**
 	 * @brief ParameterServer constructor
@@ -670,6 +776,10 @@ public:
 
 	virtual void onMessage(osc::Message& m);
 
+	/// Sets the parameters from a message read in place, without allocating
+	/// memory except for ParameterString values
+	virtual void onMessageView(osc::MessageView& m) override;
+
 protected:
 	static void changeCallback(float value, void *sender, void *userData, void *blockThis);
 	static void changeStringCallback(std::string value, void *sender, void *userData, void *blockThis);
@@ -677,6 +787,24 @@ protected:
 	static void changeVec4Callback(Vec4f value, void *sender, void *userData, void *blockThis);
 
 private:
+	// How to set a parameter from the arguments of a message
+	struct Route {
+		void * parameter;
+		const char * typeTags;	// arguments the parameter accepts
+		void (*set)(void * parameter, osc::Message& m);
+		void (*setView)(void * parameter, osc::MessageView& m);
+	};
+
+	void addRoute(std::string address, const Route& route);
+	void removeRoute(std::string address, void * parameter);
+	template <class M>
+	void dispatch(const char * address, size_t length, M& m);
+	static void dispatch(const std::vector<Route>& routes, osc::Message& m);
+	static void dispatch(const std::vector<Route>& routes, osc::MessageView& m);
+
+	std::map<std::string, std::vector<Route>> mRoutes;	// sorted by address
+	std::unordered_map<std::string, std::vector<Route> *> mRouteTable;	// hashed
+	std::string mAddressKey;	// reused to look up addresses
 	std::vector<osc::PacketHandler *> mPacketHandlers;
 	osc::Recv *mServer;
 	std::vector<Parameter *> mParameters;
@@ -686,6 +814,162 @@ private:
     std::mutex mParameterLock;
 };
 
+/**
+ * @brief The ParameterSnapshot class holds the values of a set of parameters
+ * for one audio block
+ *
+ * Reading a parameter several times during an audio callback can return
+ * different values if another thread sets it in the meantime. A snapshot
+ * reads all its parameters once, at the start of the block, and the audio
+ * code then reads the copies, which stay the same until the next update().
+ * update() does not lock or allocate, so it is safe in the audio callback.
+ *
+ * @code
+	Parameter freq("Frequency", "", 440.0);
+	ParameterVec3 pos("Position", "", Vec3f(0));
+	ParameterSnapshot snapshot;
+	snapshot << freq << pos;
+
+	void onAudioCB(AudioIOData& io){
+		snapshot.update();
+		float f = snapshot.get(freq);
+		Vec3f p = snapshot.get(pos);
+		...
+	}
+ * @endcode
+ *
+ * Parameters must be added before the audio thread starts calling update().
+ *
+ * @ingroup allocore
+ */
+class ParameterSnapshot
+{
+public:
+	ParameterSnapshot(){}
+
+	/// Add a float parameter
+	ParameterSnapshot &add(Parameter &param);
+
+	/// Add a Vec3 parameter
+	ParameterSnapshot &add(ParameterVec3 &param);
+
+	/// Add a Vec4 parameter
+	ParameterSnapshot &add(ParameterVec4 &param);
+
+	/// Add the float, Vec3 and Vec4 parameters registered with a server
+	ParameterSnapshot &add(ParameterServer &server);
+
+	/// Add parameter using the streaming operator
+	template <class T>
+	ParameterSnapshot &operator << (T& param){ return add(param); }
+
+	/// Read the current values of all parameters
+	void update();
+
+	/// Get the value of a float parameter at the last update()
+	float get(Parameter &param) const;
+
+	/// Get the value of a Vec3 parameter at the last update()
+	Vec3f get(ParameterVec3 &param) const;
+
+	/// Get the value of a Vec4 parameter at the last update()
+	Vec4f get(ParameterVec4 &param) const;
+
+	/// Get number of parameters in the snapshot
+	int size() const { return mEntries.size(); }
+
+private:
+	enum Type { FLOAT, VEC3, VEC4 };
+	struct Entry {
+		void * parameter;
+		Type type;
+		Vec4f value;
+	};
+
+	ParameterSnapshot &add(void * param, Type type);
+	const Entry * find(const void * param) const;
+
+	std::vector<Entry> mEntries;
+	std::unordered_map<const void *, int> mIndex;
+};
+
+/**
+ * @brief The ParameterSmoother class ramps to the value of a Parameter one
+ * sample at a time
+ *
+ * Applying a new parameter value at the start of an audio block causes a
+ * step in the signal, which is audible as a click for parameters such as
+ * gains. A smoother reads the parameter once per block in update() and then
+ * returns a new value for every sample, moving linearly from the previous
+ * value to the new one over the ramp time. Changes during a ramp start a new
+ * ramp from the current value.
+ *
+ * @code
+	Parameter amp("Amplitude", "", 0.1);
+	ParameterSmoother ampSmooth(amp, 0.02);
+
+	void onAudioCB(AudioIOData& io){
+		ampSmooth.update(io.framesPerSecond());
+		while(io()){
+			io.out(0) = osc() * ampSmooth();
+		}
+	}
+ * @endcode
+ *
+ * @ingroup allocore
+ */
+class ParameterSmoother
+{
+public:
+	/// @param[in] param	parameter to follow
+	/// @param[in] rampSec	time to reach a new value, in seconds
+	ParameterSmoother(Parameter &param, float rampSec = 0.01);
+
+	/// Set ramp time, in seconds
+	void rampTime(float sec){ mRampSec = sec; }
+
+	/// Get ramp time, in seconds
+	float rampTime() const { return mRampSec; }
+
+	/// Read the parameter and start a ramp if it changed
+
+	/// This is meant to be called once at the start of each audio block.
+	///
+	void update(double framesPerSecond){ target(mParameter.get(), framesPerSecond); }
+
+	/// Start a ramp to a value, e.g. from a ParameterSnapshot
+	void target(float value, double framesPerSecond);
+
+	/// Jump to the current value of the parameter
+	void reset();
+
+	/// Get the value for the next sample
+	float operator()(){
+		if (mRemaining > 0) {
+			if (--mRemaining == 0) {
+				mValue = mTarget;
+			} else {
+				mValue += mStep;
+			}
+		}
+		return mValue;
+	}
+
+	/// Get the value of the last sample
+	float value() const { return mValue; }
+
+	/// Whether the value is still moving to the target
+	bool ramping() const { return mRemaining > 0; }
+
+private:
+	Parameter &mParameter;
+	float mRampSec;
+	float mValue;
+	float mTarget;
+	float mStep;
+	int mRemaining;
+};
+
 // Implementations -----------------------------------------------------------
 
 template<class ParameterType>
@@ -718,8 +1002,7 @@ ParameterWrapper<ParameterType>::ParameterWrapper(std::string parameterName, std
 		mFullAddress = "/";
 	}
 	mFullAddress += mParameterName;
-	mValue = defaultValue;
-	mValueCache = defaultValue;
+	mValue.store(defaultValue);
 }
 
 
@@ -746,6 +1029,7 @@ ParameterWrapper<ParameterType>::ParameterWrapper(const ParameterWrapper<Paramet
 	mProcessUdata = param.mProcessUdata;
 	mCallbacks = param.mCallbacks;
 	mCallbackUdata = param.mCallbackUdata;
+	mValue.store(param.mValue.load());
 
 	//TODO: Add better heuristics for slash handling
 	if (mPrefix.length() > 0 && mPrefix.at(0) != '/') {
@@ -776,9 +1060,7 @@ void ParameterWrapper<ParameterType>::set(ParameterType value)
 	if (mProcessCallback) {
 		value = mProcessCallback(value, mProcessUdata);
 	}
-	mMutex.lock();
-	mValue = value;
-	mMutex.unlock();
+	mValue.store(value);
 	for(size_t i = 0; i < mCallbacks.size(); ++i) {
 		if (mCallbacks[i]) {
 			mCallbacks[i](value, this,  mCallbackUdata[i], NULL);
@@ -802,9 +1084,7 @@ void ParameterWrapper<ParameterType>::setNoCalls(ParameterType value, void *bloc
 			}
 		}
 	}
-	mMutex.lock();
-	mValue = value;
-	mMutex.unlock();
+	mValue.store(value);
 }
 
 
@@ -812,11 +1092,7 @@ void ParameterWrapper<ParameterType>::setNoCalls(ParameterType value, void *bloc
 template<class ParameterType>
 ParameterType ParameterWrapper<ParameterType>::get()
 {
-	if (mMutex.try_lock()) {
-		mValueCache = mValue;
-		mMutex.unlock();
-	}
-	return mValueCache;
+	return mValue.load();
 }
 
 template<class ParameterType>
@@ -42,9 +42,12 @@
 	Andrés Cabrera mantaraya36@gmail.com
 */
 
+#include <atomic>
+#include <functional>
+#include <limits>
 #include <map>
+#include <string>
 #include <vector>
-#include <list>
 #include <limits.h>
 #include <cassert>
 #include <iostream>
@@ -61,6 +64,8 @@
 namespace al
 {
 
+struct SynthVoicePool;
+
 /**
  * @brief The SynthVoice class
  *
@@ -68,8 +73,12 @@ namespace al
 */
 class SynthVoice {
     friend class PolySynth; // PolySynth needs to access private members like "next".
+    friend struct SynthVoicePool;
+    friend class SynthSequencer; // Keeps the voices of its events out of the pools
 public:
 
+    virtual ~SynthVoice() {}
+
     /// Returns true if voice is currently active
     bool active() { return mActive;}
 
@@ -82,6 +91,10 @@ public:
      * call free() from one of the render() functions. You can access the
      * note parameters using the getInstanceParameter(), getParameters()
      * and getOffParameters() functions.
+     *
+     * When PolySynth releases the voice within a block, this is called once
+     * for the frames before the release and once for the frames after it,
+     * so processing should iterate over the frames with io().
      */
     virtual void onProcess(AudioIOData& io) {}
 
@@ -105,18 +118,37 @@ public:
     * */
     virtual void onTriggerOff() {}
 
+    /**
+     * @brief Override this function to set the note parameters from a sequence file
+     * @param pFields numeric fields following the synth name on the event line
+     * @param numFields number of fields
+     * @return false if the fields are not valid for this voice
+     *
+     * This is called by SynthSequencer::loadSequence() for each event.
+     */
+    virtual bool setParamFields(float *pFields, int numFields) { return numFields == 0; }
+
     /// This function can be called to programatically trigger  a voice.
     /// It is used for example in PolySynth to trigger a voice.
     void triggerOn(int offsetFrames = 0) {
         mOnOffsetFrames = offsetFrames;
+        mOffOffsetFrames = -1;
+        mReleased = false;
         onTriggerOn();
         mActive = true;
     }
 
     /// This function can be called to programatically trigger the release
-    /// of a voice.
+    /// of a voice, immediately or offsetFrames into the next rendered block.
+    /// Call it from the thread rendering the voice: use PolySynth::triggerOff()
+    /// from other threads.
     void triggerOff(int offsetFrames = 0) {
-        mOffOffsetFrames = offsetFrames; // TODO implement offset frames for trigger off. Currently ignoring and turning off at start of buffer
+        if (offsetFrames > 0) {
+            mOffOffsetFrames = offsetFrames; // Released by PolySynth::processVoice()
+            return;
+        }
+        mOffOffsetFrames = -1;
+        mReleased = true;
         onTriggerOff();
     }
     void id(int idValue) {mId = idValue;}
@@ -137,6 +169,7 @@ public:
         return frames;
     }
 
+    /// Frames until a release scheduled by PolySynth::triggerOff(), or -1
     int &getEndOffsetFrames() {return mOffOffsetFrames;}
 
 protected:
@@ -155,9 +188,54 @@ protected:
 private:
     int mId {-1};
     int mActive {false};
+    bool mReleased {false};
     int mOnOffsetFrames {0};
-    int mOffOffsetFrames {0};
+    int mOffOffsetFrames {-1};
     SynthVoice *next {nullptr}; // To support SynthVoices as linked lists
+    SynthVoicePool *mPool {nullptr}; // Pool the voice returns to when done, if allocated by PolySynth
+    bool mSequenced {false}; // Owned by a SynthSequencer event, so not returned to the pool
+    float mCost {-1}; // Seconds onProcess() took in recent blocks, when rendered in parallel. Negative until measured
+};
+
+/**
+ * @brief Free voices of one SynthVoice type
+ *
+ * The audio thread pushes done voices on the lock-free released list.
+ * getVoice() takes them all at once and puts them at the front of its own
+ * free list, so that pops never race with pushes. The voice released last,
+ * whose memory is most likely still cached, is reused first.
+ */
+struct SynthVoicePool {
+    std::atomic<SynthVoice *> released {nullptr}; // Pushed by the audio thread
+    SynthVoice *free {nullptr}; // Only used by getVoice(), under its lock
+    std::vector<std::unique_ptr<SynthVoice>> voices; // All voices allocated for the pool
+
+    void release(SynthVoice *voice) {
+        SynthVoice *head = released.load(std::memory_order_relaxed);
+        do {
+            voice->next = head;
+        } while (!released.compare_exchange_weak(head, voice,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed));
+    }
+
+    SynthVoice *pop() {
+        SynthVoice *newlyReleased = released.exchange(nullptr, std::memory_order_acquire);
+        if (newlyReleased) {
+            SynthVoice *last = newlyReleased;
+            while (last->next) {
+                last = last->next;
+            }
+            last->next = free;
+            free = newlyReleased;
+        }
+        SynthVoice *voice = free;
+        if (voice) {
+            free = voice->next;
+            voice->next = nullptr;
+        }
+        return voice;
+    }
 };
 
 class PolySynth {
@@ -167,17 +245,29 @@ public:
         TIME_MASTER_GRAPHICS
     } TimeMasterMode;
 
+    /// What to do when more voices than maxVoices() are active
+    typedef enum {
+        VOICE_STEAL_NONE, ///< No limit, all voices play
+        VOICE_STEAL_OLDEST, ///< Free the voice triggered first
+        VOICE_STEAL_OLDEST_RELEASED ///< Free the oldest released voice, or else the oldest
+    } VoiceStealing;
+
     PolySynth(unsigned int numPolyphony=64, TimeMasterMode masterMode = TIME_MASTER_AUDIO)
-        : mMasterMode(masterMode)
+        : mMaxVoices(numPolyphony), mMasterMode(masterMode)
     {
     }
 
+    ~PolySynth();
+
     /**
      * @brief trigger Puts voice in active voice lit and calls triggerOn() for it
      * @param voice pointer to the voice to trigger
+     * @param offsetFrames frames into the next rendered block at which the voice starts
+     * @param id id for the voice, or -1 to generate a new one
      * @return a unique id for the voice
      *
-     * You can use the id to identify the note for later triggerOff() calls
+     * You can use the id to identify the note for later triggerOff() calls.
+     * This is lock-free and can be called from any thread.
      */
     int triggerOn(SynthVoice *voice, int offsetFrames = 0, int id = -1) {
         assert(voice);
@@ -187,15 +277,26 @@ public:
         }
         voice->id(thisId);
         voice->triggerOn(offsetFrames);
-        std::unique_lock<std::mutex> lk(mVoiceToInsertLock);
-        voice->next = mVoicesToInsert;
-        mVoicesToInsert = voice;
+        SynthVoice *head = mVoicesToInsert.load(std::memory_order_relaxed);
+        do {
+            voice->next = head;
+        } while (!mVoicesToInsert.compare_exchange_weak(head, voice,
+                                                        std::memory_order_release,
+                                                        std::memory_order_relaxed));
         return thisId;
     }
 
-    /// trigger release of voice with id
-    void triggerOff(int id) {
-        mVoiceIdsToTurnOff.write((const char*) &id, sizeof (int));
+    /**
+     * @brief trigger release of voice with id
+     * @param id id returned by triggerOn()
+     * @param offsetFrames frames into the next rendered block at which the
+     * voice is released. This can be larger than the block size.
+     *
+     * Calls to triggerOff() must not be made from several threads at once.
+     */
+    void triggerOff(int id, int offsetFrames = 0) {
+        int message[2] = {id, offsetFrames};
+        mVoiceIdsToTurnOff.write((const char*) message, sizeof (message));
     }
 
     /**
@@ -205,28 +306,20 @@ public:
      * Returns a free voice from the internal dynamic allocated pool.
      * You must call triggerVoice to put the voice back in the rendering
      * chain after setting its properties, otherwise it will be lost.
+     *
+     * Each voice type has its own pool, so this does not search for a voice.
+     * A new voice is allocated when the pool is empty: use allocatePolyphony()
+     * to allocate them in advance.
      */
     template<class TSynthVoice>
     TSynthVoice &getVoice() {
         std::unique_lock<std::mutex> lk(mFreeVoiceLock); // Only one getVoice() call at a time
-        SynthVoice *freeVoice = mFreeVoices;
-        SynthVoice *previousVoice = nullptr;
-        while (freeVoice) {
-            if (typeid(freeVoice) == typeid (TSynthVoice)) {
-                if (previousVoice) {
-                    previousVoice->next = freeVoice->next;
-                } else {
-                    mFreeVoices = freeVoice->next;
-                }
-                break;
-            }
-            previousVoice = freeVoice;
-            freeVoice = freeVoice->next;
-        }
-        if (!freeVoice) { // No free voice in list, so we need to allocate it
+        SynthVoicePool &voicePool = pool<TSynthVoice>();
+        SynthVoice *freeVoice = voicePool.pop();
+        if (!freeVoice) { // No free voice in pool, so we need to allocate it
             // TODO report current polyphony for more informed allocation of polyphony
             std::cout << "Allocating voice of type " << typeid (TSynthVoice).name() << "." << std::endl;
-            freeVoice = new TSynthVoice;
+            freeVoice = allocate<TSynthVoice>(voicePool);
         }
         return *static_cast<TSynthVoice *>(freeVoice);
     }
@@ -236,67 +329,68 @@ public:
      * @param io AudioIOData containing buffers and audio I/O meta data
      */
     void render(AudioIOData &io) {
-        // TODO implement turn off
         if (mMasterMode == TIME_MASTER_AUDIO) {
-            if (mVoiceToInsertLock.try_lock()) {
-                if (mVoicesToInsert) {
-                    // If lock acquired insert queued voices
-                    if (mActiveVoices) {
-                        auto voice = mVoicesToInsert;
-                        while (voice->next) { // Find last voice to insert
-                            voice = voice->next;
-                        }
-                        voice->next = mActiveVoices; // Connect last inserted to previously active
-                        mActiveVoices = mVoicesToInsert; // Put new voices in head
-                    } else {
-                        mActiveVoices = mVoicesToInsert;
+            // Read turn offs before inserting voices, so that the voices
+            // they refer to have been queued
+            int numTurnOffs = 0;
+            while (numTurnOffs < MAX_TURN_OFFS_PER_BLOCK
+                   && mVoiceIdsToTurnOff.read((char *) mTurnOffs[numTurnOffs], sizeof (mTurnOffs[0])) == sizeof (mTurnOffs[0])) {
+                numTurnOffs++;
+            }
+            SynthVoice *voicesToInsert = mVoicesToInsert.exchange(nullptr, std::memory_order_acquire);
+            // The queue is newest first, so insert each at the head to keep
+            // the active list sorted from newest to oldest
+            SynthVoice *queued = nullptr;
+            while (voicesToInsert) {
+                SynthVoice *voice = voicesToInsert;
+                voicesToInsert = voice->next;
+                voice->next = queued;
+                queued = voice;
+            }
+            while (queued) {
+                SynthVoice *voice = queued;
+                queued = voice->next;
+                voice->next = mActiveVoices;
+                mActiveVoices = voice;
+                mNumActiveVoices++;
+            }
+            for (int i = 0; i < numTurnOffs; i++) {
+                for (auto voice = mActiveVoices; voice; voice = voice->next) {
+                    if (voice->id() == mTurnOffs[i][0] && !voice->mReleased
+                            && voice->mOffOffsetFrames < 0) {
+                        voice->mOffOffsetFrames = mTurnOffs[i][1] > 0 ? mTurnOffs[i][1] : 0;
+                        break;
                     }
-                    mVoicesToInsert = nullptr;
                 }
-                mVoiceToInsertLock.unlock();
+            }
+            if (mVoiceStealing != VOICE_STEAL_NONE) {
+                while (mNumActiveVoices > mMaxVoices && steal()) {}
             }
         }
         // Render active voices
-        auto voice = mActiveVoices;
-        while (voice) {
-            if (voice->active()) {
-                io.frame(voice->getStartOffsetFrames());
-//                int endOffsetFrames = voice->getEndOffsetFrames();
-//                if (endOffsetFrames >= 0) {
-//                    if (endOffsetFrames < io.framesPerBuffer()) {
-//                        voice->triggerOff(endOffsetFrames);
-//                    }
-//                    endOffsetFrames -= io.framesPerBuffer();
-//                }
-                voice->onProcess(io);
+        if (mRenderPool) {
+            renderParallel(io);
+        } else {
+            auto voice = mActiveVoices;
+            while (voice) {
+                if (voice->active()) {
+                    processVoice(*voice, io);
+                }
+                voice = voice->next;
             }
-            voice = voice->next;
         }
-        // Move inactive voices to free queue
+        // Move inactive voices to their pools
         if (mMasterMode == TIME_MASTER_AUDIO) {
-            if (mFreeVoiceLock.try_lock()) { // Attempt to remove inactive voices without waiting.
-                auto voice = mActiveVoices;
-                SynthVoice *previousVoice = nullptr;
-                while(voice) {
-                    if (!voice->active()) {
-                        if (previousVoice) {
-                            previousVoice->next = voice->next; // Remove from active list
-                            voice->next = mFreeVoices;
-                            mFreeVoices = voice; // Insert as head in free voices
-                            voice = previousVoice; // prepare next iteration
-                        } else { // Inactive is head of the list
-                            mActiveVoices = voice->next; // Remove voice from list
-                            voice->next = mFreeVoices;
-                            mFreeVoices = voice; // Insert as head in free voices
-                            voice = mActiveVoices; // prepare next iteration
-                        }
-                    }
-                    previousVoice = voice;
-                    if (voice) {
-                        voice = voice->next;
-                    }
+            SynthVoice **link = &mActiveVoices;
+            while (*link) {
+                SynthVoice *voice = *link;
+                if (!voice->active()) {
+                    *link = voice->next; // Remove from active list
+                    mNumActiveVoices--;
+                    release(voice);
+                } else {
+                    link = &voice->next;
                 }
-                mFreeVoiceLock.unlock();
             }
         }
     }
@@ -321,19 +415,66 @@ public:
     template<class TSynthVoice>
     void allocatePolyphony(int number) {
         std::unique_lock<std::mutex> lk(mFreeVoiceLock);
-        SynthVoice *lastVoice = mFreeVoices;
-        if (lastVoice) {
-            while (lastVoice->next) { lastVoice = lastVoice->next; }
-        } else {
-            lastVoice = mFreeVoices = new TSynthVoice;
-            number--;
-        }
+        SynthVoicePool &voicePool = pool<TSynthVoice>();
         for(int i = 0; i < number; i++) {
-            lastVoice->next = new TSynthVoice;
-            lastVoice = lastVoice->next;
+            SynthVoice *voice = allocate<TSynthVoice>(voicePool);
+            voice->next = voicePool.free;
+            voicePool.free = voice;
         }
     }
 
+    /**
+     * @brief Set what happens when more than maxVoices() voices are active
+     *
+     * Stolen voices are freed at the start of the block, without release.
+     */
+    void setVoiceStealing(VoiceStealing policy) { mVoiceStealing = policy; }
+    VoiceStealing voiceStealing() const { return mVoiceStealing; }
+
+    /// Set the number of active voices over which voices are stolen
+    void setMaxVoices(unsigned int maxVoices) { mMaxVoices = maxVoices; }
+    unsigned int maxVoices() const { return mMaxVoices; }
+
+    /// Number of active voices after the last render(), only valid in the audio thread
+    unsigned int numActiveVoices() const { return mNumActiveVoices; }
+
+    /**
+     * @brief Set number of threads rendering voices (1 by default)
+     *
+     * When greater than one, render(AudioIOData&) splits the active voices
+     * among a TaskPool of n threads dedicated to this PolySynth, one of which
+     * is the thread calling render(). Each thread renders into its own output
+     * and bus buffers, which are then summed into the AudioIOData. Voices are
+     * assigned so that each thread gets about the same processing time, using
+     * the time each voice took in previous blocks.
+     *
+     * Voices then call onProcess() concurrently, so they must not share
+     * state that is modified while rendering. Inputs are shared by all
+     * threads. This should not be called while render() is running.
+     */
+    void setNumThreads(int n);
+
+    /**
+     * @brief Size the buffers of the rendering threads for the blocks of io
+     *
+     * With more than one thread, render(AudioIOData&) otherwise allocates
+     * memory when the number of frames or channels changes, or when more
+     * voices are active than ever before. Call this before rendering and
+     * whenever the block size changes, e.g. after opening the audio device.
+     * Room is made for maxVoices() active voices. This should not be
+     * called while render() is running.
+     */
+    void prepare(const AudioIOData &io);
+
+    /// Get number of threads rendering voices
+    int numThreads() const { return mNumThreads; }
+
+    /// Set priority of the threads helping render(), in [0, 99]
+
+    /// A value greater than 0 makes the threads "real-time", like the audio
+    /// thread usually is. Returns whether the priority could be set.
+    bool threadPriority(int v);
+
     /**
      * @brief prints details of the allocated voices (free, active and queued)
      *
@@ -343,12 +484,19 @@ public:
     void print() {
         {
             std::unique_lock<std::mutex> lk(mFreeVoiceLock);
-            auto voice = mFreeVoices;
             int counter = 0;
             std::cout << " ---- Free Voices ----" << std:: endl;
-            while(voice) {
-                std::cout << "Voice " << counter++ << " " << voice->id() << " : " <<  typeid(voice).name() << " " << voice << std::endl;
-                voice = voice->next;
+            for (auto &voicePool : mPools) {
+                if (!voicePool) {
+                    continue;
+                }
+                for (auto lists : {voicePool->free, voicePool->released.load()}) {
+                    auto voice = lists;
+                    while(voice) {
+                        std::cout << "Voice " << counter++ << " " << voice->id() << " : " <<  typeid(*voice).name() << " " << voice << std::endl;
+                        voice = voice->next;
+                    }
+                }
             }
         }
         //
@@ -357,18 +505,17 @@ public:
             int counter = 0;
             std::cout << " ---- Active Voices ----" << std:: endl;
             while(voice) {
-                std::cout << "Voice " << counter++ << " " << voice->id() << " : " <<  typeid(voice).name() << " " << voice  << std::endl;
+                std::cout << "Voice " << counter++ << " " << voice->id() << " : " <<  typeid(*voice).name() << " " << voice  << std::endl;
                 voice = voice->next;
             }
         }
         //
         {
-            std::unique_lock<std::mutex> lk(mVoiceToInsertLock);
-            auto voice = mVoicesToInsert;
+            auto voice = mVoicesToInsert.load();
             int counter = 0;
             std::cout << " ---- Queued Voices ----" << std:: endl;
             while(voice) {
-                std::cout << "Voice " << counter++ << " " << voice->id() << " : " <<  typeid(voice).name() << " " << voice  << std::endl;
+                std::cout << "Voice " << counter++ << " " << voice->id() << " : " <<  typeid(*voice).name() << " " << voice  << std::endl;
                 voice = voice->next;
             }
         }
@@ -376,19 +523,129 @@ public:
 
 private:
 
+    enum { MAX_TURN_OFFS_PER_BLOCK = 64 };
+
+    // Index of each voice type into mPools, shared by all PolySynths
+    static int nextVoiceTypeIndex() {
+        static std::atomic<int> counter {0};
+        return counter++;
+    }
+
+    template<class TSynthVoice>
+    static int voiceTypeIndex() {
+        static const int index = nextVoiceTypeIndex();
+        return index;
+    }
+
+    // Must be called with mFreeVoiceLock held
+    template<class TSynthVoice>
+    SynthVoicePool &pool() {
+        size_t index = voiceTypeIndex<TSynthVoice>();
+        if (index >= mPools.size()) {
+            mPools.resize(index + 1);
+        }
+        if (!mPools[index]) {
+            mPools[index].reset(new SynthVoicePool);
+        }
+        return *mPools[index];
+    }
+
+    template<class TSynthVoice>
+    SynthVoice *allocate(SynthVoicePool &voicePool) {
+        SynthVoice *voice = new TSynthVoice;
+        voice->mPool = &voicePool;
+        voicePool.voices.emplace_back(voice);
+        return voice;
+    }
+
+    // Render one voice, releasing it at the frame set by triggerOff()
+    void processVoice(SynthVoice &voice, AudioIOData &io) {
+        const int framesPerBuffer = io.framesPerBuffer();
+        int startFrame = voice.getStartOffsetFrames();
+        int &offFrame = voice.mOffOffsetFrames;
+        if (offFrame >= framesPerBuffer) {
+            offFrame -= framesPerBuffer; // Released in a later block
+            io.frame(startFrame);
+            voice.onProcess(io);
+        } else if (offFrame >= 0) { // Released within this block
+            io.frame(startFrame);
+            io.frameEnd(offFrame);
+            voice.onProcess(io);
+            io.frameEnd(-1);
+            io.frame(offFrame > startFrame ? offFrame : startFrame);
+            offFrame = -1;
+            voice.mReleased = true;
+            voice.onTriggerOff();
+            voice.onProcess(io);
+        } else {
+            io.frame(startFrame);
+            voice.onProcess(io);
+        }
+    }
+
+    // Render active voices on mRenderPool, defined in al_SynthSequencer.cpp
+    void renderParallel(AudioIOData &io);
+
+    // Remove one active voice according to mVoiceStealing, from the audio thread
+    bool steal() {
+        SynthVoice **oldest = nullptr;
+        SynthVoice **oldestReleased = nullptr;
+        for (SynthVoice **link = &mActiveVoices; *link; link = &(*link)->next) {
+            oldest = link;
+            if ((*link)->mReleased) {
+                oldestReleased = link;
+            }
+        }
+        SynthVoice **stolen = oldest;
+        if (mVoiceStealing == VOICE_STEAL_OLDEST_RELEASED && oldestReleased) {
+            stolen = oldestReleased;
+        }
+        if (!stolen) {
+            return false;
+        }
+        SynthVoice *voice = *stolen;
+        *stolen = voice->next;
+        mNumActiveVoices--;
+        voice->free();
+        release(voice);
+        return true;
+    }
+
+    // Return a voice removed from the active list to its pool
+    void release(SynthVoice *voice) {
+        if (voice->mPool && !voice->mSequenced) {
+            voice->mPool->release(voice);
+        } else {
+            voice->next = nullptr; // Owned by the caller of triggerOn() or by a sequencer event
+        }
+    }
+
     // Internal voices are allocated in PolySynth and shared with the outside.
-    SynthVoice *mVoicesToInsert {nullptr}; //Voices to be inserted in the realtime context
-    SynthVoice *mFreeVoices {nullptr}; // Allocated voices available for reuse
-    SynthVoice *mActiveVoices {nullptr}; // Dynamic voices that are currently active. Only modified within the master domain (set by mMasterMode)
-    std::mutex mVoiceToInsertLock;
+    std::atomic<SynthVoice *> mVoicesToInsert {nullptr}; // Voices to be inserted in the realtime context, newest first
+    SynthVoice *mActiveVoices {nullptr}; // Dynamic voices that are currently active, newest first. Only modified within the master domain (set by mMasterMode)
+    std::vector<std::unique_ptr<SynthVoicePool>> mPools; // Free voices for each voice type, owns the voices
     std::mutex mFreeVoiceLock;
     std::mutex mGraphicsLock;
 
-    SingleRWRingBuffer mVoiceIdsToTurnOff {64 * sizeof(int)};
+    SingleRWRingBuffer mVoiceIdsToTurnOff {256 * 2 * sizeof(int)};
+    int mTurnOffs[MAX_TURN_OFFS_PER_BLOCK][2]; // Id and offset frames of turn offs read in a block
+
+    unsigned int mMaxVoices;
+    unsigned int mNumActiveVoices {0};
+    VoiceStealing mVoiceStealing {VOICE_STEAL_NONE};
 
     TimeMasterMode mMasterMode;
 
-    int mIdCounter {0};
+    std::atomic<int> mIdCounter {0};
+
+    // Multithreaded rendering
+    class RenderPool;
+    RenderPool *mRenderPool {nullptr};
+    int mNumThreads {1};
+    int mThreadPriority {0};
+    int mChannelsOut {0}; // Block layout given to prepare()
+    int mChannelsBus {0};
+    int mFramesPerBuffer {0};
 };
 
 class SynthSequencerEvent {
@@ -428,16 +685,14 @@ public:
                    PolySynth::TimeMasterMode masterMode =  PolySynth::TIME_MASTER_AUDIO)
         : mPolySynth(numPolyphony, masterMode), mMasterMode(masterMode)
     {
+        mNextEvent = mEvents.end();
     }
 
     /// Insert this function within the audio callback
     void render(AudioIOData &io) {
         if (mMasterMode ==  PolySynth::TIME_MASTER_AUDIO) {
             double timeIncrement = io.framesPerBuffer()/(double) io.framesPerSecond();
-            double blockStartTime = mMasterTime;
-            mMasterTime += timeIncrement;
-            processEvents(blockStartTime, io.framesPerSecond());
-
+            processEvents(timeIncrement, io.framesPerSecond());
         }
         mPolySynth.render(io);
     }
@@ -446,9 +701,7 @@ public:
     void render(Graphics &g) {
         if (mMasterMode == PolySynth::TIME_MASTER_GRAPHICS) {
             double timeIncrement = 1.0/mFps;
-            double blockStartTime = mMasterTime;
-            mMasterTime += timeIncrement;
-            processEvents(blockStartTime, mFps);
+            processEvents(timeIncrement, mFps);
         }
         mPolySynth.render(g);
     }
@@ -463,27 +716,83 @@ public:
      * @param duration
      * @return a reference to the voice instance inserted
      *
-     * This function is not thread safe, so you must add all your notes before starting the
-     * sequencer context (e.g. the audio callback if using TIME_MASTER_AUDIO). If you need
-     * to insert events on the fly, use triggerOn() directly on the PolySynth member
+     * Insertion takes O(log n) for n events, and can be done from any thread
+     * while the sequencer is playing. An event inserted at a time that has
+     * already played is not triggered until the sequencer seeks back to it.
+     * As the returned voice is set after insertion, events inserted while
+     * playing should start at least a block after the current time().
      *
      * The TSynthVoice template must be a class inherited from SynthVoice.
      */
     template<class TSynthVoice>
     TSynthVoice &add(double startTime, double duration = -1) {
-        // Insert into event list, sorted.
-        auto position = mEvents.begin();
-        while(position != mEvents.end() && position->startTime < startTime) {
-            position++;
-        }
-        auto insertedEvent = mEvents.insert(position, SynthSequencerEvent());
-        insertedEvent->startTime = startTime;
-        insertedEvent->duration = duration;
         auto &newVoice = mPolySynth.getVoice<TSynthVoice>();
-        insertedEvent->voice = &newVoice;
+        newVoice.mSequenced = true;
+        SynthSequencerEvent event;
+        event.startTime = startTime;
+        event.duration = duration;
+        event.voice = &newVoice;
+        insertEvent(event);
         return newVoice;
     }
 
+    /// Allocate voices for add() in advance, as PolySynth::allocatePolyphony()
+    template<class TSynthVoice>
+    void allocatePolyphony(int number) {
+        mPolySynth.allocatePolyphony<TSynthVoice>(number);
+    }
+
+    /**
+     * @brief Register a voice type for loadSequence()
+     * @param name name of the voice type in sequence files
+     */
+    template<class TSynthVoice>
+    void registerSynthClass(std::string name) {
+        SynthClass &synthClass = mSynthClasses[name];
+        synthClass.getVoice = [this]() -> SynthVoice * { return &mPolySynth.getVoice<TSynthVoice>(); };
+        synthClass.allocate = [this](int number) { mPolySynth.allocatePolyphony<TSynthVoice>(number); };
+    }
+
+    /**
+     * @brief Add the events of a sequence file
+     * @param fileName path of the file
+     * @return false if the file could not be read
+     *
+     * Each event is a line with the format:
+     * @code
+     * @ startTime duration synthName field1 field2 ...
+     * @endcode
+     * where synthName was registered with registerSynthClass() and the fields
+     * are passed to SynthVoice::setParamFields(). Empty lines and lines
+     * starting with # are ignored, as well as events that can't be parsed.
+     *
+     * The events are sorted once and then merged into the timeline, and the
+     * voices for them are allocated in advance, so loading is O(n log n) for
+     * n events. This can be called while the sequencer is playing.
+     */
+    bool loadSequence(std::string fileName);
+
+    /**
+     * @brief Move the sequencer to a time in seconds
+     *
+     * Events starting at or after time are triggered from the next block.
+     * Voices that are already playing are not stopped. This can be called
+     * from any thread and takes O(log n) for n events.
+     */
+    void seek(double time) {
+        mSeekTime.store(time, std::memory_order_relaxed);
+        mSeekPending.store(true, std::memory_order_release);
+    }
+
+    /// Get the time in seconds at the end of the last processed block
+    double time() const { return mMasterTime.load(std::memory_order_relaxed); }
+
+    /// Get the number of events in the sequence
+    size_t numEvents() {
+        std::unique_lock<std::mutex> lk(mEventLock);
+        return mEvents.size();
+    }
+
     /**
      * @brief Basic audio callback for quick prototyping
      * @param io
@@ -504,34 +813,35 @@ public:
     }
 
 private:
+    typedef std::multimap<double, SynthSequencerEvent> Timeline;
+
+    struct SynthClass {
+        std::function<SynthVoice *()> getVoice;
+        std::function<void(int)> allocate;
+    };
+
     PolySynth mPolySynth;
 
     double mFps {30}; // graphics frames per second
 
-    unsigned int mNextEvent {0};
-    std::list<SynthSequencerEvent> mEvents; // List of events sorted by start time.
+    Timeline mEvents; // Events by start time
+    Timeline::iterator mNextEvent; // First event not yet triggered
+    double mNextTime {std::numeric_limits<double>::lowest()}; // Events before this time have been triggered or skipped
+    std::mutex mEventLock; // Protects mEvents, mNextEvent and mNextTime
+
+    std::map<std::string, SynthClass> mSynthClasses;
 
     PolySynth::TimeMasterMode mMasterMode {PolySynth::TIME_MASTER_AUDIO};
-    double mMasterTime {0};
-
-    void processEvents(double blockStartTime, double fps) {
-        if (mNextEvent < mEvents.size()) {
-            auto iter = mEvents.begin();
-            std::advance(iter, mNextEvent);
-            auto event = *iter;
-            while (event.startTime <= mMasterTime) {
-                event.offsetCounter = (event.startTime - blockStartTime)*fps;
-                mPolySynth.triggerOn(event.voice, event.offsetCounter);
-//                    std::cout << "Event " << mNextEvent << " " << event.startTime << " " << typeid(*event.voice.get()).name() << std::endl;
-                mNextEvent++;
-                iter++;
-                if (iter == mEvents.end()) {
-                    break;
-                }
-                event = *iter;
-            }
-        }
-    }
+    std::atomic<double> mMasterTime {0}; // Only set by the thread of the time master
+    std::atomic<double> mSeekTime {0};
+    std::atomic<bool> mSeekPending {false};
+
+    // Insert in the timeline, moving mNextEvent back if the event is next
+    void insertEvent(const SynthSequencerEvent &event);
+    void insertLocked(const SynthSequencerEvent &event);
+
+    // Advance time by a block and trigger the events that start within it
+    void processEvents(double blockDuration, double fps);
 };
 
 }
@@ -0,0 +1,76 @@
+/*
+Allocore Example: Incremental isosurface benchmark
+
+Description:
+This measures how long it takes to keep the isosurface of a time-varying
+field up to date when only part of the field changes each frame. A gyroid is
+perturbed in a slab covering 1%, 10% or 50% of the field and the surface is
+extracted by generate(), by update() comparing the field against the previous
+frame and by update() with the changed region marked by the caller.
+
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "allocore/graphics/al_Isosurface.hpp"
+#include "allocore/system/al_Time.hpp"
+
+using namespace al;
+
+static const int N = 128;		// field points per side
+static const int FRAMES = 20;
+
+enum Mode { FULL, DIFF, MARKED };
+
+// Returns milliseconds per frame
+double run(Mode mode, float rate){
+	std::vector<float> field(N*N*N);
+	auto fill = [&](int z0, int z1, float t){
+		for(int z=z0; z<z1; ++z){
+		for(int y=0; y<N; ++y){
+		for(int x=0; x<N; ++x){
+			float a = 0.3;
+			field[x + N*(y + N*z)] =
+				sin(x*a + t)*cos(y*a) + sin(y*a)*cos(z*a) + sin(z*a)*cos(x*a);
+		}}}
+	};
+	fill(0, N, 0);
+
+	Isosurface iso;
+	iso.fieldDims(N).cellLengths(1./N);
+	if(mode == FULL) iso.generate(&field[0]);
+	else iso.update(&field[0], mode == DIFF);
+
+	int slab = std::max(1, int(rate*N + 0.5));
+	double sec = 0;
+	for(int f=1; f<=FRAMES; ++f){
+		fill(0, slab, f*0.1);
+		Timer timer;
+		switch(mode){
+		case FULL: iso.generate(&field[0]); break;
+		case DIFF: iso.update(&field[0], true); break;
+		case MARKED:
+			iso.markDirty(0,0,0, N,N,slab);
+			iso.update(&field[0]);
+			break;
+		}
+		timer.stop();
+		sec += timer.elapsedSec();
+	}
+	return sec / FRAMES * 1e3;
+}
+
+int main(){
+	printf("\n%d^3 field, ms per frame\n\n", N);
+	printf("changed   generate   update (diff)   update (marked)\n");
+	float rates[] = {0.01, 0.1, 0.5};
+	for(float r : rates){
+		double full = run(FULL, r);
+		double diff = run(DIFF, r);
+		double marked = run(MARKED, r);
+		printf("%6.0f%%   %8.1f   %13.1f   %15.1f\n", r*100, full, diff, marked);
+	}
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*
+Allocore Example: Mesh smoothing benchmark
+
+Description:
+This measures Laplacian smoothing and normal generation on indexed triangle
+meshes of about 100k and 1M triangles. The old Mesh::smooth() built an
+ordered map of sets for the adjacency on every call; it is compared with the
+current version, once while the adjacency is built and once with it cached,
+as happens when smoothing every frame. Normal generation is compared with
+the serial face loop used before, on a mesh without a cached adjacency, where
+it runs the same loop, and on the smoothed mesh, where it runs in parallel
+on all hardware threads like smoothing.
+
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <thread>
+#include "allocore/graphics/al_Graphics.hpp"
+#include "allocore/graphics/al_Mesh.hpp"
+#include "allocore/system/al_Time.hpp"
+
+using namespace al;
+
+// Wavy indexed grid with N x N quads
+void makeGrid(Mesh& m, int N){
+	m.reset();
+	m.primitive(Graphics::TRIANGLES);
+	for(int j=0; j<=N; ++j){
+	for(int i=0; i<=N; ++i){
+		m.vertex(i, j, sin(i*0.3)*cos(j*0.2));
+	}}
+	for(int j=0; j<N; ++j){
+	for(int i=0; i<N; ++i){
+		int a = j*(N+1) + i;
+		int b = a + N+1;
+		m.index(a, a+1, b+1, a, b+1, b);
+	}}
+}
+
+// The previous implementation of Mesh::smooth()
+void mapSmooth(Mesh& m, float amount){
+	std::map<int, std::set<int>> nodes;
+	int Ni = m.indices().size();
+	for(int i=0; i<Ni; i+=3){
+		int i0 = m.indices()[i], i1 = m.indices()[i+1], i2 = m.indices()[i+2];
+		nodes[i0].insert(i1); nodes[i0].insert(i2);
+		nodes[i1].insert(i2); nodes[i1].insert(i0);
+		nodes[i2].insert(i0); nodes[i2].insert(i1);
+	}
+	Mesh::Vertices vertsCopy(m.vertices());
+	for(const auto& node: nodes){
+		Mesh::Vertex sum(0,0,0);
+		for(auto adj : node.second) sum += vertsCopy[adj];
+		sum /= node.second.size();
+		auto& orig = m.vertices()[node.first];
+		orig = (sum-orig)*amount + orig;
+	}
+}
+
+// The previous serial loop of Mesh::generateNormals() for indexed triangles
+void serialNormals(Mesh& m){
+	int Nv = m.vertices().size();
+	m.normals().size(Nv);
+	for(int i=0; i<Nv; ++i) m.normals()[i].set(0,0,0);
+	for(int i=0; i<m.indices().size(); i+=3){
+		int i1 = m.indices()[i], i2 = m.indices()[i+1], i3 = m.indices()[i+2];
+		Mesh::Vertex vn = cross(m.vertices()[i2]-m.vertices()[i1], m.vertices()[i3]-m.vertices()[i1]);
+		m.normals()[i1] += vn; m.normals()[i2] += vn; m.normals()[i3] += vn;
+	}
+	for(int i=0; i<Nv; ++i) m.normals()[i].normalize();
+}
+
+template <class Func>
+double msec(Func f){
+	Timer timer;
+	f();
+	timer.stop();
+	return timer.elapsedSec() * 1e3;
+}
+
+int main(){
+	printf("\n%d hardware threads, times in ms\n\n", std::thread::hardware_concurrency());
+	printf("triangles   map smooth   smooth (build)   smooth (cached)   serial normals   normals   normals (cached)\n");
+
+	int sizes[] = {224, 708};
+	for(int N : sizes){
+		Mesh a, b, c;
+		makeGrid(a, N);
+		makeGrid(b, N);
+		makeGrid(c, N);
+
+		double tMap = msec([&](){ mapSmooth(a, 0.5); mapSmooth(a, 0.5); }) / 2;
+		double tBuild = msec([&](){ b.smooth(0.5); });
+		double tCached = msec([&](){ b.smooth(0.5); });
+		double tSerial = msec([&](){ serialNormals(a); });
+		Mesh::Normals ref(a.normals());
+		double tNormals = msec([&](){ c.generateNormals(); });
+		c.vertices() = b.vertices();
+		c.generateNormals();
+		double tCachedNormals = msec([&](){ b.generateNormals(); });
+
+		bool match = true;
+		for(int i=0; i<a.vertices().size(); ++i){
+			if((a.vertices()[i] - b.vertices()[i]).mag() > 1e-5) match = false;
+			if((ref[i] - b.normals()[i]).mag() > 1e-5) match = false;
+			if(!(c.normals()[i] == b.normals()[i])) match = false;
+		}
+
+		printf("%9d   %10.1f   %14.1f   %15.1f   %14.1f   %7.1f   %16.1f%s\n",
+			a.indices().size()/3, tMap, tBuild, tCached, tSerial, tNormals, tCachedNormals,
+			match ? "" : "   (results differ!)");
+	}
+	return 0;
+}
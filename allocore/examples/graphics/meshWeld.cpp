@@ -0,0 +1,91 @@
+/*
+Allocore Example: Mesh welding benchmark
+
+Description:
+This measures how long it takes to merge the duplicate vertices of a large
+unindexed triangle mesh, like one loaded from an STL scan. It compares the
+ordered map based method Mesh::compress() used before with Mesh::weld(),
+exactly, with attributes and with a tolerance against jittered positions.
+
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+#include "allocore/graphics/al_Mesh.hpp"
+#include "allocore/system/al_Time.hpp"
+
+using namespace al;
+
+static const int GRID = 600; // quads per side
+
+// Unindexed grid of triangles with normals and optional position jitter
+void makeGrid(Mesh& m, float jitter){
+	m.reset();
+	std::vector<Vec3f> pos((GRID+1)*(GRID+1));
+	for(int j=0; j<=GRID; ++j){
+	for(int i=0; i<=GRID; ++i){
+		pos[j*(GRID+1)+i].set(i, j, 0.1*sin(i*0.1)*cos(j*0.1));
+	}}
+	auto jit = [&](){ return jitter * (rand()/float(RAND_MAX) - 0.5f); };
+	auto add = [&](int i, int j){
+		m.vertex(pos[j*(GRID+1)+i] + Vec3f(jit(), jit(), jit()));
+		m.normal(0,0,1);
+	};
+	for(int j=0; j<GRID; ++j){
+	for(int i=0; i<GRID; ++i){
+		add(i,j); add(i+1,j); add(i+1,j+1);
+		add(i,j); add(i+1,j+1); add(i,j+1);
+	}}
+}
+
+// The previous implementation of Mesh::compress()
+void mapCompress(Mesh& m){
+	typedef std::map<float, int> Zmap;
+	typedef std::map<float, Zmap> Ymap;
+	typedef std::map<float, Ymap> Xmap;
+	Xmap xmap;
+	Mesh old(m);
+	for(int i=m.vertices().size()-1; i>=0; i--){
+		Mesh::Vertex& v = m.vertices()[i];
+		xmap[v.x][v.y][v.z] = i;
+	}
+	std::map<int, int> imap;
+	m.reset();
+	for(int i=0; i<old.vertices().size(); i++){
+		Mesh::Vertex& v = old.vertices()[i];
+		int idx = xmap[v.x][v.y][v.z];
+		std::map<int, int>::iterator it = imap.find(idx);
+		if(it != imap.end()){
+			m.index(it->second);
+		} else {
+			int newidx = m.vertices().size();
+			m.vertex(v);
+			m.normal(old.normals()[i]);
+			imap[idx] = newidx;
+			m.index(newidx);
+		}
+	}
+}
+
+template <class Func>
+void run(const char * name, float jitter, Func f){
+	Mesh m;
+	makeGrid(m, jitter);
+	int before = m.vertices().size();
+	Timer timer;
+	f(m);
+	timer.stop();
+	printf("%-22s %9d %9d %10.1f\n", name, before, m.vertices().size(), timer.elapsedSec()*1e3);
+}
+
+int main(){
+	printf("\nmethod                  vertices   welded         ms\n");
+	run("std::map (old)", 0, [](Mesh& m){ mapCompress(m); });
+	run("compress()", 0, [](Mesh& m){ m.compress(); });
+	run("weld()", 0, [](Mesh& m){ m.weld(); });
+	run("weld(1e-3), jittered", 1e-4, [](Mesh& m){ m.weld(1e-3); });
+	return 0;
+}
@@ -0,0 +1,90 @@
+/*
+Allocore Example: OSC batching benchmark
+
+Description:
+This streams frames of rigid body poses, one OSC message per body, through
+the loopback interface and reports the messages per second and the process
+CPU time per message. It compares sending and receiving one datagram per
+system call, receiving batches of datagrams with Recv::batchSize(), and
+also coalescing the messages of a frame into bundles that fit into an
+Ethernet MTU with Send::coalesce(). The sender waits for the receiver after
+each frame, so that the socket buffer never overflows.
+
+*/
+
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <thread>
+
+#include "allocore/protocol/al_OSC.hpp"
+#include "allocore/system/al_Time.hpp"
+
+using namespace al;
+
+static const int BODIES = 100;		// messages per frame
+static const int FRAMES = 2000;
+static const unsigned PORT = 4120;
+
+struct Counter : public osc::PacketHandler {
+	std::atomic<int> count;
+	Counter(): count(0){}
+	void onMessage(osc::Message& m){}
+	void onMessageView(osc::MessageView& m){
+		count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+};
+
+void run(const char * name, int recvBatch, int mtu){
+	Counter counter;
+	osc::Recv recv(PORT, "", 0.01);
+	recv.handler(counter);
+	recv.bufferSize(1500); // must hold the largest bundle
+	recv.batchSize(recvBatch);
+	osc::Send send(PORT, "127.0.0.1");
+	send.coalesce(mtu);
+
+	std::atomic<bool> done(false);
+	std::thread receiver([&](){ while(!done) recv.recv(); });
+
+	int sent = 0, lost = 0;
+	std::clock_t cpu0 = std::clock();
+	Timer timer;
+	for(int f=0; f<FRAMES; ++f){
+		for(int b=0; b<BODIES; ++b){
+			send.beginMessage("/tracker/rigidbody/pose");
+			send << b << 0.f << 1.f << 2.f << 1.f << 0.f << 0.f << 0.f;
+			send.endMessage();
+			send.send();
+		}
+		send.flush();
+		sent += BODIES;
+
+		// wait for the frame to arrive, counting datagrams dropped
+		al_sec waitStart = al_steady_time();
+		while(counter.count.load(std::memory_order_acquire) < sent - lost){
+			if(al_steady_time() - waitStart > 0.1){
+				lost = sent - counter.count.load(std::memory_order_acquire);
+				break;
+			}
+			std::this_thread::yield();
+		}
+	}
+	timer.stop();
+	double cpu = double(std::clock() - cpu0) / CLOCKS_PER_SEC;
+	done = true;
+	receiver.join();
+
+	int received = counter.count;
+	printf("%-26s %10.3f %12.2f %8d\n", name,
+		received / timer.elapsedSec() * 1e-6, cpu / received * 1e6, sent - received);
+}
+
+int main(){
+	printf("\n%d frames of %d messages over loopback\n\n", FRAMES, BODIES);
+	printf("                              Mmsgs/s  CPU us/msg     lost\n");
+	run("1 datagram per syscall", 1, 0);
+	run("batched recv", 64, 0);
+	run("coalesced + batched recv", 64, 1472);
+	return 0;
+}
@@ -0,0 +1,114 @@
+/*
+Allocore Example: OSC parse and build throughput
+
+Description:
+This measures how many OSC messages per second can be built and parsed, as a
+tracking system would send them: a bundle of rigid body poses, each with an
+id, a position and a quaternion. It compares Packet, which goes through
+oscpack, with PacketBuilder writing into a stack buffer, and handlers that
+receive a Message with handlers that receive a MessageView. It also counts
+the memory allocations made per message.
+
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "allocore/protocol/al_OSC.hpp"
+#include "allocore/system/al_Time.hpp"
+
+using namespace al;
+
+static const int BODIES = 16;		// messages per bundle
+static const int BUNDLES = 100000;
+
+// Count heap allocations
+static unsigned long long allocations = 0;
+void * operator new(size_t n){
+	++allocations;
+	if(void * p = malloc(n)) return p;
+	throw std::bad_alloc();
+}
+void operator delete(void * p) noexcept { free(p); }
+
+struct MessageHandler : public osc::PacketHandler {
+	float sum = 0;
+	void onMessage(osc::Message& m){
+		int id; float x, y, z, qw, qx, qy, qz;
+		m >> id >> x >> y >> z >> qw >> qx >> qy >> qz;
+		sum += x + qw;
+	}
+};
+
+struct ViewHandler : public osc::PacketHandler {
+	float sum = 0;
+	void onMessage(osc::Message& m){}
+	void onMessageView(osc::MessageView& m){
+		int id; float x, y, z, qw, qx, qy, qz;
+		m >> id >> x >> y >> z >> qw >> qx >> qy >> qz;
+		sum += x + qw;
+	}
+};
+
+template <class P>
+void addPoses(P& p, int frame){
+	p.beginBundle(frame);
+	for(int i=0; i<BODIES; ++i){
+		p.beginMessage("/tracker/rigidbody/pose");
+		p << i << float(frame) << 1.f << 2.f << 1.f << 0.f << 0.f << 0.f;
+		p.endMessage();
+	}
+	p.endBundle();
+}
+
+void report(const char * name, double sec, unsigned long long allocs){
+	double msgs = double(BUNDLES) * BODIES;
+	printf("%-28s %10.2f %14.2f\n", name, msgs / sec * 1e-6, allocs / msgs);
+}
+
+int main(){
+	printf("\n%d bundles of %d messages\n\n", BUNDLES, BODIES);
+	printf("                             Mmsgs/s   allocs/msg\n");
+
+	// Build
+	{
+		osc::Packet p(4096);
+		allocations = 0;
+		Timer timer;
+		for(int i=0; i<BUNDLES; ++i){ p.clear(); addPoses(p, i); }
+		timer.stop();
+		report("build Packet", timer.elapsedSec(), allocations);
+	}
+	{
+		char buf[4096];
+		osc::PacketBuilder p(buf, sizeof(buf));
+		allocations = 0;
+		Timer timer;
+		for(int i=0; i<BUNDLES; ++i){ p.clear(); addPoses(p, i); }
+		timer.stop();
+		report("build PacketBuilder", timer.elapsedSec(), allocations);
+	}
+
+	// Parse
+	char buf[4096];
+	osc::PacketBuilder packet(buf, sizeof(buf));
+	addPoses(packet, 1);
+	{
+		MessageHandler h;
+		allocations = 0;
+		Timer timer;
+		for(int i=0; i<BUNDLES; ++i) h.parse(packet.data(), packet.size());
+		timer.stop();
+		report("parse into Message", timer.elapsedSec(), allocations);
+	}
+	{
+		ViewHandler h;
+		allocations = 0;
+		Timer timer;
+		for(int i=0; i<BUNDLES; ++i) h.parse(packet.data(), packet.size());
+		timer.stop();
+		report("parse into MessageView", timer.elapsedSec(), allocations);
+	}
+	return 0;
+}
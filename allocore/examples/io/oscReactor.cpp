@@ -0,0 +1,87 @@
+/*
+Allocore Example: OSC reactor benchmark
+
+Description:
+This runs a number of OSC servers, like the parameter, preset and sequence
+servers of an application, and compares giving each of them a background
+thread that polls its socket with a 1 ms timeout to letting them share the
+single I/O thread of a SocketReactor. It reports the number of threads, the
+process CPU time spent while the servers sit idle, and the latency from
+sending a message to its handler being called.
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+#include "allocore/protocol/al_OSC.hpp"
+#include "allocore/system/al_Time.hpp"
+
+using namespace al;
+typedef std::chrono::steady_clock SteadyClock;
+
+static const int SERVERS = 16;
+static const int MESSAGES = 500;
+static const unsigned PORT = 4130;
+
+struct Handler : public osc::PacketHandler {
+	std::atomic<long long> received;	// time of last message, in ns
+	Handler(): received(0){}
+	void onMessage(osc::Message& m){
+		received = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			SteadyClock::now().time_since_epoch()).count();
+	}
+};
+
+void run(const char * name, bool useReactor){
+	std::vector<Handler> handlers(SERVERS);
+	std::vector<osc::Recv *> servers;
+	for(int i=0; i<SERVERS; ++i){
+		servers.push_back(new osc::Recv(PORT + i, "", 0.001));
+		servers[i]->handler(handlers[i]);
+		if(useReactor) servers[i]->start(SocketReactor::global());
+		else servers[i]->start();
+	}
+
+	// CPU time while idle
+	std::clock_t cpu0 = std::clock();
+	al_sleep(1);
+	double idleCPU = double(std::clock() - cpu0) / CLOCKS_PER_SEC;
+
+	// Latency of messages sent to each server in turn
+	std::vector<osc::Send *> senders;
+	for(int i=0; i<SERVERS; ++i) senders.push_back(new osc::Send(PORT + i, "127.0.0.1"));
+	std::vector<double> lat;
+	for(int i=0; i<MESSAGES; ++i){
+		int s = i % SERVERS;
+		Handler& h = handlers[s];
+		long long before = h.received;
+		long long t0 = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			SteadyClock::now().time_since_epoch()).count();
+		senders[s]->send("/value", float(i));
+		while(h.received == before){}
+		lat.push_back((h.received - t0) * 1e-3);
+	}
+	std::sort(lat.begin(), lat.end());
+	double mean = 0;
+	for(double l : lat) mean += l;
+	mean /= lat.size();
+
+	for(auto s : senders) delete s;
+	for(auto s : servers) delete s;
+	printf("%-18s %8d %12.1f %10.1f %10.1f %10.1f\n", name,
+		useReactor ? 1 : SERVERS, idleCPU * 100,
+		mean, lat[lat.size() / 2], lat[lat.size() * 99 / 100]);
+}
+
+int main(){
+	printf("\n%d OSC servers, latency in us\n\n", SERVERS);
+	printf("                    threads   idle CPU %%       mean     median        p99\n");
+	run("thread per server", false);
+	run("shared reactor", true);
+	return 0;
+}
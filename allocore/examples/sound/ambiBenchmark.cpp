@@ -0,0 +1,99 @@
+/*
+Allocore Example: Higher order Ambisonics benchmark
+
+Description:
+This measures the cost of Ambisonic encoding and decoding for each order from
+1 to 7 on a sphere of 54 speakers, with ACN/SN3D channels. Encoding computes
+the spherical harmonics of a moving source and adds its block to the
+Ambisonic channels with weights ramping from the previous block. Decoding is
+done once per block for all sources; it compares a scalar loop over speakers,
+channels and frames with AmbiDecode::decode. The last column is the cost per
+source of a scene of 64 sources.
+
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "allocore/sound/al_Ambisonics.hpp"
+#include "allocore/system/al_Time.hpp"
+
+using namespace al;
+
+static const int NUM_FRAMES = 256;
+static const int NUM_BLOCKS = 400;
+static const int NUM_SOURCES = 64;
+
+// Decode as a loop over speakers, channels and frames
+void decodeScalar(const AmbiDecode& decoder, const Speakers& speakers,
+	float * dec, const float * ambi, int numFrames)
+{
+	for(int s=0; s<decoder.numSpeakers(); ++s){
+		float * out = dec + speakers[s].deviceChannel * numFrames;
+		for(int c=0; c<decoder.channels(); ++c){
+			const float * in = ambi + c * numFrames;
+			float w = decoder.decodeWeight(s, c);
+			for(int i=0; i<numFrames; ++i){
+				out[i] += in[i] * w;
+			}
+		}
+	}
+}
+
+int main(){
+	// AlloSphere-like layout: three rings
+	SpeakerLayout layout;
+	int chan = 0;
+	for(int i=0; i<12; ++i) layout.addSpeaker(Speaker(chan++, i * 30, 41));
+	for(int i=0; i<30; ++i) layout.addSpeaker(Speaker(chan++, i * 12, 0));
+	for(int i=0; i<12; ++i) layout.addSpeaker(Speaker(chan++, i * 30, -32.5));
+	const int numSpeakers = layout.numSpeakers();
+
+	std::vector<float> input(NUM_FRAMES);
+	for(int i=0; i<NUM_FRAMES; ++i) input[i] = sin(i * 0.1);
+	std::vector<float> out(numSpeakers * NUM_FRAMES);
+
+	printf("\n%d speakers, %d frames per block, all times in us\n\n", numSpeakers, NUM_FRAMES);
+	printf("order  channels   encode/source   scalar decode   decode   speedup   per source\n");
+
+	for(int order=1; order<=AmbiBase::MAX_ORDER; ++order){
+		AmbiEncode encoder(3, order, AMBI_ACN_SN3D);
+		AmbiDecode decoder(3, order, numSpeakers, 3, AMBI_ACN_SN3D);
+		decoder.setSpeakers(layout.speakers());
+		const int chans = encoder.channels();
+		std::vector<float> ambi(chans * NUM_FRAMES, 0.f);
+		std::vector<float> prev(chans, 0.f);
+
+		al_sec encodeSec = 0, scalarSec = 0, decodeSec = 0;
+		for(int b=0; b<NUM_BLOCKS; ++b){
+			std::fill(ambi.begin(), ambi.end(), 0.f);
+			std::fill(out.begin(), out.end(), 0.f);
+
+			al_sec t0 = al_steady_time();
+			float az = b * 0.01f;
+			float el = 0.3f * sin(b * 0.02f);
+			encoder.direction(az, el);
+			encoder.encode(&ambi[0], &input[0], NUM_FRAMES, &prev[0]);
+			for(int c=0; c<chans; ++c) prev[c] = encoder.weights()[c];
+			encodeSec += al_steady_time() - t0;
+
+			t0 = al_steady_time();
+			decodeScalar(decoder, layout.speakers(), &out[0], &ambi[0], NUM_FRAMES);
+			scalarSec += al_steady_time() - t0;
+
+			t0 = al_steady_time();
+			decoder.decode(&out[0], &ambi[0], NUM_FRAMES);
+			decodeSec += al_steady_time() - t0;
+		}
+
+		double encodeUs = encodeSec / NUM_BLOCKS * 1e6;
+		double scalarUs = scalarSec / NUM_BLOCKS * 1e6;
+		double decodeUs = decodeSec / NUM_BLOCKS * 1e6;
+		printf("%5d %9d %15.2f %15.1f %8.1f %8.1fx %12.2f\n",
+			order, chans, encodeUs, scalarUs, decodeUs, scalarUs / decodeUs,
+			encodeUs + decodeUs / NUM_SOURCES);
+	}
+	return 0;
+}
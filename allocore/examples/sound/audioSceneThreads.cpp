@@ -0,0 +1,88 @@
+/*
+Allocore Example: Multithreaded audio scene benchmark
+
+Description:
+This renders an audio scene with many moving Doppler sources using an
+increasing number of render threads. For each thread count it reports the
+time needed to render one block and an estimate of how many sources fit in
+the real-time budget of a block.
+
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "allocore/io/al_AudioIO.hpp"
+#include "allocore/sound/al_AudioScene.hpp"
+#include "allocore/sound/al_Vbap.hpp"
+#include "allocore/system/al_Time.hpp"
+
+using namespace al;
+
+static const int BLOCK_SIZE = 256;
+static const double SAMPLE_RATE = 44100;
+static const int NUM_SOURCES = 256;
+static const int NUM_BLOCKS = 200;
+
+// Returns average seconds to render one block
+double renderTime(Spatializer& panner, int numChans, int numThreads){
+	AudioScene scene(BLOCK_SIZE);
+	scene.createListener(&panner);
+	scene.numThreads(numThreads);
+
+	const double farClip = 20;
+	int delaySize = SoundSource::bufferSize(SAMPLE_RATE, 340, farClip) + BLOCK_SIZE;
+	std::vector<SoundSource> sources;
+	sources.reserve(NUM_SOURCES);
+	for(int k=0; k<NUM_SOURCES; ++k){
+		sources.emplace_back(0.1, farClip, ATTEN_INVERSE, DOPPLER_SYMMETRICAL,
+			SAMPLE_RATE, 0, delaySize);
+		scene.addSource(sources.back());
+	}
+
+	AudioIO io(BLOCK_SIZE, SAMPLE_RATE, NULL, NULL, numChans, 0);
+
+	Timer timer;
+	for(int b=0; b<NUM_BLOCKS; ++b){
+		for(int k=0; k<NUM_SOURCES; ++k){
+			double ang = k * 0.37 + b * 0.01;
+			double dist = 2 + 8 * (k % 7) / 7.;
+			sources[k].pos(dist * cos(ang), 0, dist * sin(ang));
+			for(int i=0; i<BLOCK_SIZE; ++i){
+				sources[k].writeSample(sin(0.01 * (i + b*BLOCK_SIZE) * (k+1)));
+			}
+		}
+		if(b == 0) timer.start(); // skip first block (allocations)
+		scene.render(io);
+	}
+	timer.stop();
+	return timer.elapsedSec() / (NUM_BLOCKS-1);
+}
+
+int main(int argc, char* argv[]){
+	SpeakerLayout layout = SpeakerRingLayout<16>();
+	Vbap panner(layout);
+
+	// Maximum number of threads can be given as first argument
+	int maxThreads = std::thread::hardware_concurrency();
+	if(argc > 1) maxThreads = atoi(argv[1]);
+	if(maxThreads < 1) maxThreads = 1;
+
+	const double budget = BLOCK_SIZE / SAMPLE_RATE;
+
+	printf("\n%d sources, %d frames/block, %.2f ms budget/block\n\n",
+		NUM_SOURCES, BLOCK_SIZE, budget*1000);
+	printf("threads  ms/block  us/source  speedup  max sources\n");
+
+	double t1 = 0;
+	for(int n=1; n<=maxThreads; ++n){
+		double t = renderTime(panner, layout.numSpeakers(), n);
+		if(n == 1) t1 = t;
+		printf("%7d  %8.3f  %9.3f  %7.2f  %11d\n",
+			n, t*1000, t*1e6/NUM_SOURCES, t1/t, int(NUM_SOURCES * budget/t));
+	}
+	return 0;
+}
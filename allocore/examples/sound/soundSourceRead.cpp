@@ -0,0 +1,74 @@
+/*
+Allocore Example: Sound source delay-line read benchmark
+
+Description:
+This compares reading a block of Doppler-shifted samples from a SoundSource
+one sample at a time with getNextSample() against the block read of
+getBuffer(), which computes all the read positions first and then gathers
+and interpolates them with SIMD instructions. It also reports the largest
+difference between the two outputs.
+
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "allocore/sound/al_AudioScene.hpp"
+#include "allocore/system/al_Time.hpp"
+
+using namespace al;
+
+static const double SAMPLE_RATE = 44100;
+static const int NUM_SAMPLES = 1 << 22; // samples read per measurement
+
+int main(){
+	printf("\nframes   scalar ns/smp   block ns/smp   speedup   max error\n");
+
+	int blockSizes[] = {64, 256, 1024};
+
+	for(int blockSize : blockSizes){
+		SoundSource srcScalar(0.1, 20, ATTEN_INVERSE, DOPPLER_SYMMETRICAL, SAMPLE_RATE);
+		SoundSource srcBlock (0.1, 20, ATTEN_INVERSE, DOPPLER_SYMMETRICAL, SAMPLE_RATE);
+		std::vector<float> outScalar(blockSize), outBlock(blockSize);
+
+		const int numBlocks = NUM_SAMPLES / blockSize;
+		double tScalar = 0, tBlock = 0;
+		float maxErr = 0;
+
+		for(int b=0; b<numBlocks; ++b){
+			for(int i=0; i<blockSize; ++i){
+				float smp = sin(0.01 * (i + b*blockSize));
+				srcScalar.writeSample(smp);
+				srcBlock.writeSample(smp);
+			}
+
+			// Slowly moving source
+			Pose relpos(Vec3d(5 + 4*sin(b*0.01), 0, 0));
+
+			Timer timer;
+			srcScalar.frame(0);
+			for(int i=0; i<blockSize; ++i){
+				outScalar[i] = srcScalar.getNextSample(relpos);
+			}
+			timer.stop();
+			tScalar += timer.elapsedSec();
+
+			timer.start();
+			srcBlock.getBuffer(relpos, &outBlock[0], blockSize);
+			timer.stop();
+			tBlock += timer.elapsedSec();
+
+			for(int i=0; i<blockSize; ++i){
+				float err = std::fabs(outScalar[i] - outBlock[i]);
+				if(err > maxErr) maxErr = err;
+			}
+		}
+
+		double nsScalar = tScalar * 1e9 / (numBlocks * blockSize);
+		double nsBlock  = tBlock  * 1e9 / (numBlocks * blockSize);
+		printf("%6d   %13.3f   %12.3f   %7.2f   %9.2g\n",
+			blockSize, nsScalar, nsBlock, nsScalar/nsBlock, maxErr);
+	}
+	return 0;
+}
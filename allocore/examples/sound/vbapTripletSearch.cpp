@@ -0,0 +1,81 @@
+/*
+Allocore Example: VBAP triplet search benchmark
+
+Description:
+This measures how long VBAP takes to find the speaker triplet of each source
+in a block. It compares a linear search over all triplets, the direction
+lookup table and the lookup table starting from the triplet cached for the
+source in the previous block, for slowly moving sources around a dense dome
+of speakers.
+
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "allocore/sound/al_Vbap.hpp"
+#include "allocore/system/al_Time.hpp"
+
+using namespace al;
+
+static const int NUM_SOURCES = 512;
+static const int NUM_BLOCKS = 2000;
+
+enum SearchMode { LINEAR, TABLE, CACHED };
+
+// Returns average seconds to find the triplets of all sources in one block
+double searchTime(Vbap& panner, SearchMode mode, int& found){
+	panner.useLookupTable(mode != LINEAR);
+	std::vector<int> cached(NUM_SOURCES, -1);
+	found = 0;
+
+	Timer timer;
+	for(int b=0; b<NUM_BLOCKS; ++b){
+		for(int k=0; k<NUM_SOURCES; ++k){
+			double az = k * 2.39996 + b * 0.002 * (1 + k%5);
+			double el = 0.5 * sin(k * 0.7 + b * 0.001) + 0.3;
+			Vec3d dir(cos(el)*cos(az), cos(el)*sin(az), sin(el));
+			Vec3d gains;
+			int index = panner.findTriplet(dir, mode == CACHED ? cached[k] : -1, gains);
+			cached[k] = index;
+			found += index >= 0;
+		}
+	}
+	timer.stop();
+	return timer.elapsedSec() / NUM_BLOCKS;
+}
+
+int main(){
+	// Dome with three rings and a top speaker
+	SpeakerLayout layout;
+	int chan = 0;
+	for(int i=0; i<12; ++i) layout.addSpeaker(Speaker(chan++, i * 30, -15, 1));
+	for(int i=0; i<16; ++i) layout.addSpeaker(Speaker(chan++, i * 22.5 + 11.25, 15, 1));
+	for(int i=0; i<8;  ++i) layout.addSpeaker(Speaker(chan++, i * 45, 50, 1));
+	layout.addSpeaker(Speaker(chan++, 0, 90, 1));
+
+	Vbap panner(layout, true);
+
+	printf("\n%d speakers, %d triplets, %d sources\n\n",
+		layout.numSpeakers(), (int)panner.triplets().size(), NUM_SOURCES);
+	printf("search   us/block   ns/source   speedup\n");
+
+	const char * names[] = {"linear", "table", "cached"};
+	double tLinear = 0;
+	int foundLinear = 0;
+	for(int m=LINEAR; m<=CACHED; ++m){
+		int found;
+		double t = searchTime(panner, SearchMode(m), found);
+		if(m == LINEAR){
+			tLinear = t;
+			foundLinear = found;
+		}
+		else if(found != foundLinear){
+			printf("Mismatch in number of sources found!\n");
+		}
+		printf("%-6s   %8.2f   %9.2f   %7.2f\n",
+			names[m], t*1e6, t*1e9/NUM_SOURCES, tLinear/t);
+	}
+	return 0;
+}
@@ -0,0 +1,88 @@
+/*
+Allocore Example: HashSpace batched queries
+
+Description:
+This compares two ways of updating a HashSpace with 100k moving agents and
+finding their neighbors each frame, as a flocking simulation would: moving
+objects one at a time with move() and querying them one at a time with
+Query, and rebuilding the space from a position array with rebuild() and
+answering all queries at once with queryRadius() and queryNearest().
+
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "allocore/spatial/al_HashSpace.hpp"
+#include "allocore/system/al_Time.hpp"
+
+using namespace al;
+
+static const int NUM_AGENTS = 100000;
+static const double RADIUS = 2;
+static const int MAX_NEIGHBORS = 16;
+
+int main(){
+	HashSpace space(6); // 64 units per side
+	std::vector<Vec3d> pos(NUM_AGENTS);
+	for(auto& p : pos){
+		p.set(rand() % 6400 / 100., rand() % 6400 / 100., rand() % 6400 / 100.);
+	}
+	for(auto& p : pos) p += 0.5;
+
+	Timer timer;
+
+	// Per-object path
+	HashSpace perObject(6, NUM_AGENTS);
+	timer.start();
+	for(int i=0; i<NUM_AGENTS; ++i) perObject.move(i, pos[i]);
+	timer.stop();
+	double tMove = timer.elapsedSec();
+
+	HashSpace::Query query(MAX_NEIGHBORS);
+	long found = 0;
+	timer.start();
+	for(int i=0; i<NUM_AGENTS; ++i){
+		query.clear();
+		found += query(perObject, &perObject.object(i), RADIUS);
+	}
+	timer.stop();
+	double tRadius = timer.elapsedSec();
+
+	HashSpace::Query nearQuery;
+	timer.start();
+	for(int i=0; i<NUM_AGENTS; ++i){
+		nearQuery.nearest(perObject, &perObject.object(i));
+	}
+	timer.stop();
+	double tNearest = timer.elapsedSec();
+
+	// Batched path
+	HashSpace::Neighbors nbrs;
+	timer.start();
+	space.rebuild(&pos[0], NUM_AGENTS);
+	timer.stop();
+	double tRebuild = timer.elapsedSec();
+
+	timer.start();
+	space.queryRadius(nbrs, RADIUS, MAX_NEIGHBORS);
+	timer.stop();
+	double tBatchRadius = timer.elapsedSec();
+	long batchFound = 0;
+	for(unsigned i=0; i<nbrs.size(); ++i) batchFound += nbrs.count(i);
+
+	timer.start();
+	space.queryNearest(nbrs, 1);
+	timer.stop();
+	double tBatchNearest = timer.elapsedSec();
+
+	printf("\n%d agents, %d hardware threads, times in ms\n\n",
+		NUM_AGENTS, std::thread::hardware_concurrency());
+	printf("              update   radius   nearest\n");
+	printf("per object  %8.1f %8.1f %9.1f\n", tMove*1e3, tRadius*1e3, tNearest*1e3);
+	printf("batched     %8.1f %8.1f %9.1f\n", tRebuild*1e3, tBatchRadius*1e3, tBatchNearest*1e3);
+	printf("\nneighbors within radius: %ld per object, %ld batched (nearest %d kept)\n",
+		found, batchFound, MAX_NEIGHBORS);
+	return 0;
+}
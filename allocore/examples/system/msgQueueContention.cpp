@@ -0,0 +1,126 @@
+/*
+Allocore Example: Message queue contention
+
+Description:
+This measures how long it takes to send a message to a queue drained by a
+consumer thread while several producer threads send at the same time. It
+compares the lock-free ConcurrentMsgQueue with a MsgQueue protected by a
+mutex, which is what producers on different threads had to use before. For
+each number of producers it reports the mean, 99th percentile and maximum
+latency of send().
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "allocore/types/al_MsgQueue.hpp"
+
+using namespace al;
+typedef std::chrono::steady_clock Clock;
+
+static const int MSGS_PER_PRODUCER = 100000;
+
+static std::atomic<int> received(0);
+static void onMsg(al_sec t, int producer, int n){ received.fetch_add(1, std::memory_order_relaxed); }
+
+// Wraps a MsgQueue with a mutex
+struct LockedMsgQueue {
+	MsgQueue queue;
+	std::mutex mutex;
+
+	// MsgQueue cannot grow its pool, so make room for all messages
+	LockedMsgQueue(int maxMsgs): queue(maxMsgs){}
+
+	bool send(al_sec at, int producer, int n){
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.send(at, onMsg, producer, n);
+		return true;
+	}
+	void update(al_sec until){
+		std::lock_guard<std::mutex> lock(mutex);
+		queue.update(until);
+	}
+};
+
+struct LockFreeMsgQueue {
+	ConcurrentMsgQueue queue;
+
+	LockFreeMsgQueue(int maxMsgs): queue(4096){}
+
+	bool send(al_sec at, int producer, int n){
+		return queue.send(at, onMsg, producer, n);
+	}
+	void update(al_sec until){
+		queue.update(until);
+	}
+};
+
+// Returns send() latencies in nanoseconds
+template <class Queue>
+std::vector<double> run(int numProducers){
+	const int total = numProducers * MSGS_PER_PRODUCER;
+	Queue q(total);
+	received = 0;
+
+	// Consumer updates like an audio callback would
+	std::thread consumer([&](){
+		al_sec t = 0;
+		while(received < total){
+			q.update(t += 1);
+			std::this_thread::yield();
+		}
+	});
+
+	std::vector<std::vector<double> > latencies(numProducers);
+	std::vector<std::thread> producers;
+	for(int p=0; p<numProducers; ++p){
+		producers.push_back(std::thread([&, p](){
+			std::vector<double>& lat = latencies[p];
+			lat.reserve(MSGS_PER_PRODUCER);
+			for(int n=0; n<MSGS_PER_PRODUCER; ){
+				Clock::time_point t0 = Clock::now();
+				bool sent = q.send(0, p, n);
+				Clock::time_point t1 = Clock::now();
+				if(sent){
+					lat.push_back(std::chrono::duration<double, std::nano>(t1 - t0).count());
+					++n;
+				} else {
+					std::this_thread::yield(); // queue full
+				}
+			}
+		}));
+	}
+	for(auto& t : producers) t.join();
+	consumer.join();
+
+	std::vector<double> all;
+	for(auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+	return all;
+}
+
+void report(const char * name, int numProducers, std::vector<double> lat){
+	std::sort(lat.begin(), lat.end());
+	double mean = 0;
+	for(double l : lat) mean += l;
+	mean /= lat.size();
+	printf("%-10s %9d %10.1f %10.1f %12.1f\n", name, numProducers,
+		mean, lat[lat.size() * 99 / 100], lat.back());
+}
+
+int main(){
+	printf("\n%d messages per producer, latency of send() in ns\n\n", MSGS_PER_PRODUCER);
+	printf("queue      producers       mean        p99          max\n");
+
+	int maxProducers = std::max(2u, std::thread::hardware_concurrency());
+	for(int n=1; n<=maxProducers; n*=2){
+		report("mutex", n, run<LockedMsgQueue>(n));
+		report("lock-free", n, run<LockFreeMsgQueue>(n));
+	}
+	return 0;
+}
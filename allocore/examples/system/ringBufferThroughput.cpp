@@ -0,0 +1,92 @@
+/*
+Allocore Example: Ring buffer throughput
+
+Description:
+This streams floats from a writer thread to a reader thread through a
+SingleRWRingBuffer, first copying them with write() and read() and then
+accessing the buffer in place with prepareWrite()/commitWrite() and
+peekRead()/commitRead(). For each chunk size it reports the throughput in
+megabytes per second.
+
+*/
+
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "allocore/system/al_Time.hpp"
+#include "allocore/types/al_SingleRWRingBuffer.hpp"
+
+using namespace al;
+
+static const size_t BUFFER_SIZE = 1 << 16;		// bytes
+static const size_t TOTAL_FLOATS = 1 << 26;	// floats streamed per run
+
+// Returns MB/s, sum is used to check the data
+double stream(size_t chunk, bool inPlace, double& sum){
+	SingleRWRingBuffer rb(BUFFER_SIZE);
+	const size_t chunkBytes = chunk * sizeof(float);
+
+	Timer timer;
+	std::thread writer([&](){
+		std::vector<float> src(chunk);
+		size_t sent = 0;
+		while(sent < TOTAL_FLOATS){
+			if(inPlace){
+				SingleRWRingBuffer::Span s = rb.prepareWrite(chunkBytes);
+				if(s.size() < chunkBytes){ std::this_thread::yield(); continue; }
+				// Chunks of floats never straddle the wrap point
+				float * dst = (float *)s.data1;
+				for(size_t i=0; i<s.size1/sizeof(float); ++i) *dst++ = float(sent++);
+				dst = (float *)s.data2;
+				for(size_t i=0; i<s.size2/sizeof(float); ++i) *dst++ = float(sent++);
+				rb.commitWrite(chunkBytes);
+			} else {
+				if(rb.writeSpace() < chunkBytes){ std::this_thread::yield(); continue; }
+				for(size_t i=0; i<chunk; ++i) src[i] = float(sent++);
+				rb.write((const char *)&src[0], chunkBytes);
+			}
+		}
+	});
+
+	std::vector<float> dst(chunk);
+	size_t received = 0;
+	sum = 0;
+	while(received < TOTAL_FLOATS){
+		if(inPlace){
+			SingleRWRingBuffer::Span s = rb.peekRead(chunkBytes);
+			if(s.size() < chunkBytes){ std::this_thread::yield(); continue; }
+			const float * src = (const float *)s.data1;
+			for(size_t i=0; i<s.size1/sizeof(float); ++i) sum += *src++;
+			src = (const float *)s.data2;
+			for(size_t i=0; i<s.size2/sizeof(float); ++i) sum += *src++;
+			rb.commitRead(chunkBytes);
+		} else {
+			if(rb.read((char *)&dst[0], chunkBytes) < chunkBytes){
+				std::this_thread::yield(); continue;
+			}
+			for(size_t i=0; i<chunk; ++i) sum += dst[i];
+		}
+		received += chunk;
+	}
+	writer.join();
+	timer.stop();
+
+	return TOTAL_FLOATS * sizeof(float) / timer.elapsedSec() / 1e6;
+}
+
+int main(){
+	printf("\n%d MB through a %d byte buffer\n\n",
+		int(TOTAL_FLOATS * sizeof(float) >> 20), int(BUFFER_SIZE));
+	printf("floats/chunk   copy MB/s   in place MB/s\n");
+
+	size_t chunks[] = {16, 64, 256, 1024};
+	for(size_t chunk : chunks){
+		double sumCopy, sumInPlace;
+		double copy = stream(chunk, false, sumCopy);
+		double inPlace = stream(chunk, true, sumInPlace);
+		printf("%12d   %9.1f   %13.1f%s\n", int(chunk), copy, inPlace,
+			sumCopy == sumInPlace ? "" : "   (data mismatch!)");
+	}
+	return 0;
+}
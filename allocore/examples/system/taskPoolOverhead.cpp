@@ -0,0 +1,82 @@
+/*
+Allocore Example: Task pool overhead
+
+Description:
+This measures how long it takes to split a small loop across threads and
+wait for it, as Mesh, HashSpace, Field3D and AudioScene do every frame. It
+compares starting and joining new threads on each call, like al::Threads,
+with TaskPool::parallelFor on threads that persist between calls. For each
+number of threads it reports the mean time of one call in microseconds.
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "allocore/system/al_TaskPool.hpp"
+#include "allocore/system/al_Time.hpp"
+
+using namespace al;
+
+static const int CALLS = 2000;
+static const int N = 1 << 14;	// loop size
+
+static std::vector<float> data(N, 1.f);
+
+static void work(int begin, int end){
+	for(int i=begin; i<end; ++i) data[i] = data[i] * 0.999f + 0.001f;
+}
+
+// Returns microseconds per call
+double spawnThreads(int numThreads){
+	Timer timer;
+	for(int c=0; c<CALLS; ++c){
+		std::vector<std::thread> threads;
+		for(int t=1; t<numThreads; ++t){
+			threads.push_back(std::thread(work, N*t/numThreads, N*(t+1)/numThreads));
+		}
+		work(0, N/numThreads);
+		for(auto& t : threads) t.join();
+	}
+	timer.stop();
+	return timer.elapsedSec() / CALLS * 1e6;
+}
+
+double taskPool(TaskPool& pool){
+	Timer timer;
+	for(int c=0; c<CALLS; ++c){
+		pool.parallelFor(0, N, N / pool.size(), work);
+	}
+	timer.stop();
+	return timer.elapsedSec() / CALLS * 1e6;
+}
+
+double taskGroup(TaskPool& pool){
+	Timer timer;
+	for(int c=0; c<CALLS; ++c){
+		TaskGroup group(pool);
+		const int n = pool.size();
+		for(int t=0; t<n; ++t){
+			group.run([t, n](){ work(N*t/n, N*(t+1)/n); });
+		}
+		group.wait();
+	}
+	timer.stop();
+	return timer.elapsedSec() / CALLS * 1e6;
+}
+
+int main(){
+	printf("\nloop of %d floats, microseconds per call\n\n", N);
+	printf("threads   new threads   parallelFor   TaskGroup\n");
+
+	int maxThreads = std::max(2u, std::thread::hardware_concurrency());
+	for(int n=1; n<=maxThreads; n*=2){
+		TaskPool pool(n);
+		printf("%7d   %11.1f   %11.1f   %9.1f\n", n,
+			spawnThreads(n), taskPool(pool), taskGroup(pool));
+	}
+	return 0;
+}
@@ -0,0 +1,94 @@
+/*
+Allocore Example: Parameter server dispatch
+
+Description:
+This measures how many OSC messages per second a ParameterServer can apply
+to its parameters as the number of registered parameters grows. It
+compares the address table of ParameterServer with comparing the address
+of every parameter to the message, which is how messages used to be
+dispatched, and also reports the rate of messages whose address is a
+pattern matching ten parameters.
+
+*/
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "allocore/math/al_Random.hpp"
+#include "allocore/system/al_Time.hpp"
+#include "allocore/ui/al_Parameter.hpp"
+
+using namespace al;
+
+static const int MESSAGES = 200000;
+
+// Sets parameters by comparing the message address to every parameter
+struct LinearDispatch : public osc::PacketHandler {
+	std::vector<Parameter *> params;
+	std::mutex lock;
+
+	void onMessage(osc::Message& m){
+		m.resetStream();
+		float val;
+		m >> val;
+		lock.lock();
+		for(Parameter * p : params){
+			if(m.addressPattern() == p->getFullAddress() && m.typeTags() == "f"){
+				p->set(val);
+			}
+		}
+		lock.unlock();
+	}
+};
+
+// Returns messages per second
+double rate(osc::PacketHandler& handler, std::vector<std::unique_ptr<osc::Message>>& msgs){
+	Timer timer;
+	for(int i=0; i<MESSAGES; ++i){
+		handler.onMessage(*msgs[i % msgs.size()]);
+	}
+	timer.stop();
+	return MESSAGES / timer.elapsedSec();
+}
+
+int main(){
+	printf("\nmessages per second\n\n");
+	printf("parameters       linear      indexed   pattern (10 matches)\n");
+
+	int counts[] = {10, 100, 500, 2000};
+	for(int numParams : counts){
+		std::vector<std::unique_ptr<Parameter>> params;
+		for(int i=0; i<numParams; ++i){
+			params.emplace_back(new Parameter("param" + std::to_string(i%10),
+				"group" + std::to_string(i/10), 0, "/synth", -1, 1));
+		}
+
+		LinearDispatch linear;
+		ParameterServer server("127.0.0.1", 9011);
+		for(auto& p : params){
+			linear.params.push_back(p.get());
+			server << *p;
+		}
+
+		// messages to random parameters
+		rnd::Random<> rng(1);
+		std::vector<osc::Packet> packets(256), patternPackets(256);
+		std::vector<std::unique_ptr<osc::Message>> msgs, patternMsgs;
+		for(unsigned i=0; i<packets.size(); ++i){
+			Parameter& p = *params[rng.uniform(numParams)];
+			packets[i].addMessage(p.getFullAddress(), rng.uniformS());
+			msgs.emplace_back(new osc::Message(packets[i].data(), packets[i].size()));
+
+			std::string group = "/synth/group" + std::to_string(rng.uniform(numParams/10));
+			patternPackets[i].addMessage(group + "/param?", rng.uniformS());
+			patternMsgs.emplace_back(new osc::Message(patternPackets[i].data(), patternPackets[i].size()));
+		}
+
+		printf("%10d %12.0f %12.0f %12.0f\n", numParams,
+			rate(linear, msgs), rate(server, msgs), rate(server, patternMsgs));
+	}
+	return 0;
+}
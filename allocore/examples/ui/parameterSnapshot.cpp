@@ -0,0 +1,102 @@
+/*
+Allocore Example: Parameter snapshot benchmark
+
+Description:
+This measures how long the audio thread takes to read a Vec3 parameter
+while other threads keep setting it. It compares the mutex storage that
+ParameterVec3 used before, where get() falls back to a cached copy when a
+writer holds the lock, with the lock-free storage it uses now. For each
+number of writers it reports the mean, 99th percentile and maximum latency
+of a read. It then reports the cost of updating a ParameterSnapshot of 1000
+parameters once per block and of smoothing a parameter for every sample.
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "allocore/system/al_Time.hpp"
+#include "allocore/ui/al_Parameter.hpp"
+
+using namespace al;
+typedef std::chrono::steady_clock SteadyClock;
+
+static const int READS = 200000;
+
+template <bool LockFree>
+void run(const char * name, int numWriters){
+	ParameterValue<Vec3f, LockFree> value;
+	value.store(Vec3f(0));
+	std::atomic<bool> done(false);
+	std::vector<std::thread> writers;
+	for(int w=0; w<numWriters; ++w){
+		writers.push_back(std::thread([&](){
+			for(int i=1; !done; ++i) value.store(Vec3f(i, i, i));
+		}));
+	}
+
+	std::vector<double> lat(READS);
+	for(int i=0; i<READS; ++i){
+		SteadyClock::time_point t0 = SteadyClock::now();
+		Vec3f v = value.load();
+		SteadyClock::time_point t1 = SteadyClock::now();
+		lat[i] = std::chrono::duration<double, std::nano>(t1 - t0).count();
+		if(v[0] != v[1] || v[1] != v[2]) printf("torn read!\n");
+	}
+	done = true;
+	for(auto& t : writers) t.join();
+
+	std::sort(lat.begin(), lat.end());
+	double mean = 0;
+	for(double l : lat) mean += l;
+	mean /= lat.size();
+	printf("%-10s %7d %8.1f %8.1f %10.1f\n", name, numWriters,
+		mean, lat[lat.size() * 99 / 100], lat.back());
+}
+
+int main(){
+	printf("\n%d reads of a Vec3 parameter, latency in ns\n\n", READS);
+	printf("storage    writers     mean      p99        max\n");
+	int maxWriters = std::max(2u, std::thread::hardware_concurrency());
+	for(int n=0; n<=maxWriters; n = n ? n*2 : 1){
+		run<false>("mutex", n);
+		run<true>("lock-free", n);
+	}
+
+	// Snapshot of many parameters, updated once per block
+	const int NUM_PARAMS = 1000, BLOCKS = 10000, FRAMES = 256;
+	std::vector<Parameter *> params;
+	std::vector<ParameterVec3 *> vecs;
+	ParameterSnapshot snapshot;
+	for(int i=0; i<NUM_PARAMS/2; ++i){
+		params.push_back(new Parameter("p" + std::to_string(i), "", 0));
+		vecs.push_back(new ParameterVec3("v" + std::to_string(i), "", Vec3f(0)));
+		snapshot << *params.back() << *vecs.back();
+	}
+	Timer timer;
+	for(int b=0; b<BLOCKS; ++b) snapshot.update();
+	timer.stop();
+	printf("\nsnapshot of %d parameters: %.2f us per update\n",
+		snapshot.size(), timer.elapsedSec() / BLOCKS * 1e6);
+
+	// Smoothing a parameter for every sample
+	ParameterSmoother smooth(*params[0], 0.01);
+	float sum = 0;
+	timer.start();
+	for(int b=0; b<BLOCKS; ++b){
+		params[0]->set(b & 1);
+		smooth.update(44100);
+		for(int i=0; i<FRAMES; ++i) sum += smooth();
+	}
+	timer.stop();
+	printf("smoothing: %.2f ns per sample (sum %g)\n",
+		timer.elapsedSec() / (double(BLOCKS) * FRAMES) * 1e9, sum);
+
+	for(auto p : params) delete p;
+	for(auto p : vecs) delete p;
+	return 0;
+}
@@ -0,0 +1,171 @@
+/*
+Allocore Example: PolySynth trigger benchmark
+
+Description:
+This measures how fast PolySynth can start short grains. Each grain is a
+sine burst of one block that frees itself when done. The first part times
+getVoice() and triggerOn() with a triggerOff() inside the block from a single
+thread, and the render() of those grains. The second part runs one to four
+threads triggering grains while the main thread renders blocks as fast as it
+can, and reports the grains started per second and the slowest block. The
+last part renders 512 sustained voices of uneven cost with PolySynth rendering
+on one to four threads.
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "allocore/io/al_AudioIO.hpp"
+#include "allocore/system/al_Time.hpp"
+#include "allocore/ui/al_SynthSequencer.hpp"
+
+using namespace al;
+
+static const int NUM_FRAMES = 128;
+static const int GRAINS_PER_BLOCK = 256;
+static const int NUM_BLOCKS = 200;
+
+class Grain : public SynthVoice {
+public:
+	virtual void onProcess(AudioIOData& io) override {
+		while (io()) {
+			io.out(0) += 0.01f * std::sin(mPhase);
+			mPhase += 0.1f;
+			if (++mFrames >= NUM_FRAMES) {
+				free();
+				break;
+			}
+		}
+		if (mReleased) {
+			free();
+		}
+	}
+	virtual void onTriggerOn() override { mPhase = 0; mFrames = 0; mReleased = false; }
+	virtual void onTriggerOff() override { mReleased = true; }
+
+private:
+	float mPhase {0};
+	int mFrames {0};
+	bool mReleased {false};
+};
+
+// Additive voice whose cost grows with its number of partials
+class Partials : public SynthVoice {
+public:
+	virtual void onProcess(AudioIOData& io) override {
+		while (io()) {
+			float s = 0;
+			for (int i = 0; i < mNumPartials; i++) {
+				s += std::sin(mPhase * (i + 1)) / (i + 1);
+			}
+			io.out(0) += 0.001f * s;
+			mPhase += 0.01f;
+		}
+	}
+
+	int mNumPartials {1};
+
+private:
+	float mPhase {0};
+};
+
+int main(){
+	AudioIO io(NUM_FRAMES, 44100, NULL, NULL, 1, 0);
+
+	// Single thread: trigger a block of grains, then render them
+	{
+		PolySynth synth;
+		synth.allocatePolyphony<Grain>(2 * GRAINS_PER_BLOCK);
+		al_sec triggerSec = 0, renderSec = 0;
+		for (int b = 0; b < NUM_BLOCKS; b++) {
+			al_sec t0 = al_steady_time();
+			for (int i = 0; i < GRAINS_PER_BLOCK; i++) {
+				auto& grain = synth.getVoice<Grain>();
+				int id = synth.triggerOn(&grain, i % NUM_FRAMES);
+				if (i % 4 == 0) {
+					synth.triggerOff(id, NUM_FRAMES - 1);
+				}
+			}
+			triggerSec += al_steady_time() - t0;
+			io.zeroOut();
+			t0 = al_steady_time();
+			synth.render(io);
+			renderSec += al_steady_time() - t0;
+		}
+		int grains = GRAINS_PER_BLOCK * NUM_BLOCKS;
+		printf("\n%d grains per block of %d frames\n", GRAINS_PER_BLOCK, NUM_FRAMES);
+		printf("trigger: %.1f ns per grain\n", triggerSec / grains * 1e9);
+		printf("render:  %.1f us per block, %.1f ns per grain\n\n",
+			renderSec / NUM_BLOCKS * 1e6, renderSec / grains * 1e9);
+	}
+
+	// Triggering threads against a rendering thread
+	printf("threads   grains/s   max block (us)\n");
+	for (int numThreads = 1; numThreads <= 4; numThreads++) {
+		PolySynth synth;
+		synth.allocatePolyphony<Grain>(16384);
+		std::atomic<bool> running(true);
+		std::atomic<long> triggered(0);
+		std::atomic<int> pending(0);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < numThreads; t++) {
+			threads.emplace_back([&]() {
+				while (running) {
+					// Keep at most a few blocks of grains waiting for render()
+					if (pending.load() > 4 * GRAINS_PER_BLOCK) {
+						std::this_thread::yield();
+						continue;
+					}
+					auto& grain = synth.getVoice<Grain>();
+					synth.triggerOn(&grain, triggered % NUM_FRAMES);
+					pending++;
+					triggered++;
+				}
+			});
+		}
+		al_sec start = al_steady_time();
+		al_sec maxBlock = 0;
+		while (al_steady_time() - start < 1.0) {
+			pending = 0;
+			io.zeroOut();
+			al_sec t0 = al_steady_time();
+			synth.render(io);
+			maxBlock = std::max(maxBlock, al_steady_time() - t0);
+		}
+		running = false;
+		for (auto& thread : threads) {
+			thread.join();
+		}
+		double elapsed = al_steady_time() - start;
+		printf("%7d %10.0f %16.1f\n", numThreads, triggered / elapsed, maxBlock * 1e6);
+	}
+
+	// Sustained voices rendered on several threads
+	printf("\n512 voices of 1 to 16 partials\n");
+	printf("threads   block (us)\n");
+	for (int numThreads = 1; numThreads <= 4; numThreads *= 2) {
+		PolySynth synth(512);
+		synth.allocatePolyphony<Partials>(512);
+		synth.setNumThreads(numThreads);
+		synth.prepare(io);
+		for (int i = 0; i < 512; i++) {
+			auto& voice = synth.getVoice<Partials>();
+			voice.mNumPartials = 1 + (i * 7) % 16;
+			synth.triggerOn(&voice);
+		}
+		al_sec renderSec = 0;
+		for (int b = 0; b < NUM_BLOCKS; b++) {
+			io.zeroOut();
+			al_sec t0 = al_steady_time();
+			synth.render(io);
+			renderSec += al_steady_time() - t0;
+		}
+		printf("%7d %12.1f\n", numThreads, renderSec / NUM_BLOCKS * 1e6);
+	}
+	return 0;
+}
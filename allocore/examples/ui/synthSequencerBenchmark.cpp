@@ -0,0 +1,149 @@
+/*
+Allocore Example: SynthSequencer timeline benchmark
+
+Description:
+This measures the SynthSequencer timeline on a generated score of 100k notes
+over ten minutes. It times loading the score from a file, inserting the same
+notes with add() in random order, and compares the latter with inserting
+into a list by walking it from the start, as the sequencer did before. It
+then times seeks to random positions, and the dispatch of events per block
+while playing the whole score, alone and with a thread adding notes ahead of
+the play position.
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <list>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "allocore/io/al_AudioIO.hpp"
+#include "allocore/system/al_Time.hpp"
+#include "allocore/ui/al_SynthSequencer.hpp"
+
+using namespace al;
+
+static const int NUM_NOTES = 100000;
+static const double SCORE_LENGTH = 600;
+static const int NUM_FRAMES = 256;
+static const int NUM_SEEKS = 1000;
+
+// Note that writes its amplitude on its first frame
+class Note : public SynthVoice {
+public:
+	virtual void onProcess(AudioIOData& io) override {
+		if (io()) {
+			io.out(0) += mAmp;
+		}
+		free();
+	}
+	virtual bool setParamFields(float *pFields, int numFields) override {
+		if (numFields < 1) return false;
+		mAmp = pFields[0];
+		return true;
+	}
+
+	float mAmp {0.01f};
+};
+
+// Play the sequence block by block, returning the slowest block
+static al_sec play(SynthSequencer& seq, AudioIO& io, al_sec& total) {
+	seq.seek(0);
+	al_sec maxBlock = 0;
+	total = 0;
+	int numBlocks = SCORE_LENGTH * io.framesPerSecond() / NUM_FRAMES;
+	for (int b = 0; b < numBlocks; b++) {
+		io.zeroOut();
+		al_sec t0 = al_steady_time();
+		seq.render(io);
+		al_sec dt = al_steady_time() - t0;
+		total += dt;
+		maxBlock = std::max(maxBlock, dt);
+	}
+	return maxBlock;
+}
+
+int main(){
+	AudioIO io(NUM_FRAMES, 44100, NULL, NULL, 1, 0);
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<double> when(0, SCORE_LENGTH);
+	std::vector<double> times(NUM_NOTES);
+	for (auto& t : times) t = when(rng);
+
+	// Score file, in random order
+	const char *path = "synthSequencerBenchmark.sequence";
+	FILE *f = fopen(path, "w");
+	fprintf(f, "# %d generated notes\n", NUM_NOTES);
+	for (int i = 0; i < NUM_NOTES; i++) {
+		fprintf(f, "@ %f 0.1 Note %f\n", times[i], 0.01 * (i % 100));
+	}
+	fclose(f);
+
+	printf("\n%d notes over %.0f s\n\n", NUM_NOTES, SCORE_LENGTH);
+	{
+		SynthSequencer seq;
+		seq.registerSynthClass<Note>("Note");
+		al_sec t0 = al_steady_time();
+		seq.loadSequence(path);
+		printf("load file:        %8.1f ms\n", (al_steady_time() - t0) * 1e3);
+	}
+	remove(path);
+
+	SynthSequencer seq;
+	seq.allocatePolyphony<Note>(NUM_NOTES);
+	al_sec t0 = al_steady_time();
+	for (int i = 0; i < NUM_NOTES; i++) {
+		seq.add<Note>(times[i]);
+	}
+	printf("add():            %8.1f ms\n", (al_steady_time() - t0) * 1e3);
+
+	// The previous insertion, on a fifth of the notes as it is quadratic
+	{
+		std::list<SynthSequencerEvent> events;
+		t0 = al_steady_time();
+		for (int i = 0; i < NUM_NOTES / 5; i++) {
+			auto position = events.begin();
+			while (position != events.end() && position->startTime < times[i]) {
+				position++;
+			}
+			events.insert(position, SynthSequencerEvent())->startTime = times[i];
+		}
+		printf("list insertion:   %8.1f ms for %d notes\n", (al_steady_time() - t0) * 1e3, NUM_NOTES / 5);
+	}
+
+	// Each seek is applied by the render() of the next block
+	t0 = al_steady_time();
+	for (int i = 0; i < NUM_SEEKS; i++) {
+		seq.seek(when(rng));
+		io.zeroOut();
+		seq.render(io);
+	}
+	printf("seek + block:     %8.2f us\n\n", (al_steady_time() - t0) / NUM_SEEKS * 1e6);
+
+	al_sec total;
+	al_sec maxBlock = play(seq, io, total);
+	int numBlocks = SCORE_LENGTH * io.framesPerSecond() / NUM_FRAMES;
+	printf("play:             %8.2f us per block, max %.1f us\n", total / numBlocks * 1e6, maxBlock * 1e6);
+
+	// Another thread adds notes a second ahead of the play position
+	seq.allocatePolyphony<Note>(NUM_NOTES);
+	std::atomic<bool> running(true);
+	std::thread writer([&]() {
+		int added = 0;
+		while (running && added < NUM_NOTES) {
+			// Voices must not be modified after add() once the sequencer may
+			// have triggered them, so the default amplitude is used
+			seq.add<Note>(seq.time() + 1);
+			added++;
+			std::this_thread::yield();
+		}
+	});
+	maxBlock = play(seq, io, total);
+	running = false;
+	writer.join();
+	printf("play with writer: %8.2f us per block, max %.1f us\n", total / numBlocks * 1e6, maxBlock * 1e6);
+	return 0;
+}
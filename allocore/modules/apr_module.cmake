@@ -3,6 +3,7 @@ find_package(APR QUIET)
 
 set(APR_HEADERS
     allocore/io/al_Socket.hpp
+    allocore/io/al_SocketReactor.hpp
     allocore/system/al_Memory.hpp
 )
 
@@ -11,6 +12,7 @@ message(STATUS "Building APR module.")
 
 list(APPEND ALLOCORE_SRC
     src/io/al_SocketAPR.cpp
+    src/io/al_SocketReactor.cpp
     src/system/al_Memory.cpp
 )
 
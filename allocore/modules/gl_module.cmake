@@ -43,6 +43,7 @@ list(APPEND ALLOCORE_SRC
   src/io/al_App.cpp
   src/io/al_RenderToDisk.cpp
   src/io/al_Window.cpp
+  src/ui/al_SynthSequencer.cpp
   )
 
 # TODO empty  allocore/graphics/al_Slab.hpp, remove?
@@ -1,4 +1,5 @@
 #include <math.h>
+#include <algorithm>
 #include "allocore/graphics/al_Isosurface.hpp"
 #include "allocore/graphics/al_Graphics.hpp"
 
@@ -330,10 +331,12 @@ Isosurface::NoVertexAction Isosurface::noVertexAction;
 
 Isosurface::Isosurface(float lev, VertexAction& va)
 :	mIsolevel(lev), mVertexAction(&va),
-	mValidSurface(false), mComputeNormals(true), mNormalize(true), mInBox(false)
+	mValidSurface(false), mComputeNormals(true), mNormalize(true), mInBox(false),
+	mBrickNormalsOn(false), mDeadVertices(0), mDeadIndices(0), mNumUpdatedBricks(0)
 {
 	cellLengths(1);
 	fieldDims(0);
+	brickSize(8);
 }
 
 Isosurface::~Isosurface(){}
@@ -371,12 +374,7 @@ Compression pass:
 
 */
 
-void Isosurface::addCell(const int * cellIdx3, const float * vals){
-	const int &ix = cellIdx3[0];
-	const int &iy = cellIdx3[1];
-	const int &iz = cellIdx3[2];
-
-	// Get isosurface cell index depending on field values at corners of cell
+int Isosurface::cellCase(const float * vals) const {
 	int idx = 0;
 	if(vals[0] < level()) idx |=   1;
 	if(vals[2] < level()) idx |=   2;
@@ -386,6 +384,16 @@ void Isosurface::addCell(const int * cellIdx3, const float * vals){
 	if(vals[6] < level()) idx |=  32;
 	if(vals[7] < level()) idx |=  64;
 	if(vals[5] < level()) idx |= 128;
+	return idx;
+}
+
+void Isosurface::addCell(const int * cellIdx3, const float * vals){
+	const int &ix = cellIdx3[0];
+	const int &iy = cellIdx3[1];
+	const int &iz = cellIdx3[2];
+
+	// Get isosurface cell index depending on field values at corners of cell
+	int idx = cellCase(vals);
 
 	// Create a triangulation of the isosurface in this cell
 	const int edgeCode = sEdgeTable[idx];
@@ -523,6 +531,7 @@ Isosurface::calcIntersection(int ix, int iy, int iz, int edgeNo, const float * v
 
 void Isosurface::begin(){
 	mValidSurface = false;
+	mBricks.clear();
 	reset();
 }
 
@@ -570,33 +579,38 @@ Isosurface& Isosurface::cellLengths(double dx, double dy, double dz){
 }
 
 
-Isosurface& Isosurface::fieldDims(int nx, int ny, int nz){
-	mNF[0] = nx;
-	mNF[1] = ny;
-	mNF[2] = nz;
-
+// Set offsets used to obtain edge ID from cell ID and edge number in a grid
+// with nx by ny points per z slice
+static void setEdgeIDOffsets(int * offsets, int nx, int ny){
 	// offsets for edges going in positive directions at each corner
 	static const int ex = 0;
 	static const int ey = 1;
 	static const int ez = 2;
 
-	mEdgeIDOffsets[ 3] = ex;
-	mEdgeIDOffsets[ 0] = ey;
-	mEdgeIDOffsets[ 8] = ez;
+	offsets[ 3] = ex;
+	offsets[ 0] = ey;
+	offsets[ 8] = ez;
+
+	offsets[ 2] = ey + 3;
+	offsets[11] = ez + 3;
 
-	mEdgeIDOffsets[ 2] = ey + 3;
-	mEdgeIDOffsets[11] = ez + 3;
+	offsets[ 1] = ex + 3*nx;
+	offsets[ 9] = ez + 3*nx;
 
-	mEdgeIDOffsets[ 1] = ex + 3*mNF[0];
-	mEdgeIDOffsets[ 9] = ez + 3*mNF[0];
+	offsets[ 7] = ex + 3*nx*ny;
+	offsets[ 4] = ey + 3*nx*ny;
 
-	mEdgeIDOffsets[ 7] = ex + 3*mNF[0]*mNF[1];
-	mEdgeIDOffsets[ 4] = ey + 3*mNF[0]*mNF[1];
+	offsets[10] = ez + 3*(1 + nx     );
+	offsets[ 5] = ex + 3*(    nx + nx*ny);
+	offsets[ 6] = ey + 3*(1      + nx*ny);
+}
 
-	mEdgeIDOffsets[10] = ez + 3*(1 + mNF[0]                );
-	mEdgeIDOffsets[ 5] = ex + 3*(    mNF[0] + mNF[0]*mNF[1]);
-	mEdgeIDOffsets[ 6] = ey + 3*(1          + mNF[0]*mNF[1]);
 
+Isosurface& Isosurface::fieldDims(int nx, int ny, int nz){
+	mNF[0] = nx;
+	mNF[1] = ny;
+	mNF[2] = nz;
+	setEdgeIDOffsets(mEdgeIDOffsets, mNF[0], mNF[1]);
 	return *this;
 }
 
@@ -614,6 +628,300 @@ Isosurface& Isosurface::inBox(bool v){
 }
 
 
+Isosurface& Isosurface::brickSize(int cells){
+	mBrickSize = cells > 0 ? cells : 1;
+	int n = mBrickSize + 1; // field points along side of brick
+	setEdgeIDOffsets(mBrickEdgeIDOffsets, n, n);
+	mBrickEdgeToVertex.assign(3*n*n*n, -1);
+	mBricks.clear();
+	return *this;
+}
+
+
+void Isosurface::resetBricks(){
+	int numBricks = 1;
+	for(int i=0; i<3; ++i){
+		int numCells = std::max(mNF[i]-1, 0);
+		mNumBricks[i] = (numCells + mBrickSize - 1) / mBrickSize;
+		numBricks *= mNumBricks[i];
+		mBrickFieldDims[i] = mNF[i];
+		mBrickL[i] = mL[i];
+	}
+	mBrickLevel = mIsolevel;
+	Brick empty = {0,0,0, 0,0,0, true};
+	mBricks.assign(numBricks, empty);
+	mBrickNormalsOn = mComputeNormals;
+	mDeadVertices = mDeadIndices = 0;
+	reset();
+}
+
+
+void Isosurface::markDirty(int x0, int y0, int z0, int x1, int y1, int z1){
+	if(mBricks.empty()) return;
+
+	// A field point is used by the cells on either side of it and, through
+	// the gradient, by the cells one further out
+	int p0[3] = {x0, y0, z0};
+	int p1[3] = {x1, y1, z1};
+	int b0[3], b1[3];
+	for(int i=0; i<3; ++i){
+		int c0 = std::max(p0[i]-2, 0);
+		int c1 = std::min(p1[i], mNF[i]-2); // last cell using point p1-1
+		if(c0 > c1) return;
+		b0[i] = c0 / mBrickSize;
+		b1[i] = c1 / mBrickSize;
+	}
+
+	for(int z=b0[2]; z<=b1[2]; ++z){
+	for(int y=b0[1]; y<=b1[1]; ++y){
+	for(int x=b0[0]; x<=b1[0]; ++x){
+		mBricks[x + mNumBricks[0]*(y + mNumBricks[1]*z)].dirty = true;
+	}}}
+}
+
+
+void Isosurface::markDirty(){
+	for(auto& b : mBricks) b.dirty = true;
+}
+
+
+void Isosurface::update(const float * field, bool diffField){
+
+	if(mBricks.empty() || mBrickNormalsOn != mComputeNormals
+		|| mBrickFieldDims[0] != mNF[0]
+		|| mBrickFieldDims[1] != mNF[1]
+		|| mBrickFieldDims[2] != mNF[2]
+		|| mBrickL[0] != mL[0] || mBrickL[1] != mL[1] || mBrickL[2] != mL[2]
+		|| mBrickLevel != mIsolevel
+	){
+		resetBricks();
+	}
+
+	// Without diffing, the field may change unseen, so the next diffed
+	// update starts over from a full extraction
+	if(!diffField){
+		mPrevField.clear();
+	}
+	else{
+		const int Nx = mNF[0], Ny = mNF[1], Nz = mNF[2];
+		if(int(mPrevField.size()) != Nx*Ny*Nz){
+			mPrevField.assign(field, field + Nx*Ny*Nz);
+			markDirty();
+		}
+		else{
+			// Mark the points that differ from the previous field, merging
+			// runs along x
+			for(int z=0; z<Nz; ++z){
+			for(int y=0; y<Ny; ++y){
+				const int row = Nx*(y + Ny*z);
+				const float * src = field + row;
+				float * prev = &mPrevField[row];
+				for(int x=0; x<Nx; ++x){
+					if(src[x] != prev[x]){
+						int x0 = x;
+						for(; x<Nx && src[x] != prev[x]; ++x) prev[x] = src[x];
+						markDirty(x0,y,z, x,y+1,z+1);
+					}
+				}
+			}}
+		}
+	}
+
+	primitive(Graphics::TRIANGLES);
+
+	mNumUpdatedBricks = 0;
+	for(unsigned b=0; b<mBricks.size(); ++b){
+		if(mBricks[b].dirty){
+			extractBrick(b, field);
+			placeBrick(b);
+			mBricks[b].dirty = false;
+			++mNumUpdatedBricks;
+		}
+	}
+
+	int liveVertices = Mesh::vertices().size() - mDeadVertices;
+	if(mDeadVertices > 1024 && mDeadVertices > liveVertices){
+		compactBricks();
+	}
+
+	mValidSurface = true;
+}
+
+
+void Isosurface::extractBrick(int brick, const float * field){
+
+	mBrickVertices.clear();
+	mBrickNormals.clear();
+	mBrickIndices.clear();
+
+	const int Nx = mNF[0];
+	const int Nxy = mNF[0]*mNF[1];
+	const int n = mBrickSize + 1;
+
+	int bx = brick % mNumBricks[0];
+	int by = (brick / mNumBricks[0]) % mNumBricks[1];
+	int bz = brick / (mNumBricks[0]*mNumBricks[1]);
+	int c0[3] = { bx*mBrickSize, by*mBrickSize, bz*mBrickSize };
+	int c1[3];
+	for(int i=0; i<3; ++i) c1[i] = std::min(c0[i] + mBrickSize, mNF[i]-1);
+
+	// Field gradient at a field point from central differences, or one-sided
+	// differences on the boundary
+	auto gradient = [&](const Vec3i& p){
+		Vec3f g;
+		const int strides[3] = { 1, Nx, Nxy };
+		int i = p[0] + Nx*p[1] + Nxy*p[2];
+		for(int k=0; k<3; ++k){
+			int lo = p[k] > 0 ? 1 : 0;
+			int hi = p[k] < mNF[k]-1 ? 1 : 0;
+			g[k] = (lo+hi) ? (field[i + hi*strides[k]] - field[i - lo*strides[k]]) / ((lo+hi)*mL[k]) : 0;
+		}
+		return g;
+	};
+
+	for(int z=c0[2]; z<c1[2]; ++z){
+	for(int y=c0[1]; y<c1[1]; ++y){
+		const int z0y0 = z*Nxy + y*Nx;
+		const int z0y1 = z0y0 + Nx;
+		const int z1y0 = z0y0 + Nxy;
+		const int z1y1 = z1y0 + Nx;
+
+		for(int x=c0[0]; x<c1[0]; ++x){
+			const float vals[8] = {
+				field[z0y0 + x], field[z0y0 + x+1],
+				field[z0y1 + x], field[z0y1 + x+1],
+				field[z1y0 + x], field[z1y0 + x+1],
+				field[z1y1 + x], field[z1y1 + x+1]
+			};
+
+			int idx = cellCase(vals);
+			const int edgeCode = sEdgeTable[idx];
+			if(!edgeCode) continue;
+
+			int cID = 3*((x-c0[0]) + n*((y-c0[1]) + n*(z-c0[2])));
+
+			for(int e=0; e<12; ++e){
+				if(!(edgeCode & (1<<e))) continue;
+				int eIdx = cID + mBrickEdgeIDOffsets[e];
+				if(mBrickEdgeToVertex[eIdx] >= 0) continue;
+
+				EdgeVertex ev = calcIntersection(x,y,z, e, vals);
+				mBrickEdgeToVertex[eIdx] = mBrickVertices.size();
+				mBrickEdges.push_back(eIdx);
+				mBrickVertices.push_back(Vertex(ev.x, ev.y, ev.z));
+
+				if(mComputeNormals){
+					Vec3i p(x,y,z);
+					Vec3f g0 = gradient(p + ev.corners[0]);
+					Vec3f g1 = gradient(p + ev.corners[1]);
+					// Surface faces towards decreasing values
+					Normal nrm = -(g0 + (g1 - g0) * ev.mu);
+					if(mNormalize) nrm.normalize();
+					mBrickNormals.push_back(nrm);
+				}
+			}
+
+			for(int i=1; i <= sTriTable[idx][0]; i+=3){
+				mBrickIndices.push_back(mBrickEdgeToVertex[cID + mBrickEdgeIDOffsets[sTriTable[idx][i+2]]]);
+				mBrickIndices.push_back(mBrickEdgeToVertex[cID + mBrickEdgeIDOffsets[sTriTable[idx][i+1]]]);
+				mBrickIndices.push_back(mBrickEdgeToVertex[cID + mBrickEdgeIDOffsets[sTriTable[idx][i  ]]]);
+			}
+		}
+	}}
+
+	for(int e : mBrickEdges) mBrickEdgeToVertex[e] = -1;
+	mBrickEdges.clear();
+}
+
+
+// Set size of buffer, growing its capacity geometrically
+template <class T>
+static void growTo(Buffer<T>& buf, int size){
+	if(buf.capacity() < size) buf.resize(std::max(size, buf.capacity()*2));
+	buf.size(size);
+}
+
+
+void Isosurface::placeBrick(int brick){
+	Brick& b = mBricks[brick];
+	const int nv = mBrickVertices.size();
+	const int ni = mBrickIndices.size();
+
+	// Move brick to end of buffers if it no longer fits in its range
+	if(nv > b.vertexCapacity || ni > b.indexCapacity){
+		for(int i=0; i<b.indexCapacity; ++i) Mesh::indices()[b.indexStart + i] = 0;
+		mDeadVertices += b.vertexCapacity;
+		mDeadIndices += b.indexCapacity;
+
+		// Leave room for the surface to grow
+		b.vertexCapacity = nv + nv/4;
+		b.indexCapacity = (ni + ni/4) / 3 * 3;
+		b.vertexStart = Mesh::vertices().size();
+		b.indexStart = Mesh::indices().size();
+		growTo(Mesh::vertices(), b.vertexStart + b.vertexCapacity);
+		if(mComputeNormals) growTo(Mesh::normals(), b.vertexStart + b.vertexCapacity);
+		growTo(Mesh::indices(), b.indexStart + b.indexCapacity);
+	}
+
+	b.vertexCount = nv;
+	b.indexCount = ni;
+
+	if(nv){
+		std::copy(mBrickVertices.begin(), mBrickVertices.end(), &Mesh::vertices()[b.vertexStart]);
+		if(mComputeNormals){
+			std::copy(mBrickNormals.begin(), mBrickNormals.end(), &Mesh::normals()[b.vertexStart]);
+		}
+	}
+
+	Index * dst = Mesh::indices().elems() + b.indexStart;
+	for(int i=0; i<ni; ++i) dst[i] = b.vertexStart + mBrickIndices[i];
+	// Degenerate triangles in unused part of range
+	for(int i=ni; i<b.indexCapacity; ++i) dst[i] = 0;
+}
+
+
+void Isosurface::compactBricks(){
+	Vertices vertices;
+	Normals normals;
+	Indices indices;
+
+	int nv = 0, ni = 0;
+	for(auto& b : mBricks){
+		nv += b.vertexCount + b.vertexCount/4;
+		ni += (b.indexCount + b.indexCount/4) / 3 * 3;
+	}
+	vertices.resize(nv);
+	if(mComputeNormals) normals.resize(nv);
+	indices.resize(ni);
+
+	int vertexStart = 0, indexStart = 0;
+	for(auto& b : mBricks){
+		int vertexCapacity = b.vertexCount + b.vertexCount/4;
+		int indexCapacity = (b.indexCount + b.indexCount/4) / 3 * 3;
+		std::copy(&mVertices[b.vertexStart], &mVertices[b.vertexStart] + b.vertexCount, &vertices[vertexStart]);
+		if(mComputeNormals){
+			std::copy(&mNormals[b.vertexStart], &mNormals[b.vertexStart] + b.vertexCount, &normals[vertexStart]);
+		}
+		for(int i=0; i<b.indexCount; ++i){
+			indices[indexStart + i] = mIndices[b.indexStart + i] - b.vertexStart + vertexStart;
+		}
+		for(int i=b.indexCount; i<indexCapacity; ++i) indices[indexStart + i] = 0;
+
+		b.vertexStart = vertexStart;
+		b.vertexCapacity = vertexCapacity;
+		b.indexStart = indexStart;
+		b.indexCapacity = indexCapacity;
+		vertexStart += vertexCapacity;
+		indexStart += indexCapacity;
+	}
+
+	mVertices = vertices;
+	if(mComputeNormals) mNormals = normals;
+	Mesh::indices() = indices;
+	mDeadVertices = mDeadIndices = 0;
+}
+
+
 bool Isosurface::volumeLengths(double& volLengthX, double& volLengthY, double& volLengthZ) const {
 	if(validSurface()){
 		volLengthX = mL[0]*(mNF[0]-1);
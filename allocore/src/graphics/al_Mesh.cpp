@@ -1,16 +1,62 @@
 #include <algorithm> // transform
 #include <cctype> // tolower
-#include <map>
-#include <set>
+#include <cmath>
+#include <cstdint>
+#include <cstring> // memcpy
 #include <string>
 #include <vector>
 #include <fstream>
 #include "allocore/graphics/al_Mesh.hpp"
 #include "allocore/system/al_Printing.hpp"
+#include "allocore/system/al_TaskPool.hpp"
 #include "allocore/graphics/al_Graphics.hpp"
 
 namespace al{
 
+namespace{
+
+// Smallest number of vertices or faces worth handing to another thread
+const int parallelGrain = 4096;
+
+// Call func(i1,i2,i3) on the triangles or triangle strip of a mesh, with
+// strips unwound to consistent winding. Triangles with invalid indices are
+// skipped.
+template <class Func, class Indexer>
+void forEachTriangle(const Mesh& m, int N, Indexer idx, Func& func){
+	const unsigned Nv = m.vertices().size();
+	if(m.primitive() == Graphics::TRIANGLES){
+		for(int i=0; i+2<N; i+=3){
+			unsigned i1 = idx[i], i2 = idx[i+1], i3 = idx[i+2];
+			if(i1 < Nv && i2 < Nv && i3 < Nv) func(i1, i2, i3);
+		}
+	}
+	else if(m.primitive() == Graphics::TRIANGLE_STRIP){
+		for(int i=0; i+2<N; ++i){
+			// Flip every other triangle due to change in winding direction
+			int odd = i & 1;
+			unsigned i1 = idx[i], i2 = idx[i+1+odd], i3 = idx[i+2-odd];
+			if(i1 < Nv && i2 < Nv && i3 < Nv) func(i1, i2, i3);
+		}
+	}
+}
+
+// Index sequence 0, 1, 2, ... of a mesh without indices
+struct Identity{
+	unsigned operator[](int i) const { return i; }
+};
+
+template <class Func>
+void forEachTriangle(const Mesh& m, Func func){
+	if(m.indices().size()){
+		forEachTriangle(m, m.indices().size(), m.indices().elems(), func);
+	}
+	else{
+		forEachTriangle(m, m.vertices().size(), Identity(), func);
+	}
+}
+
+}
+
 Mesh::Mesh(int primitive)
 :	mPrimitive(primitive)
 {}
@@ -183,114 +229,240 @@ void Mesh::invertNormals() {
 }
 
 void Mesh::compress() {
-
-	int Ni = indices().size();
-	int Nv = vertices().size();
-	if (Ni) {
-		AL_WARN_ONCE("cannot compress Mesh with indices");
-		return;
-	}
-	if (Nv == 0) {
+	if (vertices().size() == 0) {
 		AL_WARN_ONCE("cannot compress Mesh with no vertices");
 		return;
 	}
+	weld(0, false);
+}
 
-	int Nc = colors().size();
-	int Nci = coloris().size();
-	int Nn = normals().size();
-	int Nt1 = texCoord1s().size();
-	int Nt2 = texCoord2s().size();
-	int Nt3 = texCoord3s().size();
+namespace{
 
-	// map tree to uniquely ID vertices with same values:
-	typedef std::map<float, int> Zmap;
-	typedef std::map<float, Zmap> Ymap;
-	typedef std::map<float, Ymap> Xmap;
-	Xmap xmap;
+// Grid cell of a vertex position used as the key when welding
+struct WeldCell{
+	int64_t c[3];
 
-	// copy current values:
-	Mesh old(*this);
+	uint32_t hash() const {
+		uint64_t h = uint64_t(c[0]) * 0x9E3779B97F4A7C15ULL
+				   ^ uint64_t(c[1]) * 0xC2B2AE3D27D4EB4FULL
+				   ^ uint64_t(c[2]) * 0x165667B19E3779F9ULL;
+		return uint32_t(h ^ (h >> 29));
+	}
+};
 
-	// walk backward through the vertex list
-	// create a ID for each one
-	for (int i=vertices().size()-1; i>=0; i--) {
-		Vertex& v = vertices()[i];
-		xmap[v.x][v.y][v.z] = i;
+struct Welder{
+	float eps;
+	double invCellSize;
+
+	// With a tolerance, cells are twice its size so that a vertex can only
+	// match vertices in its own cell or the adjacent cell on the side it is
+	// nearer to along each axis. Without one, the cell is the exact position.
+	WeldCell cell(const Mesh::Vertex& v, int * side = 0) const {
+		WeldCell k;
+		for(int i=0; i<3; ++i){
+			if(eps > 0){
+				double x = v[i] * invCellSize;
+				double f = std::floor(x);
+				k.c[i] = int64_t(f);
+				if(side) side[i] = (x - f) < 0.5 ? -1 : 1;
+			}
+			else{
+				float x = v[i] + 0.f; // -0 -> +0
+				uint32_t bits;
+				std::memcpy(&bits, &x, 4);
+				k.c[i] = bits;
+			}
+		}
+		return k;
 	}
 
-	// map of old vertex index to new vertex index:
-	typedef std::map<int, int> Imap;
-	Imap imap;
+	bool near(float a, float b) const {
+		return eps > 0 ? std::abs(a - b) <= eps : a == b;
+	}
 
+	template <int N, class T>
+	bool near(const Vec<N,T>& a, const Vec<N,T>& b) const {
+		for(int i=0; i<N; ++i) if(!near(a[i], b[i])) return false;
+		return true;
+	}
 
-	// reset current mesh:
-	reset();
+	bool near(const Color& a, const Color& b) const {
+		for(int i=0; i<4; ++i) if(!near(a[i], b[i])) return false;
+		return true;
+	}
 
-	// walk forward, inserting if
-	for (int i=0; i<old.vertices().size(); i++) {
-		Vertex& v = old.vertices()[i];
-		int idx = xmap[v.x][v.y][v.z];
-		Imap::iterator it = imap.find(idx);
-		if (it != imap.end()) {
-			// use existing
-			index(it->second);
-		} else {
-			// create new
-			int newidx = vertices().size();
-			vertex(v);
-			if (Nc) color(old.colors()[i]);
-			if (Nci) colori(old.coloris()[i]);
-			if (Nn) normal(old.normals()[i]);
-			if (Nt1) texCoord(old.texCoord1s()[i]);
-			if (Nt2) texCoord(old.texCoord2s()[i]);
-			if (Nt3) texCoord(old.texCoord3s()[i]);
-			// store new index:
-			imap[idx] = newidx;
-			// use new index:
-			index(newidx);
+	bool near(const Colori& a, const Colori& b) const {
+		return a == b;
+	}
+};
+
+}
+
+int Mesh::weld(float eps, bool attributes) {
+
+	const int Nv = vertices().size();
+	if(Nv == 0) return 0;
+
+	Welder w;
+	w.eps = eps > 0 ? eps : 0;
+	w.invCellSize = w.eps > 0 ? 0.5 / w.eps : 0;
+
+	// Attribute buffers with one element per vertex are compacted along with
+	// the vertices and, if requested, compared when welding
+	bool hasN = normals().size() >= Nv;
+	bool hasC = colors().size() >= Nv;
+	bool hasCi= coloris().size() >= Nv;
+	bool hasT1= texCoord1s().size() >= Nv;
+	bool hasT2= texCoord2s().size() >= Nv;
+	bool hasT3= texCoord3s().size() >= Nv;
+
+	// Open addressed hash table of (new) vertex indices
+	unsigned tableSize = 16;
+	while(tableSize < unsigned(Nv)*2) tableSize <<= 1;
+	const unsigned mask = tableSize - 1;
+	std::vector<int> table(tableSize, -1);
+
+	std::vector<Index> remap(Nv);
+	int count = 0;
+
+	for(int i=0; i<Nv; ++i){
+		const Vertex v = vertices()[i];
+		int side[3];
+		const WeldCell home = w.cell(v, side);
+
+		// Search the home cell and, with a tolerance, its 7 neighbors for the
+		// earliest vertex within range
+		int match = -1;
+		const int numCells = w.eps > 0 ? 8 : 1;
+		for(int n=0; n<numCells; ++n){
+			WeldCell k = home;
+			for(int d=0; d<3; ++d) if(n & (1<<d)) k.c[d] += side[d];
+
+			for(unsigned s = k.hash() & mask; table[s] >= 0; s = (s+1) & mask){
+				int j = table[s];
+				if(match >= 0 && j >= match) continue;
+				if(!w.near(vertices()[j], v)) continue;
+				if(attributes){
+					if(hasN && !w.near(normals()[j], normals()[i])) continue;
+					if(hasC && !w.near(colors()[j], colors()[i])) continue;
+					if(hasCi&& !w.near(coloris()[j], coloris()[i])) continue;
+					if(hasT1&& !w.near(texCoord1s()[j], texCoord1s()[i])) continue;
+					if(hasT2&& !w.near(texCoord2s()[j], texCoord2s()[i])) continue;
+					if(hasT3&& !w.near(texCoord3s()[j], texCoord3s()[i])) continue;
+				}
+				match = j;
+			}
 		}
+
+		if(match >= 0){
+			remap[i] = match;
+			continue;
+		}
+
+		// Keep vertex, moving it down to its new index
+		if(count != i){
+			vertices()[count] = v;
+			if(hasN) normals()[count] = normals()[i];
+			if(hasC) colors()[count] = colors()[i];
+			if(hasCi) coloris()[count] = coloris()[i];
+			if(hasT1) texCoord1s()[count] = texCoord1s()[i];
+			if(hasT2) texCoord2s()[count] = texCoord2s()[i];
+			if(hasT3) texCoord3s()[count] = texCoord3s()[i];
+		}
+		unsigned s = home.hash() & mask;
+		while(table[s] >= 0) s = (s+1) & mask;
+		table[s] = count;
+		remap[i] = count++;
 	}
+
+	vertices().size(count);
+	if(hasN) normals().size(count);
+	if(hasC) colors().size(count);
+	if(hasCi) coloris().size(count);
+	if(hasT1) texCoord1s().size(count);
+	if(hasT2) texCoord2s().size(count);
+	if(hasT3) texCoord3s().size(count);
+
+	const int Ni = indices().size();
+	if(Ni){
+		for(int i=0; i<Ni; ++i){
+			Index& idx = indices()[i];
+			if(idx < Index(Nv)) idx = remap[idx];
+		}
+	}
+	else{
+		indices().size(Nv);
+		std::copy(remap.begin(), remap.end(), indices().elems());
+	}
+
+	return count;
+}
+
+const Mesh::Adjacency& Mesh::adjacency() const {
+
+	const int Nv = vertices().size();
+	const int Ni = indices().size();
+
+	if(!mAdjacencyDirty && mAdjacency.numVertices() == Nv) return mAdjacency;
+	mAdjacencyDirty = false;
+
+	Adjacency& adj = mAdjacency;
+
+	// Triangles, with strips unwound to consistent winding
+	const int N = Ni ? Ni : Nv;
+	adj.triangles.clear();
+	adj.triangles.reserve(primitive() == Graphics::TRIANGLE_STRIP ? std::max(N-2, 0) : N/3);
+	forEachTriangle(*this, [&](int i1, int i2, int i3){
+		adj.triangles.push_back(TriFace(i1,i2,i3));
+	});
+	const int Nf = adj.triangles.size();
+
+	// Faces of each vertex
+	adj.faceOffsets.assign(Nv+1, 0);
+	for(int f=0; f<Nf; ++f){
+		for(int k=0; k<3; ++k) ++adj.faceOffsets[adj.triangles[f][k]+1];
+	}
+	for(int i=0; i<Nv; ++i) adj.faceOffsets[i+1] += adj.faceOffsets[i];
+	adj.faces.resize(Nf*3);
+	{
+		std::vector<int> fill(adj.faceOffsets.begin(), adj.faceOffsets.end()-1);
+		for(int f=0; f<Nf; ++f){
+			for(int k=0; k<3; ++k) adj.faces[fill[adj.triangles[f][k]]++] = f;
+		}
+	}
+
+	// Neighbors of each vertex: gather the other corners of its faces into
+	// room for two per face, remove duplicates, then compact
+	std::vector<int> raw(Nf*6);
+	std::vector<int> degree(Nv);
+	TaskPool::global().parallelFor(0, Nv, parallelGrain, [&](int begin, int end){
+		for(int i=begin; i<end; ++i){
+			int * dst = raw.data() + adj.faceOffsets[i]*2;
+			int * d = dst;
+			for(const int * f = adj.facesBegin(i); f != adj.facesEnd(i); ++f){
+				const TriFace& t = adj.triangles[*f];
+				for(int k=0; k<3; ++k) if(t[k] != i) *d++ = t[k];
+			}
+			std::sort(dst, d);
+			degree[i] = std::unique(dst, d) - dst;
+		}
+	});
+
+	adj.neighborOffsets.resize(Nv+1);
+	adj.neighborOffsets[0] = 0;
+	for(int i=0; i<Nv; ++i) adj.neighborOffsets[i+1] = adj.neighborOffsets[i] + degree[i];
+	adj.neighbors.resize(adj.neighborOffsets[Nv]);
+	TaskPool::global().parallelFor(0, Nv, parallelGrain, [&](int begin, int end){
+		for(int i=begin; i<end; ++i){
+			const int * src = raw.data() + adj.faceOffsets[i]*2;
+			std::copy(src, src + degree[i], adj.neighbors.begin() + adj.neighborOffsets[i]);
+		}
+	});
+
+	return adj;
 }
 
 void Mesh::generateNormals(bool normalize, bool equalWeightPerFace) {
-//	/*
-//		Multi-pass algorithm:
-//			generate a list of faces (assume triangles?)
-//				(vary according to whether mIndices is used)
-//			calculate normal per face (use normal<float>(dst, p0, p1, p2))
-//			vertices may be used in multiple faces; their norm should be an average of the uses
-//				easy enough if indices is being used; not so easy otherwise.
-//					create a lookup table by hashing on vertex x,y,z
-//
-//
-//			write avg into corresponding normals for each vertex
-//				EXCEPT: if edge is sharper than @angle, just use the face normal directly
-//	*/
-//	std::vector<TriFace> faces;
-//
-//	std::map<std::string, int> vertexHash;
-//
-//	int Ni = indices().size();
-//	int Nv = vertices().size();
-//	if (Ni) {
-//		for (int i=0; i<Ni;) {
-//			TriFace face(
-//				mVertices[mIndices[i++]],
-//				mVertices[mIndices[i++]],
-//				mVertices[mIndices[i++]]
-//			);
-//			faces.push_back(face);
-//		}
-//	} else {
-//		for (int i=0; i<Nv;) {
-//			TriFace face(
-//				mVertices[i++],
-//				mVertices[i++],
-//				mVertices[i++]
-//			);
-//			faces.push_back(face);
-//		}
-//	}
 
 	struct F{
 		static Vertex calcNormal(const Vertex& v1, const Vertex& v2, const Vertex& v3, bool MWE){
@@ -312,7 +484,7 @@ void Mesh::generateNormals(bool normalize, bool equalWeightPerFace) {
 		}
 	};
 
-	unsigned Nv = vertices().size();
+	const int Nv = vertices().size();
 
 	// need at least one triangle
 	if(Nv < 3) return;
@@ -320,101 +492,64 @@ void Mesh::generateNormals(bool normalize, bool equalWeightPerFace) {
 	// make same number of normals as vertices
 	normals().size(Nv);
 
-	// compute vertex based normals
-	if(indices().size()){
-
-		for(unsigned i=0; i<Nv; ++i) normals()[i].set(0,0,0);
+	const int Ni = mIndices.size(); // not indices(), which invalidates the adjacency
 
-		unsigned Ni = indices().size();
-
-		if(primitive() == Graphics::TRIANGLES){
-			Ni = Ni - (Ni%3); // must be multiple of 3
-
-			for(unsigned i=0; i<Ni; i+=3){
-				Index i1 = indices()[i  ];
-				Index i2 = indices()[i+1];
-				Index i3 = indices()[i+2];
-
-				Vertex vn = F::calcNormal(
-					vertices()[i1], vertices()[i2], vertices()[i3],
-					equalWeightPerFace
-				);
-
-				normals()[i1] += vn;
-				normals()[i2] += vn;
-				normals()[i3] += vn;
+	// non-indexed triangles: compute face based normals
+	if(!Ni && primitive() == Graphics::TRIANGLES){
+		TaskPool::global().parallelFor(0, Nv/3, parallelGrain, [&](int begin, int end){
+			for(int f=begin; f<end; ++f){
+				int i = f*3;
+				Vertex vn = cross(vertices()[i+1]-vertices()[i], vertices()[i+2]-vertices()[i]);
+				if(normalize) vn.normalize();
+				normals()[i] = normals()[i+1] = normals()[i+2] = vn;
 			}
-		}
-		else if(primitive() == Graphics::TRIANGLE_STRIP){
-			for(unsigned i=0; i<Ni-2; ++i){
-
-				// Flip every other normal due to change in winding direction
-				unsigned odd = i & 1;
-
-				Index i1 = indices()[i];
-				Index i2 = indices()[i+1+odd];
-				Index i3 = indices()[i+2-odd];
+		});
+	}
 
-				Vertex vn = F::calcNormal(
-					vertices()[i1], vertices()[i2], vertices()[i3],
+	// compute vertex based normals by summing the faces of each vertex in
+	// parallel, if the adjacency is cached and there are threads to use
+	else if(!mAdjacencyDirty && mAdjacency.numVertices() == Nv
+		&& TaskPool::global().size() > 1 && Nv >= parallelGrain
+	){
+		const Adjacency& adj = adjacency();
+		const int Nf = adj.triangles.size();
+
+		std::vector<Vertex> faceNormals(Nf);
+		TaskPool::global().parallelFor(0, Nf, parallelGrain, [&](int begin, int end){
+			for(int f=begin; f<end; ++f){
+				const TriFace& t = adj.triangles[f];
+				faceNormals[f] = F::calcNormal(
+					vertices()[t[0]], vertices()[t[1]], vertices()[t[2]],
 					equalWeightPerFace
 				);
-
-				normals()[i1] += vn;
-				normals()[i2] += vn;
-				normals()[i3] += vn;
 			}
-		}
-
-		// normalize the normals
-		if(normalize) for(unsigned i=0; i<Nv; ++i) normals()[i].normalize();
-	}
-
-	// non-indexed case
-	else{
-		// compute face based normals
-		if(primitive() == Graphics::TRIANGLES){
-			unsigned N = Nv - (Nv % 3);
-
-			for(unsigned i=0; i<N; i+=3){
-				unsigned i1 = i+0;
-				unsigned i2 = i+1;
-				unsigned i3 = i+2;
-				const Vertex& v1 = vertices()[i1];
-				const Vertex& v2 = vertices()[i2];
-				const Vertex& v3 = vertices()[i3];
-
-				Vertex vn = cross(v2-v1, v3-v1);
+		});
+
+		// Sum in face order, as a serial scatter would
+		TaskPool::global().parallelFor(0, Nv, parallelGrain, [&](int begin, int end){
+			for(int i=begin; i<end; ++i){
+				Vertex vn(0,0,0);
+				for(const int * f = adj.facesBegin(i); f != adj.facesEnd(i); ++f){
+					vn += faceNormals[*f];
+				}
 				if(normalize) vn.normalize();
-
-				normals()[i1] = vn;
-				normals()[i2] = vn;
-				normals()[i3] = vn;
-			}
-		}
-		// compute vertex based normals
-		else if(primitive() == Graphics::TRIANGLE_STRIP){
-
-			for(unsigned i=0; i<Nv; ++i) normals()[i].set(0,0,0);
-
-			for(unsigned i=0; i<Nv-2; ++i){
-
-				// Flip every other normal due to change in winding direction
-				unsigned odd = i & 1;
-
-				Vertex vn = F::calcNormal(
-					vertices()[i], vertices()[i+1+odd], vertices()[i+2-odd],
-					equalWeightPerFace
-				);
-
-				normals()[i  ] += vn;
-				normals()[i+1] += vn;
-				normals()[i+2] += vn;
+				normals()[i] = vn;
 			}
+		});
+	}
 
-			// normalize the normals
-			if(normalize) for(unsigned i=0; i<Nv; ++i) normals()[i].normalize();
-		}
+	// otherwise, scatter face normals to their vertices in face order
+	else if(Ni || primitive() == Graphics::TRIANGLE_STRIP){
+		const Vertex * verts = vertices().elems();
+		Normal * norms = normals().elems();
+		for(int i=0; i<Nv; ++i) norms[i].set(0,0,0);
+		forEachTriangle(*this, [=](int i1, int i2, int i3){
+			Vertex vn = F::calcNormal(verts[i1], verts[i2], verts[i3], equalWeightPerFace);
+			norms[i1] += vn;
+			norms[i2] += vn;
+			norms[i3] += vn;
+		});
+		if(normalize) for(int i=0; i<Nv; ++i) norms[i].normalize();
 	}
 }
 
@@ -515,54 +650,46 @@ void Mesh::ribbonize(float * widths, int widthsStride, bool faceBinormal){
 
 
 void Mesh::smooth(float amount, int weighting){
-	std::map<int, std::set<int>> nodes;
+	// Separate triangles share no vertices to smooth across
+	if(!mIndices.size() && primitive() == Graphics::TRIANGLES) return;
 
-	int Ni = indices().size();
-
-	// Build adjacency map
-	for(int i=0; i<Ni; i+=3){
-		int i0 = indices()[i  ];
-		int i1 = indices()[i+1];
-		int i2 = indices()[i+2];
-		nodes[i0].insert(i1);
-		nodes[i0].insert(i2);
-		nodes[i1].insert(i2);
-		nodes[i1].insert(i0);
-		nodes[i2].insert(i0);
-		nodes[i2].insert(i1);
-	}
+	const Adjacency& adj = adjacency();
 
 	Mesh::Vertices vertsCopy(vertices());
 
-	for(const auto& node: nodes){
-		Mesh::Vertex sum(0,0,0);
-		const auto& adjs = node.second;
+	TaskPool::global().parallelFor(0, adj.numVertices(), parallelGrain, [&](int begin, int end){
+		for(int i=begin; i<end; ++i){
+			const int * adjBegin = adj.neighborsBegin(i);
+			const int * adjEnd = adj.neighborsEnd(i);
+			if(adjBegin == adjEnd) continue;
 
-		switch(weighting){
-		case 0: { // equal weighting
-			for(auto adj : adjs){
-				sum += vertsCopy[adj];
-			}
-			sum /= adjs.size();
-		} break;
-
-		case 1: { // inverse distance weights; reduces vertex sliding
-			float sumw = 0;
-			for(auto adj : adjs){
-				const auto& v = vertsCopy[adj];
-				const auto& c = vertsCopy[node.first];
-				float dist = (v-c).mag();
-				float w = 1./dist;
-				sumw += w;
-				sum += v * w;
+			Mesh::Vertex sum(0,0,0);
+			const auto& c = vertsCopy[i];
+
+			switch(weighting){
+			case 0: { // equal weighting
+				for(const int * a = adjBegin; a != adjEnd; ++a){
+					sum += vertsCopy[*a];
+				}
+				sum /= adjEnd - adjBegin;
+			} break;
+
+			case 1: { // inverse distance weights; reduces vertex sliding
+				float sumw = 0;
+				for(const int * a = adjBegin; a != adjEnd; ++a){
+					const auto& v = vertsCopy[*a];
+					float dist = (v-c).mag();
+					float w = 1./dist;
+					sumw += w;
+					sum += v * w;
+				}
+				sum /= sumw;
+			} break;
 			}
-			sum /= sumw;
-		} break;
-		}
 
-		auto& orig = vertices()[node.first];
-		orig = (sum-orig)*amount + orig;
-	}
+			vertices()[i] = (sum-c)*amount + c;
+		}
+	});
 }
 
 
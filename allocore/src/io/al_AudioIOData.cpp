@@ -38,9 +38,9 @@ void AudioDeviceInfo::setDefaultSampleRate(double rate) {
 //==============================================================================
 
 AudioIOData::AudioIOData(void *userData)
-    : mUser(userData), mFrame(0), mFramesPerBuffer(0), mFramesPerSecond(0),
-      mBufI(nullptr), mBufO(nullptr), mBufB(nullptr), mBufT(nullptr), mNumI(0),
-      mNumO(0), mNumB(0), mGain(1), mGainPrev(1) {}
+    : mUser(userData), mFrame(0), mFrameEnd(INT_MAX), mFramesPerBuffer(0),
+      mFramesPerSecond(0), mBufI(nullptr), mBufO(nullptr), mBufB(nullptr),
+      mBufT(nullptr), mNumI(0), mNumO(0), mNumB(0), mGain(1), mGainPrev(1) {}
 
 AudioIOData::~AudioIOData() {
 	deleteBuf(mBufI);
@@ -47,8 +47,11 @@ public:
 	bool listen(){ return false; }
 	bool accept(Socket::Impl * newSock){ return false; }
 	bool opened() const { return false;	}
+	int handle() const { return -1; }
 	size_t recv(char * buffer, size_t maxlen, char *from){ return 0; }
 	size_t send(const char * buffer, size_t len){ return 0;	}
+	int recvBatch(Socket::Datagram * dgrams, int count){ return 0; }
+	int sendBatch(const Socket::Datagram * dgrams, int count){ return 0; }
 };
 
 /*static*/ std::string Socket::hostIP(){ return "0.0.0.0"; }
@@ -111,6 +114,7 @@ DWORD secToTimeout(al_sec t){
 #include <string.h> // memset, strerror
 #include <sstream>
 #include <sys/time.h> // timeval
+#include <sys/uio.h> // iovec
 
 const char * errorString(){ return strerror(errno); }
 
@@ -329,6 +333,10 @@ public:
 		return INVALID_SOCKET != mSocket;
 	}
 
+	int handle() const {
+		return opened() ? int(mSocket) : -1;
+	}
+
 	size_t recv(char * buffer, size_t maxlen, char *from){
 		return ::recv(mSocket, buffer, maxlen, 0);
 	}
@@ -337,6 +345,90 @@ public:
 		return ::send(mSocket, buffer, len, 0);
 	}
 
+	// Writes the IPv4 address of a sender into a Datagram::from
+	static void senderAddress(sockaddr_in& sa, socklen_t len, char * from){
+		if(len < socklen_t(sizeof(sa)) || sa.sin_family != AF_INET
+			|| !inet_ntop(AF_INET, &sa.sin_addr, from, sizeof(Socket::Datagram::from))
+		){
+			from[0] = '\0';
+		}
+	}
+
+	#if defined(AL_LINUX)
+	enum { MAX_BATCH = 64 };
+
+	int recvBatch(Socket::Datagram * dgrams, int count){
+		if(count <= 0) return 0;
+		if(count > MAX_BATCH) count = MAX_BATCH;
+		mmsghdr msgs[MAX_BATCH];
+		iovec iovs[MAX_BATCH];
+		sockaddr_in senders[MAX_BATCH];
+		memset(msgs, 0, sizeof(mmsghdr) * count);
+		for(int i=0; i<count; ++i){
+			iovs[i].iov_base = dgrams[i].data;
+			iovs[i].iov_len = dgrams[i].capacity;
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &senders[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+		}
+		// block (with timeout) for the first datagram only
+		int n = ::recvmmsg(mSocket, msgs, count, MSG_WAITFORONE, NULL);
+		if(n < 0) return 0;
+		for(int i=0; i<n; ++i){
+			dgrams[i].size = msgs[i].msg_len;
+			senderAddress(senders[i], msgs[i].msg_hdr.msg_namelen, dgrams[i].from);
+		}
+		return n;
+	}
+
+	int sendBatch(const Socket::Datagram * dgrams, int count){
+		mmsghdr msgs[MAX_BATCH];
+		iovec iovs[MAX_BATCH];
+		int sent = 0;
+		while(sent < count){
+			int n = count - sent < MAX_BATCH ? count - sent : MAX_BATCH;
+			memset(msgs, 0, sizeof(mmsghdr) * n);
+			for(int i=0; i<n; ++i){
+				iovs[i].iov_base = dgrams[sent+i].data;
+				iovs[i].iov_len = dgrams[sent+i].size;
+				msgs[i].msg_hdr.msg_iov = &iovs[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+			}
+			int r = ::sendmmsg(mSocket, msgs, n, 0);
+			if(r <= 0) break;
+			sent += r;
+		}
+		return sent;
+	}
+
+	#else
+	int recvBatch(Socket::Datagram * dgrams, int count){
+		int n = 0;
+		while(n < count){
+			#ifdef MSG_DONTWAIT
+			int flags = n ? MSG_DONTWAIT : 0;
+			#else
+			if(n) break;
+			int flags = 0;
+			#endif
+			sockaddr_in sender;
+			socklen_t len = sizeof(sender);
+			int r = ::recvfrom(mSocket, dgrams[n].data, dgrams[n].capacity, flags, (sockaddr *)&sender, &len);
+			if(r < 0) break;
+			senderAddress(sender, len, dgrams[n].from);
+			dgrams[n++].size = r;
+		}
+		return n;
+	}
+
+	int sendBatch(const Socket::Datagram * dgrams, int count){
+		int n = 0;
+		while(n < count && ::send(mSocket, dgrams[n].data, dgrams[n].size, 0) >= 0) ++n;
+		return n;
+	}
+	#endif
+
 private:
 	int mType = 0;
 	al_sec mTimeout = -1;
@@ -395,6 +487,8 @@ const std::string& Socket::address() const { return mImpl->address(); }
 
 bool Socket::opened() const { return mImpl->opened(); }
 
+int Socket::handle() const { return mImpl->handle(); }
+
 uint16_t Socket::port() const { return mImpl->port(); }
 
 al_sec Socket::timeout() const { return mImpl->timeout(); }
@@ -423,6 +517,14 @@ size_t Socket::send(const char * buffer, size_t len) {
 	return mImpl->send(buffer, len);
 }
 
+int Socket::recvBatch(Datagram * dgrams, int count){
+	return mImpl->recvBatch(dgrams, count);
+}
+
+int Socket::sendBatch(const Datagram * dgrams, int count){
+	return mImpl->sendBatch(dgrams, count);
+}
+
 bool Socket::listen(){
 	return mImpl->listen();
 }
@@ -28,8 +28,13 @@ You can actually use connect() on UDP socket as an option. In that case, you can
 #include "../private/al_ImplAPR.h"
 #if defined(AL_LINUX)
 #include "apr-1.0/apr_network_io.h"
+#include "apr-1.0/apr_portable.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #else
 #include "apr-1/apr_network_io.h"
+#include "apr-1/apr_portable.h"
 #endif
 
 #define PRINT_SOCKADDR(s)\
@@ -239,6 +244,12 @@ struct Socket::Impl : public ImplAPR {
 
 	bool opened() const { return 0!=mSock; }
 
+	int handle() const {
+		apr_os_sock_t sock;
+		if(!opened() || APR_SUCCESS != apr_os_sock_get(&sock, mSock)) return -1;
+		return int(sock);
+	}
+
 	uint16_t mPort;
 	std::string mAddress;
 	apr_sockaddr_t * mSockAddr;
@@ -273,6 +284,8 @@ const std::string& Socket::address() const { return mImpl->mAddress; }
 
 bool Socket::opened() const { return mImpl->opened(); }
 
+int Socket::handle() const { return mImpl->handle(); }
+
 uint16_t Socket::port() const { return mImpl->mPort; }
 
 al_sec Socket::timeout() const { return mImpl->mTimeout; }
@@ -323,6 +336,93 @@ size_t Socket::send(const char * buffer, size_t len) {
 	return size;
 }
 
+#if defined(AL_LINUX)
+// APR has no batched calls, so the batches go through the descriptor of the
+// APR socket with recvmmsg and sendmmsg, up to 64 datagrams per call.
+enum { MAX_BATCH = 64 };
+
+static void senderAddress(sockaddr_in& sa, socklen_t len, char * from){
+	if(len < socklen_t(sizeof(sa)) || sa.sin_family != AF_INET
+		|| !inet_ntop(AF_INET, &sa.sin_addr, from, sizeof(Socket::Datagram::from))
+	){
+		from[0] = '\0';
+	}
+}
+
+int Socket::recvBatch(Datagram * dgrams, int count){
+	int fd = handle();
+	if(count <= 0 || fd < 0) return 0;
+	if(count > MAX_BATCH) count = MAX_BATCH;
+
+	// APR keeps sockets with a positive timeout non-blocking and polls them
+	// itself, so wait here for the first datagram according to the timeout.
+	// Blocking sockets block in recvmmsg, non-blocking ones return at once.
+	if(mImpl->mTimeout > 0 && APR_SUCCESS != apr_socket_wait(mImpl->mSock, APR_WAIT_READ)){
+		return 0;
+	}
+
+	mmsghdr msgs[MAX_BATCH];
+	iovec iovs[MAX_BATCH];
+	sockaddr_in senders[MAX_BATCH];
+	memset(msgs, 0, sizeof(mmsghdr) * count);
+	for(int i=0; i<count; ++i){
+		iovs[i].iov_base = dgrams[i].data;
+		iovs[i].iov_len = dgrams[i].capacity;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &senders[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+	}
+	int n = ::recvmmsg(fd, msgs, count, MSG_WAITFORONE, NULL);
+	if(n < 0) return 0;
+	for(int i=0; i<n; ++i){
+		dgrams[i].size = msgs[i].msg_len;
+		senderAddress(senders[i], msgs[i].msg_hdr.msg_namelen, dgrams[i].from);
+	}
+	return n;
+}
+
+int Socket::sendBatch(const Datagram * dgrams, int count){
+	int fd = handle();
+	if(fd < 0) return 0;
+	mmsghdr msgs[MAX_BATCH];
+	iovec iovs[MAX_BATCH];
+	int sent = 0;
+	while(sent < count){
+		int n = count - sent < MAX_BATCH ? count - sent : MAX_BATCH;
+		memset(msgs, 0, sizeof(mmsghdr) * n);
+		for(int i=0; i<n; ++i){
+			iovs[i].iov_base = dgrams[sent+i].data;
+			iovs[i].iov_len = dgrams[sent+i].size;
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int r = ::sendmmsg(fd, msgs, n, 0);
+		if(r <= 0) break;
+		sent += r;
+	}
+	// A non-blocking socket may run out of buffer space; send the rest one by
+	// one so that APR waits for room according to the timeout
+	while(sent < count && send(dgrams[sent].data, dgrams[sent].size) == dgrams[sent].size) ++sent;
+	return sent;
+}
+
+#else
+// APR has no batched calls, so one datagram is read per call
+int Socket::recvBatch(Datagram * dgrams, int count){
+	if(count <= 0) return 0;
+	memset(dgrams[0].from, 0, sizeof(dgrams[0].from));
+	dgrams[0].size = recv(dgrams[0].data, dgrams[0].capacity, dgrams[0].from);
+	return dgrams[0].size ? 1 : 0;
+}
+
+int Socket::sendBatch(const Datagram * dgrams, int count){
+	int n = 0;
+	while(n < count && send(dgrams[n].data, dgrams[n].size) == dgrams[n].size) ++n;
+	return n;
+}
+#endif
+
 
 std::string Socket::hostIP(){
 	ImplAPR apr;
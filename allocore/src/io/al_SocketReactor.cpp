@@ -0,0 +1,317 @@
+#include "allocore/io/al_SocketReactor.hpp"
+#include "allocore/system/al_Config.h"
+
+#if defined(AL_LINUX)
+	#include <errno.h>
+	#include <sys/epoll.h>
+	#include <sys/eventfd.h>
+	#include <unistd.h>
+#elif !defined(AL_WINDOWS)
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <unistd.h>
+#endif
+
+namespace al{
+
+namespace{
+
+// Entry whose handler is running on this thread
+thread_local const void * tCurrentEntry = 0;
+
+}
+
+struct SocketReactor::Entry{
+	Socket * socket;
+	Handler handler;
+	int fd;
+	std::atomic<int> busy;	// number of threads calling the handler
+	bool removed;
+
+	Entry(Socket * s, const Handler& h, int fd_)
+	:	socket(s), handler(h), fd(fd_), busy(0), removed(false)
+	{}
+};
+
+
+// The backend waits for sockets to become readable. Sockets are armed once:
+// after reporting a socket, the backend ignores it until rearm() is called,
+// so that only one thread handles it. An id of 0 reports a wakeup.
+
+#if defined(AL_LINUX)
+
+struct SocketReactor::Backend{
+	int epfd, wakefd;
+
+	Backend(){
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+		wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u64 = 0;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+	}
+
+	~Backend(){
+		::close(wakefd);
+		::close(epfd);
+	}
+
+	bool valid() const { return epfd >= 0 && wakefd >= 0; }
+
+	bool add(int fd, uint64_t id){ return ctl(EPOLL_CTL_ADD, fd, id); }
+	void rearm(int fd, uint64_t id){ ctl(EPOLL_CTL_MOD, fd, id); }
+	void remove(int fd){ epoll_ctl(epfd, EPOLL_CTL_DEL, fd, 0); }
+
+	// Wake all threads for good; the event is never read
+	void shutdown(){
+		uint64_t one = 1;
+		if(::write(wakefd, &one, sizeof(one))){}
+	}
+
+	int wait(uint64_t * ids, int maxIDs){
+		epoll_event events[64];
+		if(maxIDs > 64) maxIDs = 64;
+		int n = epoll_wait(epfd, events, maxIDs, -1);
+		if(n < 0) return 0; // interrupted
+		for(int i=0; i<n; ++i) ids[i] = events[i].data.u64;
+		return n;
+	}
+
+private:
+	bool ctl(int op, int fd, uint64_t id){
+		epoll_event ev;
+		ev.events = EPOLLIN | EPOLLONESHOT;
+		ev.data.u64 = id;
+		return 0 == epoll_ctl(epfd, op, fd, &ev);
+	}
+};
+
+#elif !defined(AL_WINDOWS)
+
+struct SocketReactor::Backend{
+	struct Socket{ int fd; uint64_t id; bool armed; };
+	std::mutex mutex;
+	std::vector<Socket> sockets;
+	int pipefd[2];
+	std::atomic<bool> shuttingDown;
+
+	Backend(): shuttingDown(false){
+		if(0 == pipe(pipefd)){
+			fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+			fcntl(pipefd[1], F_SETFL, O_NONBLOCK);
+		} else {
+			pipefd[0] = pipefd[1] = -1;
+		}
+	}
+
+	~Backend(){
+		::close(pipefd[0]);
+		::close(pipefd[1]);
+	}
+
+	bool valid() const { return pipefd[0] >= 0; }
+
+	bool add(int fd, uint64_t id){
+		{	std::lock_guard<std::mutex> lock(mutex);
+			Socket s = {fd, id, true};
+			sockets.push_back(s);
+		}
+		wake();
+		return true;
+	}
+
+	void rearm(int fd, uint64_t id){
+		{	std::lock_guard<std::mutex> lock(mutex);
+			for(auto& s : sockets) if(s.id == id) s.armed = true;
+		}
+		wake();
+	}
+
+	void remove(int fd){
+		std::lock_guard<std::mutex> lock(mutex);
+		for(size_t i=0; i<sockets.size(); ++i){
+			if(sockets[i].fd == fd){
+				sockets.erase(sockets.begin() + i);
+				break;
+			}
+		}
+	}
+
+	void shutdown(){
+		shuttingDown = true;
+		wake();
+	}
+
+	int wait(uint64_t * ids, int maxIDs){
+		// poll the armed sockets and the wakeup pipe
+		std::vector<pollfd> fds(1);
+		std::vector<uint64_t> fdIDs(1, 0);
+		fds[0].fd = pipefd[0];
+		fds[0].events = POLLIN;
+		{	std::lock_guard<std::mutex> lock(mutex);
+			for(auto& s : sockets){
+				if(!s.armed) continue;
+				pollfd p = {s.fd, POLLIN, 0};
+				fds.push_back(p);
+				fdIDs.push_back(s.id);
+			}
+		}
+		// Once shutting down the pipe is not drained, so that it wakes every
+		// thread entering poll()
+		if(shuttingDown) return 0;
+		if(::poll(&fds[0], fds.size(), -1) <= 0 || shuttingDown) return 0;
+
+		int n = 0;
+		if(fds[0].revents){
+			char buf[64];
+			while(::read(pipefd[0], buf, sizeof(buf)) > 0){}
+			// The shutdown byte may have been drained with the others
+			if(shuttingDown){
+				wake();
+				return 0;
+			}
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		for(size_t i=1; i<fds.size() && n<maxIDs; ++i){
+			if(!fds[i].revents) continue;
+			// another thread may have taken it already
+			for(auto& s : sockets){
+				if(s.id == fdIDs[i] && s.armed){
+					s.armed = false;
+					ids[n++] = s.id;
+				}
+			}
+		}
+		return n;
+	}
+
+private:
+	void wake(){
+		char c = 0;
+		if(::write(pipefd[1], &c, 1)){}
+	}
+};
+
+#else
+
+struct SocketReactor::Backend{
+	bool valid() const { return false; }
+	bool add(int fd, uint64_t id){ return false; }
+	void rearm(int fd, uint64_t id){}
+	void remove(int fd){}
+	void shutdown(){}
+	int wait(uint64_t * ids, int maxIDs){ return 0; }
+};
+
+#endif
+
+
+SocketReactor::SocketReactor(int numThreads)
+:	mNumThreads(numThreads > 0 ? numThreads : 1),
+	mBackend(new Backend), mNextID(1), mRunning(false)
+{}
+
+SocketReactor::~SocketReactor(){
+	stop();
+}
+
+int SocketReactor::size() const {
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mEntries.size();
+}
+
+bool SocketReactor::start(){
+	if(mRunning) return true;
+	if(!mBackend->valid()) return false;
+	mRunning = true;
+	for(int i=0; i<mNumThreads; ++i){
+		mThreads.push_back(std::thread(&SocketReactor::run, this));
+	}
+	return true;
+}
+
+void SocketReactor::stop(){
+	{	std::lock_guard<std::mutex> lock(mMutex);
+		if(!mRunning) return;
+		mRunning = false;
+	}
+	mBackend->shutdown();
+	for(auto& t : mThreads) t.join();
+	mThreads.clear();
+
+	// a new backend, so that the reactor can start again
+	std::lock_guard<std::mutex> lock(mMutex);
+	mBackend.reset(new Backend);
+	for(auto& e : mEntries) mBackend->add(e.second->fd, e.first);
+}
+
+bool SocketReactor::add(Socket& socket, const Handler& handler){
+	int fd = socket.handle();
+	if(fd < 0) return false;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	if(mIDs.count(&socket) || !start()) return false;
+	uint64_t id = mNextID++;
+	EntryPtr entry(new Entry(&socket, handler, fd));
+	if(!mBackend->add(fd, id)) return false;
+	mEntries[id] = entry;
+	mIDs[&socket] = id;
+	return true;
+}
+
+void SocketReactor::remove(Socket& socket){
+	EntryPtr entry;
+	{	std::lock_guard<std::mutex> lock(mMutex);
+		auto it = mIDs.find(&socket);
+		if(it == mIDs.end()) return;
+		auto e = mEntries.find(it->second);
+		entry = e->second;
+		entry->removed = true;
+		mBackend->remove(entry->fd);
+		mEntries.erase(e);
+		mIDs.erase(it);
+	}
+	// threads that found the entry before it was erased are counted in busy
+	if(tCurrentEntry != entry.get()){
+		while(entry->busy.load(std::memory_order_acquire)) std::this_thread::yield();
+	}
+}
+
+void SocketReactor::dispatch(uint64_t id){
+	EntryPtr entry;
+	{	std::lock_guard<std::mutex> lock(mMutex);
+		auto it = mEntries.find(id);
+		if(it == mEntries.end()) return;
+		entry = it->second;
+		entry->busy.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	tCurrentEntry = entry.get();
+	entry->handler(*entry->socket);
+	tCurrentEntry = 0;
+
+	{	std::lock_guard<std::mutex> lock(mMutex);
+		if(!entry->removed) mBackend->rearm(entry->fd, id);
+	}
+	entry->busy.fetch_sub(1, std::memory_order_release);
+}
+
+void SocketReactor::run(){
+	uint64_t ids[64];
+	while(mRunning){
+		int n = mBackend->wait(ids, 64);
+		for(int i=0; i<n; ++i){
+			if(ids[i]) dispatch(ids[i]);
+		}
+	}
+}
+
+SocketReactor& SocketReactor::global(){
+	// never destroyed, so that sockets can be removed during static destruction
+	static SocketReactor * reactor = new SocketReactor(1);
+	return *reactor;
+}
+
+} // al::
@@ -0,0 +1,87 @@
+#ifndef INCLUDE_AL_PRIVATE_IMPL_SIMD
+#define INCLUDE_AL_PRIVATE_IMPL_SIMD
+
+/*	Internal SIMD helpers shared by the spatializers. The widest instruction
+	set enabled by the compiler flags is used (AVX2, SSE2 or NEON on aarch64),
+	with a scalar fallback. AL_SIMD_AVX2, AL_SIMD_SSE2 or AL_SIMD_NEON tells
+	which one, for code using the intrinsics directly.
+*/
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define AL_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64)
+	#include <emmintrin.h>
+	#define AL_SIMD_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	#include <arm_neon.h>
+	#define AL_SIMD_NEON
+#endif
+
+namespace al{
+namespace simd{
+
+// Vector operations on N floats
+#if defined(AL_SIMD_AVX2)
+struct Vec {
+	typedef __m256 V; enum { N = 8 };
+	static V zero(){ return _mm256_setzero_ps(); }
+	static V set1(float v){ return _mm256_set1_ps(v); }
+	static V load(const float * p){ return _mm256_loadu_ps(p); }
+	static void store(float * p, V v){ _mm256_storeu_ps(p, v); }
+	static V add(V a, V b){ return _mm256_add_ps(a, b); }
+	static V madd(V a, V b, V c){ return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+};
+#elif defined(AL_SIMD_SSE2)
+struct Vec {
+	typedef __m128 V; enum { N = 4 };
+	static V zero(){ return _mm_setzero_ps(); }
+	static V set1(float v){ return _mm_set1_ps(v); }
+	static V load(const float * p){ return _mm_loadu_ps(p); }
+	static void store(float * p, V v){ _mm_storeu_ps(p, v); }
+	static V add(V a, V b){ return _mm_add_ps(a, b); }
+	static V madd(V a, V b, V c){ return _mm_add_ps(_mm_mul_ps(a, b), c); }
+};
+#elif defined(AL_SIMD_NEON)
+struct Vec {
+	typedef float32x4_t V; enum { N = 4 };
+	static V zero(){ return vdupq_n_f32(0.f); }
+	static V set1(float v){ return vdupq_n_f32(v); }
+	static V load(const float * p){ return vld1q_f32(p); }
+	static void store(float * p, V v){ vst1q_f32(p, v); }
+	static V add(V a, V b){ return vaddq_f32(a, b); }
+	static V madd(V a, V b, V c){ return vmlaq_f32(c, a, b); }
+};
+#else
+struct Vec {
+	typedef float V; enum { N = 1 };
+	static V zero(){ return 0.f; }
+	static V set1(float v){ return v; }
+	static V load(const float * p){ return *p; }
+	static void store(float * p, V v){ *p = v; }
+	static V add(V a, V b){ return a + b; }
+	static V madd(V a, V b, V c){ return a * b + c; }
+};
+#endif
+
+// Mix with gain ramping linearly from g0 to g0 + n*dg:
+// out[i] += in[i] * (g0 + (i+1)*dg)
+inline void mixRamp(float * out, const float * in, int n, float g0, float dg){
+	static const float ramp[8] = {1,2,3,4,5,6,7,8};
+	const int N = Vec::N;
+	int i = 0;
+	Vec::V g = Vec::madd(Vec::load(ramp), Vec::set1(dg), Vec::set1(g0));
+	const Vec::V step = Vec::set1(N*dg);
+	for(; i + N <= n; i += N){
+		Vec::store(out + i, Vec::madd(Vec::load(in + i), g, Vec::load(out + i)));
+		g = Vec::add(g, step);
+	}
+	for(; i<n; ++i){
+		out[i] += in[i] * (g0 + (i+1)*dg);
+	}
+}
+
+} // simd::
+} // al::
+
+#endif
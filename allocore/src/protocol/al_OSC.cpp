@@ -1,4 +1,5 @@
 #include <ctype.h> // isgraph
+#include <stdint.h>
 #include <stdio.h> // printf
 #include <string.h>
 #include "allocore/system/al_Printing.hpp"
@@ -270,67 +271,484 @@ Message& Message::operator>> (Blob& v){
 	return *this;
 }
 
-#ifdef VERBOSE
-#include <netinet/in.h>  // for ntohl
-#endif
 
-void PacketHandler::parse(const char *packet, int size, TimeTag timeTag, const char *senderAddr){
-	#ifdef VERBOSE
-	int i = 1;
-	#endif
+// Big-endian encoding of OSC numbers
+static inline uint32_t readU32(const char * p){
+	const unsigned char * u = (const unsigned char *)p;
+	return (uint32_t(u[0])<<24) | (uint32_t(u[1])<<16) | (uint32_t(u[2])<<8) | uint32_t(u[3]);
+}
+static inline uint64_t readU64(const char * p){
+	return (uint64_t(readU32(p))<<32) | readU32(p+4);
+}
+static inline void writeU32(char * p, uint32_t v){
+	p[0] = char(v>>24); p[1] = char(v>>16); p[2] = char(v>>8); p[3] = char(v);
+}
+static inline void writeU64(char * p, uint64_t v){
+	writeU32(p, uint32_t(v>>32)); writeU32(p+4, uint32_t(v));
+}
 
-OSCTRY("PacketHandler::parse",
-	DPRINTF("PacketHandler::parse(size %d, packet %p)\n", size, packet);
-	DPRINTF("Data to parse: ");
-	for(int i=0; i<size; ++i){ DPRINTF("%c", packet[i]); }
-	DPRINTF("\n");
+// Size of a string and its terminator padded to a multiple of four
+static inline int paddedSize(int len){ return (len + 4) & ~3; }
+
+// Size of an argument in a message, or -1 if it does not fit or is unknown
+static int argSize(char tag, const char * arg, int remaining){
+	switch(tag){
+	case 'i': case 'f': case 'c': case 'r': case 'm':
+		return remaining >= 4 ? 4 : -1;
+	case 'h': case 'd': case 't':
+		return remaining >= 8 ? 8 : -1;
+	case 's': case 'S':{
+		const char * end = (const char *)memchr(arg, '\0', remaining);
+		if(!end) return -1;
+		int n = paddedSize(end - arg);
+		return n <= remaining ? n : -1;
+	}
+	case 'b':{
+		if(remaining < 4) return -1;
+		uint32_t n = readU32(arg);
+		if(n > uint32_t(remaining - 4)) return -1;
+		n = 4 + ((n + 3) & ~3u);
+		return n <= uint32_t(remaining) ? int(n) : -1;
+	}
+	case 'T': case 'F': case 'N': case 'I': case '[': case ']':
+		return 0;
+	default:
+		return -1;
+	}
+}
 
-	// this is the only generic entry point for parsing packets
-	::osc::ReceivedPacket p(packet, size);
+MessageView::MessageView()
+:	mData(""), mSize(0), mTimeTag(1), mSenderAddr(nullptr),
+	mArgs(""), mArgsSize(0), mTag(0), mPos(0), mGood(false)
+{}
 
-	DPRINTF("Just made an ::osc::ReceivedPacket that has contents %p and size %d\n",
-		p.Contents(), (int)p.Size());
+bool MessageView::parse(const char * message, int size, const TimeTag& timeTag, const char * senderAddr){
+	mData = message;
+	mSize = size;
+	mTimeTag = timeTag;
+	mSenderAddr = senderAddr;
+	mAddressPattern = StringView();
+	mTypeTags = StringView();
+	mArgs = message;
+	mArgsSize = 0;
+	mGood = false;
+	if(size < 4 || (size & 3)) return false;
+
+	const char * end = (const char *)memchr(message, '\0', size);
+	if(!end) return false;
+	mAddressPattern = StringView(message, end - message);
+	int pos = paddedSize(end - message);
+
+	// type tags may be missing in messages from old implementations
+	if(pos < size){
+		if(message[pos] != ',') return false;
+		end = (const char *)memchr(message + pos, '\0', size - pos);
+		if(!end) return false;
+		mTypeTags = StringView(message + pos + 1, end - (message + pos + 1));
+		pos += paddedSize(end - (message + pos));
+		if(pos > size) return false;
+	}
+	mArgs = message + pos;
+	mArgsSize = size - pos;
+
+	// check the arguments now so extracting them needs no more checks
+	int argPos = 0;
+	for(int i=0; i<mTypeTags.size; ++i){
+		int n = argSize(mTypeTags[i], mArgs + argPos, mArgsSize - argPos);
+		if(n < 0) return false;
+		argPos += n;
+	}
+	resetStream();
+	return true;
+}
 
-	// iterate through all the bundle elements (bundles or messages)
-	if(p.IsBundle()){
+MessageView& MessageView::resetStream(){
+	mTag = 0;
+	mPos = 0;
+	mGood = true;
+	return *this;
+}
+
+const char * MessageView::next(char tag, int bytes){
+	if(mTag >= mTypeTags.size || mTypeTags[mTag] != tag){
+		mGood = false;
+		return nullptr;
+	}
+	const char * arg = mArgs + mPos;
+	mPos += bytes;
+	++mTag;
+	return arg;
+}
+
+MessageView& MessageView::skip(){
+	if(mTag < mTypeTags.size){
+		mPos += argSize(mTypeTags[mTag], mArgs + mPos, mArgsSize - mPos);
+		++mTag;
+	} else {
+		mGood = false;
+	}
+	return *this;
+}
+
+MessageView& MessageView::operator>> (int& v){
+	if(const char * a = next('i', 4)) v = int32_t(readU32(a));
+	return *this;
+}
+MessageView& MessageView::operator>> (float& v){
+	if(const char * a = next('f', 4)){
+		uint32_t u = readU32(a);
+		memcpy(&v, &u, 4);
+	}
+	return *this;
+}
+MessageView& MessageView::operator>> (double& v){
+	if(const char * a = next('d', 8)){
+		uint64_t u = readU64(a);
+		memcpy(&v, &u, 8);
+	}
+	return *this;
+}
+MessageView& MessageView::operator>> (char& v){
+	if(const char * a = next('c', 4)) v = char(readU32(a));
+	return *this;
+}
+MessageView& MessageView::operator>> (const char*& v){
+	StringView s;
+	*this >> s;
+	if(mGood) v = s.data;
+	return *this;
+}
+MessageView& MessageView::operator>> (StringView& v){
+	char tag = mTag < mTypeTags.size ? mTypeTags[mTag] : 0;
+	if(tag != 's' && tag != 'S'){
+		mGood = false;
+		return *this;
+	}
+	const char * a = mArgs + mPos;
+	int len = strlen(a); // terminator was checked by parse()
+	next(tag, paddedSize(len));
+	v = StringView(a, len);
+	return *this;
+}
+MessageView& MessageView::operator>> (Blob& v){
+	if(mTag >= mTypeTags.size || mTypeTags[mTag] != 'b'){
+		mGood = false;
+		return *this;
+	}
+	const char * a = mArgs + mPos;
+	uint32_t n = readU32(a);
+	next('b', 4 + ((n + 3) & ~3u));
+	v.data = a + 4;
+	v.size = n;
+	return *this;
+}
+
+void MessageView::print() const {
+	printf("%.*s, %.*s %" AL_PRINTF_LL "d from %s\n",
+		mAddressPattern.size, mAddressPattern.data,
+		mTypeTags.size, mTypeTags.data, timeTag(), senderAddress());
+
+	MessageView m(*this);
+	m.resetStream();
+	printf("\targs = (");
+	for(int i=0; i<mTypeTags.size; ++i){
+		switch(mTypeTags[i]){
+			case 'f': {float v; m >> v; printf("%g", v);} break;
+			case 'i': {int v; m >> v; printf("%d", v);} break;
+			case 'c': {char v; m >> v; printf("'%c' (=%3d)", isprint(v) ? v : ' ', v);} break;
+			case 'd': {double v; m >> v; printf("%g", v);} break;
+			case 's': case 'S': {const char * v; m >> v; printf("%s", v);} break;
+			case 'b': printf("blob"); m.skip(); break;
+			default:  printf("?"); m.skip();
+		}
+		if(i < mTypeTags.size - 1) printf(", ");
+	}
+	printf(")\n");
+}
+
+
+
+PacketBuilder::PacketBuilder(char * buffer, int capacity)
+:	mBuffer(buffer), mCapacity(capacity)
+{
+	clear();
+}
 
-		DPRINTF("It's a bundle\n");
-		//char *afterTimeTag = (char *)packet+16;  // "#bundle\0" plus 8-byte time tag
-		DPRINTF("First bundle element has size %d\n", ntohl(*((int *)(packet+16))/*firstBundleElementSize*/));
+PacketBuilder& PacketBuilder::clear(){
+	mSize = 0;
+	mTagsSize = 0;
+	mArgsBegin = 0;
+	mDepth = 0;
+	mInMessage = false;
+	mOK = true;
+	return *this;
+}
 
-		::osc::ReceivedBundle r(p);
+void PacketBuilder::beginElement(){
+	// elements of a bundle are preceded by their size
+	if(mDepth){
+		mElementBegin[mDepth] = mSize;
+		mSize += 4;
+	}
+}
+
+void PacketBuilder::endElement(){
+	if(mDepth){
+		int begin = mElementBegin[mDepth];
+		writeU32(mBuffer + begin, mSize - begin - 4);
+	}
+}
 
-		//DPRINTF("Just made an ::osc::ReceivedBundle that has time tag at %p and %d elements\n", r.timeTag_, r.ElementCount() );
+PacketBuilder& PacketBuilder::beginBundle(TimeTag timeTag){
+	if(!mOK) return *this;
+	if(mInMessage || mDepth == MAX_DEPTH || (mDepth == 0 && mSize) || mSize + 20 > mCapacity){
+		mOK = false;
+		return *this;
+	}
+	beginElement();
+	memcpy(mBuffer + mSize, "#bundle\0", 8);
+	writeU64(mBuffer + mSize + 8, timeTag);
+	mSize += 16;
+	++mDepth;
+	return *this;
+}
 
-		for(auto it = r.ElementsBegin(); it != r.ElementsEnd(); ++it){
-			const ::osc::ReceivedBundleElement& e = *it;
+PacketBuilder& PacketBuilder::endBundle(){
+	if(!mOK) return *this;
+	if(mInMessage || !mDepth){
+		mOK = false;
+		return *this;
+	}
+	--mDepth;
+	endElement();
+	return *this;
+}
 
-			DPRINTF("Just made an ::osc::ReceivedBundleElement with contents %p and size %d\n", e.Contents(), (int)e.Size());
-			DPRINTF("Parsing bundle element %d\n", i++);
-			DPRINTF("Made an ::osc::ReceivedBundleElement out of the iterator.\n");
-			DPRINTF("\tcontents: %p\n", e.Contents());
-			DPRINTF("\tsize: %d\n", (int)e.Size());
-			DPRINTF("\ttimeTag %lu\n", (unsigned long)r.TimeTag());
-			DPRINTF("\tLet's try to parse it...\n");
+PacketBuilder& PacketBuilder::beginMessage(const char * addr){
+	if(!mOK) return *this;
+	int len = strlen(addr);
+	int n = paddedSize(len);
+	if(mInMessage || (mDepth == 0 && mSize) || mSize + 4 + n + 4 > mCapacity){
+		mOK = false;
+		return *this;
+	}
+	beginElement();
+	memcpy(mBuffer + mSize, addr, len);
+	memset(mBuffer + mSize + len, 0, n - len);
+	mSize += n;
+	mArgsBegin = mSize;
+	mTagsSize = 0;
+	mInMessage = true;
+	return *this;
+}
 
-			parse(e.Contents(), e.Size(), r.TimeTag(), senderAddr);
+PacketBuilder& PacketBuilder::endMessage(){
+	if(!mOK) return *this;
+	if(!mInMessage){
+		mOK = false;
+		return *this;
+	}
+	// insert ",tags" between the address and the arguments
+	int n = paddedSize(mTagsSize + 1);
+	if(mSize + n + mTagsSize > mCapacity){
+		mOK = false;
+		return *this;
+	}
+	memmove(mBuffer + mArgsBegin + n, mBuffer + mArgsBegin, mSize - mArgsBegin);
+	char * tags = mBuffer + mArgsBegin;
+	tags[0] = ',';
+	for(int i=0; i<mTagsSize; ++i) tags[i+1] = mBuffer[mCapacity-1-i];
+	memset(tags + mTagsSize + 1, 0, n - mTagsSize - 1);
+	mSize += n;
+	mTagsSize = 0;
+	mInMessage = false;
+	endElement();
+	return *this;
+}
+
+char * PacketBuilder::reserve(char tag, int bytes){
+	if(!mOK) return nullptr;
+	// leave room for the tags at the end and for moving them in front of the
+	// arguments in endMessage()
+	int tags = mTagsSize + 1;
+	if(!mInMessage || mSize + bytes + tags + paddedSize(tags + 1) > mCapacity){
+		mOK = false;
+		return nullptr;
+	}
+	mBuffer[mCapacity - tags] = tag;
+	mTagsSize = tags;
+	char * arg = mBuffer + mSize;
+	mSize += bytes;
+	return arg;
+}
+
+PacketBuilder& PacketBuilder::operator<< (int v){
+	if(char * a = reserve('i', 4)) writeU32(a, uint32_t(v));
+	return *this;
+}
+PacketBuilder& PacketBuilder::operator<< (unsigned v){
+	return *this << int(v);
+}
+PacketBuilder& PacketBuilder::operator<< (float v){
+	if(char * a = reserve('f', 4)){
+		uint32_t u;
+		memcpy(&u, &v, 4);
+		writeU32(a, u);
+	}
+	return *this;
+}
+PacketBuilder& PacketBuilder::operator<< (double v){
+	if(char * a = reserve('d', 8)){
+		uint64_t u;
+		memcpy(&u, &v, 8);
+		writeU64(a, u);
+	}
+	return *this;
+}
+PacketBuilder& PacketBuilder::operator<< (char v){
+	if(char * a = reserve('c', 4)) writeU32(a, uint32_t(int(v)));
+	return *this;
+}
+PacketBuilder& PacketBuilder::addString(char tag, const char * v, int len){
+	int n = paddedSize(len);
+	if(char * a = reserve(tag, n)){
+		memcpy(a, v, len);
+		memset(a + len, 0, n - len);
+	}
+	return *this;
+}
+PacketBuilder& PacketBuilder::operator<< (const char * v){
+	return addString('s', v, strlen(v));
+}
+PacketBuilder& PacketBuilder::operator<< (const std::string& v){
+	return addString('s', v.c_str(), v.size());
+}
+PacketBuilder& PacketBuilder::operator<< (const StringView& v){
+	return addString('s', v.data, v.size);
+}
+PacketBuilder& PacketBuilder::operator<< (const Blob& v){
+	int n = 4 + ((int(v.size) + 3) & ~3);
+	if(char * a = reserve('b', n)){
+		writeU32(a, v.size);
+		memcpy(a + 4, v.data, v.size);
+		memset(a + 4 + v.size, 0, n - 4 - v.size);
+	}
+	return *this;
+}
+
+
+bool isPattern(const std::string& addressPattern){
+	return addressPattern.find_first_of("?*[{") != std::string::npos;
+}
+
+bool matchPattern(const char * p, const char * a){
+	while(*p){
+		switch(*p){
+		case '?':
+			if(!*a || *a == '/') return false;
+			++p; ++a;
+			break;
+
+		case '*':
+			while(*p == '*') ++p;
+			// try every split of the address part before the next '/'
+			while(true){
+				if(matchPattern(p, a)) return true;
+				if(!*a || *a == '/') return false;
+				++a;
+			}
+
+		case '[':{
+			if(!*a || *a == '/') return false;
+			++p;
+			bool negate = (*p == '!');
+			if(negate) ++p;
+			bool found = false;
+			while(*p && *p != ']'){
+				if(p[1] == '-' && p[2] && p[2] != ']'){
+					if(p[0] <= *a && *a <= p[2]) found = true;
+					p += 3;
+				} else {
+					if(*p == *a) found = true;
+					++p;
+				}
+			}
+			if(!*p || found == negate) return false;
+			++p; ++a;
+			break;
+		}
+
+		case '{':{
+			const char * end = strchr(p, '}');
+			if(!end) return false;
+			const char * alt = p+1;
+			while(alt <= end){
+				const char * altEnd = alt;
+				while(altEnd < end && *altEnd != ',') ++altEnd;
+				size_t n = altEnd - alt;
+				if(!strncmp(alt, a, n) && matchPattern(end+1, a+n)) return true;
+				alt = altEnd+1;
+			}
+			return false;
+		}
+
+		default:
+			if(*p != *a) return false;
+			++p; ++a;
+		}
+	}
+	return !*a;
+}
+
+
+void PacketHandler::onMessageView(MessageView& v){
+	Message m(v.data(), v.size(), v.timeTag(), v.senderAddress());
+	onMessage(m);
+}
+
+void PacketHandler::parse(const char *packet, int size, TimeTag timeTag, const char *senderAddr){
+	DPRINTF("PacketHandler::parse(size %d, packet %p)\n", size, packet);
+
+	// iterate through all the bundle elements (bundles or messages)
+	if(size >= 16 && !memcmp(packet, "#bundle\0", 8)){
+		TimeTag bundleTimeTag = readU64(packet + 8);
+		for(int pos = 16; pos < size; ){
+			int n = pos + 4 <= size ? int32_t(readU32(packet + pos)) : -1;
+			if(n < 0 || (n & 3) || n > size - pos - 4){
+				AL_WARN("OSC error: malformed bundle element");
+				return;
+			}
+			DPRINTF("Parsing bundle element of size %d\n", n);
+			parse(packet + pos + 4, n, bundleTimeTag, senderAddr);
+			pos += 4 + n;
 		}
 	}
-	else if(p.IsMessage()){
-		DPRINTF("Parsing a message\n");
-		Message m(packet, size, timeTag, senderAddr);
-		onMessage(m);
+	else {
+		MessageView m;
+		if(m.parse(packet, size, timeTag, senderAddr)){
+			onMessageView(m);
+		} else {
+			AL_WARN("OSC error: malformed message");
+		}
 	}
-) // OSCTRY
 }
 
 
 
 Send::Send(uint16_t port, const char * address, al_sec timeout, int size)
 :	SocketClient(port, address, timeout, Socket::UDP),
-	Packet(size)
+	Packet(size), mMTU(0), mMaxDatagrams(0)
 {}
 
+Send& Send::coalesce(int mtu, int maxDatagrams){
+	flush();
+	mMTU = mtu > 0 ? mtu : 0;
+	mMaxDatagrams = maxDatagrams > 0 ? maxDatagrams : 1;
+	mBatchData.resize(mMTU ? mMTU * mMaxDatagrams : 0);
+	mBatch.reserve(mMaxDatagrams);
+	return *this;
+}
+
 int Send::send(){
 	//int r = Socket::send(Packet::data(), Packet::size());
 	int r = send(*this);
@@ -339,11 +757,52 @@ int Send::send(){
 }
 
 int Send::send(const Packet& p){
+	if(mMTU) return queue(p.data(), p.size());
 	int r = 0;
 	OSCTRY("Packet::endMessage", r = Socket::send(p.data(), p.size());)
 	return r;
 }
 
+int Send::queue(const char * data, int size){
+	// does not fit into a bundle (header and element size)
+	if(16 + 4 + size > mMTU){
+		flush();
+		return Socket::send(data, size);
+	}
+
+	if(mBatch.empty() || int(mBatch.back().size) + 4 + size > mMTU){
+		if(int(mBatch.size()) == mMaxDatagrams) flush();
+		Socket::Datagram d;
+		d.data = &mBatchData[mBatch.size() * mMTU];
+		d.capacity = mMTU;
+		d.size = 16;
+		memcpy(d.data, "#bundle\0", 8);
+		writeU64(d.data + 8, 1); // immediately
+		mBatch.push_back(d);
+	}
+
+	Socket::Datagram& d = mBatch.back();
+	writeU32(d.data + d.size, size);
+	memcpy(d.data + d.size + 4, data, size);
+	d.size += 4 + size;
+	return size;
+}
+
+int Send::flush(){
+	if(mBatch.empty()) return 0;
+	for(auto& d : mBatch){
+		// send a lone packet without the bundle around it
+		int first = readU32(d.data + 16);
+		if(int(d.size) == 16 + 4 + first){
+			d.data += 20;
+			d.size = first;
+		}
+	}
+	int n = sendBatch(&mBatch[0], mBatch.size());
+	mBatch.clear();
+	return n;
+}
+
 
 
 static void * recvThreadFunc(void * user){
@@ -356,16 +815,18 @@ static void * recvThreadFunc(void * user){
 }
 
 Recv::Recv()
-:	mHandler(0), mBuffer(1024), mBackground(false)
+:	mHandler(0), mBufferSize(1024), mBatchSize(16), mReactor(0), mBackground(false)
 {
+	bufferSize(mBufferSize);
 	//printf("Entering Recv::Recv()\n");
 }
 
 
 Recv::Recv(uint16_t port, const char * address, al_sec timeout)
 :	SocketServer(port, address, timeout, Socket::UDP),
-	mHandler(0), mBuffer(1024), mBackground(false)
+	mHandler(0), mBufferSize(1024), mBatchSize(16), mReactor(0), mBackground(false)
 {
+	bufferSize(mBufferSize);
 	//printf("Entering Recv::Recv(port=%d, addr=%s)\n", port, address);
 }
 
@@ -373,18 +834,23 @@ int Recv::recv(){
 	int r = 0;
 	DPRINTF("Entering Recv::recv() - mBuffer = %p and mBuffer.size() = %d\n", &mBuffer[0], mBuffer.size());
 
-	/*	printf("Here's what's in my buffer before recv...\n");
-	for (int i = 0; i < mBuffer.size(); ++i) {
-	  if (mBuffer[i] != 0)  printf("Byte %d: %d (%c)\n", i, mBuffer[i], mBuffer[i]);
+	mDatagrams.resize(mBatchSize);
+	for(int i=0; i<mBatchSize; ++i){
+		mDatagrams[i].data = &mBuffer[i * mBufferSize];
+		mDatagrams[i].capacity = mBufferSize;
+		mDatagrams[i].size = 0;
 	}
-	*/
 
 	OSCTRY("Packet::endMessage",
-		char sender[16] = "";
-		r = Socket::recv(&mBuffer[0], mBuffer.size(), sender);
-		if(r && mHandler){
-			DPRINTF("Recv:recv() Received %d bytes from %s; parsing...\n", r, sender);
-			mHandler->parse(&mBuffer[0], r, 1, sender);
+		// a timeout returns no datagrams
+		int n = recvBatch(&mDatagrams[0], mBatchSize);
+		for(int i=0; i<n; ++i){
+			const Socket::Datagram& d = mDatagrams[i];
+			r += d.size;
+			if(d.size > 0 && mHandler){
+				DPRINTF("Recv:recv() Received %d bytes from %s; parsing...\n", int(d.size), d.from);
+				mHandler->parse(d.data, d.size, 1, d.from);
+			}
 		}
 	)
 
@@ -401,8 +867,24 @@ bool Recv::start(){
 	return mThread.start(recvThreadFunc, this);
 }
 
+bool Recv::start(SocketReactor& reactor){
+	if(mBackground) return true;
+	// the socket is readable, so a single recv() will not wait
+	if(reactor.add(*this, [this](Socket&){ recv(); })){
+		mReactor = &reactor;
+		mBackground = true;
+		return true;
+	}
+	return start();
+}
+
 void Recv::stop(){
-	if(mBackground){
+	if(mReactor){
+		mReactor->remove(*this);
+		mReactor = 0;
+		mBackground = false;
+	}
+	else if(mBackground){
 		mBackground = false;
 		mThread.join();
 	}
@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <string.h>
 #include "allocore/sound/al_Ambisonics.hpp"
+#include "../private/al_ImplSIMD.h"
 
 #ifdef USE_GAMMA
 	#include "scl.h"
@@ -20,6 +22,114 @@ static const double c1_sqrt2	= 0.707106781186548;
 static const double c8_11		= 8./11.;
 static const double c40_11		= 40./11.;
 
+namespace{
+
+using simd::Vec;
+using simd::mixRamp;
+
+typedef Vec::V V;
+enum { N = Vec::N };
+
+// Add the ambi channels of frames [beg, end), weighted by the rows of
+// weights (numChans per speaker), to the outputs of S speakers. Each ambi
+// sample loaded is used for all S speakers.
+template <int S>
+void decodeSpeakers(float * const * outs, const float * weights,
+	const float * ambi, int numChans, int numFrames, int beg, int end)
+{
+	int i = beg;
+	for(; i + 2*N <= end; i += 2*N){
+		V acc0[S], acc1[S];
+		for(int k=0; k<S; ++k) acc0[k] = acc1[k] = Vec::zero();
+		for(int c=0; c<numChans; ++c){
+			const float * in = ambi + c * numFrames + i;
+			V x0 = Vec::load(in);
+			V x1 = Vec::load(in + N);
+			for(int k=0; k<S; ++k){
+				V w = Vec::set1(weights[k * numChans + c]);
+				acc0[k] = Vec::madd(w, x0, acc0[k]);
+				acc1[k] = Vec::madd(w, x1, acc1[k]);
+			}
+		}
+		// speakers may share a device channel, so add one at a time
+		for(int k=0; k<S; ++k){
+			Vec::store(outs[k] + i,     Vec::add(Vec::load(outs[k] + i),     acc0[k]));
+			Vec::store(outs[k] + i + N, Vec::add(Vec::load(outs[k] + i + N), acc1[k]));
+		}
+	}
+	for(; i + N <= end; i += N){
+		V acc[S];
+		for(int k=0; k<S; ++k) acc[k] = Vec::zero();
+		for(int c=0; c<numChans; ++c){
+			V x = Vec::load(ambi + c * numFrames + i);
+			for(int k=0; k<S; ++k){
+				acc[k] = Vec::madd(Vec::set1(weights[k * numChans + c]), x, acc[k]);
+			}
+		}
+		for(int k=0; k<S; ++k){
+			Vec::store(outs[k] + i, Vec::add(Vec::load(outs[k] + i), acc[k]));
+		}
+	}
+	for(; i < end; ++i){
+		for(int k=0; k<S; ++k){
+			float acc = 0.f;
+			for(int c=0; c<numChans; ++c){
+				acc += weights[k * numChans + c] * ambi[c * numFrames + i];
+			}
+			outs[k][i] += acc;
+		}
+	}
+}
+
+void decodeSpeakers(int numSpeakers, float * const * outs, const float * weights,
+	const float * ambi, int numChans, int numFrames, int beg, int end)
+{
+	switch(numSpeakers){
+	case 4: decodeSpeakers<4>(outs, weights, ambi, numChans, numFrames, beg, end); break;
+	case 3: decodeSpeakers<3>(outs, weights, ambi, numChans, numFrames, beg, end); break;
+	case 2: decodeSpeakers<2>(outs, weights, ambi, numChans, numFrames, beg, end); break;
+	case 1: decodeSpeakers<1>(outs, weights, ambi, numChans, numFrames, beg, end); break;
+	default:;
+	}
+}
+
+// Legendre polynomial P_n(x)
+double legendre(int n, double x){
+	double p0 = 1, p1 = x;
+	if(n == 0) return p0;
+	for(int k=2; k<=n; ++k){
+		double p2 = ((2*k-1) * x * p1 - (k-1) * p0) / k;
+		p0 = p1;
+		p1 = p2;
+	}
+	return p1;
+}
+
+// SN3D normalization of degree n and order m >= 0 times (2m-1)!!, the
+// leading coefficient of the associated Legendre function P_n^m
+struct SN3DNorms {
+	float v[AmbiBase::MAX_ORDER+1][AmbiBase::MAX_ORDER+1];
+	SN3DNorms(){
+		for(int n=0; n<=AmbiBase::MAX_ORDER; ++n){
+			for(int m=0; m<=n; ++m){
+				// sqrt((2 - delta_m0) (n-m)!/(n+m)!)
+				double r = m ? 2 : 1;
+				for(int k=n-m+1; k<=n+m; ++k) r /= k;
+				double dfact = 1;
+				for(int k=2*m-1; k>1; k-=2) dfact *= k;
+				v[n][m] = sqrt(r) * dfact;
+			}
+		}
+	}
+};
+
+const SN3DNorms& sn3dNorms(){
+	static SN3DNorms norms;
+	return norms;
+}
+
+} // ::
+
 
 //// @see http://www.ai.sri.com/ajh/ambisonics/
 //
@@ -40,8 +150,8 @@ static const double c40_11		= 40./11.;
 
 // AmbiBase
 
-AmbiBase::AmbiBase(int dim, int order)
-:	mDim(dim), mOrder(0), mWeights(0)
+AmbiBase::AmbiBase(int dim, int order, AmbiConvention convention)
+:	mDim(dim), mOrder(-1), mChannels(0), mConvention(convention), mWeights(0)
 {	this->order(order); }
 
 AmbiBase::~AmbiBase(){
@@ -49,6 +159,7 @@ AmbiBase::~AmbiBase(){
 }
 
 void AmbiBase::order(int o){
+	if(o > MAX_ORDER) o = MAX_ORDER;
 	if(o != mOrder){
 		mOrder = o;
 		mChannels = orderToChannels(mDim, mOrder);
@@ -158,6 +269,78 @@ void AmbiBase::encodeWeightsFuMa16(float * ws, float az, float el){
 }
 
 
+void AmbiBase::encodeWeightsACN(float * ws, int dim, int order, float x, float y, float z){
+	if(order > MAX_ORDER) order = MAX_ORDER;
+
+	// cm[m] + i sm[m] = (x + iy)^m = r^m cos^m(E) (cos(mA) + i sin(mA))
+	float cm[MAX_ORDER+1], sm[MAX_ORDER+1];
+	cm[0] = 1.f; sm[0] = 0.f;
+	for(int m=1; m<=order; ++m){
+		cm[m] = x * cm[m-1] - y * sm[m-1];
+		sm[m] = x * sm[m-1] + y * cm[m-1];
+	}
+
+	ws[0] = 1.f;									// W
+
+	if(dim == 2){
+		for(int m=1; m<=order; ++m){
+			ws[2*m-1] = sm[m];
+			ws[2*m  ] = cm[m];
+		}
+		return;
+	}
+
+	// The associated Legendre functions are P_n^m(sin E) = cos^m(E) q_n^m,
+	// with q_n^m a polynomial in sin(E). Multiplying by r^n makes
+	// r^(n-m) q_n^m a polynomial in z and r^2:
+	//   q_m^m     = (2m-1)!!, kept in the normalization
+	//   q_(m+1)^m = (2m+1) z q_m^m
+	//   q_n^m     = ((2n-1) z q_(n-1)^m - (n+m-1) r^2 q_(n-2)^m) / (n-m)
+	const SN3DNorms& norms = sn3dNorms();
+	float r2 = x*x + y*y + z*z;
+	for(int m=0; m<=order; ++m){
+		float q0 = 0.f, q1 = 1.f;
+		for(int n=m; n<=order; ++n){
+			if(n > m){
+				float q2 = ((2*n-1) * z * q1 - (n+m-1) * r2 * q0) / (n-m);
+				q0 = q1;
+				q1 = q2;
+			}
+			float p = norms.v[n][m] * q1;
+			int acn = n*n + n;
+			ws[acn + m] = p * cm[m];
+			if(m) ws[acn - m] = p * sm[m];
+		}
+	}
+}
+
+void AmbiBase::encodeWeightsACN(float * ws, int dim, int order, float az, float el){
+	WRAP(az);
+	WRAP(el);
+	float cosel = COS(el);
+	float x = COS(az) * cosel;
+	float y = SIN(az) * cosel;
+	float z = dim>=3 ? SIN(el) : 0;
+	encodeWeightsACN(ws, dim, order, x,y,z);
+}
+
+void AmbiBase::encodeWeights(float * ws, AmbiConvention convention, int dim, int order, float x, float y, float z){
+	if(convention == AMBI_ACN_SN3D){
+		encodeWeightsACN(ws, dim, order, x,y,z);
+	} else {
+		encodeWeightsFuMa(ws, dim, order, x,y,z);
+	}
+}
+
+void AmbiBase::encodeWeights(float * ws, AmbiConvention convention, int dim, int order, float az, float el){
+	if(convention == AMBI_ACN_SN3D){
+		encodeWeightsACN(ws, dim, order, az, el);
+	} else {
+		encodeWeightsFuMa(ws, dim, order, az, el);
+	}
+}
+
+
 
 
 // AmbiDecode
@@ -190,10 +373,11 @@ float AmbiDecode::flavorWeights[4][5][5] = {
 	}
 };
 
-AmbiDecode::AmbiDecode(int dim, int order, int numSpeakers, int flav)
-	: AmbiBase(dim, order),
+AmbiDecode::AmbiDecode(int dim, int order, int numSpeakers, int flav, AmbiConvention convention)
+	: AmbiBase(dim, order, convention),
 	mNumSpeakers(0), mDecodeMatrix(0), mSpeakers(NULL)
 {
+	for(int i=0; i<=MAX_ORDER; ++i) mWOrder[i] = 0.f;
 	resizeArrays(channels(), numSpeakers);
 	flavor(flav);
 }
@@ -203,56 +387,86 @@ AmbiDecode::~AmbiDecode(){
 	//delete[] mSpeakers; // listener now owns speakers and will delete them
 }
 
-void AmbiDecode::decode(float * dec, const float * ambi, int numDecFrames) const {
-
-	// iterate speakers
-	for(int s=0; s<numSpeakers(); ++s){
-		// skip zero-amp speakers:
-		if ((*mSpeakers)[s].gain != 0.) {
-			float * out = dec + (*mSpeakers)[s].deviceChannel * numDecFrames;
+void AmbiDecode::speakerWeights(int s, float * w) const {
+	for(int c=0; c<channels(); ++c){
+		w[c] = decodeWeight(s, c) + mConfig.weightOffset;
+		if (mConfig.discardNegativeWeights && w[c] < 0.0f) {
+			w[c] = 0.0f;
+		}
+	}
+}
 
-			// iterate ambi channels
-			for(int c=0; c<channels(); ++c){
-				const float * in = ambi + c * numDecFrames;
-				float w = decodeWeight(s, c) + mConfig.weightOffset;
-				if (mConfig.discardNegativeWeights && w < 0.0f) {
-					w = 0.0f;
-				}
- 				for(int i=0; i<numDecFrames; ++i) {
-					out[i] += in[i] * w;
-				}
+void AmbiDecode::decode(float * dec, const float * ambi, int numDecFrames) const {
+	const int numChans = channels();
+
+	// frames of a tile of all ambi channels fit in the L1 cache
+	int tileFrames = (4096 / numChans) & ~15;
+	if(tileFrames < 16) tileFrames = 16;
+
+	float weights[4 * MAX_CHANNELS];
+	float * outs[4];
+
+	for(int beg=0; beg<numDecFrames; beg+=tileFrames){
+		int end = beg + tileFrames < numDecFrames ? beg + tileFrames : numDecFrames;
+
+		// iterate speakers, four at a time
+		int n = 0;
+		for(int s=0; s<numSpeakers(); ++s){
+			// skip zero-amp speakers:
+			if ((*mSpeakers)[s].gain == 0.f) continue;
+			outs[n] = dec + (*mSpeakers)[s].deviceChannel * numDecFrames;
+			speakerWeights(s, weights + n * numChans);
+			if(++n == 4){
+				decodeSpeakers(n, outs, weights, ambi, numChans, numDecFrames, beg, end);
+				n = 0;
 			}
 		}
+		decodeSpeakers(n, outs, weights, ambi, numChans, numDecFrames, beg, end);
 	}
 }
 
 void AmbiDecode::decode(float *dec, const float * ambi, int numDecFrames, int timeIndex) const {
+	float weights[MAX_CHANNELS];
 
 	// iterate speakers
 	for(int s=0; s<numSpeakers(); ++s){
 		// skip zero-amp speakers:
 		if ((*mSpeakers)[s].gain != 0.f) {
 			float * out = dec + (*mSpeakers)[s].deviceChannel * numDecFrames;
+			speakerWeights(s, weights);
 
 			// iterate ambi channels
 			for(int c=0; c<channels(); ++c){
 				const float * in = ambi + c * numDecFrames;
-				float w = decodeWeight(s, c) + mConfig.weightOffset;
-				if (mConfig.discardNegativeWeights && w < 0.0f) {
-					w = 0.0f;
-				}
-				out[timeIndex] += in[timeIndex] * w;
+				out[timeIndex] += in[timeIndex] * weights[c];
 			}
 		}
 	}
 }
 
 
+float AmbiDecode::flavorWeight(int type, int n, int order){
+	if(n > order) return 0.f;
+	if(order <= 4) return flavorWeights[type][n][order];
+	switch(type){
+	case 2: {	// in phase: M!(M+1)! / ((M+n+1)!(M-n)!)
+		double w = 1;
+		for(int k=order-n+1; k<=order; ++k) w *= k;
+		for(int k=order+2; k<=order+n+1; ++k) w /= k;
+		return w;
+	}
+	case 1:		// default: max-rE beyond the table
+	case 3:		// max-rE: P_n(cos(137.9 deg / (M + 1.51)))
+		return legendre(n, cos(137.9 / (order + 1.51) * 0.01745329252));
+	default:
+		return 1.f;
+	}
+}
+
 void AmbiDecode::flavor(int type){
 	if(type < 4){
 		mFlavor = type;
-		const int No = sizeof(mWOrder)/sizeof(mWOrder[0]);
-		for(int i=0; i<No; ++i) mWOrder[i] = flavorWeights[flavor()][i][order()];
+		for(int i=0; i<=MAX_ORDER; ++i) mWOrder[i] = flavorWeight(flavor(), i, order());
 		updateChanWeights();
 	}
 }
@@ -268,13 +482,14 @@ void AmbiDecode::setSpeakerRadians(int index, int deviceChannel, float az, float
 		numSpeakers(index);	// grow adaptively
 	}
 
-	(*mSpeakers)[index].azimuth = az;
-	(*mSpeakers)[index].elevation = el;
+	// speaker positions are in degrees
+	(*mSpeakers)[index].azimuth = az * float(57.2957795131);
+	(*mSpeakers)[index].elevation = el * float(57.2957795131);
 	(*mSpeakers)[index].deviceChannel = deviceChannel;
 	(*mSpeakers)[index].gain = amp;
 
 	// update encoding weights
-	encodeWeightsFuMa(mDecodeMatrix + index * channels(), mDim, mOrder, az, el);
+	encodeWeights(mDecodeMatrix + index * channels(), mConvention, mDim, mOrder, az, el);
 	for (int i=0; i<channels(); i++) {
 		mDecodeMatrix[index * channels() + i] *= amp;
 	}
@@ -293,6 +508,23 @@ void AmbiDecode::setSpeakers(Speakers &spkrs) {
 }
 
 void AmbiDecode::updateChanWeights(){
+	if(mConvention == AMBI_ACN_SN3D){
+		// Sampling decoder: the gain of a speaker is the sum over orders of
+		// (2n+1) P_n(cos angle) in 3D or 2 cos(n angle) in 2D, times the
+		// weight of the order, divided by the number of speakers.
+		float norm = mNumSpeakers > 0 ? 1.f / mNumSpeakers : 1.f;
+		for(int c=0; c<channels(); ++c){
+			int n = mDim == 2 ? (c + 1) >> 1 : int(sqrt(c + 0.5));
+			int multiplicity = mDim == 2 ? (n ? 2 : 1) : 2*n + 1;
+			mWeights[c] = mWOrder[n];
+			mDecodeScale[c] = mWOrder[n] * multiplicity * norm;
+		}
+		return;
+	}
+
+	// The FuMa decode matrix is not weighted
+	for(int c=0; c<channels(); ++c) mDecodeScale[c] = 1.f;
+
 	float * wc = mWeights;
 	*wc++ = mWOrder[0];
 
@@ -346,11 +578,10 @@ void AmbiDecode::resizeArrays(int numChannels, int numSpeakers){
 //		for(int i=0; i<numSpeakers; i++){
 //			setSpeaker(i, azimuths()[i], elevations()[i]);
 //		}
-
-		updateChanWeights();
 	}
 
 	mChannels = numChannels;
+	updateChanWeights();
 }
 
 void AmbiDecode::onChannelsChange(){
@@ -363,10 +594,25 @@ void AmbiDecode::print(FILE * fp, const char * append) const {
 }
 
 
+// AmbiEncode
+
+void AmbiEncode::encode(float * ambiChans, const float * input, int numFrames, const float * prevWeights) const {
+	if(numFrames <= 0) return;
+	const float invFrames = 1.f / numFrames;
+	for(int c=0; c<channels(); ++c){
+		float w0 = prevWeights[c];
+		float w1 = weights()[c];
+		if(w0 == 0.f && w1 == 0.f) continue;
+		mixRamp(ambiChans + c * numFrames, input, numFrames, w0, (w1 - w0) * invFrames);
+	}
+}
+
+
 AmbisonicsSpatializer::AmbisonicsSpatializer(
-	SpeakerLayout &sl, int dim, int order, int flavor
+	SpeakerLayout &sl, int dim, int order, int flavor, AmbiConvention convention
 )
-	:	Spatializer(sl), mDecoder(dim, order, sl.numSpeakers(), flavor), mEncoder(dim,order),
+	:	Spatializer(sl), mDecoder(dim, order, sl.numSpeakers(), flavor, convention),
+		mEncoder(dim, order, convention),
 	  mListener(NULL),  mNumFrames(0)
 {
 	setSpeakerLayout(sl);
@@ -415,88 +661,67 @@ void AmbisonicsSpatializer::prepare(){
     zeroAmbi();
 }
 
-void AmbisonicsSpatializer::renderBuffer(AudioIOData& io,
-                          const Pose& listeningPose,
-                          const float *samples,
-                          const int& numFrames
-                          )
-{
-//	// compute azimuth & elevation of relative position in current listener's coordinate frame:
-//	Vec3d urel(relpos);
-//	urel.normalize();	// unit vector in axis listener->source
-
-//	/* project into listener's coordinate frame:
-//		Vec3d axis;
-//		l.mQuatHistory[i].toVectorX(axis);
-//		double rr = urel.dot(axis);
-//		l.mQuatHistory[i].toVectorY(axis);
-//		double ru = urel.dot(axis);
-//		l.mQuatHistory[i].toVectorZ(axis);
-//		double rf = urel.dot(axis);
-//		//*/
+void AmbisonicsSpatializer::direction(const Pose& listeningPose){
 	Vec3d vec = listeningPose.vec();
 
 	//Rotate vector according to listener-rotation
 	Quatd srcRot = listeningPose.quat();
 	vec = srcRot.rotate(vec);
 
-//	vec = Vec4d(vec.x, -vec.z, vec.y);
-
-	mEncoder.direction(vec.x, -vec.z, vec.y);
+	// OpenGL to Ambisonics coordinates
+	vec = Vec3d(-vec.z, -vec.x, vec.y);
+	double mag = vec.mag();
+	if(mag > 0) vec /= mag;
+	mEncoder.direction(vec.x, vec.y, vec.z);
+}
 
+void AmbisonicsSpatializer::renderBuffer(AudioIOData& io,
+                          const Pose& listeningPose,
+                          const float *samples,
+                          const int& numFrames
+                          )
+{
+	direction(listeningPose);
 	mEncoder.encode(ambiChans(), samples, numFrames);
-//	for(int i = 0; i < numFrames; i++){
-////		// cheaper:
-////		Vec3d direction = mListener->quatHistory()[i].rotateTransposed(urel);
-
-////		//mEncoder.direction(azimuth, elevation);
-////		//mEncoder.direction(-rf, -rr, ru);
-//		mEncoder.encode(ambiChans(), numFrames, i, samples[i]);
-//	}
-	float *outs = &io.out(0,0);//io.outBuffer();
-	mDecoder.decode(outs, ambiChans(), mNumFrames);
 }
 
+void AmbisonicsSpatializer::initSourceState(SpatializerState& state) const {
+	state.weights.reserve(mEncoder.channels());
+	state.weights.clear();
+}
+
+void AmbisonicsSpatializer::renderSourceBuffer(AudioIOData& io, SoundSource& /*src*/,
+                          SpatializerState& state,
+                          const Pose& listeningPose,
+                          const float *samples,
+                          const int& numFrames
+                          )
+{
+	direction(listeningPose);
+
+	// The state keeps the weights of the last buffer of the source. The
+	// first buffer does not ramp.
+	const unsigned numChans = mEncoder.channels();
+	if(state.weights.size() != numChans){
+		state.weights.assign(mEncoder.weights(), mEncoder.weights() + numChans);
+	}
+	mEncoder.encode(ambiChans(), samples, numFrames, &state.weights[0]);
+	std::copy(mEncoder.weights(), mEncoder.weights() + numChans, state.weights.begin());
+}
 
 void AmbisonicsSpatializer::renderSample(AudioIOData& io, const Pose& listeningPose,
                           const float& sample,
                           const int& frameIndex)
 {
-	// compute azimuth & elevation of relative position in current listener's coordinate frame:
-//    Vec3d urel(relpos);
-//    urel.normalize();	// unit vector in axis listener->source
-//    // project into listener's coordinate frame:
-//    //						Vec3d axis;
-//    //						l.mQuatHistory[i].toVectorX(axis);
-//    //						double rr = urel.dot(axis);
-//    //						l.mQuatHistory[i].toVectorY(axis);
-//    //						double ru = urel.dot(axis);
-//    //						l.mQuatHistory[i].toVectorZ(axis);
-//    //						double rf = urel.dot(axis);
-
-//    // cheaper:
-//    Vec3d direction = mListener->quatHistory()[frameIndex].rotateTransposed(urel);
-	Vec3d direction = listeningPose.vec();
-
-	//Rotate vector according to listener-rotation
-	Quatd srcRot = listeningPose.quat();
-	direction = srcRot.rotate(direction);
-	direction = Vec4d(direction.x, direction.z, direction.y);
-
-    //mEncoder.direction(azimuth, elevation);
-    //mEncoder.direction(-rf, -rr, ru);
-//    mEncoder.direction(-direction[2], -direction[0], direction[1]);
-	mEncoder.direction(direction[0], direction[1], direction[2]);
-    mEncoder.encode(ambiChans(), io.framesPerBuffer(), frameIndex, sample);
+	direction(listeningPose);
+	mEncoder.encode(ambiChans(), io.framesPerBuffer(), frameIndex, sample);
+}
 
+void AmbisonicsSpatializer::finalize(AudioIOData& io){
 	float *outs = &io.out(0,0);//io.outBuffer();
 	mDecoder.decode(outs, ambiChans(), mNumFrames);
 }
 
-//void AmbisonicsSpatializer::finalize(AudioIOData& io){
-//	//previously done in render method of audioscene
-//}
-
 } // al::
 
 #undef WRAP
@@ -1,11 +1,73 @@
 #include "allocore/sound/al_AudioScene.hpp"
 #include "allocore/math/al_Constants.hpp"
-
+#include "allocore/system/al_TaskPool.hpp"
+#include "../private/al_ImplSIMD.h"
 
 #include <iostream>
 
 namespace al{
 
+// Output accumulator of one group of sources. It has the same layout as
+// the AudioIOData passed to AudioScene::render.
+class AudioSceneAccum : public AudioIOData {
+public:
+	AudioSceneAccum(): AudioIOData(nullptr){}
+
+	void resize(int chans, int frames, double fps){
+		if(chans != mNumO || frames != mFramesPerBuffer){
+			mNumO = chans;
+			mFramesPerBuffer = frames;
+			resizeBuf(mBufO, chans * frames);
+			resizeBuf(mBufT, frames);
+		}
+		mFramesPerSecond = fps;
+	}
+};
+
+
+// Accumulators of the groups of sources and the threads rendering them. The
+// threads are dedicated to the scene, rather than shared with other work, so
+// that rendering does not wait behind tasks unrelated to audio.
+class AudioScene::RenderPool {
+public:
+
+	RenderPool(AudioScene& scene, int numGroups)
+	:	mScene(scene), mAccums(numGroups), mTasks(numGroups)
+	{
+		for(int i=0; i<numGroups; ++i) mAccums[i] = new AudioSceneAccum;
+	}
+
+	~RenderPool(){
+		for(unsigned i=0; i<mAccums.size(); ++i) delete mAccums[i];
+	}
+
+	int numGroups() const { return mAccums.size(); }
+
+	AudioSceneAccum& accum(int i){ return *mAccums[i]; }
+
+	TaskPool& tasks(){ return mTasks; }
+
+	void resize(const AudioIOData& io){
+		for(unsigned i=0; i<mAccums.size(); ++i){
+			mAccums[i]->resize(io.channelsOut(), io.framesPerBuffer(), io.framesPerSecond());
+		}
+	}
+
+	// Render all groups and return once every group has finished
+	void run(){
+		const int N = numGroups();
+		mTasks.parallelFor(N, [this, N](int group){
+			mScene.renderGroup(accum(group), group, N);
+		});
+	}
+
+private:
+	AudioScene& mScene;
+	std::vector<AudioSceneAccum *> mAccums;
+	TaskPool mTasks;
+};
+
+
 Spatializer::Spatializer(const SpeakerLayout& sl) :
     mEnabled(true)
 {
@@ -16,6 +78,111 @@ Spatializer::Spatializer(const SpeakerLayout& sl) :
 };
 
 
+using simd::mixRamp;
+
+void GainMatrix::setup(const Speakers& speakers, const std::map<int, std::vector<int> >& reassigned){
+	mRowStarts.assign(1, 0);
+	mEntryOutputs.clear();
+	mEntryWeights.clear();
+	mOutputs.clear();
+
+	std::map<int, unsigned> outputIndex;
+	auto addEntry = [&](int chan, float weight){
+		auto it = outputIndex.find(chan);
+		if(it == outputIndex.end()){
+			it = outputIndex.insert(std::make_pair(chan, (unsigned)mOutputs.size())).first;
+			mOutputs.push_back(chan);
+		}
+		mEntryOutputs.push_back(it->second);
+		mEntryWeights.push_back(weight);
+	};
+
+	for(unsigned s=0; s<speakers.size(); ++s){
+		int chan = speakers[s].deviceChannel;
+		auto it = reassigned.find(chan);
+		if(it != reassigned.end()){
+			float weight = 1.f / sqrt(float(it->second.size()));
+			for(int c : it->second){
+				addEntry(c, weight);
+			}
+		} else {
+			addEntry(chan, 1.f);
+		}
+		mRowStarts.push_back(mEntryOutputs.size());
+	}
+}
+
+void GainMatrix::initState(State& state) const {
+	state.matrix = this;
+	state.gains.assign(mOutputs.size(), 0.f);
+	state.next.assign(mOutputs.size(), 0.f);
+	state.fresh = true;
+}
+
+void GainMatrix::renderBuffer(AudioIOData& io, State * state,
+	const float * samples, int numFrames,
+	const float * gains, int numGains, const int * speakers) const
+{
+	if(!state){
+		for(int k=0; k<numGains; ++k){
+			if(gains[k] == 0.f) continue;
+			int s = speakers ? speakers[k] : k;
+			for(unsigned e=mRowStarts[s]; e<mRowStarts[s+1]; ++e){
+				float g = gains[k] * mEntryWeights[e];
+				mixRamp(io.outBuffer(mOutputs[mEntryOutputs[e]]), samples, numFrames, g, 0.f);
+			}
+		}
+		return;
+	}
+
+	if(numFrames <= 0) return;
+
+	const unsigned numOut = mOutputs.size();
+	if(state->matrix != this || state->gains.size() != numOut){
+		initState(*state);
+	}
+
+	// Output gains of this block
+	float * next = &state->next[0];
+	std::fill(state->next.begin(), state->next.end(), 0.f);
+	for(int k=0; k<numGains; ++k){
+		if(gains[k] == 0.f) continue;
+		int s = speakers ? speakers[k] : k;
+		for(unsigned e=mRowStarts[s]; e<mRowStarts[s+1]; ++e){
+			next[mEntryOutputs[e]] += gains[k] * mEntryWeights[e];
+		}
+	}
+
+	// A new source starts at its gains without ramp
+	if(state->fresh){
+		state->gains = state->next;
+		state->fresh = false;
+	}
+
+	const float * prev = &state->gains[0];
+	const float invFrames = 1.f / numFrames;
+	for(unsigned c=0; c<numOut; ++c){
+		if(prev[c] == 0.f && next[c] == 0.f) continue;
+		mixRamp(io.outBuffer(mOutputs[c]), samples, numFrames,
+			prev[c], (next[c] - prev[c]) * invFrames);
+	}
+
+	state->gains.swap(state->next);
+}
+
+void GainMatrix::renderSample(AudioIOData& io, float sample, int frameIndex,
+	const float * gains, int numGains, const int * speakers) const
+{
+	for(int k=0; k<numGains; ++k){
+		if(gains[k] == 0.f) continue;
+		int s = speakers ? speakers[k] : k;
+		for(unsigned e=mRowStarts[s]; e<mRowStarts[s+1]; ++e){
+			io.out(mOutputs[mEntryOutputs[e]], frameIndex) += sample * gains[k] * mEntryWeights[e];
+		}
+	}
+}
+
+
 
 void AudioSceneObject::updateHistory(){
 	mPosHistory(mPose.pos());
@@ -23,8 +190,8 @@ void AudioSceneObject::updateHistory(){
 
 
 
-Listener::Listener(int numFrames_, Spatializer *spatializer)
-	:	mSpatializer(spatializer), mIsCompiled(false)
+Listener::Listener(int numFrames_, Spatializer *spatializer, unsigned index)
+	:	mSpatializer(spatializer), mIndex(index), mIsCompiled(false)
 {
 	numFrames(numFrames_);
 }
@@ -71,15 +238,234 @@ int SoundSource::bufferSize(double samplerate, double speedOfSound, double dista
 	return (int)ceil(samplerate * distance / speedOfSound);
 }
 
+double SoundSource::readIndices(const Pose& listeningPose, double * indices, int size){
+	double dist = listeningPose.vec().mag();
+
+	// The pose is constant over the block, so once the position history has
+	// filled with it the Doppler delay no longer changes and only the frame
+	// offset has to be advanced.
+	const int historySize = posHistory().size();
+	int i = 0;
+	for(; i<size && i<historySize; ++i){
+		indices[i] = nextReadIndex(listeningPose, dist);
+	}
+	if(i < size){
+		double samplesAgo = dopplerDelay(listeningPose, dist);
+		if(usePerSampleProcessing()){
+			for(; i<size; ++i) indices[i] = samplesAgo;
+		} else {
+			for(; i<size; ++i) indices[i] = samplesAgo - mFrameCounter++;
+		}
+	}
+	return attenuation(dist);
+}
+
+// Catmull-Rom interpolation of four taps, as ipl::cubic, on SIMD vectors
+#if defined(AL_SIMD_AVX2)
+static inline __m256 cubic8(__m256 f, __m256 w, __m256 x, __m256 y, __m256 z){
+	const __m256 half = _mm256_set1_ps(0.5f);
+	__m256 c1 = _mm256_mul_ps(_mm256_sub_ps(y, w), half);
+	__m256 c3 = _mm256_add_ps(
+		_mm256_mul_ps(_mm256_sub_ps(x, y), _mm256_set1_ps(1.5f)),
+		_mm256_mul_ps(_mm256_sub_ps(z, w), half));
+	__m256 c2 = _mm256_sub_ps(_mm256_sub_ps(_mm256_add_ps(c1, w), x), c3);
+	__m256 r = _mm256_add_ps(_mm256_mul_ps(c3, f), c2);
+	r = _mm256_add_ps(_mm256_mul_ps(r, f), c1);
+	return _mm256_add_ps(_mm256_mul_ps(r, f), x);
+}
+#elif defined(AL_SIMD_SSE2)
+static inline __m128 cubic4(__m128 f, __m128 w, __m128 x, __m128 y, __m128 z){
+	const __m128 half = _mm_set1_ps(0.5f);
+	__m128 c1 = _mm_mul_ps(_mm_sub_ps(y, w), half);
+	__m128 c3 = _mm_add_ps(
+		_mm_mul_ps(_mm_sub_ps(x, y), _mm_set1_ps(1.5f)),
+		_mm_mul_ps(_mm_sub_ps(z, w), half));
+	__m128 c2 = _mm_sub_ps(_mm_sub_ps(_mm_add_ps(c1, w), x), c3);
+	__m128 r = _mm_add_ps(_mm_mul_ps(c3, f), c2);
+	r = _mm_add_ps(_mm_mul_ps(r, f), c1);
+	return _mm_add_ps(_mm_mul_ps(r, f), x);
+}
+#elif defined(AL_SIMD_NEON)
+static inline float32x4_t cubic4(float32x4_t f, float32x4_t w, float32x4_t x, float32x4_t y, float32x4_t z){
+	float32x4_t c1 = vmulq_n_f32(vsubq_f32(y, w), 0.5f);
+	float32x4_t c3 = vaddq_f32(
+		vmulq_n_f32(vsubq_f32(x, y), 1.5f),
+		vmulq_n_f32(vsubq_f32(z, w), 0.5f));
+	float32x4_t c2 = vsubq_f32(vsubq_f32(vaddq_f32(c1, w), x), c3);
+	float32x4_t r = vaddq_f32(vmulq_f32(c3, f), c2);
+	r = vaddq_f32(vmulq_f32(r, f), c1);
+	return vaddq_f32(vmulq_f32(r, f), x);
+}
+#endif
+
+void SoundSource::readSamples(float * out, const double * indices, int size, float gain) const {
+	const double maxIdx = maxIndex();
+	bool exceeded = false;
+	int i = 0;
+
+#if defined(AL_SIMD_AVX2) || defined(AL_SIMD_SSE2) || defined(AL_SIMD_NEON)
+	const float * elems = &mSound[0];
+	const int pos = mSound.pos();
+	const int len = mSound.size();
+#endif
+
+#if defined(AL_SIMD_AVX2)
+	// Gather the four taps of eight samples at once. The taps of sample j are
+	// at pos-idx[j]-1 ... pos-idx[j]+2, wrapped once into the buffer.
+	const __m256i vpos = _mm256_set1_epi32(pos);
+	const __m256i vlen = _mm256_set1_epi32(len);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256d vmax = _mm256_set1_pd(maxIdx);
+	for(; i+8 <= size; i+=8){
+		__m256d d0 = _mm256_loadu_pd(indices + i);
+		__m256d d1 = _mm256_loadu_pd(indices + i + 4);
+		__m128i t0 = _mm256_cvttpd_epi32(d0);
+		__m128i t1 = _mm256_cvttpd_epi32(d1);
+		__m256 f = _mm256_insertf128_ps(_mm256_castps128_ps256(
+			_mm256_cvtpd_ps(_mm256_sub_pd(d0, _mm256_cvtepi32_pd(t0)))),
+			_mm256_cvtpd_ps(_mm256_sub_pd(d1, _mm256_cvtepi32_pd(t1))), 1);
+		__m256i idx = _mm256_inserti128_si256(_mm256_castsi128_si256(t0), t1, 1);
+
+		// Lanes beyond the delay-line read index 0 and are silenced below
+		int over = _mm256_movemask_pd(_mm256_cmp_pd(d0, vmax, _CMP_GT_OQ))
+			| (_mm256_movemask_pd(_mm256_cmp_pd(d1, vmax, _CMP_GT_OQ)) << 4);
+		if(over){
+			__m256i overMask = _mm256_setr_epi32(
+				over&1 ? -1:0, over&2 ? -1:0, over&4 ? -1:0, over&8 ? -1:0,
+				over&16? -1:0, over&32? -1:0, over&64? -1:0, over&128?-1:0);
+			idx = _mm256_andnot_si256(overMask, idx);
+		}
+
+		__m256i base = _mm256_sub_epi32(vpos, idx);
+		__m256 taps[4];
+		for(int k=0; k<4; ++k){
+			__m256i t = _mm256_add_epi32(base, _mm256_set1_epi32(k-1));
+			t = _mm256_add_epi32(t, _mm256_and_si256(_mm256_cmpgt_epi32(zero, t), vlen));
+			t = _mm256_sub_epi32(t, _mm256_andnot_si256(_mm256_cmpgt_epi32(vlen, t), vlen));
+			taps[k] = _mm256_i32gather_ps(elems, t, 4);
+		}
+		__m256 r = cubic8(f, taps[0], taps[1], taps[2], taps[3]);
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(r, _mm256_set1_ps(gain)));
+
+		if(over){
+			exceeded = true;
+			for(int j=0; j<8; ++j) if(over & (1<<j)) out[i+j] = 0.f;
+		}
+	}
+
+#elif defined(AL_SIMD_SSE2)
+	// The four taps of a sample are contiguous in memory unless they wrap
+	// around the end of the buffer. Load them as one vector per sample and
+	// transpose so each vector holds one tap of four samples. Groups that
+	// wrap or exceed the delay-line are left to the scalar path.
+	const __m128d vmax = _mm_set1_pd(maxIdx);
+	const __m128i vpos = _mm_set1_epi32(pos);
+	const __m128i vlo = _mm_set1_epi32(1);
+	const __m128i vhi = _mm_set1_epi32(len-3);
+	for(; i+4 <= size; i+=4){
+		__m128d d0 = _mm_loadu_pd(indices + i);
+		__m128d d1 = _mm_loadu_pd(indices + i + 2);
+		__m128i t0 = _mm_cvttpd_epi32(d0);
+		__m128i t1 = _mm_cvttpd_epi32(d1);
+		__m128i base = _mm_sub_epi32(vpos, _mm_unpacklo_epi64(t0, t1));
+
+		int over = _mm_movemask_pd(_mm_cmpgt_pd(d0, vmax)) | _mm_movemask_pd(_mm_cmpgt_pd(d1, vmax));
+		int wraps = _mm_movemask_epi8(_mm_or_si128(
+			_mm_cmplt_epi32(base, vlo), _mm_cmpgt_epi32(base, vhi)));
+		if(over || wraps){
+			for(int j=0; j<4; ++j){
+				double index = indices[i+j];
+				if(index <= maxIdx){
+					out[i+j] = readSample(index) * gain;
+				} else {
+					out[i+j] = 0.f;
+					exceeded = true;
+				}
+			}
+			continue;
+		}
+
+		__m128 f = _mm_movelh_ps(
+			_mm_cvtpd_ps(_mm_sub_pd(d0, _mm_cvtepi32_pd(t0))),
+			_mm_cvtpd_ps(_mm_sub_pd(d1, _mm_cvtepi32_pd(t1))));
+		int b[4];
+		_mm_storeu_si128((__m128i *)b, base);
+		__m128 w = _mm_loadu_ps(elems + b[0] - 1);
+		__m128 x = _mm_loadu_ps(elems + b[1] - 1);
+		__m128 y = _mm_loadu_ps(elems + b[2] - 1);
+		__m128 z = _mm_loadu_ps(elems + b[3] - 1);
+		_MM_TRANSPOSE4_PS(w, x, y, z);
+		__m128 r = cubic4(f, w, x, y, z);
+		_mm_storeu_ps(out + i, _mm_mul_ps(r, _mm_set1_ps(gain)));
+	}
+
+#elif defined(AL_SIMD_NEON)
+	// As for SSE2, load the contiguous taps of four samples and transpose
+	for(; i+4 <= size; i+=4){
+		int b[4];
+		float frac[4];
+		bool contiguous = true;
+		for(int j=0; j<4; ++j){
+			double index = indices[i+j];
+			int index0 = (int)index;
+			frac[j] = -(index0 - index);
+			b[j] = pos - index0;
+			contiguous &= (index <= maxIdx) && (b[j] >= 1) && (b[j] + 2 < len);
+		}
+		if(!contiguous){
+			for(int j=0; j<4; ++j){
+				double index = indices[i+j];
+				if(index <= maxIdx){
+					out[i+j] = readSample(index) * gain;
+				} else {
+					out[i+j] = 0.f;
+					exceeded = true;
+				}
+			}
+			continue;
+		}
+
+		float32x4_t s0 = vld1q_f32(elems + b[0] - 1);
+		float32x4_t s1 = vld1q_f32(elems + b[1] - 1);
+		float32x4_t s2 = vld1q_f32(elems + b[2] - 1);
+		float32x4_t s3 = vld1q_f32(elems + b[3] - 1);
+		float32x4x2_t p01 = vtrnq_f32(s0, s1);
+		float32x4x2_t p23 = vtrnq_f32(s2, s3);
+		float32x4_t w = vcombine_f32(vget_low_f32(p01.val[0]), vget_low_f32(p23.val[0]));
+		float32x4_t x = vcombine_f32(vget_low_f32(p01.val[1]), vget_low_f32(p23.val[1]));
+		float32x4_t y = vcombine_f32(vget_high_f32(p01.val[0]), vget_high_f32(p23.val[0]));
+		float32x4_t z = vcombine_f32(vget_high_f32(p01.val[1]), vget_high_f32(p23.val[1]));
+		float32x4_t r = cubic4(vld1q_f32(frac), w, x, y, z);
+		vst1q_f32(out + i, vmulq_n_f32(r, gain));
+	}
+#endif
+
+	// Remaining samples (or all of them without SIMD)
+	for(; i<size; ++i){
+		if(indices[i] <= maxIdx){
+			out[i] = readSample(indices[i]) * gain;
+		} else {
+			out[i] = 0.f;
+			exceeded = true;
+		}
+	}
+
+	if(exceeded){
+		std::cout << "Delay line exceeded in SoundSource" << std::endl;
+	}
+}
+
 
 
 AudioScene::AudioScene(int numFrames_)
-	:   mNumFrames(0), mPerSampleProcessing(false)
+	:   mNumFrames(0), mPerSampleProcessing(false),
+		mRenderPool(0), mNumThreads(1), mThreadPriority(0), mRenderListener(0), mRenderConcurrent(false)
 {
 	numFrames(numFrames_);
 }
 
 AudioScene::~AudioScene(){
+	delete mRenderPool;
 	for(
 		Listeners::iterator it = mListeners.begin();
 		it != mListeners.end();
@@ -91,6 +477,10 @@ AudioScene::~AudioScene(){
 
 void AudioScene::addSource(SoundSource& src){
 	mSources.push_back(&src);
+	for(unsigned il=0; il<mListeners.size(); ++il){
+		Listener& l = *mListeners[il];
+		l.mSpatializer->initSourceState(src.spatializerState(l));
+	}
 }
 
 void AudioScene::removeSource(SoundSource& src){
@@ -110,10 +500,28 @@ void AudioScene::numFrames(int v){
 	}
 }
 
+void AudioScene::numThreads(int n){
+	if(n < 1) n = 1;
+	if(n != mNumThreads){
+		delete mRenderPool;
+		mRenderPool = n > 1 ? new RenderPool(*this, n) : 0;
+		mNumThreads = n;
+		if(mRenderPool) mRenderPool->tasks().priority(mThreadPriority);
+	}
+}
+
+bool AudioScene::threadPriority(int v){
+	mThreadPriority = v;
+	return mRenderPool ? mRenderPool->tasks().priority(v) : true;
+}
+
 Listener * AudioScene::createListener(Spatializer* spatializer){
-	Listener * l = new Listener(mNumFrames, spatializer);
+	Listener * l = new Listener(mNumFrames, spatializer, mListeners.size());
 	l->compile();
 	mListeners.push_back(l);
+	for(Sources::iterator it = mSources.begin(); it != mSources.end(); ++it){
+		spatializer->initSourceState((*it)->spatializerState(*l));
+	}
 	return l;
 }
 
@@ -131,6 +539,15 @@ void AudioScene::render(AudioIOData& io) {
 	// double sampleRate = io.framesPerSecond();
 	io.zeroOut();
 
+	if(mRenderPool){
+		renderParallel(io);
+	} else {
+		renderSerial(io);
+	}
+}
+
+void AudioScene::renderSerial(AudioIOData& io) {
+
 	// iterate through all listeners adding contribution from all sources
 	for(unsigned il=0; il<mListeners.size(); ++il){
 		Listener& l = *mListeners[il];
@@ -148,7 +565,7 @@ void AudioScene::render(AudioIOData& io) {
 				src.frame(0);
                 for(int i=0; i < mNumFrames; ++i){
                     Pose relpos(src.pose().pos() - l.pose().pos(), src.pose().quat() /l.pose().quat());
-					spatializer->renderSample(io, relpos, src.getNextSample(l), i);
+					spatializer->renderSourceSample(io, src, relpos, src.getNextSample(l), i);
 				}
 			} else { //more efficient, per buffer processing for audioscene (does not work well with doppler)
 				Pose relpos(src.pose().pos() - l.pose().pos(), src.pose().quat() /l.pose().quat());
@@ -156,7 +573,7 @@ void AudioScene::render(AudioIOData& io) {
 //				std::cout << l.pose().x() << "," << l.pose().z() << " ---- ";
 //				std::cout << src.pos().x << "," << src.pos().z << " ----- ";
 //				std::cout << relpos.x << "," << relpos.z << std::endl;
-				spatializer->renderBuffer(io, relpos, mBuffer.data(), mNumFrames);
+				spatializer->renderSourceBuffer(io, src, src.spatializerState(l), relpos, mBuffer.data(), mNumFrames);
 			}
 		} //end for each source
 
@@ -165,6 +582,101 @@ void AudioScene::render(AudioIOData& io) {
 	} // end for each listener
 }
 
+void AudioScene::renderParallel(AudioIOData& io) {
+	RenderPool& pool = *mRenderPool;
+	pool.resize(io);
+
+	mSourceArray.assign(mSources.begin(), mSources.end());
+	const int numSources = mSourceArray.size();
+
+	for(unsigned il=0; il<mListeners.size(); ++il){
+		Listener& l = *mListeners[il];
+
+		Spatializer* spatializer = l.mSpatializer;
+		spatializer->prepare();
+
+		l.updateHistory(mNumFrames);
+
+		mRenderListener = &l;
+		mRenderConcurrent = spatializer->concurrentRender();
+
+		if(!mRenderConcurrent){
+			if(mSourceSamples.size() < unsigned(numSources * mNumFrames)){
+				mSourceSamples.resize(numSources * mNumFrames);
+			}
+			if(mSourcePoses.size() < unsigned(numSources)){
+				mSourcePoses.resize(numSources);
+			}
+		}
+
+		pool.run();
+
+		if(mRenderConcurrent){
+			// Sum thread accumulators in a fixed order
+			const int numSamples = io.channelsOut() * mNumFrames;
+			float * out = io.outBuffer();
+			for(int g=0; g<pool.numGroups(); ++g){
+				const float * acc = pool.accum(g).outBuffer();
+				for(int i=0; i<numSamples; ++i) out[i] += acc[i];
+			}
+		} else {
+			// Spatialize source samples in source order
+			for(int k=0; k<numSources; ++k){
+				SoundSource& src = *mSourceArray[k];
+				const float * samples = &mSourceSamples[k * mNumFrames];
+				if(mPerSampleProcessing){
+					for(int i=0; i<mNumFrames; ++i){
+						spatializer->renderSourceSample(io, src, mSourcePoses[k], samples[i], i);
+					}
+				} else {
+					spatializer->renderSourceBuffer(io, src, src.spatializerState(l), mSourcePoses[k], samples, mNumFrames);
+				}
+			}
+		}
+
+		spatializer->finalize(io);
+	}
+
+	mRenderListener = 0;
+}
+
+void AudioScene::renderGroup(AudioIOData& accum, int group, int numGroups) {
+	Listener& l = *mRenderListener;
+	Spatializer * spatializer = l.mSpatializer;
+
+	const int numSources = mSourceArray.size();
+	const int beg = (numSources * group) / numGroups;
+	const int end = (numSources * (group+1)) / numGroups;
+
+	if(mRenderConcurrent) accum.zeroOut();
+
+	for(int k=beg; k<end; ++k){
+		SoundSource& src = *mSourceArray[k];
+		Pose relpos(src.pose().pos() - l.pose().pos(), src.pose().quat() /l.pose().quat());
+
+		float * samples = mRenderConcurrent ? accum.tempBuffer() : &mSourceSamples[k * mNumFrames];
+
+		if(mPerSampleProcessing){
+			src.frame(0);
+			for(int i=0; i < mNumFrames; ++i){
+				samples[i] = src.getNextSample(l);
+			}
+			if(mRenderConcurrent){
+				for(int i=0; i < mNumFrames; ++i){
+					spatializer->renderSourceSample(accum, src, relpos, samples[i], i);
+				}
+			}
+		} else {
+			src.getBuffer(relpos, samples, mNumFrames);
+			if(mRenderConcurrent){
+				spatializer->renderSourceBuffer(accum, src, src.spatializerState(l), relpos, samples, mNumFrames);
+			}
+		}
+
+		if(!mRenderConcurrent) mSourcePoses[k] = relpos;
+	}
+}
+
 } // al::
 
 
@@ -4,21 +4,34 @@ namespace al{
 
 Dbap::Dbap(const SpeakerLayout &sl, float focus)
 	:	Spatializer(sl), mListener(NULL), mNumSpeakers(0), mFocus(focus)
-{}
+{
+	setupSpeakers();
+}
 
-void Dbap::compile(Listener& listener){
-	mListener = &listener;
+void Dbap::setupSpeakers(){
 	mNumSpeakers = mSpeakers.size();
-	printf("DBAP Compiled with %d speakers\n", mNumSpeakers);
+	if(mNumSpeakers > DBAP_MAX_NUM_SPEAKERS){
+		mNumSpeakers = DBAP_MAX_NUM_SPEAKERS;
+	}
 
 	for(int i = 0; i < mNumSpeakers; i++)
 	{
 		mSpeakerVecs[i] = mSpeakers[i].vec();
-		mDeviceChannels[i] = mSpeakers[i].deviceChannel;
 	}
+	mGainMatrix.setup(Speakers(mSpeakers.begin(), mSpeakers.begin() + mNumSpeakers));
+}
+
+void Dbap::compile(Listener& listener){
+	mListener = &listener;
+	setupSpeakers();
+	printf("DBAP Compiled with %d speakers\n", mNumSpeakers);
 }
 
-void Dbap::perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, float *samples){
+int Dbap::computeGains(const Pose& reldir, float * gains) const {
+	// Same orientation of speakers as VBAP
+	Vec3d relpos = reldir.quat().rotate(reldir.vec());
+	relpos = Vec3d(relpos.x, relpos.z, relpos.y);
+
 	for (int k = 0; k < mNumSpeakers; ++k)
 	{
 		float gain = 1.f;
@@ -29,29 +42,28 @@ void Dbap::perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int&
 			gain = 1.f / (1.f + dist);
 			gain = powf(gain, mFocus);
 		}
-
-		float * out = io.outBuffer(mDeviceChannels[k]);
-		for(int i = 0; i < numFrames; ++i){
-			out[i] += gain * samples[i];
-		}
+		gains[k] = gain;
 	}
+	return mNumSpeakers;
 }
 
-void Dbap::perform(AudioIOData& io, SoundSource& src, Vec3d& relpos, const int& numFrames, int& frameIndex, float& sample)
-{
-	for (int i = 0; i < mNumSpeakers; ++i)
-	{
-		float gain = 1.f;
-		if(mEnabled)
-		{
-			Vec3d vec = relpos - mSpeakerVecs[i];
-			float dist = vec.mag();
-			gain = 1.f / (1.f + dist);
-			gain = powf(gain, mFocus);
-		}
+void Dbap::renderBuffer(AudioIOData& io, const Pose& reldir, const float *samples, const int& numFrames){
+	float gains[DBAP_MAX_NUM_SPEAKERS];
+	int numGains = computeGains(reldir, gains);
+	mGainMatrix.renderBuffer(io, nullptr, samples, numFrames, gains, numGains);
+}
 
-		io.out(mDeviceChannels[i], frameIndex) += gain*sample;
-	}
+void Dbap::renderSourceBuffer(AudioIOData& io, SoundSource& /*src*/, SpatializerState& state, const Pose& reldir, const float *samples, const int& numFrames){
+	float gains[DBAP_MAX_NUM_SPEAKERS];
+	int numGains = computeGains(reldir, gains);
+	mGainMatrix.renderBuffer(io, &state.gains, samples, numFrames, gains, numGains);
+}
+
+void Dbap::renderSample(AudioIOData& io, const Pose& reldir, const float& sample, const int& frameIndex)
+{
+	float gains[DBAP_MAX_NUM_SPEAKERS];
+	int numGains = computeGains(reldir, gains);
+	mGainMatrix.renderSample(io, sample, frameIndex, gains, numGains);
 }
 
 void Dbap::print() {
@@ -1,7 +1,13 @@
+#include <cmath>
+
 #include "allocore/sound/al_Vbap.hpp"
 
 namespace al{
 
+// Resolution of the direction lookup table
+static const int VBAP_AZIMUTH_CELLS = 72;
+static const int VBAP_ELEVATION_CELLS = 36;
+
 bool SpeakerTriple::loadVectors(const std::vector<Speaker>& spkrs){
 	bool hasInverse;
 
@@ -52,7 +58,7 @@ bool SpeakerTriple::loadVectors(const std::vector<Speaker>& spkrs){
 
 
 Vbap::Vbap(const SpeakerLayout &sl, bool is3D)
-    :	Spatializer(sl), mIs3D(is3D)
+    :	Spatializer(sl), mListener(nullptr), mIs3D(is3D), mUseLookupTable(true)
 {
 	//Check if 3D...
 	if(mIs3D){
@@ -69,10 +75,117 @@ Vbap::Vbap(const SpeakerLayout &sl, bool is3D)
 		throw -1;
 	}
 
+	buildLookupTable();
+	mGainMatrix.setup(mSpeakers, mPhantomChannels);
 }
 
 void Vbap::addTriple(const SpeakerTriple& st) {
 	mTriplets.push_back(st);
+	// Table is out of date until next compile
+	mCellStarts.clear();
+	mCellTriplets.clear();
+}
+
+void Vbap::buildLookupTable(){
+	const int numAz = VBAP_AZIMUTH_CELLS;
+	const int numEl = mIs3D ? VBAP_ELEVATION_CELLS : 1;
+	const double dAz = 2*M_PI / numAz;
+	const double dEl = M_PI / numEl;
+	const unsigned dims = mIs3D ? 3 : 2;
+
+	// Gains are linear in the direction, so moving the direction by an angle
+	// r changes gain i by at most r times the norm of column i of the matrix.
+	std::vector<Vec3d> colNorms(mTriplets.size());
+	for(unsigned t=0; t<mTriplets.size(); ++t){
+		for(unsigned i=0; i<dims; ++i){
+			double sum = 0;
+			for(unsigned j=0; j<dims; ++j){
+				sum += mTriplets[t].mat(j,i) * mTriplets[t].mat(j,i);
+			}
+			colNorms[t][i] = sqrt(sum);
+		}
+	}
+
+	mCellStarts.assign(1, 0);
+	mCellTriplets.clear();
+
+	for(int e=0; e<numEl; ++e){
+		double el = mIs3D ? -M_PI/2 + (e + 0.5) * dEl : 0;
+		// Largest cosine of elevation within cell
+		double elNear = mIs3D ? -M_PI/2 + e * dEl : 0;
+		if(elNear < 0) elNear = std::min(elNear + dEl, 0.);
+		double maxCos = cos(elNear);
+
+		for(int a=0; a<numAz; ++a){
+			double az = -M_PI + (a + 0.5) * dAz;
+			Vec3d center(cos(el)*cos(az), cos(el)*sin(az), sin(el));
+
+			// Angle from cell center covering the whole cell (with some margin)
+			double radius = (mIs3D ? dEl/2 : 0) + maxCos * dAz/2 + 1e-6;
+
+			for(unsigned t=0; t<mTriplets.size(); ++t){
+				Vec3d gains = computeGains(center, mTriplets[t]);
+				bool possible = true;
+				for(unsigned i=0; i<dims; ++i){
+					if(gains[i] < -colNorms[t][i] * radius){
+						possible = false;
+						break;
+					}
+				}
+				if(possible) mCellTriplets.push_back(t);
+			}
+			mCellStarts.push_back(mCellTriplets.size());
+		}
+	}
+}
+
+int Vbap::lookupCell(const Vec3d& vec) const {
+	double xy = hypot(vec[0], vec[1]);
+	if(!(xy > 0)) return -1; // also rejects NaN
+
+	const int numAz = VBAP_AZIMUTH_CELLS;
+	int a = int((atan2(vec[1], vec[0]) + M_PI) * (numAz / (2*M_PI)));
+	if(a < 0) a = 0;
+	if(a >= numAz) a = numAz-1;
+	if(!mIs3D) return a;
+
+	const int numEl = VBAP_ELEVATION_CELLS;
+	int e = int((atan2(vec[2], xy) + M_PI/2) * (numEl / M_PI));
+	if(e < 0) e = 0;
+	if(e >= numEl) e = numEl-1;
+	return e * numAz + a;
+}
+
+int Vbap::findTriplet(const Vec3d& vec, int hint, Vec3d& gains){
+	const int numTriplets = mTriplets.size();
+
+	// Sources move slowly, so the last triplet found is usually right
+	if(hint >= 0 && hint < numTriplets){
+		gains = computeGains(vec, mTriplets[hint]);
+		if(containsDirection(gains)) return hint;
+	}
+
+	int cell = -1;
+	if(mUseLookupTable && !mCellStarts.empty()){
+		cell = lookupCell(vec);
+	}
+
+	if(cell >= 0){
+		// Candidates are in ascending order, so this finds the same triplet
+		// as searching all triplets
+		for(unsigned k=mCellStarts[cell]; k<mCellStarts[cell+1]; ++k){
+			unsigned t = mCellTriplets[k];
+			gains = computeGains(vec, mTriplets[t]);
+			if(containsDirection(gains)) return t;
+		}
+	}
+	else{
+		for(int t=0; t<numTriplets; ++t){
+			gains = computeGains(vec, mTriplets[t]);
+			if(containsDirection(gains)) return t;
+		}
+	}
+	return -1;
 }
 
 Vec3d Vbap::computeGains(const Vec3d& vecA, const SpeakerTriple& speak) {
@@ -393,19 +506,42 @@ void Vbap::findSpeakerTriplets(const std::vector<Speaker>& spkrs){
 void Vbap::makePhantomChannel(int channelIndex, std::vector<int> assignedOutputs)
 {
 	mPhantomChannels[channelIndex] = assignedOutputs;
+	mGainMatrix.setup(mSpeakers, mPhantomChannels);
 }
 
 void Vbap::compile(Listener& listener){
 	this->mListener = &listener;
+	if(mCellStarts.empty()){
+		buildLookupTable();
+	}
+	mGainMatrix.setup(mSpeakers, mPhantomChannels);
 }
 
 void Vbap::renderBuffer(AudioIOData &io, const Pose &listeningPose, const float *samples, const int &numFrames)
 {
-	// FIMXE AC use cached index
-//	unsigned currentTripletIndex = src.cachedIndex();
-	unsigned currentTripletIndex = 0;
-	// unsigned currentTripletIndex = mCachedTripletIndex; // Cached source placement, so it starts searching from there.
+	renderTripletBuffer(io, listeningPose, samples, numFrames, -1, nullptr);
+}
+
+void Vbap::renderSourceBuffer(AudioIOData &io, SoundSource &src, SpatializerState &state, const Pose &listeningPose, const float *samples, const int &numFrames)
+{
+	int index = renderTripletBuffer(io, listeningPose, samples, numFrames, src.cachedIndex(), &state.gains);
+	if(index >= 0){
+		src.cachedIndex(index);
+	}
+}
+
+void Vbap::renderSample(AudioIOData &io, const Pose &listeningPose, const float &sample, const int &frameIndex)
+{
+	renderTripletSample(io, listeningPose, sample, frameIndex, -1);
+}
+
+void Vbap::renderSourceSample(AudioIOData &io, SoundSource &src, const Pose &listeningPose, const float &sample, const int &frameIndex)
+{
+	src.cachedIndex(renderTripletSample(io, listeningPose, sample, frameIndex, src.cachedIndex()));
+}
 
+int Vbap::renderTripletBuffer(AudioIOData &io, const Pose &listeningPose, const float *samples, const int &numFrames, int hint, GainMatrix::State * state)
+{
 	Vec3d vec = listeningPose.vec();
 
 	//Rotate vector according to listener-rotation
@@ -413,81 +549,25 @@ void Vbap::renderBuffer(AudioIOData &io, const Pose &listeningPose, const float
 	vec = srcRot.rotate(vec);
 	vec = Vec4d(vec.x, vec.z, vec.y);
 
-	//Silent by default
-	Vec3d gains;
-
 	// Search thru the triplets array in search of a match for the source position.
-	for (unsigned count = 0; count < mTriplets.size(); ++count) {
-		gains = computeGains(vec, mTriplets[currentTripletIndex]);
-		if ((gains[0] >= 0) && (gains[1] >= 0) && (!mIs3D || (gains[2] >= 0)) ){
-			gains.normalize();
-
-			SpeakerTriple triple = mTriplets[currentTripletIndex];
-
-			float * outBuff1 = io.outBuffer(triple.s1Chan);
-			float * outBuff2 = io.outBuffer(triple.s2Chan);
-			float * outBuff3 = nullptr;
-			if(mIs3D){
-				outBuff3 = io.outBuffer(triple.s3Chan);
-			}
-
-			// Check if any of the triplets are phantom channels and
-			// reassign signal
-			auto it1 = mPhantomChannels.find(triple.s1Chan);
-			auto it2 = mPhantomChannels.find(triple.s2Chan);
-			auto it3 = mPhantomChannels.find(triple.s3Chan);
-
-			for(int i = 0; i < numFrames; ++i){
-				if (it1 != mPhantomChannels.end()) { // vertex 1 is phantom
-					float splitGain = gains[0] /mPhantomChannels.size();
-					float splitGainSQ = splitGain * splitGain;
-					for(auto const &element : it1->second) { // iterate across all assigned speakers
-						io.out(element, i) += samples[i]*splitGainSQ;
-					}
-				} else {
-					outBuff1[i] += samples[i]*gains[0];
-				}
-				if (it2 != mPhantomChannels.end()) { // vertex 2 is phantom
-					float splitGain = gains[1] /mPhantomChannels.size();
-					float splitGainSQ = splitGain * splitGain;
-					for(auto const &element : it2->second) {
-						io.out(element, i) += samples[i]*splitGainSQ;
-					}
-				} else {
-					outBuff2[i] += samples[i]*gains[1];
-				}
-				if(mIs3D){
-					if (it3 != mPhantomChannels.end()) {
-						float splitGain = gains[2] /mPhantomChannels.size();
-						float splitGainSQ = splitGain * splitGain;
-						for(auto const &element : it3->second) {
-							io.out(element, i) += samples[i]*splitGainSQ;
-						}
-					} else {
-						outBuff3[i] += samples[i]*gains[2];
-					}
-				}
-
-			}
-			break;
-		}
-
-		++currentTripletIndex;
-		if (currentTripletIndex >= mTriplets.size()){
-			currentTripletIndex = 0;
-		}
+	Vec3d gains;
+	int tripletIndex = findTriplet(vec, hint, gains);
+	if(tripletIndex < 0){
+		// Silent, but fade out gains of last block
+		mGainMatrix.renderBuffer(io, state, samples, numFrames, nullptr, 0);
+		return -1;
 	}
-	// FIXME AC store cached index
-//	src.cachedIndex(currentTripletIndex);
-	//mCachedTripletIndex = currentTripletIndex; // Store the new index
+	gains.normalize();
+
+	const SpeakerTriple& triple = mTriplets[tripletIndex];
+	const int speakers[3] = {triple.s1, triple.s2, triple.s3};
+	const float speakerGains[3] = {float(gains[0]), float(gains[1]), float(gains[2])};
+	mGainMatrix.renderBuffer(io, state, samples, numFrames, speakerGains, mIs3D ? 3 : 2, speakers);
+	return tripletIndex;
 }
 
-void Vbap::renderSample(AudioIOData &io, const Pose &listeningPose, const float &sample, const int &frameIndex)
+int Vbap::renderTripletSample(AudioIOData &io, const Pose &listeningPose, const float &sample, const int &frameIndex, int hint)
 {
-	// FIXME AC use cached index
-//	unsigned currentTripletIndex = src.cachedIndex();
-	//unsigned currentTripletIndex = mCachedTripletIndex; // Cached source placement, so it starts searching from there.
-	unsigned currentTripletIndex = 0;
 	Vec3d vec = listeningPose.vec();
 
 	//Rotate vector according to listener-rotation
@@ -496,62 +576,20 @@ void Vbap::renderSample(AudioIOData &io, const Pose &listeningPose, const float
 
 	// now transform to audio positions
 	vec = Vec4d(vec.x, vec.z, vec.y);
-	//Silent by default
-	Vec3d gains;
-//	Vec3d gainsTemp;
 
 	// Search thru the triplets array in search of a match for the source position.
-	for (unsigned count = 0; count < mTriplets.size(); ++count) {
-		gains = computeGains(vec, mTriplets[currentTripletIndex]);
-		if ((gains[0] >= 0) && (gains[1] >= 0) && (!mIs3D || (gains[2] >= 0)) ){
-			gains.normalize();
-			break;
-		}
-
-		++currentTripletIndex;
-		if (currentTripletIndex >= mTriplets.size()){
-			currentTripletIndex = 0;
-		}
+	Vec3d gains;
+	int tripletIndex = findTriplet(vec, hint, gains);
+	if(tripletIndex < 0){
+		return -1; // Silent, as in renderTripletBuffer()
 	}
+	gains.normalize();
 
-	SpeakerTriple triple = mTriplets[currentTripletIndex];
-
-	//mCachedTripletIndex = currentTripletIndex; // Store the new index
-	// FIXME stored cached index
-//	src.cachedIndex(currentTripletIndex);
-
-	// Check if any of the triplets are phantom channels and
-	// reassign signal
-	auto it1 = mPhantomChannels.find(triple.s1Chan);
-	auto it2 = mPhantomChannels.find(triple.s2Chan);
-	auto it3 = mPhantomChannels.find(triple.s3Chan);
-
-	if (it1 != mPhantomChannels.end()) { // vertex 1 is phantom
-		float splitGain = gains[0]* gains[0] /2.0;
-		io.out(triple.s1Chan,frameIndex) = 0.0;
-		io.out(triple.s2Chan,frameIndex) += sample*splitGain;
-		io.out(triple.s3Chan, frameIndex) += sample*splitGain;
-	} else {
-		io.out(triple.s1Chan,frameIndex) += sample * gains[0];
-	}
-	if (it2 != mPhantomChannels.end()) { // vertex 2 is phantom
-		float splitGain = gains[1]* gains[1] /2.0;
-		io.out(triple.s1Chan,frameIndex) += sample*splitGain;
-		io.out(triple.s2Chan,frameIndex) = 0.0;
-		io.out(triple.s3Chan, frameIndex) += sample*splitGain;
-	} else {
-		io.out(triple.s2Chan,frameIndex) += sample * gains[1];
-	}
-	if(mIs3D){
-		if (it2 != mPhantomChannels.end()) {
-			float splitGain = gains[2]* gains[2] /2.0;
-			io.out(triple.s1Chan,frameIndex) += sample*splitGain;
-			io.out(triple.s2Chan,frameIndex) += sample*splitGain;
-			io.out(triple.s3Chan,frameIndex) = 0.0;
-		} else {
-			io.out(triple.s3Chan, frameIndex) += sample * gains[2];
-		}
-	}
+	const SpeakerTriple& triple = mTriplets[tripletIndex];
+	const int speakers[3] = {triple.s1, triple.s2, triple.s3};
+	const float speakerGains[3] = {float(gains[0]), float(gains[1]), float(gains[2])};
+	mGainMatrix.renderSample(io, sample, frameIndex, speakerGains, mIs3D ? 3 : 2, speakers);
+	return tripletIndex;
 }
 
 ////Per buffer
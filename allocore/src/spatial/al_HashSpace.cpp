@@ -1,8 +1,29 @@
+#include <algorithm>
 #include "allocore/spatial/al_HashSpace.hpp"
 #include "allocore/math/al_Functions.hpp"
+#include "allocore/system/al_TaskPool.hpp"
 
 using namespace al;
 
+namespace{
+
+int hardwareThreads(int numThreads){
+	return numThreads > 0 ? numThreads : TaskPool::global().size();
+}
+
+// Calls func(part, begin, end) on numParts contiguous ranges of [0, n), using
+// the shared task pool
+template <class Func>
+void parallelFor(uint32_t n, int numParts, const Func& func){
+	uint32_t chunk = (n + numParts - 1) / numParts;
+	TaskPool::global().parallelFor(numParts, [&](int t){
+		uint32_t b = std::min(n, t*chunk), e = std::min(n, b + chunk);
+		func(t, b, e);
+	});
+}
+
+}
+
 // resolution can be 1 to 10; the dim is 2^resolution i.e. 2..1024
 // (the limit is 10 so that the hash can fit inside a uint32_t integer)
 // default 5 implies 32 units per side
@@ -81,6 +102,8 @@ HashSpace :: HashSpace(uint32_t resolution, uint32_t numObjects)
 	// store last shell:
 	mDistanceToVoxelIndices[mMaxHalfD2] = mVoxelIndices.size();
 
+	mCellStart.assign(mDim3+1, 0);
+
 //	// dump the lists:
 //	uint32_t offset = hash(0, 1, 0);
 //	printf("offset %d\n", offset);
@@ -99,3 +122,253 @@ HashSpace :: HashSpace(uint32_t resolution, uint32_t numObjects)
 
 HashSpace :: ~HashSpace() {}
 
+
+template<typename T>
+void HashSpace :: rebuildFrom(const Vec<3,T> * positions, uint32_t count, int numThreads) {
+	numThreads = hardwareThreads(numThreads);
+	if (count < 4096) numThreads = 1;
+
+	mObjects.resize(count);
+	parallelFor(count, numThreads, [&](int, uint32_t begin, uint32_t end){
+		for (uint32_t i=begin; i<end; i++) {
+			Object& o = mObjects[i];
+			o.pos.set(wrap(Vec3d(positions[i])));
+			o.hash = hash(o.pos);
+			o.id = i;
+		}
+	});
+
+	sortObjects(numThreads, true);
+}
+
+void HashSpace :: rebuild(const Vec3d * positions, uint32_t count, int numThreads) {
+	rebuildFrom(positions, count, numThreads);
+}
+
+void HashSpace :: rebuild(const Vec3f * positions, uint32_t count, int numThreads) {
+	rebuildFrom(positions, count, numThreads);
+}
+
+void HashSpace :: rebuild(int numThreads) {
+	numThreads = hardwareThreads(numThreads);
+	if (mObjects.size() < 4096) numThreads = 1;
+	sortObjects(numThreads, false);
+}
+
+// Counting sort of objects by voxel. Each thread counts the voxels of its
+// range of objects, the counts are turned into per thread write positions
+// and each thread scatters its range, keeping objects in id order per voxel.
+void HashSpace :: sortObjects(int numThreads, bool relink) {
+	const uint32_t N = mObjects.size();
+
+	// per thread counts of every voxel must stay affordable
+	numThreads = std::max(1, std::min(numThreads, int((1u<<24) / mDim3)));
+
+	mCellCounts.assign(size_t(numThreads) * mDim3, 0);
+	parallelFor(N, numThreads, [&](int t, uint32_t begin, uint32_t end){
+		uint32_t * counts = &mCellCounts[size_t(t) * mDim3];
+		for (uint32_t i=begin; i<end; i++) {
+			uint32_t h = mObjects[i].hash;
+			if (h != invalidHash()) counts[h]++;
+		}
+	});
+
+	uint32_t total = 0;
+	for (uint32_t v=0; v<mDim3; v++) {
+		mCellStart[v] = total;
+		for (int t=0; t<numThreads; t++) {
+			uint32_t& c = mCellCounts[size_t(t) * mDim3 + v];
+			uint32_t n = c;
+			c = total;
+			total += n;
+		}
+	}
+	mCellStart[mDim3] = total;
+
+	mSortedIds.resize(total);
+	mSortedPos.resize(total);
+	parallelFor(N, numThreads, [&](int t, uint32_t begin, uint32_t end){
+		uint32_t * next = &mCellCounts[size_t(t) * mDim3];
+		for (uint32_t i=begin; i<end; i++) {
+			uint32_t h = mObjects[i].hash;
+			if (h != invalidHash()) {
+				uint32_t j = next[h]++;
+				mSortedIds[j] = i;
+				// wrap() can leave a coordinate at dim(), which hashes to 0
+				Vec3d p = mObjects[i].pos;
+				for (int k=0; k<3; k++) if (p[k] >= mDim) p[k] -= mDim;
+				mSortedPos[j] = p;
+			}
+		}
+	});
+
+	// link objects of each voxel into its list
+	if (relink) {
+		parallelFor(mDim3, numThreads, [&](int, uint32_t begin, uint32_t end){
+			for (uint32_t v=begin; v<end; v++) {
+				uint32_t b = mCellStart[v], e = mCellStart[v+1];
+				if (b == e) {
+					mVoxels[v].mObjects = NULL;
+					continue;
+				}
+				Object * first = &mObjects[mSortedIds[b]];
+				Object * prev = &mObjects[mSortedIds[e-1]];
+				for (uint32_t j=b; j<e; j++) {
+					Object * o = &mObjects[mSortedIds[j]];
+					o->prev = prev;
+					prev->next = o;
+					prev = o;
+				}
+				mVoxels[v].mObjects = first;
+			}
+		});
+	}
+}
+
+void HashSpace :: queryNearest(Neighbors& results, const Vec3d * points, uint32_t count, uint32_t maxResults, int numThreads) const {
+	query(results, points, count, maxRadius(), maxResults, numThreads);
+}
+
+void HashSpace :: queryNearest(Neighbors& results, uint32_t maxResults, int numThreads) const {
+	query(results, NULL, numObjects(), maxRadius(), maxResults, numThreads);
+}
+
+void HashSpace :: queryRadius(Neighbors& results, const Vec3d * points, uint32_t count, double radius, uint32_t maxResults, int numThreads) const {
+	query(results, points, count, radius, maxResults, numThreads);
+}
+
+void HashSpace :: queryRadius(Neighbors& results, double radius, uint32_t maxResults, int numThreads) const {
+	query(results, NULL, numObjects(), radius, maxResults, numThreads);
+}
+
+// Without points, every object is queried around its own position, skipping
+// itself. The voxels within a cube around the center are searched row by row:
+// the objects of consecutive voxels along x are contiguous in the sorted
+// array. Along an axis where the cube spans the whole space, the cube is
+// centered and distances use the nearest periodic image. Nearest neighbor
+// queries search growing cubes until the farthest result lies within the cube.
+void HashSpace :: query(Neighbors& results, const Vec3d * points, uint32_t count, double radius, uint32_t maxResults, int numThreads) const {
+	results.maxResults = maxResults;
+	results.counts.assign(count, 0);
+	results.ids.resize(size_t(count) * maxResults);
+	results.distancesSquared.resize(size_t(count) * maxResults);
+	if (maxResults == 0) return;
+
+	radius = al::min(radius, double(maxRadius()));
+	const bool nearest = radius == maxRadius();
+
+	// start nearest neighbor search with a cube expected to hold maxResults
+	double startRadius = radius;
+	if (nearest && mSortedIds.size()) {
+		double density = double(mSortedIds.size()) / mDim3;
+		startRadius = al::clip(cbrt(maxResults / density * 3./(4.*M_PI)), radius, 1.);
+	}
+
+	numThreads = hardwareThreads(numThreads);
+	if (count < 256) numThreads = 1;
+
+	// objects removed since the last rebuild() get no results
+	const uint32_t numQueries = points ? count : mSortedIds.size();
+
+	parallelFor(numQueries, numThreads, [&](int, uint32_t begin, uint32_t end){
+		typedef std::pair<double, uint32_t> Result;
+		std::vector<Result> best;
+		best.reserve(maxResults);
+
+		for (uint32_t i=begin; i<end; i++) {
+			uint32_t q = i;
+			uint32_t self = invalidHash();
+			Vec3d center;
+			if (points) {
+				center = wrap(points[q]);
+			} else {
+				// visit objects in voxel order for locality
+				q = self = mSortedIds[i];
+				center = mSortedPos[i];
+			}
+
+			double R = startRadius;
+			while (true) {
+				best.clear();
+				double limit = R*R;
+
+				// cube of voxels (in unwrapped coordinates) around center
+				int lo[3], n[3];
+				bool full[3];
+				bool anyFull = false;
+				for (int k=0; k<3; k++) {
+					lo[k] = floor(center[k] - R);
+					n[k] = int(floor(center[k] + R)) - lo[k] + 1;
+					full[k] = n[k] >= int(mDim);
+					if (full[k]) {
+						lo[k] = int(floor(center[k])) - int(mDimHalf);
+						n[k] = mDim;
+						anyFull = true;
+					}
+				}
+
+				// distance from center to the nearest image of voxel slab v
+				auto gap = [&](int k, int v){
+					double g = al::max(0., al::max(v - center[k], center[k] - (v+1)));
+					if (full[k]) {
+						for (int s=-1; s<=1; s+=2) {
+							int w = v + s*int(mDim);
+							g = al::min(g, al::max(0., al::max(w - center[k], center[k] - (w+1))));
+						}
+					}
+					return g;
+				};
+
+				for (int z=lo[2]; z<lo[2]+n[2]; z++) {
+					double gz = gap(2, z);
+					for (int y=lo[1]; y<lo[1]+n[1]; y++) {
+						double gy = gap(1, y);
+						if (gy*gy + gz*gz > limit) continue;
+
+						// scan row in one or two contiguous segments
+						int x = lo[0];
+						int remain = n[0];
+						while (remain > 0) {
+							uint32_t wx = hashx(x);
+							int len = al::min(remain, int(mDim - wx));
+							uint32_t v = hash(wx, y, z);
+							const Vec3d shift = Vec3d(x - int(wx), y - int(unhashy(v)), z - int(unhashz(v))) - center;
+
+							for (uint32_t j=mCellStart[v]; j<mCellStart[v+len]; j++) {
+								uint32_t id = mSortedIds[j];
+								if (id == self) continue;
+								Vec3d d = mSortedPos[j] + shift;
+								if (anyFull) {
+									for (int k=0; k<3; k++) {
+										if (full[k] && d[k] < -double(mDimHalf)) d[k] += mDim;
+									}
+								}
+								double d2 = d.magSqr();
+								if (d2 > limit) continue;
+								// insert into results sorted by distance
+								if (best.size() < maxResults) best.push_back(Result(d2, id));
+								size_t k = best.size()-1;
+								for (; k > 0 && Result(d2, id) < best[k-1]; k--) best[k] = best[k-1];
+								best[k] = Result(d2, id);
+								if (best.size() == maxResults) limit = best.back().first;
+							}
+
+							x += len;
+							remain -= len;
+						}
+					}
+				}
+
+				if (!nearest || best.size() == maxResults || R >= radius) break;
+				R = al::min(R*2., radius);
+			}
+
+			size_t base = size_t(q) * maxResults;
+			for (uint32_t k=0; k<best.size(); k++) {
+				results.ids[base + k] = best[k].second;
+				results.distancesSquared[base + k] = best[k].first;
+			}
+			results.counts[q] = best.size();
+		}
+	});
+}
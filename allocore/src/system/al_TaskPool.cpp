@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <cstdint>
+#include "allocore/system/al_Config.h"
+#include "allocore/system/al_TaskPool.hpp"
+
+#ifdef AL_WINDOWS
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+
+namespace al{
+
+namespace{
+
+// Pool and queue of the worker running on this thread
+thread_local TaskPool * tPool = 0;
+thread_local int tQueue = 0;
+
+}
+
+// Ring of tasks that only allocates when it grows, so that handing out tasks
+// of a steady workload, such as rendering audio, does not allocate
+struct TaskPool::Queue{
+	std::mutex mutex;
+	std::vector<Task> ring;
+	size_t head, count;
+
+	Queue(): ring(16), head(0), count(0){}
+
+	void pushBack(const Task& task){
+		if(count == ring.size()){
+			std::vector<Task> r(ring.size()*2);
+			for(size_t i=0; i<count; ++i) r[i].swap(ring[(head+i) % ring.size()]);
+			ring.swap(r);
+			head = 0;
+		}
+		ring[(head+count) % ring.size()] = task;
+		++count;
+	}
+
+	void popBack(Task& task){
+		--count;
+		task.swap(ring[(head+count) % ring.size()]);
+	}
+
+	void popFront(Task& task){
+		task.swap(ring[head]);
+		head = (head+1) % ring.size();
+		--count;
+	}
+};
+
+struct TaskPool::Worker{
+	std::thread thread;
+};
+
+
+TaskPool::TaskPool(int numThreads)
+:	mQueued(0), mSleeping(0), mQuit(false)
+{
+	if(numThreads <= 0) numThreads = std::thread::hardware_concurrency();
+	if(numThreads <= 0) numThreads = 1;
+	for(int i=0; i<numThreads; ++i) mQueues.push_back(new Queue);
+	for(int i=0; i<numThreads-1; ++i){
+		mWorkers.push_back(new Worker);
+		mWorkers[i]->thread = std::thread(&TaskPool::workerLoop, this, i);
+	}
+}
+
+TaskPool::~TaskPool(){
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+	}
+	mWake.notify_all();
+	for(unsigned i=0; i<mWorkers.size(); ++i){
+		mWorkers[i]->thread.join();
+		delete mWorkers[i];
+	}
+	for(unsigned i=0; i<mQueues.size(); ++i) delete mQueues[i];
+}
+
+TaskPool& TaskPool::global(){
+	static TaskPool pool;
+	return pool;
+}
+
+bool TaskPool::priority(int v){
+	bool ok = true;
+	for(unsigned i=0; i<mWorkers.size(); ++i){
+		std::thread::native_handle_type h = mWorkers[i]->thread.native_handle();
+	#ifdef AL_WINDOWS
+		int p = v > 0 ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_NORMAL;
+		ok &= 0 != SetThreadPriority((HANDLE)h, p);
+	#else
+		struct sched_param param;
+		// FIFO is for real-time scheduling
+		param.sched_priority = (v >= 1 && v <= 99) ? v : 0;
+		ok &= 0 == pthread_setschedparam(h, param.sched_priority ? SCHED_FIFO : SCHED_OTHER, &param);
+	#endif
+	}
+	return ok;
+}
+
+bool TaskPool::pin(int firstCPU){
+	const int numCPUs = std::max(1u, std::thread::hardware_concurrency());
+	bool ok = true;
+	for(unsigned i=0; i<mWorkers.size(); ++i){
+		const int cpu = (firstCPU + i + 1) % numCPUs;
+		std::thread::native_handle_type h = mWorkers[i]->thread.native_handle();
+	#if defined(AL_LINUX)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		ok &= 0 == pthread_setaffinity_np(h, sizeof(set), &set);
+	#elif defined(AL_WINDOWS)
+		ok &= 0 != SetThreadAffinityMask((HANDLE)h, DWORD_PTR(1) << cpu);
+	#else
+		// OS X only takes affinity hints between threads
+		(void)cpu; (void)h;
+		ok = false;
+	#endif
+	}
+	return ok;
+}
+
+int TaskPool::queueIndex() const {
+	return tPool == this ? tQueue : mQueues.size()-1;
+}
+
+void TaskPool::submit(const Task& task){
+	if(mWorkers.empty()){
+		task();
+		return;
+	}
+	Queue& q = *mQueues[queueIndex()];
+	// count the task first, so that it is never taken while uncounted
+	mQueued.fetch_add(1);
+	{
+		std::lock_guard<std::mutex> lock(q.mutex);
+		q.pushBack(task);
+	}
+	if(mSleeping.load() > 0){
+		std::lock_guard<std::mutex> lock(mMutex);
+		mWake.notify_one();
+	}
+}
+
+bool TaskPool::pop(int queue, Task& task){
+	Queue& q = *mQueues[queue];
+	std::lock_guard<std::mutex> lock(q.mutex);
+	if(!q.count) return false;
+	// workers run their newest task, whose data is most likely in cache
+	if(queue < int(mWorkers.size())) q.popBack(task);
+	else q.popFront(task);
+	mQueued.fetch_sub(1);
+	return true;
+}
+
+bool TaskPool::steal(int thief, Task& task){
+	const int N = mQueues.size();
+	for(int i=1; i<N; ++i){
+		Queue& q = *mQueues[(thief + i) % N];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if(!q.count) continue;
+		q.popFront(task);
+		mQueued.fetch_sub(1);
+		return true;
+	}
+	return false;
+}
+
+bool TaskPool::runOne(){
+	const int q = queueIndex();
+	Task task;
+	if(pop(q, task) || steal(q, task)){
+		task();
+		return true;
+	}
+	return false;
+}
+
+void TaskPool::workerLoop(int index){
+	tPool = this;
+	tQueue = index;
+	while(true){
+		Task task;
+		if(pop(index, task) || steal(index, task)){
+			task();
+			continue;
+		}
+
+		// tasks often come in bursts, so check again for a while before sleeping
+		bool queued = false;
+		for(int i=0; i<64 && !queued; ++i){
+			std::this_thread::yield();
+			queued = mQueued.load() > 0;
+		}
+		if(queued) continue;
+
+		std::unique_lock<std::mutex> lock(mMutex);
+		mSleeping.fetch_add(1);
+		mWake.wait(lock, [this]{ return mQuit || mQueued.load() > 0; });
+		mSleeping.fetch_sub(1);
+		if(mQuit && mQueued.load() == 0) return;
+	}
+}
+
+void TaskPool::parallelFor(int begin, int end, int grain,
+	const std::function<void(int begin, int end)>& func
+){
+	const int n = end - begin;
+	if(n <= 0) return;
+	if(grain < 1) grain = 1;
+	const int numChunks = std::min(n/grain + (n%grain != 0), 4*size());
+	if(numChunks <= 1){
+		func(begin, end);
+		return;
+	}
+
+	// chunks are handed out in order to whichever thread asks first
+	std::atomic<int> next(0);
+	auto work = [&](){
+		int c;
+		while((c = next.fetch_add(1)) < numChunks){
+			func(begin + int(int64_t(n) * c / numChunks),
+				begin + int(int64_t(n) * (c+1) / numChunks));
+		}
+	};
+
+	// the helper tasks refer to this stack frame, so wait for all of them
+	const int numHelpers = std::min(numChunks, size()) - 1;
+	std::atomic<int> helping(numHelpers);
+	for(int i=0; i<numHelpers; ++i){
+		submit([&](){
+			work();
+			helping.fetch_sub(1, std::memory_order_release);
+		});
+	}
+	work();
+	while(helping.load(std::memory_order_acquire) > 0){
+		if(!runOne()) std::this_thread::yield();
+	}
+}
+
+
+
+TaskGroup::TaskGroup(TaskPool& pool)
+:	mPool(pool), mPending(0)
+{}
+
+TaskGroup& TaskGroup::run(const Task& task){
+	mPending.fetch_add(1);
+	mPool.submit([this, task](){
+		task();
+		finish();
+	});
+	return *this;
+}
+
+TaskGroup& TaskGroup::then(const Task& task){
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if(mPending.load() > 0){
+			if(mContinuation){
+				Task first = mContinuation;
+				mContinuation = [first, task](){ first(); task(); };
+			} else {
+				mContinuation = task;
+			}
+			return *this;
+		}
+	}
+	return run(task);
+}
+
+void TaskGroup::finish(){
+	Task next;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if(mPending.load() == 1 && mContinuation){
+			// the continuation takes over the count of the last task
+			next.swap(mContinuation);
+		} else {
+			mPending.fetch_sub(1, std::memory_order_release);
+			return;
+		}
+	}
+	mPool.submit([this, next](){
+		next();
+		finish();
+	});
+}
+
+void TaskGroup::wait(){
+	while(mPending.load(std::memory_order_acquire) > 0){
+		if(!mPool.runOne()) std::this_thread::yield();
+	}
+	// let the thread finishing the last task release the lock
+	std::lock_guard<std::mutex> lock(mMutex);
+}
+
+} // al::
@@ -149,4 +149,135 @@ void MsgQueue :: clear() {
 	mTail = NULL;
 }
 
+
+
+
+ConcurrentMsgQueue :: ConcurrentMsgQueue(int size)
+:	mCells(size > 0 ? size : 1),
+	mFree(NIL), mInbox(NIL),
+	mHeap(mCells.size()), mHeapSize(0), mSeq(0), mNow(0)
+{
+	for (uint32_t i = mCells.size(); i-- > 0; ) {
+		pushFree(i);
+	}
+}
+
+uint32_t ConcurrentMsgQueue :: popFree() {
+	uint64_t head = mFree.load(std::memory_order_acquire);
+	for (;;) {
+		uint32_t i = uint32_t(head);
+		if (i == NIL) return NIL;
+		// The tag changes on every push and pop, so the exchange fails if
+		// the cell was popped and pushed back since head was read.
+		uint64_t next = ((head >> 32) + 1) << 32 | mCells[i].next.load(std::memory_order_relaxed);
+		if (mFree.compare_exchange_weak(head, next,
+			std::memory_order_acquire, std::memory_order_acquire)) {
+			return i;
+		}
+	}
+}
+
+void ConcurrentMsgQueue :: pushFree(uint32_t i) {
+	uint64_t head = mFree.load(std::memory_order_relaxed);
+	for (;;) {
+		mCells[i].next.store(uint32_t(head), std::memory_order_relaxed);
+		uint64_t next = ((head >> 32) + 1) << 32 | i;
+		if (mFree.compare_exchange_weak(head, next,
+			std::memory_order_release, std::memory_order_relaxed)) {
+			return;
+		}
+	}
+}
+
+bool ConcurrentMsgQueue :: sched(al_sec at, msg_func func, char * data, size_t size) {
+	if (size > MAX_ARGS_SIZE) return false;
+
+	uint32_t i = popFree();
+	if (i == NIL) return false;
+
+	Cell& c = mCells[i];
+	c.t = at;
+	c.func = func;
+	memcpy(c.args, data, size);
+
+	// Push onto inbox; the consumer takes all cells at once, so there is
+	// no ABA problem here
+	uint32_t head = mInbox.load(std::memory_order_relaxed);
+	do {
+		c.next.store(head, std::memory_order_relaxed);
+	} while (!mInbox.compare_exchange_weak(head, i,
+		std::memory_order_release, std::memory_order_relaxed));
+	return true;
+}
+
+bool ConcurrentMsgQueue :: before(uint32_t a, uint32_t b) const {
+	const Cell& ca = mCells[a];
+	const Cell& cb = mCells[b];
+	return ca.t < cb.t || (ca.t == cb.t && ca.seq < cb.seq);
+}
+
+void ConcurrentMsgQueue :: heapPush(uint32_t i) {
+	int k = mHeapSize++;
+	while (k > 0) {
+		int parent = (k - 1) / 2;
+		if (!before(i, mHeap[parent])) break;
+		mHeap[k] = mHeap[parent];
+		k = parent;
+	}
+	mHeap[k] = i;
+}
+
+uint32_t ConcurrentMsgQueue :: heapPop() {
+	uint32_t top = mHeap[0];
+	uint32_t last = mHeap[--mHeapSize];
+	int k = 0;
+	for (;;) {
+		int child = 2*k + 1;
+		if (child >= mHeapSize) break;
+		if (child + 1 < mHeapSize && before(mHeap[child+1], mHeap[child])) ++child;
+		if (!before(mHeap[child], last)) break;
+		mHeap[k] = mHeap[child];
+		k = child;
+	}
+	if (mHeapSize > 0) mHeap[k] = last;
+	return top;
+}
+
+void ConcurrentMsgQueue :: receive() {
+	uint32_t i = mInbox.exchange(NIL, std::memory_order_acquire);
+	if (i == NIL) return;
+
+	// Inbox is newest first; reverse it to number messages in sending order
+	uint32_t prev = NIL;
+	while (i != NIL) {
+		uint32_t next = mCells[i].next.load(std::memory_order_relaxed);
+		mCells[i].next.store(prev, std::memory_order_relaxed);
+		prev = i;
+		i = next;
+	}
+	for (i = prev; i != NIL; i = mCells[i].next.load(std::memory_order_relaxed)) {
+		mCells[i].seq = mSeq++;
+		heapPush(i);
+	}
+}
+
+void ConcurrentMsgQueue :: update(al_sec until) {
+	receive();
+	while (mHeapSize > 0 && mCells[mHeap[0]].t <= until) {
+		uint32_t i = heapPop();
+		mNow = std::max(mNow, mCells[i].t);
+		(mCells[i].func)(mNow, mCells[i].args);
+		pushFree(i);
+	}
+	mNow = until;
+}
+
+void ConcurrentMsgQueue :: clear() {
+	receive();
+	while (mHeapSize > 0) {
+		pushFree(heapPop());
+	}
+	mNow = 0;
+}
+
 } // al::
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -164,7 +165,7 @@ ParameterServer::ParameterServer(std::string oscAddress, int oscPort)
 	mServer = new osc::Recv(oscPort, oscAddress.c_str(), 0.001); // Is 1ms wait OK?
 	if (mServer) {
 		mServer->handler(*this);
-		mServer->start();
+		mServer->start(SocketReactor::global());
 	} else {
 		std::cout << "Error starting OSC server." << std::endl;
 	}
@@ -180,10 +181,136 @@ ParameterServer::~ParameterServer()
 	}
 }
 
+namespace {
+
+template <class T>
+void removeFrom(std::vector<T *>& v, T * item)
+{
+	v.erase(std::remove(v.begin(), v.end(), item), v.end());
+}
+
+template <class M>
+void setFloat(void * parameter, M& m)
+{
+	float x;
+	m >> x;
+	static_cast<Parameter *>(parameter)->set(x);
+}
+
+void readString(osc::Message& m, std::string& x)
+{
+	m >> x;
+}
+
+void readString(osc::MessageView& m, std::string& x)
+{
+	osc::StringView v;
+	m >> v;
+	x.assign(v.data, v.size);
+}
+
+template <class M>
+void setString(void * parameter, M& m)
+{
+	std::string x;
+	readString(m, x);
+	static_cast<ParameterString *>(parameter)->set(x);
+}
+
+template <class M>
+void setVec3(void * parameter, M& m)
+{
+	float x, y, z;
+	m >> x >> y >> z;
+	static_cast<ParameterVec3 *>(parameter)->set(Vec3f(x, y, z));
+}
+
+template <class M>
+void setVec4(void * parameter, M& m)
+{
+	float x, y, z, w;
+	m >> x >> y >> z >> w;
+	static_cast<ParameterVec4 *>(parameter)->set(Vec4f(x, y, z, w));
+}
+
+}
+
+void ParameterServer::addRoute(std::string address, const Route &route)
+{
+	std::vector<Route> &routes = mRoutes[address];
+	routes.push_back(route);
+	mRouteTable[address] = &routes;
+}
+
+void ParameterServer::removeRoute(std::string address, void *parameter)
+{
+	auto it = mRoutes.find(address);
+	if (it == mRoutes.end()) {
+		return;
+	}
+	std::vector<Route> &routes = it->second;
+	for (size_t i = 0; i < routes.size(); ) {
+		if (routes[i].parameter == parameter) {
+			routes.erase(routes.begin() + i);
+		} else {
+			i++;
+		}
+	}
+	if (routes.empty()) {
+		mRouteTable.erase(address);
+		mRoutes.erase(it);
+	}
+}
+
+void ParameterServer::dispatch(const std::vector<Route> &routes, osc::Message &m)
+{
+	for (const Route &route: routes) {
+		if (m.typeTags() == route.typeTags) {
+			m.resetStream();
+			route.set(route.parameter, m);
+		}
+	}
+}
+
+void ParameterServer::dispatch(const std::vector<Route> &routes, osc::MessageView &m)
+{
+	for (const Route &route: routes) {
+		if (m.typeTags() == route.typeTags) {
+			m.resetStream();
+			route.setView(route.parameter, m);
+		}
+	}
+}
+
+// Dispatches to the routes matching a null-terminated address or pattern
+template <class M>
+void ParameterServer::dispatch(const char *address, size_t length, M &m)
+{
+	mAddressKey.assign(address, length);
+	const size_t wildcard = mAddressKey.find_first_of("?*[{");
+	if (wildcard != std::string::npos) {
+		// matching addresses start with the characters before the first wildcard
+		mAddressKey.resize(wildcard);
+		for (auto it = mRoutes.lower_bound(mAddressKey);
+		     it != mRoutes.end() && it->first.compare(0, wildcard, mAddressKey) == 0;
+		     it++) {
+			if (osc::matchPattern(address, it->first.c_str())) {
+				dispatch(it->second, m);
+			}
+		}
+	} else {
+		auto it = mRouteTable.find(mAddressKey);
+		if (it != mRouteTable.end()) {
+			dispatch(*it->second, m);
+		}
+	}
+}
+
 ParameterServer &ParameterServer::registerParameter(Parameter &param)
 {
 	mParameterLock.lock();
 	mParameters.push_back(&param);
+	addRoute(param.getFullAddress(), Route{&param, "f", setFloat<osc::Message>, setFloat<osc::MessageView>});
 	mParameterLock.unlock();
 	mListenerLock.lock();
 	param.registerChangeCallback(ParameterServer::changeCallback,
@@ -195,12 +322,8 @@ ParameterServer &ParameterServer::registerParameter(Parameter &param)
 void ParameterServer::unregisterParameter(Parameter &param)
 {
 	mParameterLock.lock();
-	std::vector<Parameter *>::iterator it = mParameters.begin();
-	for(it = mParameters.begin(); it != mParameters.end(); it++) {
-		if (*it == &param) {
-			mParameters.erase(it);
-		}
-	}
+	removeFrom(mParameters, &param);
+	removeRoute(param.getFullAddress(), &param);
 	mParameterLock.unlock();
 }
 
@@ -208,6 +331,7 @@ ParameterServer &ParameterServer::registerParameter(ParameterString &param)
 {
 	mParameterLock.lock();
 	mStringParameters.push_back(&param);
+	addRoute(param.getFullAddress(), Route{&param, "s", setString<osc::Message>, setString<osc::MessageView>});
 	mParameterLock.unlock();
 	mListenerLock.lock();
 	param.registerChangeCallback(ParameterServer::changeStringCallback,
@@ -219,12 +343,8 @@ ParameterServer &ParameterServer::registerParameter(ParameterString &param)
 void ParameterServer::unregisterParameter(ParameterString &param)
 {
 	mParameterLock.lock();
-	auto it = mStringParameters.begin();
-	for(it = mStringParameters.begin(); it != mStringParameters.end(); it++) {
-		if (*it == &param) {
-			mStringParameters.erase(it);
-		}
-	}
+	removeFrom(mStringParameters, &param);
+	removeRoute(param.getFullAddress(), &param);
 	mParameterLock.unlock();
 }
 
@@ -232,6 +352,7 @@ ParameterServer &ParameterServer::registerParameter(ParameterVec3 &param)
 {
 	mParameterLock.lock();
 	mVec3Parameters.push_back(&param);
+	addRoute(param.getFullAddress(), Route{&param, "fff", setVec3<osc::Message>, setVec3<osc::MessageView>});
 	mParameterLock.unlock();
 	mListenerLock.lock();
 	param.registerChangeCallback(ParameterServer::changeVec3Callback,
@@ -243,12 +364,29 @@ ParameterServer &ParameterServer::registerParameter(ParameterVec3 &param)
 void ParameterServer::unregisterParameter(ParameterVec3 &param)
 {
 	mParameterLock.lock();
-	auto it = mVec3Parameters.begin();
-	for(it = mVec3Parameters.begin(); it != mVec3Parameters.end(); it++) {
-		if (*it == &param) {
-			mVec3Parameters.erase(it);
-		}
-	}
+	removeFrom(mVec3Parameters, &param);
+	removeRoute(param.getFullAddress(), &param);
+	mParameterLock.unlock();
+}
+
+ParameterServer &ParameterServer::registerParameter(ParameterVec4 &param)
+{
+	mParameterLock.lock();
+	mVec4Parameters.push_back(&param);
+	addRoute(param.getFullAddress(), Route{&param, "ffff", setVec4<osc::Message>, setVec4<osc::MessageView>});
+	mParameterLock.unlock();
+	mListenerLock.lock();
+	param.registerChangeCallback(ParameterServer::changeVec4Callback,
+	                             (void *) this);
+	mListenerLock.unlock();
+	return *this;
+}
+
+void ParameterServer::unregisterParameter(ParameterVec4 &param)
+{
+	mParameterLock.lock();
+	removeFrom(mVec4Parameters, &param);
+	removeRoute(param.getFullAddress(), &param);
 	mParameterLock.unlock();
 }
 
@@ -260,30 +398,8 @@ void ParameterServer::onMessage(osc::Message &m)
 		std::string parameterAddress;
 		m >> parameterAddress;
 	}
-	float val; // TODO: doens't make sense for parameters of different types
-	m >> val;
 	mParameterLock.lock();
-	for (Parameter *p:mParameters) {
-		if(m.addressPattern() == p->getFullAddress() && m.typeTags() == "f"){
-			// Extract the data out of the packet
-			p->set(val);
-//			std::cout << "ParameterServer::onMessage" << val << std::endl;
-		}
-	}
-	for (ParameterVec3 *p:mVec3Parameters) {
-		if(m.addressPattern() == p->getFullAddress() && m.typeTags() == "fff"){
-			float y,z;
-			m >> y >> z;
-			p->set(Vec3f(val,y,z));
-		}
-	}
-	for (ParameterVec4 *p:mVec4Parameters) {
-		if(m.addressPattern() == p->getFullAddress() && m.typeTags() == "ffff"){
-			float x,y,z;
-			m >> x >> y >> z;
-			p->set(Vec4f(val,x,y,z));
-		}
-	}
+	dispatch(m.addressPattern().c_str(), m.addressPattern().size(), m);
 	for (osc::PacketHandler *handler: mPacketHandlers) {
 		m.resetStream();
 		handler->onMessage(m);
@@ -291,6 +407,17 @@ void ParameterServer::onMessage(osc::Message &m)
 	mParameterLock.unlock();
 }
 
+void ParameterServer::onMessageView(osc::MessageView &m)
+{
+	mParameterLock.lock();
+	dispatch(m.addressPattern().data, m.addressPattern().size, m);
+	for (osc::PacketHandler *handler: mPacketHandlers) {
+		m.resetStream();
+		handler->onMessageView(m);
+	}
+	mParameterLock.unlock();
+}
+
 void ParameterServer::print()
 {
 	std::cout << "Parameter server listening on " << mServer->address()
@@ -350,3 +477,118 @@ void ParameterServer::changeVec4Callback(Vec4f value, void *sender, void *userDa
 	ParameterVec4 *parameter = static_cast<ParameterVec4 *>(sender);
 	server->notifyListeners(parameter->getFullAddress(), parameter->get());
 }
+
+// ParameterSnapshot ----------------------------------------------------------
+
+ParameterSnapshot &ParameterSnapshot::add(void *param, Type type)
+{
+	if (mIndex.find(param) == mIndex.end()) {
+		mIndex[param] = mEntries.size();
+		Entry entry = {param, type, Vec4f(0)};
+		mEntries.push_back(entry);
+	}
+	return *this;
+}
+
+ParameterSnapshot &ParameterSnapshot::add(Parameter &param)
+{
+	add(&param, FLOAT);
+	mEntries[mIndex[&param]].value[0] = param.get();
+	return *this;
+}
+
+ParameterSnapshot &ParameterSnapshot::add(ParameterVec3 &param)
+{
+	add(&param, VEC3);
+	Vec3f v = param.get();
+	mEntries[mIndex[&param]].value.set(v[0], v[1], v[2], 0);
+	return *this;
+}
+
+ParameterSnapshot &ParameterSnapshot::add(ParameterVec4 &param)
+{
+	add(&param, VEC4);
+	mEntries[mIndex[&param]].value = param.get();
+	return *this;
+}
+
+ParameterSnapshot &ParameterSnapshot::add(ParameterServer &server)
+{
+	server.mParameterLock.lock();
+	for (Parameter *param: server.mParameters) add(*param);
+	for (ParameterVec3 *param: server.mVec3Parameters) add(*param);
+	for (ParameterVec4 *param: server.mVec4Parameters) add(*param);
+	server.mParameterLock.unlock();
+	return *this;
+}
+
+void ParameterSnapshot::update()
+{
+	for (Entry &entry: mEntries) {
+		switch (entry.type) {
+		case FLOAT:
+			entry.value[0] = static_cast<Parameter *>(entry.parameter)->get();
+			break;
+		case VEC3: {
+			Vec3f v = static_cast<ParameterVec3 *>(entry.parameter)->get();
+			entry.value[0] = v[0]; entry.value[1] = v[1]; entry.value[2] = v[2];
+			break;
+		}
+		case VEC4:
+			entry.value = static_cast<ParameterVec4 *>(entry.parameter)->get();
+			break;
+		}
+	}
+}
+
+const ParameterSnapshot::Entry *ParameterSnapshot::find(const void *param) const
+{
+	std::unordered_map<const void *, int>::const_iterator it = mIndex.find(param);
+	return it != mIndex.end() ? &mEntries[it->second] : nullptr;
+}
+
+float ParameterSnapshot::get(Parameter &param) const
+{
+	const Entry *entry = find(&param);
+	return entry ? entry->value[0] : param.get();
+}
+
+Vec3f ParameterSnapshot::get(ParameterVec3 &param) const
+{
+	const Entry *entry = find(&param);
+	return entry ? Vec3f(entry->value[0], entry->value[1], entry->value[2]) : param.get();
+}
+
+Vec4f ParameterSnapshot::get(ParameterVec4 &param) const
+{
+	const Entry *entry = find(&param);
+	return entry ? entry->value : param.get();
+}
+
+// ParameterSmoother ----------------------------------------------------------
+
+ParameterSmoother::ParameterSmoother(Parameter &param, float rampSec)
+    : mParameter(param), mRampSec(rampSec), mStep(0), mRemaining(0)
+{
+	reset();
+}
+
+void ParameterSmoother::target(float value, double framesPerSecond)
+{
+	if (value == mTarget) return;
+	mTarget = value;
+	int frames = int(mRampSec * framesPerSecond);
+	if (frames > 1) {
+		mStep = (mTarget - mValue) / frames;
+		mRemaining = frames;
+	} else {
+		// Jump on the next sample
+		mRemaining = 1;
+	}
+}
+
+void ParameterSmoother::reset()
+{
+	mValue = mTarget = mParameter.get();
+	mRemaining = 0;
+}
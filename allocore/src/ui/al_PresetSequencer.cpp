@@ -375,7 +375,7 @@ SequenceServer::SequenceServer(std::string oscAddress, int oscPort) :
 	mServer = new osc::Recv(oscPort, oscAddress.c_str(), 0.001); // Is this 1ms wait OK?
 	if (mServer) {
 		mServer->handler(*this);
-		mServer->start();
+		mServer->start(SocketReactor::global());
 	} else {
 		std::cout << "Error starting OSC server." << std::endl;
 	}
@@ -0,0 +1,368 @@
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+
+#include "allocore/ui/al_SynthSequencer.hpp"
+#include "allocore/system/al_TaskPool.hpp"
+
+#if defined(__AVX__)
+	#include <immintrin.h>
+	#define AL_POLYSYNTH_AVX
+#elif defined(__SSE2__) || defined(_M_X64)
+	#include <emmintrin.h>
+	#define AL_POLYSYNTH_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	#include <arm_neon.h>
+	#define AL_POLYSYNTH_NEON
+#endif
+
+using namespace al;
+
+// Output and bus buffers of the voices rendered by one thread. They have the
+// same layout as the AudioIOData passed to PolySynth::render, whose inputs
+// are shared rather than copied.
+class PolySynthScratch : public AudioIOData {
+public:
+	PolySynthScratch(): AudioIOData(nullptr) {}
+
+	~PolySynthScratch() {
+		mBufI = nullptr; // Not owned
+	}
+
+	void resize(int numOut, int numBus, int frames) {
+		if (numOut != mNumO || frames != mFramesPerBuffer) {
+			resizeBuf(mBufO, numOut * frames);
+		}
+		if (numBus != mNumB || frames != mFramesPerBuffer) {
+			resizeBuf(mBufB, numBus * frames);
+		}
+		if (frames != mFramesPerBuffer) {
+			resizeBuf(mBufT, frames);
+		}
+		mNumO = numOut;
+		mNumB = numBus;
+		mFramesPerBuffer = frames;
+	}
+
+	void resize(const AudioIOData &io) {
+		resize(io.channelsOut(), io.channelsBus(), io.framesPerBuffer());
+		mFramesPerSecond = io.framesPerSecond();
+		mNumI = io.channelsIn();
+		mBufI = mNumI > 0 ? const_cast<float *>(io.inBuffer()) : nullptr;
+		user(io.user());
+	}
+};
+
+// out[i] += in[i]
+static void mixAdd(float *out, const float *in, int n) {
+	int i = 0;
+#if defined(AL_POLYSYNTH_AVX)
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_loadu_ps(in + i)));
+	}
+#elif defined(AL_POLYSYNTH_SSE2)
+	for (; i + 4 <= n; i += 4) {
+		_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_loadu_ps(in + i)));
+	}
+#elif defined(AL_POLYSYNTH_NEON)
+	for (; i + 4 <= n; i += 4) {
+		vst1q_f32(out + i, vaddq_f32(vld1q_f32(out + i), vld1q_f32(in + i)));
+	}
+#endif
+	for (; i < n; ++i) {
+		out[i] += in[i];
+	}
+}
+
+
+// Scratch buffers and voices of each thread, and the threads rendering them.
+// The threads are dedicated to the PolySynth, like those of AudioScene, so
+// that voices do not wait behind unrelated work.
+class PolySynth::RenderPool {
+public:
+	RenderPool(int numGroups)
+	:	mScratch(numGroups), mGroups(numGroups), mLoads(numGroups), mTasks(numGroups),
+		mSynth(nullptr), mIO(nullptr)
+	{
+		for (int i = 0; i < numGroups; ++i) mScratch[i] = new PolySynthScratch;
+	}
+
+	~RenderPool() {
+		for (unsigned i = 0; i < mScratch.size(); ++i) delete mScratch[i];
+	}
+
+	int numGroups() const { return mScratch.size(); }
+
+	PolySynthScratch &scratch(int i) { return *mScratch[i]; }
+	std::vector<SynthVoice *> &voices() { return mVoices; }
+	std::vector<float> &costs() { return mCosts; }
+	TaskPool &tasks() { return mTasks; }
+
+	// Size the buffers, so that rendering up to maxVoices voices in blocks of
+	// this size does not allocate memory
+	void reserve(unsigned maxVoices, int numOut, int numBus, int frames) {
+		mVoices.reserve(maxVoices);
+		mCosts.reserve(maxVoices);
+		for (int g = 0; g < numGroups(); ++g) {
+			mGroups[g].reserve(maxVoices);
+			if (frames > 0) mScratch[g]->resize(numOut, numBus, frames);
+		}
+	}
+
+	// Assign voices, sorted by decreasing cost, to the least loaded group
+	void assign() {
+		for (int g = 0; g < numGroups(); ++g) {
+			mGroups[g].clear();
+			mLoads[g] = 0;
+		}
+		for (unsigned i = 0; i < mVoices.size(); ++i) {
+			int least = std::min_element(mLoads.begin(), mLoads.end()) - mLoads.begin();
+			mGroups[least].push_back(mVoices[i]);
+			mLoads[least] += mCosts[i];
+		}
+	}
+
+	// Render the voices of each group into its scratch buffers, in parallel
+	void render(PolySynth &synth, AudioIOData &io) {
+		mSynth = &synth;
+		mIO = &io;
+		// A task capturing only this is stored without allocating memory
+		mTasks.parallelFor(numGroups(), [this](int g) { renderGroup(g); });
+	}
+
+private:
+	void renderGroup(int g) {
+		typedef std::chrono::steady_clock Clock;
+		PolySynthScratch &scratch = *mScratch[g];
+		scratch.resize(*mIO);
+		scratch.zeroOut();
+		scratch.zeroBus();
+		for (SynthVoice *voice : mGroups[g]) {
+			Clock::time_point t0 = Clock::now();
+			mSynth->processVoice(*voice, scratch);
+			float dt = std::chrono::duration<float>(Clock::now() - t0).count();
+			// Smooth over a few blocks, as a voice's cost varies with its envelope
+			voice->mCost = voice->mCost >= 0 ? voice->mCost + 0.25f * (dt - voice->mCost) : dt;
+		}
+	}
+
+	std::vector<PolySynthScratch *> mScratch;
+	std::vector<std::vector<SynthVoice *>> mGroups;
+	std::vector<float> mLoads;
+	std::vector<SynthVoice *> mVoices; // Active voices, most expensive first
+	std::vector<float> mCosts; // Cost of mVoices
+	TaskPool mTasks;
+	PolySynth *mSynth; // Arguments of render()
+	AudioIOData *mIO;
+};
+
+
+PolySynth::~PolySynth() {
+	delete mRenderPool;
+}
+
+void PolySynth::setNumThreads(int n) {
+	if (n < 1) n = 1;
+	if (n != mNumThreads) {
+		delete mRenderPool;
+		mRenderPool = n > 1 ? new RenderPool(n) : nullptr;
+		mNumThreads = n;
+		if (mRenderPool) {
+			mRenderPool->tasks().priority(mThreadPriority);
+			mRenderPool->reserve(mMaxVoices, mChannelsOut, mChannelsBus, mFramesPerBuffer);
+		}
+	}
+}
+
+void PolySynth::prepare(const AudioIOData &io) {
+	mChannelsOut = io.channelsOut();
+	mChannelsBus = io.channelsBus();
+	mFramesPerBuffer = io.framesPerBuffer();
+	if (mRenderPool) {
+		mRenderPool->reserve(mMaxVoices, mChannelsOut, mChannelsBus, mFramesPerBuffer);
+	}
+}
+
+bool PolySynth::threadPriority(int v) {
+	mThreadPriority = v;
+	return mRenderPool ? mRenderPool->tasks().priority(v) : true;
+}
+
+void PolySynth::renderParallel(AudioIOData &io) {
+	RenderPool &pool = *mRenderPool;
+	const int numGroups = pool.numGroups();
+
+	// Voices not measured yet are assumed to cost the mean of the others
+	std::vector<SynthVoice *> &voices = pool.voices();
+	voices.clear();
+	float measuredCost = 0;
+	int numMeasured = 0;
+	for (auto voice = mActiveVoices; voice; voice = voice->next) {
+		if (voice->active()) {
+			voices.push_back(voice);
+			if (voice->mCost >= 0) {
+				measuredCost += voice->mCost;
+				numMeasured++;
+			}
+		}
+	}
+	if (voices.empty()) {
+		return;
+	}
+	const float defaultCost = numMeasured ? measuredCost / numMeasured : 1;
+	std::sort(voices.begin(), voices.end(), [defaultCost](SynthVoice *a, SynthVoice *b) {
+		float costA = a->mCost >= 0 ? a->mCost : defaultCost;
+		float costB = b->mCost >= 0 ? b->mCost : defaultCost;
+		return costA > costB;
+	});
+	std::vector<float> &costs = pool.costs();
+	costs.resize(voices.size());
+	for (unsigned i = 0; i < voices.size(); ++i) {
+		costs[i] = voices[i]->mCost >= 0 ? voices[i]->mCost : defaultCost;
+	}
+	pool.assign();
+
+	pool.render(*this, io);
+
+	// Sum thread buffers in a fixed order
+	const int numOut = io.channelsOut() * io.framesPerBuffer();
+	const int numBus = io.channelsBus() * io.framesPerBuffer();
+	for (int g = 0; g < numGroups; ++g) {
+		if (numOut > 0) mixAdd(io.outBuffer(), pool.scratch(g).outBuffer(), numOut);
+		if (numBus > 0) mixAdd(io.busBuffer(), pool.scratch(g).busBuffer(), numBus);
+	}
+}
+
+
+void SynthSequencer::insertEvent(const SynthSequencerEvent &event) {
+	std::unique_lock<std::mutex> lk(mEventLock);
+	insertLocked(event);
+}
+
+void SynthSequencer::insertLocked(const SynthSequencerEvent &event) {
+	// Equal start times are inserted last, so events keep the order of insertion
+	Timeline::iterator it = mEvents.insert(mEvents.end(), std::make_pair(event.startTime, event));
+	if (event.startTime >= mNextTime
+			&& (mNextEvent == mEvents.end() || event.startTime < mNextEvent->first)) {
+		mNextEvent = it;
+	}
+}
+
+void SynthSequencer::processEvents(double blockDuration, double fps) {
+	// Don't wait on threads inserting events. If they hold the lock, the
+	// events of this block are triggered late, at the start of the next one.
+	std::unique_lock<std::mutex> lk(mEventLock, std::try_to_lock);
+	double blockStartTime = mMasterTime.load(std::memory_order_relaxed);
+	if (lk.owns_lock() && mSeekPending.exchange(false, std::memory_order_acquire)) {
+		blockStartTime = mSeekTime.load(std::memory_order_relaxed);
+		mNextTime = blockStartTime;
+		mNextEvent = mEvents.lower_bound(blockStartTime);
+	}
+	const double blockEndTime = blockStartTime + blockDuration;
+	mMasterTime.store(blockEndTime, std::memory_order_relaxed);
+	if (!lk.owns_lock()) {
+		return;
+	}
+	while (mNextEvent != mEvents.end() && mNextEvent->first < blockEndTime) {
+		SynthSequencerEvent &event = mNextEvent->second;
+		event.offsetCounter = std::max(0.0, (event.startTime - blockStartTime) * fps);
+		// A voice still playing from before a seek can't be triggered again
+		if (!event.voice->active()) {
+			mPolySynth.triggerOn(event.voice, event.offsetCounter);
+		}
+		++mNextEvent;
+	}
+	mNextTime = blockEndTime;
+}
+
+bool SynthSequencer::loadSequence(std::string fileName) {
+	std::ifstream f(fileName);
+	if (!f.is_open()) {
+		std::cout << "Could not open sequence file " << fileName << std::endl;
+		return false;
+	}
+
+	struct EventLine {
+		double startTime;
+		double duration;
+		SynthClass *synthClass;
+		size_t firstField;
+		int numFields;
+	};
+	std::vector<EventLine> lines;
+	std::vector<float> fields;
+	std::map<SynthClass *, int> voiceCounts;
+	std::string line;
+	while (std::getline(f, line)) {
+		const char *c = line.c_str();
+		while (*c == ' ' || *c == '\t') c++;
+		if (*c != '@') { // Empty, comment or unknown command
+			continue;
+		}
+		char *end;
+		EventLine eventLine;
+		eventLine.startTime = std::strtod(c + 1, &end);
+		if (end == c + 1) continue;
+		c = end;
+		eventLine.duration = std::strtod(c, &end);
+		if (end == c) continue;
+		c = end;
+		while (*c == ' ' || *c == '\t') c++;
+		const char *nameEnd = c;
+		while (*nameEnd && *nameEnd != ' ' && *nameEnd != '\t') nameEnd++;
+		auto synthClass = mSynthClasses.find(std::string(c, nameEnd));
+		if (synthClass == mSynthClasses.end()) {
+			std::cout << "Synth class " << std::string(c, nameEnd) << " not registered." << std::endl;
+			continue;
+		}
+		eventLine.synthClass = &synthClass->second;
+		eventLine.firstField = fields.size();
+		c = nameEnd;
+		while (true) {
+			float value = std::strtof(c, &end);
+			if (end == c) break;
+			fields.push_back(value);
+			c = end;
+		}
+		eventLine.numFields = fields.size() - eventLine.firstField;
+		lines.push_back(eventLine);
+		voiceCounts[eventLine.synthClass]++;
+	}
+
+	std::stable_sort(lines.begin(), lines.end(), [](const EventLine &a, const EventLine &b) {
+		return a.startTime < b.startTime;
+	});
+	for (auto &count : voiceCounts) {
+		count.first->allocate(count.second);
+	}
+
+	// Insert in chunks, so that the audio thread is not kept from the
+	// timeline for the whole file
+	const size_t chunkSize = 1024;
+	std::vector<SynthSequencerEvent> events;
+	events.reserve(chunkSize);
+	for (size_t i = 0; i < lines.size(); i++) {
+		const EventLine &eventLine = lines[i];
+		SynthVoice *voice = eventLine.synthClass->getVoice();
+		if (voice->setParamFields(fields.data() + eventLine.firstField, eventLine.numFields)) {
+			voice->mSequenced = true;
+			SynthSequencerEvent event;
+			event.startTime = eventLine.startTime;
+			event.duration = eventLine.duration;
+			event.voice = voice;
+			events.push_back(event);
+		} else {
+			std::cout << "Invalid fields for event at " << eventLine.startTime << std::endl;
+		}
+		if (events.size() == chunkSize || i + 1 == lines.size()) {
+			std::unique_lock<std::mutex> lk(mEventLock);
+			for (auto &e : events) {
+				insertLocked(e);
+			}
+			events.clear();
+		}
+	}
+	return true;
+}
@@ -46,6 +46,7 @@ int main (int argc, char * const argv[]) {
 
 	RUNTEST(AudioScene);
 	RUNTEST(Ambisonics);
+	RUNTEST(SynthSequencer);
 	
 #ifndef ALLOCORE_TESTS_NO_GUI
 	// This test should always be run last since it calls exit()
@@ -35,6 +35,7 @@ int utThread();
 int utFile();
 int utAsset();
 int utAmbisonics();
+int utSynthSequencer();
 
 SearchPaths& getSearchPaths();
 
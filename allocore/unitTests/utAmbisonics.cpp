@@ -1,5 +1,6 @@
 
 #include <cstdlib>
+#include <vector>
 
 #include "utAllocore.h"
 
@@ -64,8 +65,195 @@ void testFirstOrder2D() {
 	}
 }
 
+// Legendre polynomial P_n(x)
+double legendreP(int n, double x) {
+	double p0 = 1, p1 = x;
+	if (n == 0) return p0;
+	for (int k = 2; k <= n; k++) {
+		double p2 = ((2*k - 1) * x * p1 - (k - 1) * p0) / k;
+		p0 = p1;
+		p1 = p2;
+	}
+	return p1;
+}
+
+void testACNWeights() {
+	float ws[64];
+	float x = 0.48f, y = -0.6f, z = 0.64f; // unit vector
+
+	// Closed forms up to second order
+	AmbiBase::encodeWeightsACN(ws, 3, 2, x, y, z);
+	assert(almostEqual(ws[0], 1.f));
+	assert(almostEqual(ws[1], y));
+	assert(almostEqual(ws[2], z));
+	assert(almostEqual(ws[3], x));
+	float s3 = sqrt(3.f);
+	assert(almostEqual(ws[4], s3 * x * y));
+	assert(almostEqual(ws[5], s3 * y * z));
+	assert(almostEqual(ws[6], 1.5f * z * z - 0.5f));
+	assert(almostEqual(ws[7], s3 * x * z));
+	assert(almostEqual(ws[8], s3 / 2.f * (x * x - y * y)));
+
+	// Sum over each degree of products of SN3D harmonics is P_n(cos angle)
+	AmbiBase::encodeWeightsACN(ws, 3, 7, x, y, z);
+	float ws2[64];
+	float x2 = -0.8f, y2 = 0.f, z2 = 0.6f;
+	AmbiBase::encodeWeightsACN(ws2, 3, 7, x2, y2, z2);
+	for (int n = 0; n <= 7; n++) {
+		double sum = 0;
+		for (int c = n*n; c < (n+1)*(n+1); c++) sum += ws[c] * ws2[c];
+		assert(fabs(sum - legendreP(n, x*x2 + y*y2 + z*z2)) < 1e-5);
+	}
+
+	// A zero vector only encodes W
+	AmbiBase::encodeWeightsACN(ws, 3, 7, 0.f, 0.f, 0.f);
+	assert(ws[0] == 1.f);
+	for (int c = 1; c < 64; c++) assert(ws[c] == 0.f);
+
+	// Circular harmonics in 2D
+	float az = 0.7f;
+	AmbiBase::encodeWeightsACN(ws, 2, 7, az, 0.f);
+	assert(almostEqual(ws[0], 1.f));
+	for (int m = 1; m <= 7; m++) {
+		assert(almostEqual(ws[2*m - 1], sin(m * az)));
+		assert(almostEqual(ws[2*m], cos(m * az)));
+	}
+
+	assert(AmbiBase::channelsToOrder(64) == 7);
+	assert(AmbiBase::channelsToDimensions(64) == 3);
+	assert(AmbiBase::channelsToOrder(15) == 7);
+	assert(AmbiBase::channelsToDimensions(15) == 2);
+	assert(AmbiBase::channelsToOrder(16) == 3);
+	assert(AmbiBase::channelsToDimensions(10) == -1);
+}
+
+void testHigherOrderDecode() {
+	// Sphere of speakers, with one muted and two sharing a device channel
+	SpeakerLayout layout;
+	for (int i = 0; i < 12; i++) layout.addSpeaker(Speaker(i, i * 30, -30));
+	for (int i = 0; i < 12; i++) layout.addSpeaker(Speaker(12 + i, i * 30 + 15, 30));
+	layout.addSpeaker(Speaker(24, 0, 90));
+	layout.addSpeaker(Speaker(24, 0, -90));
+	layout.speakers()[5].gain = 0;
+	const int numSpeakers = layout.numSpeakers();
+
+	for (int order = 1; order <= 7; order += 3) {
+		AmbiDecode decoder(3, order, numSpeakers, 3, AMBI_ACN_SN3D);
+		decoder.setSpeakers(layout.speakers());
+		AmbiDecodeConfig config;
+		config.weightOffset = 0.01f;
+		decoder.setConfiguration(config);
+		const int chans = decoder.channels();
+
+		// Odd number of frames for the vector tails
+		const int numFrames = 75;
+		std::vector<float> ambi(chans * numFrames);
+		for (int i = 0; i < chans * numFrames; i++) ambi[i] = sin(i * 0.37f);
+		std::vector<float> out(25 * numFrames, 0.f), ref(25 * numFrames, 0.f);
+		decoder.decode(&out[0], &ambi[0], numFrames);
+
+		for (int s = 0; s < numSpeakers; s++) {
+			if (s == 5) continue;
+			int chan = layout.speakers()[s].deviceChannel;
+			for (int c = 0; c < chans; c++) {
+				float w = decoder.decodeWeight(s, c) + 0.01f;
+				for (int i = 0; i < numFrames; i++) {
+					ref[chan * numFrames + i] += w * ambi[c * numFrames + i];
+				}
+			}
+		}
+		for (int i = 0; i < 25 * numFrames; i++) {
+			assert(fabs(out[i] - ref[i]) < 1e-4);
+		}
+		for (int i = 0; i < numFrames; i++) assert(out[5 * numFrames + i] == 0.f);
+
+		// Decoding by sample agrees
+		std::vector<float> outSample(25 * numFrames, 0.f);
+		for (int i = 0; i < numFrames; i++) {
+			decoder.decode(&outSample[0], &ambi[0], numFrames, i);
+		}
+		for (int i = 0; i < 25 * numFrames; i++) {
+			assert(fabs(outSample[i] - ref[i]) < 1e-4);
+		}
+	}
+
+	// A source at a speaker is loudest there
+	AmbiEncode encoder(3, 7, AMBI_ACN_SN3D);
+	AmbiDecode decoder(3, 7, numSpeakers, 3, AMBI_ACN_SN3D);
+	decoder.setSpeakers(layout.speakers());
+	encoder.direction(float(M_PI * 75 / 180), float(M_PI / 6)); // speaker 14
+	float ambi[64], out[25];
+	for (int c = 0; c < 64; c++) ambi[c] = encoder.weights()[c];
+	for (int s = 0; s < 25; s++) out[s] = 0.f;
+	decoder.decode(out, ambi, 1);
+	for (int s = 0; s < 25; s++) {
+		if (s != 14) assert(out[14] > out[s]);
+	}
+}
+
+void testEncodeRamp() {
+	const int numFrames = 21;
+	float input[numFrames];
+	for (int i = 0; i < numFrames; i++) input[i] = 1.f;
+	AmbiEncode encoder(3, 2, AMBI_ACN_SN3D);
+	encoder.direction(1, 0, 0);
+	float prev[9];
+	for (int c = 0; c < 9; c++) prev[c] = encoder.weights()[c];
+	encoder.direction(0, 1, 0);
+
+	float ambi[9 * numFrames];
+	memset(ambi, 0, sizeof(ambi));
+	encoder.encode(ambi, input, numFrames, prev);
+	for (int c = 0; c < 9; c++) {
+		float w = encoder.weights()[c];
+		for (int i = 0; i < numFrames; i++) {
+			float frac = float(i + 1) / numFrames;
+			assert(almostEqual(ambi[c * numFrames + i], prev[c] + (w - prev[c]) * frac));
+		}
+	}
+}
+
+void testSpatializerRamp() {
+	const int bufferSize = 16;
+	SpeakerLayout speakerLayout = OctalSpeakerLayout();
+	AudioIO audioIO(bufferSize, 44100, NULL, NULL, speakerLayout.numSpeakers(), 0);
+	AmbisonicsSpatializer panner(speakerLayout, 2, 3, 1, AMBI_ACN_SN3D);
+	panner.numFrames(bufferSize);
+	SoundSource src;
+	SpatializerState state;
+	panner.initSourceState(state);
+	float input[bufferSize];
+	for (int i = 0; i < bufferSize; i++) input[i] = 0.5f;
+
+	// Front, in OpenGL coordinates
+	audioIO.zeroOut();
+	panner.prepare();
+	panner.renderSourceBuffer(audioIO, src, state, Pose(Vec3d(0, 0, -2)), input, bufferSize);
+	panner.finalize(audioIO);
+	for (int i = 0; i < bufferSize; i++) {
+		for (int chan = 1; chan < 8; chan++) {
+			assert(audioIO.out(0, i) > audioIO.out(chan, i));
+		}
+		assert(almostEqual(audioIO.out(1, i), audioIO.out(7, i)));
+	}
+
+	// Left, reached at the end of the block
+	audioIO.zeroOut();
+	panner.prepare();
+	panner.renderSourceBuffer(audioIO, src, state, Pose(Vec3d(-1, 0, 0)), input, bufferSize);
+	panner.finalize(audioIO);
+	assert(audioIO.out(0, 0) > audioIO.out(2, 0));
+	for (int chan = 0; chan < 8; chan++) {
+		if (chan != 2) assert(audioIO.out(2, bufferSize - 1) > audioIO.out(chan, bufferSize - 1));
+	}
+}
+
 int utAmbisonics() {
 	testFirstOrder2D();
+	testACNWeights();
+	testHigherOrderDecode();
+	testEncodeRamp();
+	testSpatializerRamp();
 
 	return 0;
 }
@@ -214,6 +214,105 @@ void testMultipleSourcesMovingStereo() {
 	}
 }
 
+// Compare block reads of the delay-line with per sample reads
+void testSoundSourceBlockRead() {
+	const int delaySize = 2000;
+	const int bufferSize = 67;
+	DopplerType types[3] = {DOPPLER_NONE, DOPPLER_SYMMETRICAL, DOPPLER_PHYSICAL};
+
+	for (int t = 0; t < 3; t++) {
+		SoundSource srcBlock(0.1, 20, ATTEN_INVERSE, types[t], 44100, 0, delaySize);
+		SoundSource srcSample(0.1, 20, ATTEN_INVERSE, types[t], 44100, 0, delaySize);
+		float block[bufferSize], sample[bufferSize];
+
+		// Clear far away initial history to not exceed the delay-line
+		for (int i = 0; i < 4; i++) {
+			srcBlock.updateHistory();
+			srcSample.updateHistory();
+		}
+
+		// Enough blocks to wrap around the delay-line several times
+		for (int b = 0; b < 50; b++) {
+			for (int i = 0; i < bufferSize; i++) {
+				float smp = sin(0.05 * (i + b * bufferSize)) + 0.1 * cos(0.7 * i);
+				srcBlock.writeSample(smp);
+				srcSample.writeSample(smp);
+			}
+			// Distances map to delays from a few samples up to most of the delay-line
+			Pose relpos(Vec3d(0.1 + b * 0.3, 0, 0));
+
+			srcBlock.getBuffer(relpos, block, bufferSize);
+			srcSample.frame(0);
+			for (int i = 0; i < bufferSize; i++) {
+				sample[i] = srcSample.getNextSample(relpos);
+			}
+			for (int i = 0; i < bufferSize; i++) {
+				assert(fabs(block[i] - sample[i]) < 1e-5);
+			}
+		}
+	}
+}
+
+// Render the same scene serially and with several threads and compare
+void testParallelRender(Spatializer * panner, int numChans, bool perSample) {
+	const int bufferSize = 64;
+	const int numSources = 13;
+	AudioScene sceneSerial(bufferSize), sceneParallel(bufferSize);
+	sceneSerial.createListener(panner);
+	sceneParallel.createListener(panner);
+	sceneSerial.usePerSampleProcessing(perSample);
+	sceneParallel.usePerSampleProcessing(perSample);
+	sceneParallel.numThreads(3);
+	assert(sceneParallel.numThreads() == 3);
+
+	SoundSource srcSerial[numSources], srcParallel[numSources];
+	for (int k = 0; k < numSources; k++) {
+		srcSerial[k].dopplerType(DOPPLER_NONE);
+		srcParallel[k].dopplerType(DOPPLER_NONE);
+		sceneSerial.addSource(srcSerial[k]);
+		sceneParallel.addSource(srcParallel[k]);
+	}
+
+	AudioIO ioSerial(bufferSize, 44100, NULL, NULL, numChans, 0);
+	AudioIO ioParallel(bufferSize, 44100, NULL, NULL, numChans, 0);
+
+	for (int block = 0; block < 4; block++) {
+		for (int k = 0; k < numSources; k++) {
+			double ang = k * 0.7 + block * 0.1;
+			srcSerial[k].pos(cos(ang), 0, sin(ang));
+			srcParallel[k].pos(cos(ang), 0, sin(ang));
+			for (int i = 0; i < bufferSize; i++) {
+				float smp = sin(0.01 * (i + block * bufferSize) * (k + 1));
+				srcSerial[k].writeSample(smp);
+				srcParallel[k].writeSample(smp);
+			}
+		}
+		sceneSerial.render(ioSerial);
+		sceneParallel.render(ioParallel);
+		for (int c = 0; c < numChans; c++) {
+			for (int i = 0; i < bufferSize; i++) {
+				assert(fabs(ioSerial.out(c, i) - ioParallel.out(c, i)) < 1e-4);
+			}
+		}
+	}
+}
+
+void testParallelRender() {
+	SpeakerLayout stereoLayout = HeadsetSpeakerLayout();
+	StereoPanner stereo(stereoLayout);
+	testParallelRender(&stereo, 2, false);
+	testParallelRender(&stereo, 2, true);
+
+	SpeakerLayout ringLayout = SpeakerRingLayout<8>();
+	Vbap vbap(ringLayout);
+	testParallelRender(&vbap, 8, false);
+
+	// Not concurrent; sources are read in parallel and spatialized serially
+	SpeakerLayout octalLayout = OctalSpeakerLayout();
+	AmbisonicsSpatializer ambi(octalLayout, 2, 1);
+	testParallelRender(&ambi, octalLayout.numSpeakers(), false);
+}
+
 void testHeadphoneRendering() {
 //	FIXME add tests for headphone speaker leayout
 }
@@ -332,6 +431,24 @@ void testVbapGains() {
 		assert(almostEqual(audioIO.out(4, i), input[i]  * sqrt(1.0/3.0)));
 		assert(almostEqual(audioIO.out(5, i), 0.0));
 	}
+
+	// No speakers below, so a source below is silent per sample and per buffer
+	SpeakerLayout speakerLayoutDome;
+	speakerLayoutDome.addSpeaker(Speaker(0, 0, 0, 1));
+	speakerLayoutDome.addSpeaker(Speaker(1, -120, 0, 1));
+	speakerLayoutDome.addSpeaker(Speaker(2, 120, 0, 1));
+	speakerLayoutDome.addSpeaker(Speaker(3, 0, 90, 1));
+
+	Vbap pannerDome(speakerLayoutDome, true);
+	audioIO.zeroOut();
+	listeningPose = Pose(Vec3d(0, -4, 0)); // Below
+	pannerDome.renderSample(audioIO, listeningPose, 0.5, 0);
+	pannerDome.renderBuffer(audioIO, listeningPose, input, 8);
+	for (int i = 0; i < 8; i++) {
+		for (int c = 0; c < 4; c++) {
+			assert(audioIO.out(c, i) == 0.0f);
+		}
+	}
 }
 
 void testVbapRing() {
@@ -407,6 +524,203 @@ void testVbapRing() {
 	}
 }
 
+// Compare triplets found with lookup table to linear search
+void testVbapLookup(const SpeakerLayout& speakerLayout, bool is3D) {
+	Vbap panner(speakerLayout, is3D);
+
+	std::vector<Vec3d> directions;
+	for (int el = -90; el <= 90; el += (is3D ? 5 : 90)) {
+		for (int az = -180; az < 180; az += 3) {
+			double e = el * M_PI/180., a = az * M_PI/180.;
+			directions.push_back(Vec3d(cos(e)*cos(a), cos(e)*sin(a), sin(e)));
+		}
+	}
+	for (unsigned i = 0; i < speakerLayout.speakers().size(); i++) {
+		Vec3d v = speakerLayout.speakers()[i].vec();
+		directions.push_back(Vec3d(v.x, v.y, v.z));
+		directions.push_back(Vec3d(v.x, v.y, v.z) * 3.);
+	}
+
+	for (unsigned i = 0; i < directions.size(); i++) {
+		Vec3d gainsLinear, gainsTable, gainsHint;
+		panner.useLookupTable(false);
+		int linear = panner.findTriplet(directions[i], -1, gainsLinear);
+		panner.useLookupTable(true);
+		int table = panner.findTriplet(directions[i], -1, gainsTable);
+		assert(table == linear);
+		assert(linear < 0 || gainsTable == gainsLinear);
+
+		// Any triplet found starting from a hint must contain the direction
+		int hint = panner.findTriplet(directions[i], (i * 7) % panner.triplets().size(), gainsHint);
+		assert((hint < 0) == (linear < 0));
+		if (hint >= 0) {
+			assert(gainsHint[0] >= 0 && gainsHint[1] >= 0 && (!is3D || gainsHint[2] >= 0));
+		}
+	}
+}
+
+void testVbapLookup() {
+	testVbapLookup(SpeakerRingLayout<8>(), false);
+
+	SpeakerLayout octahedron;
+	octahedron.addSpeaker(Speaker(0, 0, 0, 1));
+	octahedron.addSpeaker(Speaker(1, -90, 0, 1));
+	octahedron.addSpeaker(Speaker(2, 90, 0, 1));
+	octahedron.addSpeaker(Speaker(3, 180, 0, 1));
+	octahedron.addSpeaker(Speaker(4, 0, 90, 1));
+	octahedron.addSpeaker(Speaker(5, 0, -90, 1));
+	testVbapLookup(octahedron, true);
+
+	// Three rings and a top speaker
+	SpeakerLayout dome;
+	int chan = 0;
+	for (int i = 0; i < 8; i++) dome.addSpeaker(Speaker(chan++, i * 45, -30, 1));
+	for (int i = 0; i < 8; i++) dome.addSpeaker(Speaker(chan++, i * 45 + 22.5, 0, 1));
+	for (int i = 0; i < 6; i++) dome.addSpeaker(Speaker(chan++, i * 60, 45, 1));
+	dome.addSpeaker(Speaker(chan++, 0, 90, 1));
+	testVbapLookup(dome, true);
+}
+
+void testGainMatrix() {
+	const int bufferSize = 13;
+	AudioIO audioIO(bufferSize, 44100, NULL, NULL, 4, 0);
+	SpeakerLayout speakerLayout;
+	speakerLayout.addSpeaker(Speaker(0, -45, 0, 1));
+	speakerLayout.addSpeaker(Speaker(1, 45, 0, 1));
+	speakerLayout.addSpeaker(Speaker(3, 180, 0, 1)); // Phantom, goes to 0 and 2
+
+	std::map<int, std::vector<int> > phantoms;
+	phantoms[3] = {0, 2};
+	GainMatrix matrix;
+	matrix.setup(speakerLayout.speakers(), phantoms);
+	assert(matrix.numSpeakers() == 3);
+	assert(matrix.numOutputs() == 3);
+
+	float input[bufferSize];
+	for (int i = 0; i < bufferSize; i++) input[i] = 0.5f - 0.1f * i;
+
+	// First block of a source does not ramp
+	GainMatrix::State state;
+	float gains[3] = {0.5f, 0.25f, 0.f};
+	audioIO.zeroOut();
+	matrix.renderBuffer(audioIO, &state, input, bufferSize, gains, 3);
+	for (int i = 0; i < bufferSize; i++) {
+		assert(almostEqual(audioIO.out(0, i), input[i] * 0.5f));
+		assert(almostEqual(audioIO.out(1, i), input[i] * 0.25f));
+		assert(audioIO.out(2, i) == 0.f);
+		assert(audioIO.out(3, i) == 0.f);
+	}
+
+	// Gains ramp from previous block, reaching the new gains at the last frame
+	float gains2[3] = {0.f, 0.25f, 1.f};
+	audioIO.zeroOut();
+	matrix.renderBuffer(audioIO, &state, input, bufferSize, gains2, 3);
+	float phantomGain = 1.f / sqrt(2.f);
+	for (int i = 0; i < bufferSize; i++) {
+		float frac = float(i + 1) / bufferSize;
+		assert(almostEqual(audioIO.out(0, i), input[i] * (0.5f + (phantomGain - 0.5f) * frac)));
+		assert(almostEqual(audioIO.out(1, i), input[i] * 0.25f));
+		assert(almostEqual(audioIO.out(2, i), input[i] * phantomGain * frac));
+		assert(audioIO.out(3, i) == 0.f);
+	}
+
+	// Sparse gains and per sample rendering
+	int speakers[1] = {2};
+	float gains3[1] = {0.5f};
+	audioIO.zeroOut();
+	matrix.renderSample(audioIO, 0.8f, 3, gains3, 1, speakers);
+	assert(almostEqual(audioIO.out(0, 3), 0.8f * 0.5f * phantomGain));
+	assert(almostEqual(audioIO.out(2, 3), 0.8f * 0.5f * phantomGain));
+	assert(audioIO.out(1, 3) == 0.f);
+}
+
+// Each listener keeps its own gains of a source between blocks
+void testGainStatePerListener() {
+	const int bufferSize = 16;
+	SpeakerLayout layoutA, layoutB;
+	layoutA.addSpeaker(Speaker(0, 45, 0, 1));
+	layoutA.addSpeaker(Speaker(1, -45, 0, 1));
+	layoutB.addSpeaker(Speaker(2, 135, 0, 1));
+	layoutB.addSpeaker(Speaker(3, -135, 0, 1));
+	Dbap pannerA(layoutA), pannerB(layoutB), pannerRef(layoutA);
+
+	AudioScene scene(bufferSize), sceneRef(bufferSize);
+	SoundSource src, srcRef;
+	src.dopplerType(DOPPLER_NONE);
+	srcRef.dopplerType(DOPPLER_NONE);
+	src.useAttenuation(false);
+	srcRef.useAttenuation(false);
+	Listener * listenerA = scene.createListener(&pannerA);
+	scene.addSource(src);
+	Listener * listenerB = scene.createListener(&pannerB);
+	sceneRef.createListener(&pannerRef);
+	sceneRef.addSource(srcRef);
+
+	// Allocated when the source or the listener is added
+	assert(listenerA->index() == 0 && listenerB->index() == 1);
+	assert(src.spatializerState(*listenerA).gains.gains.size() == 2);
+	assert(src.spatializerState(*listenerB).gains.gains.size() == 2);
+
+	// Without Doppler, sources are read 1024 samples ago
+	for (int i = 0; i < 1024; i++) {
+		src.writeSample(0.5f);
+		srcRef.writeSample(0.5f);
+	}
+
+	AudioIO audioIO(bufferSize, 44100, NULL, NULL, 4, 0);
+	AudioIO audioIORef(bufferSize, 44100, NULL, NULL, 4, 0);
+	for (int block = 0; block < 3; block++) {
+		for (int i = 0; i < bufferSize; i++) {
+			src.writeSample(0.5f);
+			srcRef.writeSample(0.5f);
+		}
+		src.pos(block - 1, 0, -1);
+		srcRef.pos(block - 1, 0, -1);
+		scene.render(audioIO);
+		sceneRef.render(audioIORef);
+		// The second listener does not reset the ramps of the first
+		for (int c = 0; c < 2; c++) {
+			for (int i = 0; i < bufferSize; i++) {
+				assert(audioIO.out(c, i) == audioIORef.out(c, i));
+			}
+		}
+		if (block > 0) {
+			assert(audioIO.out(0, 0) != audioIO.out(0, bufferSize - 1));
+		}
+	}
+}
+
+void testDbap() {
+	const int bufferSize = 8;
+	SpeakerLayout speakerLayout = SpeakerRingLayout<4>();
+	Dbap panner(speakerLayout);
+	AudioIO audioIO(bufferSize, 44100, NULL, NULL, speakerLayout.numSpeakers(), 0);
+	float input[bufferSize] = {0.5f, 0.5f, 0.4f, 0.3f, 0.2f, 0.1f, -0.3f, -0.4f};
+
+	// Buffer and sample rendering must agree
+	Pose listeningPose(Vec3d(0.3, 0, 2));
+	audioIO.zeroOut();
+	panner.renderBuffer(audioIO, listeningPose, input, bufferSize);
+	std::vector<float> buffered(bufferSize * 4);
+	for (int c = 0; c < 4; c++) {
+		for (int i = 0; i < bufferSize; i++) buffered[c*bufferSize + i] = audioIO.out(c, i);
+	}
+	audioIO.zeroOut();
+	for (int i = 0; i < bufferSize; i++) {
+		panner.renderSample(audioIO, listeningPose, input[i], i);
+	}
+	for (int c = 0; c < 4; c++) {
+		for (int i = 0; i < bufferSize; i++) {
+			assert(almostEqual(audioIO.out(c, i), buffered[c*bufferSize + i]));
+		}
+	}
+
+	// Closest speaker is loudest
+	assert(fabs(audioIO.out(0, 0)) > fabs(audioIO.out(1, 0)));
+	assert(fabs(audioIO.out(0, 0)) > fabs(audioIO.out(2, 0)));
+	assert(fabs(audioIO.out(0, 0)) > fabs(audioIO.out(3, 0)));
+}
+
 void testAmbisonicsFirstOrder2D(int bufferSize) {
 	// TODO Finish ambisonics scene tester
 	SpeakerLayout speakerLayout = OctalSpeakerLayout();
@@ -478,6 +792,8 @@ int utAudioScene() {
 	testMultipleSourcesStereo(8);
 	testMultipleSourcesStereo(4096);
 	testMultipleSourcesMovingStereo();
+	testParallelRender();
+	testSoundSourceBlockRead();
 
 	// Headphones
 	testHeadphoneRendering();
@@ -486,9 +802,12 @@ int utAudioScene() {
 	testVbapTriples();
 	testVbapGains();
 	testVbapRing();
+	testVbapLookup();
+	testGainMatrix();
 
 	// DBAP
-	// FIMXE add tests for DBAP
+	testDbap();
+	testGainStatePerListener();
 
 	// Ambisonics
 	testAmbisonicsFirstOrder2D(8);
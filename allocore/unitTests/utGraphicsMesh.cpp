@@ -1,4 +1,24 @@
 #include "utAllocore.h"
+#include "allocore/graphics/al_Isosurface.hpp"
+
+// Number of non-degenerate triangles of b that are also in a
+static int sharedTriangles(const Mesh& a, const Mesh& b){
+	int count = 0;
+	for(int j=0; j<b.indices().size(); j+=3){
+		const Mesh::Index * tb = &b.indices()[j];
+		if(tb[0] == tb[1] && tb[1] == tb[2]) continue;
+		for(int i=0; i<a.indices().size(); i+=3){
+			const Mesh::Index * ta = &a.indices()[i];
+			if(a.vertices()[ta[0]] == b.vertices()[tb[0]]
+			&& a.vertices()[ta[1]] == b.vertices()[tb[1]]
+			&& a.vertices()[ta[2]] == b.vertices()[tb[2]]){
+				++count;
+				break;
+			}
+		}
+	}
+	return count;
+}
 
 int utGraphicsMesh(){
 
@@ -43,5 +63,180 @@ int utGraphicsMesh(){
 
 	}
 
+	// Welding
+	{
+		// Two triangles sharing an edge, unindexed
+		Mesh m;
+		m.vertex(0,0,0); m.vertex(1,0,0); m.vertex(0,1,0);
+		m.vertex(1,0,0); m.vertex(1,1,0); m.vertex(0,1,0);
+
+		Mesh c(m);
+		c.compress();
+		assert(c.vertices().size() == 4);
+		assert(c.indices().size() == 6);
+		for(int i=0; i<6; ++i) assert(c.vertices()[c.indices()[i]] == m.vertices()[i]);
+
+		// Differing attributes prevent welding unless ignored
+		Mesh a(m);
+		for(int i=0; i<6; ++i) a.color(Color(i<3 ? 1 : 0));
+		Mesh b(a);
+		assert(a.weld() == 6);
+		assert(b.weld(0, false) == 4);
+		assert(b.colors().size() == 4);
+		assert(b.colors()[1] == Color(1)); // first occurrence kept
+
+		// Tolerance, also across grid cell boundaries
+		Mesh t;
+		t.vertex(0,0,0); t.vertex(1e-4,-1e-4,0); t.vertex(0.4995,0,0); t.vertex(0.5004,0,0);
+		assert(t.weld(1e-3) == 2);
+		assert(t.indices()[1] == 0);
+		assert(t.indices()[3] == 1);
+
+		// Already indexed meshes have their indices remapped
+		Mesh r;
+		r.vertex(0,0,0); r.vertex(1,0,0); r.vertex(0,0,0); r.vertex(0,1,0);
+		r.index(0,1,3, 2,3,1);
+		assert(r.weld() == 3);
+		assert(r.indices().size() == 6);
+		assert(r.indices()[3] == 0);
+		assert(r.indices()[4] == 2);
+		assert(r.indices()[5] == 1);
+	}
+
+	// Adjacency
+	{
+		// Quad from two triangles sharing edge 1-2
+		Mesh m(Graphics::TRIANGLES);
+		m.vertex(0,0,0); m.vertex(1,0,0); m.vertex(0,1,0); m.vertex(1,1,0);
+		m.index(0,1,2, 2,1,3);
+
+		const Mesh::Adjacency& adj = m.adjacency();
+		assert(adj.numVertices() == 4);
+		assert(adj.triangles.size() == 2);
+		assert(adj.numNeighbors(0) == 2);
+		assert(adj.numNeighbors(1) == 3);
+		assert(adj.neighborsBegin(1)[0] == 0);
+		assert(adj.neighborsBegin(1)[1] == 2);
+		assert(adj.neighborsBegin(1)[2] == 3);
+		assert(adj.numFaces(2) == 2);
+		assert(adj.numFaces(3) == 1 && adj.facesBegin(3)[0] == 1);
+
+		// Changing the indices rebuilds it
+		m.vertex(2,0,0);
+		m.index(1,4,3);
+		assert(m.adjacency().numVertices() == 5);
+		assert(m.adjacency().numNeighbors(1) == 4);
+
+		// So does writing to the indices in place
+		m.indices()[8] = 0;
+		assert(m.adjacency().numNeighbors(0) == 3);
+		assert(m.adjacency().numNeighbors(3) == 2);
+		m.indices()[8] = 3;
+
+		m.generateNormals();
+		for(int i=0; i<5; ++i) assert(m.normals()[i] == Vec3f(0,0,1));
+
+		// Triangle strip with the same quad
+		Mesh s(Graphics::TRIANGLE_STRIP);
+		s.vertex(0,0,0); s.vertex(1,0,0); s.vertex(0,1,0); s.vertex(1,1,0);
+		assert(s.adjacency().triangles.size() == 2);
+		assert(s.adjacency().numNeighbors(1) == 3);
+		s.generateNormals();
+		for(int i=0; i<4; ++i) assert(s.normals()[i] == Vec3f(0,0,1));
+
+		// Smoothing moves the vertices of a fan towards their neighbors
+		Mesh f(Graphics::TRIANGLES);
+		f.vertex(0,0,1);
+		for(int i=0; i<4; ++i) f.vertex(i<2 ? 1-2*i : 0, i<2 ? 0 : 5-2*i, 0);
+		f.index(0,1,3, 0,3,2, 0,2,4, 0,4,1);
+		f.smooth(0.5);
+		assert(f.vertices()[0] == Vec3f(0,0,0.5));
+
+		// Normals gathered from the cached adjacency match the serial sums
+		Mesh g(Graphics::TRIANGLES);
+		const int N = 80;
+		for(int j=0; j<=N; ++j){
+		for(int i=0; i<=N; ++i){
+			g.vertex(i, j, sin(i*0.3)*cos(j*0.2));
+		}}
+		for(int j=0; j<N; ++j){
+		for(int i=0; i<N; ++i){
+			int a = j*(N+1) + i;
+			g.index(a, a+1, a+N+2, a, a+N+2, a+N+1);
+		}}
+		g.generateNormals();
+		Mesh::Normals serial(g.normals());
+		g.adjacency();
+		g.generateNormals();
+		for(int i=0; i<g.vertices().size(); ++i) assert(g.normals()[i] == serial[i]);
+
+		// Point cloud without triangles
+		Mesh p(Graphics::POINTS);
+		p.vertex(0,0,0); p.vertex(1,0,0);
+		assert(p.adjacency().numVertices() == 2);
+		assert(p.adjacency().numNeighbors(1) == 0);
+		assert(p.adjacency().neighborsBegin(1) == p.adjacency().neighborsEnd(1));
+	}
+
+	// Incremental isosurface
+	{
+		// Binary field so that edge vertices lie exactly on edge midpoints
+		const int N = 10;
+		float field[N*N*N];
+		for(int i=0; i<N*N*N; ++i) field[i] = (i*7919 % 13) < 5;
+
+		Isosurface full(0.5), inc(0.5);
+		full.generate(field, N, 1);
+		inc.fieldDims(N).cellLengths(1).brickSize(4);
+		inc.update(field, true);
+		assert(inc.numUpdatedBricks() == 27);
+		int Nt = full.indices().size()/3;
+		assert(sharedTriangles(full, inc) == Nt);
+		assert(sharedTriangles(inc, full) == Nt);
+
+		// Only bricks near a changed point are extracted again
+		field[1 + N*(1 + N*1)] = 1 - field[1 + N*(1 + N*1)];
+		full.generate(field, N, 1);
+		inc.update(field, true);
+		assert(inc.numUpdatedBricks() == 1);
+		Nt = full.indices().size()/3;
+		assert(sharedTriangles(full, inc) == Nt);
+		assert(sharedTriangles(inc, full) == Nt);
+
+		field[5 + N*(5 + N*5)] = 1 - field[5 + N*(5 + N*5)];
+		full.generate(field, N, 1);
+		inc.markDirty(5,5,5, 6,6,6);
+		inc.update(field);
+		assert(inc.numUpdatedBricks() == 8);
+		Nt = full.indices().size()/3;
+		assert(sharedTriangles(full, inc) == Nt);
+		assert(sharedTriangles(inc, full) == Nt);
+
+		// A diffed update after one without diffing extracts everything, as
+		// the field may have changed back to the last diffed values
+		field[5 + N*(5 + N*5)] = 1 - field[5 + N*(5 + N*5)];
+		full.generate(field, N, 1);
+		inc.update(field, true);
+		assert(inc.numUpdatedBricks() == 27);
+		Nt = full.indices().size()/3;
+		assert(sharedTriangles(full, inc) == Nt);
+		assert(sharedTriangles(inc, full) == Nt);
+
+		// Changing the level or cell lengths extracts everything
+		full.level(0.25).generate(field, N, 1);
+		inc.level(0.25).update(field, true);
+		assert(inc.numUpdatedBricks() == 27);
+		Nt = full.indices().size()/3;
+		assert(sharedTriangles(full, inc) == Nt);
+		assert(sharedTriangles(inc, full) == Nt);
+
+		full.generate(field, N, 2);
+		inc.cellLengths(2).update(field, true);
+		assert(inc.numUpdatedBricks() == 27);
+		Nt = full.indices().size()/3;
+		assert(sharedTriangles(full, inc) == Nt);
+		assert(sharedTriangles(inc, full) == Nt);
+	}
+
 	return 0;
 }
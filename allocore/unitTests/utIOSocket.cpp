@@ -66,6 +66,38 @@ int utIOSocket(){
 		//printf("r %d\n", i);
 	}
 
+	// Batches of datagrams
+	{
+		const int N = 8;
+		char out[N][16], in[N*2][16];
+		Socket::Datagram send[N], recv[N*2];
+		for(int i=0; i<N; ++i){
+			snprintf(out[i], 16, "datagram %d", i);
+			send[i].data = out[i];
+			send[i].size = strlen(out[i]) + 1;
+		}
+		for(int i=0; i<N*2; ++i){
+			recv[i].data = in[i];
+			recv[i].capacity = 16;
+		}
+		s.timeout(0.1);
+		assert(c.sendBatch(send, N) == N);
+		int received = 0;
+		while(received < N){
+			int n = s.recvBatch(recv + received, N*2 - received);
+			assert(n > 0);
+			received += n;
+		}
+		assert(received == N);
+		for(int i=0; i<N; ++i){
+			assert(recv[i].size == send[i].size);
+			assert(!strcmp(in[i], out[i]));
+		}
+		// nothing left
+		s.timeout(0.01);
+		assert(s.recvBatch(recv, N) == 0);
+	}
+
 	// Empirical tests
 	{
 //		printf("%s\n", Socket::hostName().c_str());
@@ -1,4 +1,6 @@
 #include "utAllocore.h"
+#include <thread>
+#include "allocore/ui/al_Parameter.hpp"
 
 struct PacketData{
 	PacketData(): i(0x12345678), f(1), d(1), c(1){}
@@ -83,6 +85,104 @@ int utProtocolOSC(){
 	assert(p.isBundle());
 	assert(!p.isMessage());
 
+	// Building into a buffer gives the same bytes as Packet
+	{
+		char buf[1024];
+		PacketBuilder b(buf, sizeof(buf));
+		b.beginBundle(12345);
+			b.addMessage("/test");
+			b.addMessage("/message11", (int)0x12345678, 1.f, 1., "hello world!");
+			b.addMessage("/message12", (int)0x23456789);
+			b.beginBundle(12346);
+				b.addMessage("/message21", (int)0x3456789a);
+				b.beginBundle(12347);
+					b.addMessage("/message31", (int)0x456789ab);
+				b.endBundle();
+			b.endBundle();
+			b.addMessage("/message13", (int)0x56789abc);
+		b.endBundle();
+			assert(b.ok());
+			assert(b.size() == p.size());
+			assert(!memcmp(b.data(), p.data(), p.size()));
+
+		// Views are handed out in order with the time tag of their bundle
+		struct ViewHandler : public osc::PacketHandler{
+			int count = 0;
+			void onMessage(osc::Message& m){ assert(false); }
+			void onMessageView(osc::MessageView& m){
+				const char * addr[] = {"/test", "/message11", "/message12", "/message21", "/message31", "/message13"};
+				TimeTag tags[] = {12345, 12345, 12345, 12346, 12347, 12345};
+				assert(m.addressPattern() == addr[count]);
+				assert(m.timeTag() == tags[count]);
+				if(count == 1){
+					int i=0; float f=0; double d=0; StringView sv;
+					m >> i >> f >> d >> sv;
+					assert(m.good());
+					assert(i == 0x12345678 && f == 1 && d == 1 && sv == "hello world!");
+				}
+				++count;
+			}
+		} handler;
+		handler.parse(b.data(), b.size());
+			assert(handler.count == 6);
+
+		// Reading a message in place
+		const char * str = "Hello World!";
+		b.clear();
+		b.addMessage("/test", 1, 1.f, 1.0, '1', str, std::string(str), Blob(str, strlen(str)));
+			assert(b.ok());
+		MessageView m;
+			assert(m.parse(b.data(), b.size()));
+			assert(m.addressPattern() == "/test");
+			assert(m.typeTags() == "ifdcssb");
+			assert(m.numArgs() == 7);
+		int i=0; float f=0; double d=0; char c=0;
+		const char * cs = 0; StringView sv; Blob bl;
+		m >> i >> f >> d >> c >> cs >> sv >> bl;
+			assert(m.good());
+			assert(1 == i && 1 == f && 1 == d && '1' == c);
+			assert(!strcmp(cs, str));
+			assert(sv == str && sv.str() == str);
+			assert(int(bl.size) == int(strlen(str)) && !memcmp(bl.data, str, bl.size));
+
+		// Wrong types leave the value and clear good()
+		m.resetStream();
+		f = 5;
+		m >> f;
+			assert(!m.good() && f == 5);
+		m.resetStream().skip() >> f;
+			assert(m.good() && f == 1);
+		m.skip().skip().skip().skip().skip() >> i;
+			assert(!m.good());
+
+		// Malformed messages are rejected
+			assert(!m.parse(b.data(), b.size() - 4));
+			assert(!m.parse(b.data(), 3));
+		char bad[8] = {'/', 'a', 'b', 'c', 'd', 'e', 'f', 'g'};
+			assert(!m.parse(bad, sizeof(bad)));
+
+		// Running out of space
+		char small[32];
+		PacketBuilder sb(small, sizeof(small));
+		sb.addMessage("/a", 1, 2, 3);
+			assert(sb.ok() && sb.size() == 4 + 8 + 12);
+			assert(m.parse(sb.data(), sb.size()) && m.typeTags() == "iii");
+		sb.clear().addMessage("/a", 1, 2, 3, 4, 5);
+			assert(!sb.ok());
+		sb.clear().beginBundle().addMessage("/a");
+			assert(!sb.ok());
+		sb.endBundle();
+			assert(sb.ok());
+		sb.clear().addMessage("/a").addMessage("/b");
+			assert(!sb.ok());
+
+		// A packet holds a single top-level element
+		sb.clear().addMessage("/a").beginBundle();
+			assert(!sb.ok());
+		sb.clear().beginBundle().endBundle().beginBundle().endBundle();
+			assert(!sb.ok());
+	}
+
 
 	PacketData data;
 	{
@@ -93,6 +193,7 @@ int utProtocolOSC(){
 
 				assert(m.typeTags() == "sifdcb");
 				assert(m.addressPattern() == "/test");
+				assert(m.senderAddress() == "127.0.0.1");
 
 				std::string s;
 				PacketData d;
@@ -130,5 +231,252 @@ int utProtocolOSC(){
 		}
 	}
 
+	// Coalescing sends into bundles, batched receives
+	{
+		struct CountHandler : public osc::PacketHandler{
+			int count = 0;
+			void onMessage(osc::Message& m){}
+			void onMessageView(osc::MessageView& m){
+				int i = -1;
+				m >> i;
+				assert(m.addressPattern() == "/pose" && i == count);
+				assert(!strcmp(m.senderAddress(), "127.0.0.1"));
+				++count;
+			}
+		} handler;
+
+		unsigned port = 4113;
+		osc::Send s(port, "127.0.0.1");
+		osc::Recv r(port, "", 0.1);
+		r.handler(handler);
+		r.batchSize(8);
+		assert(r.batchSize() == 8);
+
+		s.coalesce(256);
+		assert(s.mtu() == 256);
+		const int N = 100;
+		for(int i=0; i<N; ++i) s.send("/pose", i, 1.f, 2.f, 3.f);
+		assert(handler.count == 0 && !r.recv());
+		int datagrams = s.flush();
+		// 32 byte messages, 6 per bundle of 16 + 6*(4+32) bytes
+		assert(datagrams == (N+5)/6);
+		while(handler.count < N && r.recv()){}
+		assert(handler.count == N);
+
+		// a single message is sent without a bundle
+		s.send("/pose", N, 0.f, 0.f, 0.f);
+		assert(s.flush() == 1);
+		assert(r.recv() == 32);
+		assert(handler.count == N+1);
+	}
+
+	// Receivers sharing a reactor
+	{
+		struct Handler : public osc::PacketHandler{
+			std::atomic<int> count;
+			Handler(): count(0){}
+			void onMessage(osc::Message& m){ ++count; }
+		} handlers[3];
+
+		SocketReactor reactor(2);
+		osc::Recv r0(4114, "", 0.1), r1(4115, "", 0.1), r2(4116, "", 0.1);
+		osc::Recv * recvs[] = {&r0, &r1, &r2};
+		for(int i=0; i<3; ++i){
+			recvs[i]->handler(handlers[i]);
+			assert(recvs[i]->start(reactor));
+			assert(recvs[i]->background());
+		}
+		assert(reactor.size() == 3);
+
+		osc::Send s0(4114, "127.0.0.1"), s1(4115, "127.0.0.1"), s2(4116, "127.0.0.1");
+		const int N = 50;
+		for(int i=0; i<N; ++i){
+			s0.send("/a", i);
+			s1.send("/b", i);
+			if(i < 10) s2.send("/c", i);
+		}
+		auto waitFor = [](std::atomic<int>& count, int n){
+			for(int i=0; i<1000 && count < n; ++i) al_sleep(0.001);
+			return count == n;
+		};
+		assert(waitFor(handlers[0].count, N));
+		assert(waitFor(handlers[1].count, N));
+		assert(waitFor(handlers[2].count, 10));
+
+		// a removed receiver gets no more packets from the reactor
+		r1.stop();
+		assert(!r1.background());
+		assert(reactor.size() == 2);
+		s1.send("/b", N);
+		s0.send("/a", N);
+		assert(waitFor(handlers[0].count, N+1));
+		al_sleep(0.01);
+		assert(handlers[1].count == N);
+		assert(r1.recv() > 0 && handlers[1].count == N+1);
+
+		// stopping the reactor keeps the sockets, which it handles once restarted
+		reactor.stop();
+		s2.send("/c", 10);
+		al_sleep(0.01);
+		assert(handlers[2].count == 10);
+		r0.stop();
+		assert(reactor.size() == 1);
+		assert(r1.start(reactor));
+		assert(waitFor(handlers[2].count, 11));
+	}
+
+	// Address patterns
+	{
+		assert(!isPattern("/synth/voice1/amp"));
+		assert(isPattern("/synth/*/amp"));
+
+		assert(matchPattern("/a/b", "/a/b"));
+		assert(!matchPattern("/a/b", "/a/bc"));
+		assert(matchPattern("/a/?", "/a/b"));
+		assert(!matchPattern("/a?b", "/a/b"));
+		assert(matchPattern("/a/*", "/a/bcd"));
+		assert(matchPattern("/a/*d", "/a/bcd"));
+		assert(!matchPattern("/a/*", "/a/b/c"));
+		assert(matchPattern("/*/*", "/a/b"));
+		assert(matchPattern("/voice[1-3]", "/voice2"));
+		assert(!matchPattern("/voice[1-3]", "/voice4"));
+		assert(matchPattern("/voice[!1-3]", "/voice4"));
+		assert(matchPattern("/voice[13]", "/voice3"));
+		assert(matchPattern("/{left,right}/gain", "/right/gain"));
+		assert(!matchPattern("/{left,right}/gain", "/center/gain"));
+		assert(matchPattern("/{a,ab}c", "/abc"));
+	}
+
+	// Parameter dispatch
+	{
+		al::Parameter p1("amp", "voice1", 0);
+		al::Parameter p2("amp", "voice2", 0);
+		al::Parameter p3("freq", "voice1", 0);
+		al::ParameterVec3 pos("pos", "voice1", al::Vec3f(0));
+		al::ParameterString name("name", "voice1", "");
+
+		al::ParameterServer server("127.0.0.1", 4111);
+		server << p1 << p2 << p3 << pos << name;
+
+		Packet p;
+		p.addMessage("/voice1/amp", 0.5f);
+		{ Message m(p.data(), p.size()); server.onMessage(m); }
+			assert(p1.get() == 0.5f && p2.get() == 0 && p3.get() == 0);
+
+		// wrong type tags are ignored
+		p.clear();
+		p.addMessage("/voice1/freq", 1);
+		{ Message m(p.data(), p.size()); server.onMessage(m); }
+			assert(p3.get() == 0);
+
+		p.clear();
+		p.addMessage("/voice*/amp", 0.25f);
+		{ Message m(p.data(), p.size()); server.onMessage(m); }
+			assert(p1.get() == 0.25f && p2.get() == 0.25f && p3.get() == 0);
+
+		p.clear();
+		p.addMessage("/voice1/pos", 1.f, 2.f, 3.f);
+		{ Message m(p.data(), p.size()); server.onMessage(m); }
+			assert(pos.get() == al::Vec3f(1,2,3));
+
+		p.clear();
+		p.addMessage("/voice1/name", "one");
+		{ Message m(p.data(), p.size()); server.onMessage(m); }
+			assert(name.get() == "one");
+
+		// messages read in place take the same routes
+		MessageView v;
+		p.clear();
+		p.addMessage("/voice[12]/amp", 0.125f);
+		v.parse(p.data(), p.size());
+		server.onMessageView(v);
+			assert(p1.get() == 0.125f && p2.get() == 0.125f && p3.get() == 0);
+
+		p.clear();
+		p.addMessage("/voice1/pos", 4.f, 5.f, 6.f);
+		v.parse(p.data(), p.size());
+		server.onMessageView(v);
+			assert(pos.get() == al::Vec3f(4,5,6));
+
+		p.clear();
+		p.addMessage("/voice1/name", "two");
+		v.parse(p.data(), p.size());
+		server.onMessageView(v);
+			assert(name.get() == "two");
+
+		p.clear();
+		p.addMessage("/voice1/freq", 1);
+		v.parse(p.data(), p.size());
+		server.onMessageView(v);
+			assert(p3.get() == 0);
+
+		server.unregisterParameter(p1);
+		p.clear();
+		p.addMessage("/voice1/amp", 1.f);
+		{ Message m(p.data(), p.size()); server.onMessage(m); }
+			assert(p1.get() == 0.125f);
+	}
+
+	// Parameter snapshots and smoothing
+	{
+		al::Parameter amp("amp", "", 0);
+		al::ParameterVec3 pos("pos", "", al::Vec3f(0));
+		al::ParameterVec4 color("color", "", al::Vec4f(0));
+		al::ParameterServer server("127.0.0.1", 4112);
+		server << amp << pos << color;
+
+		al::ParameterSnapshot snapshot;
+		snapshot.add(server);
+		assert(snapshot.size() == 3);
+		snapshot << amp; // already added
+		assert(snapshot.size() == 3);
+
+		amp.set(0.5f);
+		pos.set(al::Vec3f(1,2,3));
+		color.set(al::Vec4f(1,2,3,4));
+		assert(snapshot.get(amp) == 0);
+		snapshot.update();
+		amp.set(0.75f);
+		assert(snapshot.get(amp) == 0.5f);
+		assert(snapshot.get(pos) == al::Vec3f(1,2,3));
+		assert(snapshot.get(color) == al::Vec4f(1,2,3,4));
+
+		// a Vec3 written by another thread is never read half updated
+		pos.set(al::Vec3f(0));
+		std::atomic<bool> done(false);
+		std::thread writer([&](){
+			for(int i=1; i<=100000; ++i) pos.set(al::Vec3f(i, i, i));
+			done = true;
+		});
+		bool torn = false;
+		while(!done){
+			al::Vec3f v = pos.get();
+			if(v[0] != v[1] || v[1] != v[2]) torn = true;
+		}
+		writer.join();
+		assert(!torn);
+		assert(pos.get() == al::Vec3f(100000));
+
+		// ramps linearly over 4 samples
+		amp.set(0);
+		al::ParameterSmoother smooth(amp, 4);
+		assert(smooth.value() == 0);
+		amp.set(1);
+		smooth.update(1);
+		assert(smooth.ramping());
+		assert(smooth() == 0.25f);
+		assert(smooth() == 0.5f);
+		assert(smooth() == 0.75f);
+		assert(smooth() == 1);
+		assert(!smooth.ramping());
+		assert(smooth() == 1);
+
+		// without a ramp time it jumps on the next sample
+		smooth.rampTime(0);
+		amp.set(0.5f);
+		smooth.update(44100);
+		assert(smooth() == 0.5f);
+	}
+
 	return 0;
 }
@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <vector>
 #include "utAllocore.h"
+#include "allocore/spatial/al_HashSpace.hpp"
 
 int utSpatial(){
 
@@ -17,5 +20,75 @@ int utSpatial(){
 		a.step(0.5);	assert(a.vec() == Vec3d(2.5,0,0));
 	}
 
+	// HashSpace batched queries
+	{
+		HashSpace space(4);
+		const int N = 500;
+		std::vector<Vec3d> pos(N);
+		for(int i=0; i<N; ++i){
+			pos[i].set((i*37)%160/10., (i*61)%160/10., (i*89)%160/10.);
+		}
+		space.rebuild(&pos[0], N, 2);
+
+		// Objects are still reachable by Query
+		HashSpace::Query qry(N);
+		assert(qry(space, Vec3d(8,8,8), space.maxRadius()) > 0);
+
+		HashSpace::Neighbors nbrs;
+		const int K = 5;
+		space.queryNearest(nbrs, K, 2);
+		assert(nbrs.size() == N);
+
+		const double R = 2.5;
+		HashSpace::Neighbors inR;
+		space.queryRadius(inR, R, N, 2);
+
+		for(int i=0; i<N; ++i){
+			// Brute force distances to all other objects
+			std::vector<double> d2;
+			int numInR = 0;
+			for(int j=0; j<N; ++j){
+				if(j == i) continue;
+				double d = space.wrapRelative(pos[j] - pos[i]).magSqr();
+				d2.push_back(d);
+				numInR += d <= R*R;
+			}
+			std::sort(d2.begin(), d2.end());
+
+			assert(nbrs.count(i) == K);
+			for(int k=0; k<K; ++k){
+				assert(nbrs.id(i,k) != unsigned(i));
+				assert(fabs(nbrs.distanceSquared(i,k) - d2[k]) < 1e-9);
+			}
+			assert(inR.count(i) == unsigned(numInR));
+		}
+
+		// Queries around arbitrary points
+		Vec3d pt(3.3, 1.1, 15.9);
+		space.queryNearest(nbrs, &pt, 1, 1);
+		assert(nbrs.count(0) == 1);
+		double best = 1e9;
+		for(int j=0; j<N; ++j) best = std::min(best, space.wrapRelative(pos[j] - pt).magSqr());
+		assert(fabs(nbrs.distanceSquared(0,0) - best) < 1e-9);
+	}
+
+	// HashSpace neighbor across the boundary, near the maximum radius
+	{
+		HashSpace space(4);
+		Vec3d pos[2] = { Vec3d(1.9, 0.5, 0.5), Vec3d(9, 0.5, 0.5) };
+		space.rebuild(pos, 2, 1);
+		HashSpace::Neighbors nbrs;
+		space.queryNearest(nbrs, 4, 1);
+		for(int i=0; i<2; ++i){
+			assert(nbrs.count(i) == 1);
+			assert(nbrs.id(i,0) == unsigned(1-i));
+			assert(fabs(nbrs.distanceSquared(i,0) - 7.1*7.1) < 1e-9);
+		}
+		space.queryRadius(nbrs, 7.2, 4, 1);
+		assert(nbrs.count(0) == 1 && nbrs.count(1) == 1);
+		space.queryRadius(nbrs, 7, 4, 1);
+		assert(nbrs.count(0) == 0 && nbrs.count(1) == 0);
+	}
+
 	return 0;
 }
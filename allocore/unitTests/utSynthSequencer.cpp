@@ -0,0 +1,242 @@
+#include "utAllocore.h"
+#include "allocore/ui/al_SynthSequencer.hpp"
+
+// Writes 1 on channel 0 until released, then frees itself
+class GateVoice : public SynthVoice {
+public:
+	virtual void onProcess(AudioIOData& io) override {
+		if (mOff) {
+			free();
+			return;
+		}
+		while (io()) {
+			io.out(0) += 1.0f;
+		}
+	}
+	virtual void onTriggerOn() override { mOff = false; }
+	virtual void onTriggerOff() override { mOff = true; }
+
+	bool mOff {false};
+};
+
+class OtherVoice : public GateVoice {};
+
+// Writes a ramp on every channel and bus, scaled by its number
+class RampVoice : public SynthVoice {
+public:
+	virtual void onProcess(AudioIOData& io) override {
+		while (io()) {
+			for (int c = 0; c < io.channelsOut(); c++) {
+				io.out(c) += mScale * (io.frame() + c);
+			}
+			for (int c = 0; c < io.channelsBus(); c++) {
+				io.bus(c) += mScale;
+			}
+		}
+	}
+
+	float mScale {1};
+};
+
+// Writes its amplitude on the first frame, then frees itself
+class ClickVoice : public SynthVoice {
+public:
+	virtual void onProcess(AudioIOData& io) override {
+		if (io()) {
+			io.out(0) += mAmp;
+		}
+		free();
+	}
+	virtual bool setParamFields(float *pFields, int numFields) override {
+		if (numFields != 1) {
+			return false;
+		}
+		mAmp = pFields[0];
+		return true;
+	}
+
+	float mAmp {1};
+};
+
+// Render a block of one second and return the frame of the first click, or -1
+static int renderSecond(SynthSequencer& seq, AudioIO& io, float *amp = nullptr) {
+	io.zeroOut();
+	seq.render(io);
+	for (int i = 0; i < io.framesPerBuffer(); i++) {
+		if (io.out(0, i) != 0) {
+			if (amp) *amp = io.out(0, i);
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void renderBlock(PolySynth& synth, AudioIO& io) {
+	io.zeroOut();
+	synth.render(io);
+}
+
+int utSynthSequencer() {
+	const int bufferSize = 16;
+	AudioIO io(bufferSize, 44100, NULL, NULL, 1, 0);
+
+	// Sample accurate on and off within a block
+	{
+		PolySynth synth;
+		synth.allocatePolyphony<GateVoice>(3);
+		synth.allocatePolyphony<OtherVoice>(1);
+		auto& voice = synth.getVoice<GateVoice>();
+		int id = synth.triggerOn(&voice, 3);
+		synth.triggerOff(id, 10);
+		renderBlock(synth, io);
+		for (int i = 0; i < bufferSize; i++) {
+			assert(io.out(0, i) == ((i >= 3 && i < 10) ? 1.0f : 0.0f));
+		}
+		assert(!voice.active());
+		assert(synth.numActiveVoices() == 0);
+
+		// The voice released last is reused before the other free voices,
+		// and types don't mix
+		assert(&synth.getVoice<GateVoice>() == &voice);
+		assert((SynthVoice*)&synth.getVoice<OtherVoice>() != &voice);
+	}
+
+	// Release in a later block
+	{
+		PolySynth synth;
+		synth.allocatePolyphony<GateVoice>(3);
+		auto& voice = synth.getVoice<GateVoice>();
+		int id = synth.triggerOn(&voice);
+		synth.triggerOff(id, bufferSize + 5);
+		renderBlock(synth, io);
+		for (int i = 0; i < bufferSize; i++) {
+			assert(io.out(0, i) == 1.0f);
+		}
+		renderBlock(synth, io);
+		for (int i = 0; i < bufferSize; i++) {
+			assert(io.out(0, i) == (i < 5 ? 1.0f : 0.0f));
+		}
+		assert(!voice.active());
+
+		// Releasing the voice directly, within the next block
+		synth.triggerOn(&voice);
+		voice.triggerOff(5);
+		renderBlock(synth, io);
+		for (int i = 0; i < bufferSize; i++) {
+			assert(io.out(0, i) == (i < 5 ? 1.0f : 0.0f));
+		}
+		assert(!voice.active());
+	}
+
+	// Stealing the oldest voice once over the limit
+	{
+		PolySynth synth(2);
+		synth.allocatePolyphony<GateVoice>(3);
+		synth.setVoiceStealing(PolySynth::VOICE_STEAL_OLDEST);
+		auto& first = synth.getVoice<GateVoice>();
+		synth.triggerOn(&first);
+		renderBlock(synth, io);
+		auto& second = synth.getVoice<GateVoice>();
+		synth.triggerOn(&second);
+		renderBlock(synth, io);
+		auto& third = synth.getVoice<GateVoice>();
+		synth.triggerOn(&third);
+		renderBlock(synth, io);
+		assert(synth.numActiveVoices() == 2);
+		assert(!first.active());
+		assert(second.active() && third.active());
+		assert(io.out(0, 0) == 2.0f);
+	}
+
+	// Stealing prefers released voices
+	{
+		PolySynth synth(2);
+		synth.allocatePolyphony<GateVoice>(3);
+		synth.setVoiceStealing(PolySynth::VOICE_STEAL_OLDEST_RELEASED);
+		auto& first = synth.getVoice<GateVoice>();
+		synth.triggerOn(&first);
+		auto& second = synth.getVoice<GateVoice>();
+		synth.triggerOn(&second);
+		renderBlock(synth, io);
+		second.triggerOff(); // Released, but only freed in next onProcess()
+		auto& third = synth.getVoice<GateVoice>();
+		synth.triggerOn(&third);
+		renderBlock(synth, io);
+		assert(first.active() && !second.active() && third.active());
+	}
+
+	// Rendering on several threads matches rendering on one
+	{
+		AudioIO io2(bufferSize, 44100, NULL, NULL, 2, 0);
+		io2.channelsBus(1);
+		float serial[2 * bufferSize];
+		for (int numThreads = 1; numThreads <= 4; numThreads++) {
+			PolySynth synth;
+			synth.allocatePolyphony<RampVoice>(100);
+			// Buffers are sized for io2 whether prepared before or after
+			if (numThreads % 2) synth.prepare(io2);
+			synth.setNumThreads(numThreads);
+			if (!(numThreads % 2)) synth.prepare(io2);
+			for (int i = 0; i < 100; i++) {
+				auto& voice = synth.getVoice<RampVoice>();
+				voice.mScale = i + 1;
+				synth.triggerOn(&voice, i % bufferSize);
+			}
+			for (int block = 0; block < 3; block++) { // Balanced on measured costs after the first
+				io2.zeroOut();
+				io2.zeroBus();
+				synth.render(io2);
+			}
+			for (int i = 0; i < 2 * bufferSize; i++) {
+				if (numThreads == 1) {
+					serial[i] = io2.outBuffer()[i];
+				} else {
+					assert(io2.outBuffer()[i] == serial[i]); // Sums of integers are exact
+				}
+			}
+			assert(io2.bus(0, 0) == 5050);
+		}
+	}
+
+	// Sequencer timeline. Blocks of 16 frames at 16 Hz last one second.
+	{
+		AudioIO io1(bufferSize, bufferSize, NULL, NULL, 1, 0);
+		SynthSequencer seq;
+		seq.allocatePolyphony<ClickVoice>(5);
+		seq.add<ClickVoice>(2.25);
+		seq.add<ClickVoice>(0.5);
+		seq.add<ClickVoice>(4);
+		assert(seq.numEvents() == 3);
+		assert(renderSecond(seq, io1) == 8);
+		assert(renderSecond(seq, io1) == -1);
+		// Inserted while playing, before the next event
+		seq.add<ClickVoice>(1.5); // Already played
+		seq.add<ClickVoice>(2.75).mAmp = 2;
+		float amp = 0;
+		assert(renderSecond(seq, io1, &amp) == 4 && amp == 1);
+		assert(io1.out(0, 12) == 2);
+		assert(seq.time() == 3);
+		assert(renderSecond(seq, io1) == -1);
+		assert(renderSecond(seq, io1) == 0); // Event at the start of a block
+		// Seek back to an event inserted in the past
+		seq.seek(1.25);
+		assert(renderSecond(seq, io1) == 4);
+		assert(seq.time() == 2.25);
+		assert(renderSecond(seq, io1) == 0);
+
+		// Loading from a file
+		const char *path = "utSynthSequencer.sequence";
+		FILE *f = fopen(path, "w");
+		fprintf(f, "# Test sequence\n@ 1.5 0.5 Click 0.5\n\n@ 0.25 1 Click 0.25\n");
+		fclose(f);
+		SynthSequencer loaded;
+		loaded.registerSynthClass<ClickVoice>("Click");
+		assert(loaded.loadSequence(path));
+		remove(path);
+		assert(loaded.numEvents() == 2);
+		assert(renderSecond(loaded, io1, &amp) == 4 && amp == 0.25f);
+		assert(renderSecond(loaded, io1, &amp) == 8 && amp == 0.5f);
+	}
+
+	return 0;
+}
@@ -54,5 +54,51 @@ int utThread() {
 		assert(1 == x);
 	}
 
+	// Task pool
+	{
+		TaskPool pool(4);
+		assert(pool.size() == 4);
+
+		// every index is visited once
+		std::vector<int> visits(10000, 0);
+		pool.parallelFor(0, visits.size(), 100, [&](int b, int e){
+			for(int i=b; i<e; ++i) ++visits[i];
+		});
+		for(unsigned i=0; i<visits.size(); ++i) assert(visits[i] == 1);
+
+		// nested loops do not deadlock
+		std::atomic<int> sum(0);
+		pool.parallelFor(8, [&](int i){
+			pool.parallelFor(0, 1000*(i+1), 10, [&](int b, int e){ sum += e-b; });
+		});
+		assert(sum == 36000);
+
+		// the continuation runs after all tasks of the group
+		std::atomic<int> count(0);
+		int seen = -1;
+		{
+			TaskGroup group(pool);
+			for(int i=0; i<100; ++i){
+				group.run([&](){ ++count; });
+			}
+			group.then([&](){ seen = count; });
+		}
+		assert(seen == 100);
+
+		// a continuation set on a finished group still runs
+		TaskGroup group(pool);
+		group.run([&](){ ++count; });
+		group.wait();
+		group.then([&](){ ++count; });
+		group.wait();
+		assert(count == 102);
+
+		// a pool of one thread runs everything on the caller
+		TaskPool serial(1);
+		int n = 0;
+		serial.parallelFor(0, 100, 1, [&](int b, int e){ n += e-b; });
+		assert(n == 100);
+	}
+
 	return 0;
 }
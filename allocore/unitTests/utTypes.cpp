@@ -1,7 +1,14 @@
 #include "utAllocore.h"
+#include <thread>
 
 typedef double data_t;
 
+static std::vector<int> msgLog;
+static void logMsg(al_sec t, int id){ msgLog.push_back(id); }
+
+static std::vector<std::pair<int,int> > mpLog;
+static void logProducer(al_sec t, int producer, int n){ mpLog.push_back(std::make_pair(producer, n)); }
+
 int utTypes(){
 
 	// Conversion
@@ -294,6 +301,153 @@ int utTypes(){
 		assert(a.read(3) == 2);
 	}
 
+	{
+		SingleRWRingBuffer rb(10);
+		assert(rb.writeSpace() == 15);
+		assert(rb.readSpace() == 0);
+
+		char data[16] = "abcdefghijklmn";
+		char out[16] = {0};
+		assert(rb.write(data, 12) == 12);
+		assert(rb.read(out, 8) == 8);
+		assert(0 == memcmp(out, data, 8));
+
+		// Span wraps around the end of the buffer
+		SingleRWRingBuffer::Span w = rb.prepareWrite(20);
+		assert(w.size() == 11);
+		assert(w.size1 == 4 && w.data2 == w.data1 - 12);
+		w.copyFrom(data, 6);
+		assert(rb.readSpace() == 4); // not committed yet
+		rb.commitWrite(6);
+		assert(rb.readSpace() == 10);
+
+		SingleRWRingBuffer::Span r = rb.peekRead(16);
+		assert(r.size() == 10);
+		r.copyTo(out, 10);
+		assert(0 == memcmp(out, data + 8, 4));
+		assert(0 == memcmp(out + 4, data, 6));
+		assert(rb.readSpace() == 10); // not released yet
+		rb.commitRead(10);
+		assert(rb.readSpace() == 0);
+		assert(rb.writeSpace() == 15);
+
+		rb.write(data, 5);
+		rb.clear();
+		assert(rb.readSpace() == 0);
+		assert(rb.peekRead(4).size() == 0);
+	}
+
+	{	// Stream a counter between two threads through a small buffer
+		SingleRWRingBuffer rb(64);
+		const uint32_t N = 200000;
+
+		std::thread writer([&](){
+			uint32_t next = 0;
+			while (next < N) {
+				uint32_t sent = next;
+				if (next & 1) { // copying write
+					uint32_t v[3] = {next, next+1, next+2};
+					size_t n = next + 3 <= N ? 3 : N - next;
+					if (rb.writeSpace() >= n*sizeof(uint32_t)) {
+						assert(rb.write((char *)v, n*sizeof(uint32_t)) == n*sizeof(uint32_t));
+						next += n;
+					}
+				} else { // in place write
+					SingleRWRingBuffer::Span s = rb.prepareWrite(5*sizeof(uint32_t));
+					size_t n = s.size() / sizeof(uint32_t);
+					if (n > N - next) n = N - next;
+					uint32_t v[5];
+					for (size_t i = 0; i < n; ++i) v[i] = next + i;
+					s.copyFrom((char *)v, n*sizeof(uint32_t));
+					rb.commitWrite(n*sizeof(uint32_t));
+					next += n;
+				}
+				if (next == sent) std::this_thread::yield();
+			}
+		});
+
+		uint32_t expected = 0;
+		bool ok = true;
+		while (expected < N) {
+			uint32_t received = expected;
+			if (expected & 1) {
+				uint32_t v[4];
+				size_t n = rb.read((char *)v, sizeof(v)) / sizeof(uint32_t);
+				for (size_t i = 0; i < n; ++i) ok &= v[i] == expected++;
+			} else {
+				SingleRWRingBuffer::Span s = rb.peekRead(7*sizeof(uint32_t));
+				size_t n = s.size() / sizeof(uint32_t);
+				uint32_t v[7];
+				s.copyTo((char *)v, n*sizeof(uint32_t));
+				rb.commitRead(n*sizeof(uint32_t));
+				for (size_t i = 0; i < n; ++i) ok &= v[i] == expected++;
+			}
+			if (expected == received) std::this_thread::yield();
+		}
+		writer.join();
+		assert(ok);
+		assert(rb.readSpace() == 0);
+	}
+
+	{
+		ConcurrentMsgQueue q(4);
+		msgLog.clear();
+		assert(q.send(2.0, logMsg, 1));
+		assert(q.send(1.0, logMsg, 2));
+		assert(q.send(2.0, logMsg, 3));
+		assert(q.send(0.5, logMsg, 4));
+		assert(!q.send(0.5, logMsg, 5)); // slab full
+
+		char big[ConcurrentMsgQueue::MAX_ARGS_SIZE + 1];
+		assert(!q.sched(0, NULL, big, sizeof(big)));
+
+		q.update(1.0);
+		assert(msgLog.size() == 2 && msgLog[0] == 4 && msgLog[1] == 2);
+		assert(q.now() == 1.0);
+		assert(q.len() == 2);
+
+		assert(q.send(1.5, logMsg, 6));
+		q.update(3.0);
+		assert(msgLog.size() == 5);
+		assert(msgLog[2] == 6 && msgLog[3] == 1 && msgLog[4] == 3);
+		assert(q.len() == 0);
+
+		assert(q.send(4.0, logMsg, 7));
+		q.clear();
+		q.update(10.0);
+		assert(msgLog.size() == 5);
+	}
+
+	{	// Several producers sending while the consumer updates
+		const int numProducers = 4;
+		const int numMsgs = 20000;
+		ConcurrentMsgQueue q(256);
+		mpLog.clear();
+
+		std::vector<std::thread> producers;
+		for (int p = 0; p < numProducers; p++) {
+			producers.push_back(std::thread([&q, p](){
+				for (int n = 0; n < numMsgs; ) {
+					if (q.send(al_sec(n), logProducer, p, n)) ++n;
+					else std::this_thread::yield();
+				}
+			}));
+		}
+		for (al_sec t = 0; mpLog.size() < size_t(numProducers * numMsgs); t += 1) {
+			q.update(t < numMsgs ? t : numMsgs);
+			std::this_thread::yield();
+		}
+		for (auto& t : producers) t.join();
+
+		// Each producer's messages arrive once, in order
+		std::vector<int> next(numProducers, 0);
+		for (auto& m : mpLog) {
+			assert(m.second == next[m.first]);
+			next[m.first]++;
+		}
+		assert(q.len() == 0);
+	}
+
 	return 0;
 }
 
@@ -44,9 +44,13 @@
 */
 
 
+#include <algorithm>
+#include <vector>
+
 #include "allocore/types/al_Array.hpp"
 #include "allocore/math/al_Functions.hpp"
 #include "allocore/math/al_Random.hpp"
+#include "allocore/system/al_TaskPool.hpp"
 
 namespace al {
 
@@ -68,7 +72,11 @@ public:
 		mDimWrapZ(mDimZ-1),
 		mFront(1),
 		mArray0(components, Array::type<T>(), mDimX, mDimY, mDimZ),
-		mArray1(components, Array::type<T>(), mDimX, mDimY, mDimZ)
+		mArray1(components, Array::type<T>(), mDimX, mDimY, mDimZ),
+		mNumThreads(0),
+		mRedBlack(true),
+		mAdvectionMode(SEMI_LAGRANGIAN),
+		mDeterministic(false)
 	{}
 
 	~Field3D() {}
@@ -135,6 +143,22 @@ public:
 	// diffusion
 	void diffuse(T diffusion=T(0.01), unsigned passes=14);
 
+	/// Set number of threads used by diffuse() and relax(), 0 means all
+	/// threads of the shared TaskPool
+	void numThreads(unsigned n) { mNumThreads = n; }
+
+	/// Set whether diffuse() updates cells in red-black order (the default)
+
+	/// Red-black ordering updates all cells of one parity, then all cells of
+	/// the other, so the z-slabs of a pass can be relaxed in parallel. Turn it
+	/// off to get the original single-threaded lexicographic Gauss-Seidel sweep.
+	/// With the default compiler flags the speedup comes from the threads only,
+	/// the interior rows run faster per core when compiled with -march=native.
+	void redBlack(bool v) { mRedBlack = v; }
+
+	/// Red-black Gauss-Seidel passes of front = a back + b (sum of front's 6 neighbors)
+	void relaxRedBlack(T a, T b, unsigned passes);
+
 	/// Diffusion with arbitrary kernel:
 	/// the kernel layout:
 	enum CellIndex {
@@ -172,6 +196,26 @@ public:
 	void advect(const Array& velocities, T rate = T(1.));
 	static void advect(Array& dst, const Array& src, const Array& velocities, T rate = T(1.));
 
+	enum AdvectionMode {
+		SEMI_LAGRANGIAN = 0,	///< trilinear lookup at the back-traced position
+		MACCORMACK = 1,			///< corrected by tracing the result back again
+		BFECC = 2				///< back and forth error compensation and correction
+	};
+
+	/// Set the scheme used by advect(), SEMI_LAGRANGIAN by default
+
+	/// The higher order schemes trace the field forward and back again and
+	/// correct the result by half of the error, which keeps features sharper.
+	/// Results are clamped to the cells they were interpolated from.
+	void advection(AdvectionMode m) { mAdvectionMode = m; }
+
+	/// Set whether advect() reproduces Array::read_interp lookups bit-for-bit
+
+	/// By default the lookups are computed in T with the wrap done by masking,
+	/// which is faster but may differ in the last bits. Either way the result
+	/// does not depend on the number of threads.
+	void deterministic(bool v) { mDeterministic = v; }
+
 	/*
 		Clever part of Jos Stam's work.
 			A velocity field can become divergent (have regions that are purely emanating or aggregating)
@@ -184,12 +228,108 @@ public:
 	void calculateGradientMagnitude(Array& gradient);
 	void subtractGradientMagnitude(const Array& gradient);
 
+	/// Relax the back array towards the implicit diffusion of the front array
+
+	/// Iterates Jacobi steps with the 19-point Mehrstellen kernel, using the
+	/// back array as the initial guess and storing the result there.
 	void relax(double a, int iterations);
 
 protected:
 	size_t mDimX, mDimY, mDimZ, mDim3, mDimWrapX, mDimWrapY, mDimWrapZ;
 	volatile int mFront;	// which one is the front buffer?
 	Array mArray0, mArray1; //mArrays[2];	// double-buffering
+	Array mScratch, mVelocities;
+	unsigned mNumThreads;
+	bool mRedBlack;
+	AdvectionMode mAdvectionMode;
+	bool mDeterministic;
+
+	template<typename> friend class Multigrid3D;
+
+	// Splits the z-slices into one slab per thread and calls func(z0, z1) for
+	// each slab on the shared TaskPool
+	template <class Func>
+	void slabs(Func func){ slabs(mDimZ, mDim3, mNumThreads, func); }
+	template <class Func>
+	static void slabs(size_t dimz, size_t cells, unsigned numThreads, Func func);
+
+
+	// Element strides and wrap masks of an array
+	struct Layout {
+		Layout(const Array& a)
+		:	stride0(a.stride(0)/sizeof(T)), stride1(a.stride(1)/sizeof(T)), stride2(a.stride(2)/sizeof(T)),
+			wrapx(a.dim(0)-1), wrapy(a.dim(1)-1), wrapz(a.dim(2)-1)
+		{}
+		size_t index(size_t y, size_t z) const { return y*stride1 + z*stride2; }
+		size_t stride0, stride1, stride2, wrapx, wrapy, wrapz;
+	};
+
+	// Back-traced positions of a row of cells, as offsets of the cells
+	// around each position and the interpolation factors between them
+	struct RowTrace {
+		RowTrace(size_t n): x0(n), x1(n), yz00(n), yz10(n), yz01(n), yz11(n), fx(n), fy(n), fz(n) {}
+		void trace(const Layout& l, const T * vp, size_t vstride, size_t y, size_t z, T rate);
+		void read(const T * p, size_t x, size_t components, T * out) const;
+		void range(const T * p, size_t x, T& lo, T& hi) const;
+		std::vector<size_t> x0, x1, yz00, yz10, yz01, yz11;
+		std::vector<T> fx, fy, fz;
+	};
+
+	// Calls func(y, z, trace) for all rows, in tiles of 8 rows by 8 slices
+	template <class Func>
+	static void tiles(const Array& a, unsigned numThreads, Func func);
+
+	static bool advectable(const Array& src, const Array& velocities);
+	static void semiLagrangian(Array& dst, const Array& src, const Array& velocities,
+		T rate, unsigned numThreads, bool exact);
+};
+
+/*!
+	Geometric multigrid solver for the Poisson equation on toroidal grids
+
+	Solves 6 p - (sum of the 6 neighbors of p) = rhs on a 1-component
+	Field3D, with p in the front array and rhs in the back array. Each V-cycle
+	smooths with red-black Gauss-Seidel, restricts the residual to a grid of
+	half the resolution, recurses and adds back the trilinearly interpolated
+	correction. Grids are halved while all of their dimensions are at least 4.
+*/
+template<typename T=float>
+class Multigrid3D {
+public:
+
+	Multigrid3D(): mPreSmooth(2), mPostSmooth(2), mCycles(0) {}
+	~Multigrid3D();
+
+	/// Run V-cycles until the residual is below tolerance times the rhs
+
+	/// Returns the RMS residual relative to the RMS of the rhs, the front
+	/// array is used as the initial guess.
+	double solve(Field3D<T>& field, double tolerance=1e-3, unsigned maxCycles=10);
+
+	/// Run a single V-cycle
+	void vcycle(Field3D<T>& field);
+
+	/// Returns the RMS residual of the front array
+	double residual(Field3D<T>& field);
+
+	/// Set Gauss-Seidel passes before and after each coarse grid correction
+	void smoothing(unsigned pre, unsigned post){ mPreSmooth=pre; mPostSmooth=post; }
+
+	/// Number of V-cycles run by the last solve()
+	unsigned cycles() const { return mCycles; }
+
+protected:
+	std::vector<Field3D<T> *> mLevels;	// coarse grids with error in front, residual in back
+	unsigned mPreSmooth, mPostSmooth, mCycles;
+
+	void resize(const Field3D<T>& field);
+	void vcycle(Field3D<T>& field, unsigned level);
+	static double residualNorm(Field3D<T>& field, Field3D<T> * coarse);
+	static void prolong(Field3D<T>& coarse, Field3D<T>& fine);
+
+private:
+	Multigrid3D(const Multigrid3D&);
+	Multigrid3D& operator= (const Multigrid3D&);
 };
 
 template<typename T=float>
@@ -200,6 +340,10 @@ public:
 		CLAMP = 1,
 		FIELD = 2
 	};
+	enum ProjectionMode {
+		RELAX = 0,
+		MULTIGRID = 1
+	};
 
 	Fluid3D(int dimx=32, int dimy=32, int dimz=32)
 	:	velocities(3, dimx, dimy, dimz),
@@ -210,7 +354,11 @@ public:
 		selfadvection(0.9),
 		selfdecay(0.99),
 		selfbackgroundnoise(0.001),
-		mBoundaryMode(CLAMP)
+		tolerance(1e-3),
+		maxCycles(10),
+		mBoundaryMode(CLAMP),
+		mProjectionMode(RELAX),
+		mResidual(0)
 	{
 		// set all values to T(1):
 		T one = 1;
@@ -286,6 +434,15 @@ public:
 	}
 
 	void project() {
+		if (mProjectionMode == MULTIGRID) {
+			// solve for the pressure, with the divergence as rhs
+			gradient.back().zero();
+			velocities.calculateGradientMagnitude(gradient.back());
+			gradient.front().zero();
+			mResidual = mMultigrid.solve(gradient, tolerance, maxCycles);
+			velocities.subtractGradientMagnitude(gradient.front());
+			return;
+		}
 		gradient.back().zero();
 		// prepare new gradient data:
 		velocities.calculateGradientMagnitude(gradient.front());
@@ -297,12 +454,27 @@ public:
 
 	void boundary(BoundaryMode b) { mBoundaryMode = b; }
 
+	/// Set how project() solves for the pressure
+
+	/// RELAX diffuses the divergence with a fixed number of passes, MULTIGRID
+	/// runs V-cycles until the residual is below tolerance or maxCycles
+	/// have run.
+	void projection(ProjectionMode m) { mProjectionMode = m; }
+
+	/// Relative residual left by the last multigrid projection
+	double residual() const { return mResidual; }
+
 	Field3D<T> velocities, gradient;
 	Array boundaries;
 	unsigned passes;
 	T viscocity, selfadvection, selfdecay, selfbackgroundnoise;
+	double tolerance;
+	unsigned maxCycles;
 	rnd::Random<> rng;
 	BoundaryMode mBoundaryMode;
+	ProjectionMode mProjectionMode;
+	Multigrid3D<T> mMultigrid;
+	double mResidual;
 };
 
 
@@ -624,9 +796,140 @@ inline void Field3D<T>::add(Array& src) {
 	}
 }
 
+template<typename T>
+template<class Func>
+inline void Field3D<T> :: slabs(size_t dimz, size_t cells, unsigned numThreads, Func func) {
+	TaskPool& pool = TaskPool::global();
+	if(!numThreads) numThreads = pool.size();
+	// keep at least one slice and a worthwhile number of cells per thread
+	numThreads = std::min<size_t>(numThreads, dimz);
+	numThreads = std::min<size_t>(numThreads, cells / 32768);
+	if(numThreads < 1) numThreads = 1;
+
+	pool.parallelFor(numThreads, [&](int t){
+		func(dimz * t / numThreads, dimz * (t+1) / numThreads);
+	});
+}
+
+template<typename T>
+template<class Func>
+inline void Field3D<T> :: tiles(const Array& a, unsigned numThreads, Func func) {
+	const size_t dimy = a.dim(1);
+	const size_t dimz = a.dim(2);
+	slabs(dimz, dimy*dimz*a.dim(0), numThreads, [&](size_t zbegin, size_t zend){
+		RowTrace trace(a.dim(0));
+		for (size_t z0=zbegin; z0<zend; z0+=8) {
+			const size_t z1 = std::min(z0+8, zend);
+			for (size_t y0=0; y0<dimy; y0+=8) {
+				const size_t y1 = std::min(y0+8, dimy);
+				for (size_t z=z0; z<z1; z++) {
+					for (size_t y=y0; y<y1; y++) {
+						func(y, z, trace);
+					}
+				}
+			}
+		}
+	});
+}
+
+// Red-black Gauss-Seidel relaxation scheme:
+template<typename T>
+inline void Field3D<T> :: relaxRedBlack(T a, T b, unsigned passes) {
+	T * out = (T *)front().data.ptr;
+	const T * in = (const T *)back().data.ptr;
+	const size_t components = front().header.components;
+	const size_t stride1 = stride(1) / sizeof(T);
+	const size_t stride2 = stride(2) / sizeof(T);
+	const size_t rowLength = mDimX * components;
+
+	// which elements of a row belong to a cell at even or odd x
+	std::vector<char> oddBuffer(rowLength);
+	for (size_t i=0; i<rowLength; i++) oddBuffer[i] = (i/components)&1;
+
+	// updates the cells of one color in slice z of the slab [zbegin, zend)
+	auto sweep = [&](size_t z, size_t color, size_t zbegin, size_t zend, T * rowBuffer){
+		// another thread may be updating the neighboring slice
+		const bool shared = (z == zbegin || z+1 == zend);
+		for (size_t y=0;y<mDimY;y++) {
+			const size_t offset = y*stride1 + z*stride2;
+			T * next = out + offset;
+			const T * prev = in + offset;
+			const T * v0a0 = out + ((y-1)&mDimWrapY)*stride1 + z*stride2;
+			const T * v0b0 = out + ((y+1)&mDimWrapY)*stride1 + z*stride2;
+			const T * v00a = out + y*stride1 + ((z-1)&mDimWrapZ)*stride2;
+			const T * v00b = out + y*stride1 + ((z+1)&mDimWrapZ)*stride2;
+			// ia and ib index the cells before and after i on the row
+			auto solve = [&](size_t i, size_t ia, size_t ib){
+				return a*prev[i] + b*(
+					next[ia] + next[ib] +
+					v0a0[i] + v0b0[i] +
+					v00a[i] + v00b[i]
+				);
+			};
+			const size_t x0 = (color+y+z)&1;
+
+			if (shared) {
+				// only touch the cells of this color
+				for (size_t x=2-x0; x+1<mDimX; x+=2) {
+					for (size_t i=x*components; i<(x+1)*components; i++) {
+						next[i] = solve(i, i-components, i+components);
+					}
+				}
+			} else {
+				// solve the whole row and keep the cells of this color,
+				// which vectorizes much better
+				T * row = rowBuffer;
+				const char * odd = &oddBuffer[0];
+				const char parity = x0;
+				for (size_t i=components; i+components<rowLength; i++) {
+					row[i] = solve(i, i-components, i+components);
+				}
+				for (size_t i=components; i+components<rowLength; i++) {
+					next[i] = (odd[i] == parity) ? row[i] : next[i];
+				}
+			}
+
+			// the end of the row with this color wraps around
+			if (x0 < mDimX) {
+				const size_t x = x0 ? mDimX-1 : 0;
+				const size_t ia = ((x-1)&mDimWrapX)*components;
+				const size_t ib = ((x+1)&mDimWrapX)*components;
+				for (size_t k=0; k<components; k++) {
+					const size_t i = x*components + k;
+					next[i] = solve(i, ia+k, ib+k);
+				}
+			}
+		}
+	};
+
+	for (unsigned n=0 ; n<passes ; n++) {
+		// cells of one color only have neighbors of the other color, so the
+		// second color can follow one slice behind the first, which reads the
+		// field from memory once per pass
+		slabs([&](size_t zbegin, size_t zend){
+			std::vector<T> rowBuffer(rowLength);
+			for (size_t z=zbegin;z<zend;z++) {
+				sweep(z, 0, zbegin, zend, &rowBuffer[0]);
+				if (z >= zbegin+2 && z < zend) sweep(z-1, 1, zbegin, zend, &rowBuffer[0]);
+			}
+		});
+		// the slices next to other slabs wait for their first color
+		slabs([&](size_t zbegin, size_t zend){
+			sweep(zbegin, 1, zbegin, zend, 0);
+			if (zend-1 > zbegin) sweep(zend-1, 1, zbegin, zend, 0);
+		});
+	}
+}
+
 // Gauss-Seidel relaxation scheme:
 template<typename T>
 inline void Field3D<T> :: diffuse(T diffusion, unsigned passes) {
+	if (mRedBlack) {
+		const T div = 1.0/((1.+6.*diffusion));
+		swap();
+		relaxRedBlack(div, div*diffusion, passes);
+		return;
+	}
 	swap();
 	Array& out = front();
 	const Array& in = back();
@@ -775,136 +1078,287 @@ inline void Field3D<T> :: diffuse(const Kernel3& kernel, T diffusion, unsigned p
 */
 template<typename T>
 inline void Field3D<T> :: relax( double diffusion, int iterations) {
-	char * old = front().data.ptr;
-	char * out = back().data.ptr;
-	const uint32_t comps = components();
+	const T * old = (const T *)front().data.ptr;
+	T * out = (T *)back().data.ptr;
+	const size_t comps = components();
+	const size_t stride1 = stride(1) / sizeof(T);
+	const size_t stride2 = stride(2) / sizeof(T);
+	const size_t rowLength = mDimX * comps;
+	const T d = diffusion;
 #ifdef NoMerhstellen
-	const double c = 1./(1. + 6.*diffusion);
+	const T c = 1./(1. + 6.*diffusion);
 #else
-	const double c = 1./(1. + 24.*diffusion);
+	const T c = 1./(1. + 24.*diffusion);
 #endif
+	// Jacobi iterations alternate between the back array and a scratch array
+	mScratch.format(back().header);
+
+	T * src = out;
+	T * dst = (T *)mScratch.data.ptr;
 	for (int iter=0; iter<iterations; iter++) {
-		for (size_t z=0;z<mDimZ;z++) {
-			for (size_t y=0;y<mDimY;y++) {
-				for (size_t x=0;x<mDimX;x++) {
-					const size_t idx = index(x, y, z);
+		slabs([&](size_t zbegin, size_t zend){
+			for (size_t z=zbegin;z<zend;z++) {
+				for (size_t y=0;y<mDimY;y++) {
+					const size_t ym = ((y-1)&mDimWrapY)*stride1;
+					const size_t yp = ((y+1)&mDimWrapY)*stride1;
+					const size_t zm = ((z-1)&mDimWrapZ)*stride2;
+					const size_t zp = ((z+1)&mDimWrapZ)*stride2;
+					const size_t offset = y*stride1 + z*stride2;
+					const T * prev = old + offset;
+					T * next = dst + offset;
+					// rows of immediate neighbors
+					const T * v111 = src + offset;
+					const T * v101 = src + ym + z*stride2;
+					const T * v121 = src + yp + z*stride2;
+					const T * v110 = src + y*stride1 + zm;
+					const T * v112 = src + y*stride1 + zp;
+#ifndef NoMerhstellen
+					// rows of corner neighbors
+					const T * v100 = src + ym + zm;
+					const T * v120 = src + yp + zm;
+					const T * v102 = src + ym + zp;
+					const T * v122 = src + yp + zp;
+#endif
+					// ia and ib index the cells before and after i on each row
+					auto solve = [&](size_t i, size_t ia, size_t ib){
 #ifdef NoMerhstellen
-					const size_t x0 = index(x-1, y, z);
-					const size_t x1 = index(x+1, y, z);
-					const size_t y0 = index(x, y-1, z);
-					const size_t y1 = index(x, y+1, z);
-					const size_t z0 = index(x, y, z-1);
-					const size_t z1 = index(x, y, z+1);
-					for (unsigned k=0; k<comps; k++) {
-						out[idx+k] = c * (
-										old[idx+k] +
-										diffusion * (
-											out[x0+k] + out[x1+k] +
-											out[y0+k] + out[y1+k] +
-											out[z0+k] + out[z1+k]
+						next[i] = c * (
+										prev[i] +
+										d * (
+											v111[ia] + v111[ib] +
+											v101[i] + v121[i] +
+											v110[i] + v112[i]
 										)
 									);
-					}
 #else
-					// immediate neighbors
-					const size_t idx011 = index(x-1, y, z);
-					const size_t idx211 = index(x+1, y, z);
-					const size_t idx101 = index(x, y-1, z);
-					const size_t idx121 = index(x, y+1, z);
-					const size_t idx110 = index(x, y, z-1);
-					const size_t idx112 = index(x, y, z+1);
-					// corner neighbors
-					const size_t idx010 = index(x-1, y, z-1);
-					const size_t idx100 = index(x, y-1, z-1);
-					const size_t idx120 = index(x, y+1, z-1);
-					const size_t idx210 = index(x+1, y, z-1);
-					const size_t idx001 = index(x-1, y-1, z);
-					const size_t idx201 = index(x+1, y-1, z);
-					const size_t idx021 = index(x-1, y+1, z);
-					const size_t idx221 = index(x+1, y+1, z);
-					const size_t idx012 = index(x-1, y, z+1);
-					const size_t idx102 = index(x, y-1, z+1);
-					const size_t idx122 = index(x, y+1, z+1);
-					const size_t idx212 = index(x+1, y, z+1);
-					for (unsigned k=0; k<comps; k++) {
-						out[idx+k] = c * (
-										old[idx+k] +
-										diffusion * (2.*(
-											out[idx011+k] + out[idx211+k] +
-											out[idx101+k] + out[idx121+k] +
-											out[idx110+k] + out[idx112+k]
-										) + out[idx010+k] + out[idx100+k] +
-											out[idx120+k] + out[idx210+k] +
-											out[idx001+k] + out[idx201+k] +
-											out[idx021+k] + out[idx221+k] +
-											out[idx012+k] + out[idx102+k] +
-											out[idx122+k] + out[idx212+k]
+						next[i] = c * (
+										prev[i] +
+										d * (T(2)*(
+											v111[ia] + v111[ib] +
+											v101[i] + v121[i] +
+											v110[i] + v112[i]
+										) + v110[ia] + v100[i] +
+											v120[i] + v110[ib] +
+											v101[ia] + v101[ib] +
+											v121[ia] + v121[ib] +
+											v112[ia] + v102[i] +
+											v122[i] + v112[ib]
 										)
 									);
-					}
 #endif
+					};
+					for (size_t i=comps; i+comps<rowLength; i++) {
+						solve(i, i-comps, i+comps);
+					}
+					// ends of the row wrap around
+					const size_t ends[2] = { 0, mDimX-1 };
+					for (size_t e=0; e<(mDimX>1 ? 2 : 1); e++) {
+						const size_t i = ends[e]*comps;
+						const size_t ia = ((ends[e]-1)&mDimWrapX)*comps;
+						const size_t ib = ((ends[e]+1)&mDimWrapX)*comps;
+						for (size_t k=0; k<comps; k++) {
+							solve(i+k, ia+k, ib+k);
+						}
+					}
 				}
 			}
-		}
-		// todo: apply boundary here?
+		});
+		std::swap(src, dst);
 	}
-	#undef CELL
+	// odd number of iterations left the result in the scratch array
+	if (src != out) {
+		slabs([&](size_t zbegin, size_t zend){
+			for (size_t z=zbegin;z<zend;z++) {
+				for (size_t y=0;y<mDimY;y++) {
+					const size_t offset = y*stride1 + z*stride2;
+					std::copy(src + offset, src + offset + rowLength, out + offset);
+				}
+			}
+		});
+	}
+	// todo: apply boundary here?
 }
 
 template<typename T>
-inline void Field3D<T> :: advect(Array& dst, const Array& src, const Array& velocities, T rate) {
-	const size_t stride0 = src.stride(0);
-	const size_t stride1 = src.stride(1);
-	const size_t stride2 = src.stride(2);
-	const size_t dim0 = src.dim(0);
-	const size_t dim1 = src.dim(1);
-	const size_t dim2 = src.dim(2);
-	const size_t dimwrap0 = dim0-1;
-	const size_t dimwrap1 = dim1-1;
-	const size_t dimwrap2 = dim2-1;
+inline void Field3D<T>::RowTrace::trace(const Layout& l, const T * vp, size_t vstride, size_t y, size_t z, T rate) {
+	for (size_t x=0; x<x0.size(); x++) {
+		// back trace: (current cell offset by vector at cell)
+		const T px = x - rate * vp[0];
+		const T py = y - rate * vp[1];
+		const T pz = z - rate * vp[2];
+		vp += vstride;
+		// floor, the wrap is done by masking the integer cell
+		int ix = int(px); ix -= (px < T(ix));
+		int iy = int(py); iy -= (py < T(iy));
+		int iz = int(pz); iz -= (pz < T(iz));
+		fx[x] = px - T(ix);
+		fy[x] = py - T(iy);
+		fz[x] = pz - T(iz);
+		x0[x] = (size_t(ix) & l.wrapx) * l.stride0;
+		x1[x] = (size_t(ix+1) & l.wrapx) * l.stride0;
+		const size_t y0 = (size_t(iy) & l.wrapy) * l.stride1;
+		const size_t y1 = (size_t(iy+1) & l.wrapy) * l.stride1;
+		const size_t z0 = (size_t(iz) & l.wrapz) * l.stride2;
+		const size_t z1 = (size_t(iz+1) & l.wrapz) * l.stride2;
+		yz00[x] = y0 + z0;
+		yz10[x] = y1 + z0;
+		yz01[x] = y0 + z1;
+		yz11[x] = y1 + z1;
+	}
+}
+
+template<typename T>
+inline void Field3D<T>::RowTrace::read(const T * p, size_t x, size_t components, T * out) const {
+	const T * p00 = p + yz00[x];
+	const T * p10 = p + yz10[x];
+	const T * p01 = p + yz01[x];
+	const T * p11 = p + yz11[x];
+	const size_t xa = x0[x], xb = x1[x];
+	const T bx = fx[x], ax = T(1) - bx;
+	const T by = fy[x], ay = T(1) - by;
+	const T bz = fz[x], az = T(1) - bz;
+	for (size_t k=0; k<components; k++) {
+		out[k] =	((p00[xa+k]*ax + p00[xb+k]*bx)*ay + (p10[xa+k]*ax + p10[xb+k]*bx)*by)*az +
+					((p01[xa+k]*ax + p01[xb+k]*bx)*ay + (p11[xa+k]*ax + p11[xb+k]*bx)*by)*bz;
+	}
+}
 
+template<typename T>
+inline void Field3D<T>::RowTrace::range(const T * p, size_t x, T& lo, T& hi) const {
+	const size_t rows[4] = { yz00[x], yz10[x], yz01[x], yz11[x] };
+	lo = hi = p[rows[0] + x0[x]];
+	for (int i=0; i<4; i++) {
+		const T a = p[rows[i] + x0[x]];
+		const T b = p[rows[i] + x1[x]];
+		lo = std::min(lo, std::min(a, b));
+		hi = std::max(hi, std::max(a, b));
+	}
+}
+
+template<typename T>
+inline bool Field3D<T> :: advectable(const Array& src, const Array& velocities) {
 	if (velocities.header.type != src.header.type ||
 		velocities.header.components < 3 ||
-		velocities.header.dim[0] != dim0 ||
-		velocities.header.dim[1] != dim1 ||
-		velocities.header.dim[2] != dim2)
+		velocities.header.dim[0] != src.dim(0) ||
+		velocities.header.dim[1] != src.dim(1) ||
+		velocities.header.dim[2] != src.dim(2))
 	{
 		printf("Array format mismatch\n");
-		return;
+		return false;
 	}
-	char * outptr = dst.data.ptr;
-	char * velptr = velocities.data.ptr;
-
-	const size_t vstride0 = velocities.stride(0);
-	const size_t vstride1 = velocities.stride(1);
-	const size_t vstride2 = velocities.stride(2);
-
-	#define CELL(p, x, y, z, k) (((T *)((p) + (((x)&dimwrap0)*stride0) +  (((y)&dimwrap1)*stride1) +  (((z)&dimwrap2)*stride2)))[(k)])
-	#define VCELL(p, x, y, z, k) (((T *)((p) + (((x)&dimwrap0)*vstride0) +  (((y)&dimwrap1)*vstride1) +  (((z)&dimwrap2)*vstride2)))[(k)])
+	return true;
+}
 
-	for (size_t z=0;z<dim2;z++) {
-		for (size_t y=0;y<dim1;y++) {
+template<typename T>
+inline void Field3D<T> :: semiLagrangian(Array& dst, const Array& src, const Array& velocities,
+	T rate, unsigned numThreads, bool exact)
+{
+	const Layout sl(src), dl(dst), vl(velocities);
+	const size_t dim0 = src.dim(0);
+	const size_t components = src.header.components;
+	const T * sptr = (const T *)src.data.ptr;
+	T * dptr = (T *)dst.data.ptr;
+	const T * vptr = (const T *)velocities.data.ptr;
+
+	tiles(src, numThreads, [&](size_t y, size_t z, RowTrace& trace){
+		T * bp = dptr + dl.index(y, z);
+		const T * vp = vptr + vl.index(y, z);
+		if (exact) {
 			for (size_t x=0;x<dim0;x++) {
 				// back trace: (current cell offset by vector at cell)
-				T * bp  = &(CELL(outptr, x, y, z, 0));
-				T * vp	= &(VCELL(velptr, x, y, z, 0));
 				T vx = x - rate * vp[0];
 				T vy = y - rate * vp[1];
 				T vz = z - rate * vp[2];
-
 				// read interpolated input field value into back-traced location:
 				src.read_interp(bp, vx, vy, vz);
+				bp += dl.stride0;
+				vp += vl.stride0;
+			}
+		} else {
+			trace.trace(sl, vp, vl.stride0, y, z, rate);
+			// constant component counts let the compiler unroll the lookups
+			if (components == 1) {
+				for (size_t x=0;x<dim0;x++) trace.read(sptr, x, 1, bp + x*dl.stride0);
+			} else if (components == 3) {
+				for (size_t x=0;x<dim0;x++) trace.read(sptr, x, 3, bp + x*dl.stride0);
+			} else {
+				for (size_t x=0;x<dim0;x++) trace.read(sptr, x, components, bp + x*dl.stride0);
 			}
 		}
-	}
-	#undef CELL
-	#undef VCELL
+	});
+}
+
+template<typename T>
+inline void Field3D<T> :: advect(Array& dst, const Array& src, const Array& velocities, T rate) {
+	if (!advectable(src, velocities)) return;
+	semiLagrangian(dst, src, velocities, rate, 0, true);
 }
 
 template<typename T>
 inline void Field3D<T> :: advect(const Array& velocities, T rate) {
 	swap();
-	advect(front(), back(), velocities, rate);
+	Array& dst = front();
+	const Array& src = back();
+	if (!advectable(src, velocities)) return;
+	if (mAdvectionMode == SEMI_LAGRANGIAN) {
+		semiLagrangian(dst, src, velocities, rate, mNumThreads, mDeterministic);
+		return;
+	}
+
+	// the velocities must survive writing the result
+	const Array * vel = &velocities;
+	if (velocities.data.ptr == dst.data.ptr) {
+		mVelocities.format(velocities.header);
+		memcpy(mVelocities.data.ptr, velocities.data.ptr, velocities.size());
+		vel = &mVelocities;
+	}
+	mScratch.format(src.header);
+
+	const Layout sl(src), vl(*vel);
+	const size_t components = src.header.components;
+	const T * sptr = (const T *)src.data.ptr;
+	T * dptr = (T *)dst.data.ptr;
+	T * tptr = (T *)mScratch.data.ptr;
+	const T * vptr = (const T *)vel->data.ptr;
+
+	// trace forward, then back again
+	semiLagrangian(dst, src, *vel, rate, mNumThreads, mDeterministic);
+	semiLagrangian(mScratch, dst, *vel, -rate, mNumThreads, mDeterministic);
+
+	if (mAdvectionMode == BFECC) {
+		// correct the source by half the error of the round trip
+		tiles(src, mNumThreads, [&](size_t y, size_t z, RowTrace&){
+			const size_t i = sl.index(y, z);
+			for (size_t k=i; k<i+mDimX*sl.stride0; k++) {
+				tptr[k] = sptr[k] + T(0.5)*(sptr[k] - tptr[k]);
+			}
+		});
+	}
+
+	const bool bfecc = (mAdvectionMode == BFECC);
+	tiles(src, mNumThreads, [&](size_t y, size_t z, RowTrace& trace){
+		trace.trace(sl, vptr + vl.index(y, z), vl.stride0, y, z, rate);
+		const size_t i = sl.index(y, z);
+		for (size_t x=0;x<mDimX;x++) {
+			T * out = dptr + i + x*sl.stride0;
+			if (bfecc) {
+				// advect the corrected source
+				trace.read(tptr, x, components, out);
+			} else {
+				// correct the result by half the error of the round trip
+				for (size_t k=0; k<components; k++) {
+					const size_t j = i + x*sl.stride0 + k;
+					out[k] += T(0.5)*(sptr[j] - tptr[j]);
+				}
+			}
+			// clamp to the source cells to avoid overshoots
+			for (size_t k=0; k<components; k++) {
+				T lo, hi;
+				trace.range(sptr + k, x, lo, hi);
+				out[k] = std::max(lo, std::min(hi, out[k]));
+			}
+		}
+	});
 }
 
 template<typename T>
@@ -1065,5 +1519,216 @@ inline void Field3D<T> :: add(T * force) {
 }
 
 
+template<typename T>
+Multigrid3D<T> :: ~Multigrid3D() {
+	for (unsigned i=0; i<mLevels.size(); i++) delete mLevels[i];
+}
+
+template<typename T>
+inline void Multigrid3D<T> :: resize(const Field3D<T>& field) {
+	size_t dimx = field.dimx(), dimy = field.dimy(), dimz = field.dimz();
+	if (mLevels.size() &&
+		mLevels[0]->dimx()*2 == dimx &&
+		mLevels[0]->dimy()*2 == dimy &&
+		mLevels[0]->dimz()*2 == dimz) return;
+
+	for (unsigned i=0; i<mLevels.size(); i++) delete mLevels[i];
+	mLevels.clear();
+	while (dimx >= 4 && dimy >= 4 && dimz >= 4) {
+		dimx /= 2; dimy /= 2; dimz /= 2;
+		mLevels.push_back(new Field3D<T>(1, dimx, dimy, dimz));
+	}
+}
+
+// Computes the residual of field and returns its RMS. If coarse is given,
+// the residual is restricted into the coarse back array.
+template<typename T>
+inline double Multigrid3D<T> :: residualNorm(Field3D<T>& field, Field3D<T> * coarse) {
+	const T * p = (const T *)field.front().data.ptr;
+	const T * rhs = (const T *)field.back().data.ptr;
+	const size_t dimx = field.dimx();
+	const size_t stride1 = field.stride(1) / sizeof(T);
+	const size_t stride2 = field.stride(2) / sizeof(T);
+	const size_t wrapx = field.mDimWrapX;
+	const size_t wrapy = field.mDimWrapY;
+	const size_t wrapz = field.mDimWrapZ;
+
+	// residual of row y, z
+	auto residualRow = [&](size_t y, size_t z, T * r){
+		const size_t offset = y*stride1 + z*stride2;
+		const T * f = rhs + offset;
+		const T * v = p + offset;
+		const T * v0a0 = p + ((y-1)&wrapy)*stride1 + z*stride2;
+		const T * v0b0 = p + ((y+1)&wrapy)*stride1 + z*stride2;
+		const T * v00a = p + y*stride1 + ((z-1)&wrapz)*stride2;
+		const T * v00b = p + y*stride1 + ((z+1)&wrapz)*stride2;
+		auto solve = [&](size_t x, size_t xa, size_t xb){
+			return f[x] - (T(6)*v[x] - (
+				v[xa] + v[xb] +
+				v0a0[x] + v0b0[x] +
+				v00a[x] + v00b[x]
+			));
+		};
+		for (size_t x=1; x+1<dimx; x++) r[x] = solve(x, x-1, x+1);
+		r[0] = solve(0, wrapx, 1&wrapx);
+		r[wrapx] = solve(wrapx, (wrapx-1)&wrapx, 0);
+	};
+
+	std::vector<double> sums(field.dimz(), 0.);
+	if (coarse) {
+		T * crhs = (T *)coarse->back().data.ptr;
+		const size_t cstride1 = coarse->stride(1) / sizeof(T);
+		const size_t cstride2 = coarse->stride(2) / sizeof(T);
+		coarse->slabs([&](size_t zbegin, size_t zend){
+			std::vector<T> buffer(dimx*4);
+			T * r00 = &buffer[0];
+			T * r10 = r00 + dimx;
+			T * r01 = r10 + dimx;
+			T * r11 = r01 + dimx;
+			double sum = 0;
+			for (size_t z=zbegin; z<zend; z++) {
+				for (size_t y=0; y<coarse->dimy(); y++) {
+					residualRow(2*y, 2*z, r00);
+					residualRow(2*y+1, 2*z, r10);
+					residualRow(2*y, 2*z+1, r01);
+					residualRow(2*y+1, 2*z+1, r11);
+					for (size_t x=0; x<dimx; x++) {
+						sum += r00[x]*r00[x] + r10[x]*r10[x] + r01[x]*r01[x] + r11[x]*r11[x];
+					}
+					// average of the 8 fine cells, scaled to the coarse cell size
+					T * c = crhs + y*cstride1 + z*cstride2;
+					for (size_t x=0; x<coarse->dimx(); x++) {
+						c[x] = T(0.5) * (
+							r00[2*x] + r00[2*x+1] + r10[2*x] + r10[2*x+1] +
+							r01[2*x] + r01[2*x+1] + r11[2*x] + r11[2*x+1]
+						);
+					}
+				}
+			}
+			sums[zbegin] = sum;
+		});
+	} else {
+		field.slabs([&](size_t zbegin, size_t zend){
+			std::vector<T> r(dimx);
+			double sum = 0;
+			for (size_t z=zbegin; z<zend; z++) {
+				for (size_t y=0; y<field.dimy(); y++) {
+					residualRow(y, z, &r[0]);
+					for (size_t x=0; x<dimx; x++) sum += r[x]*r[x];
+				}
+			}
+			sums[zbegin] = sum;
+		});
+	}
+	double sum = 0;
+	for (size_t z=0; z<sums.size(); z++) sum += sums[z];
+	return sqrt(sum / field.mDim3);
+}
+
+// Adds the trilinear interpolation of the coarse front array to the fine one
+template<typename T>
+inline void Multigrid3D<T> :: prolong(Field3D<T>& coarse, Field3D<T>& fine) {
+	const T * c = (const T *)coarse.front().data.ptr;
+	T * f = (T *)fine.front().data.ptr;
+	const size_t cdimx = coarse.dimx();
+	const size_t cstride1 = coarse.stride(1) / sizeof(T);
+	const size_t cstride2 = coarse.stride(2) / sizeof(T);
+	const size_t stride1 = fine.stride(1) / sizeof(T);
+	const size_t stride2 = fine.stride(2) / sizeof(T);
+
+	fine.slabs([&](size_t zbegin, size_t zend){
+		// interpolated coarse row, padded with the wrapped cells
+		std::vector<T> buffer(cdimx+2);
+		T * row = &buffer[1];
+		for (size_t z=zbegin; z<zend; z++) {
+			// fine cells lie a quarter of a coarse cell from the coarse center
+			const size_t cz0 = (z>>1) * cstride2;
+			const size_t cz1 = (((z>>1) + ((z&1) ? 1 : -1)) & coarse.mDimWrapZ) * cstride2;
+			for (size_t y=0; y<fine.dimy(); y++) {
+				const size_t cy0 = (y>>1) * cstride1;
+				const size_t cy1 = (((y>>1) + ((y&1) ? 1 : -1)) & coarse.mDimWrapY) * cstride1;
+				const T * c00 = c + cy0 + cz0;
+				const T * c10 = c + cy1 + cz0;
+				const T * c01 = c + cy0 + cz1;
+				const T * c11 = c + cy1 + cz1;
+				for (size_t x=0; x<cdimx; x++) {
+					row[x] = T(9./16.)*c00[x] + T(3./16.)*(c10[x] + c01[x]) + T(1./16.)*c11[x];
+				}
+				row[-1] = row[cdimx-1];
+				row[cdimx] = row[0];
+
+				T * next = f + y*stride1 + z*stride2;
+				for (size_t x=0; x<cdimx; x++) {
+					next[2*x]   += T(0.75)*row[x] + T(0.25)*row[x-1];
+					next[2*x+1] += T(0.75)*row[x] + T(0.25)*row[x+1];
+				}
+			}
+		}
+	});
+}
+
+template<typename T>
+inline void Multigrid3D<T> :: vcycle(Field3D<T>& field, unsigned level) {
+	const T sixth = T(1./6.);
+	Field3D<T> * coarse = level < mLevels.size() ? mLevels[level] : 0;
+	if (coarse) coarse->numThreads(field.mNumThreads);
+
+	if (level && !coarse) {
+		// solve the coarsest grid, its rhs must sum to zero on the torus
+		T * rhs = (T *)field.back().data.ptr;
+		double mean = 0;
+		for (size_t i=0; i<field.mDim3; i++) mean += rhs[i];
+		mean /= field.mDim3;
+		for (size_t i=0; i<field.mDim3; i++) rhs[i] -= mean;
+		size_t dim = std::max(field.dimx(), std::max(field.dimy(), field.dimz()));
+		field.relaxRedBlack(sixth, sixth, 4*dim*dim);
+		return;
+	}
+
+	field.relaxRedBlack(sixth, sixth, mPreSmooth);
+	if (coarse) {
+		residualNorm(field, coarse);
+		coarse->front().zero();
+		vcycle(*coarse, level+1);
+		prolong(*coarse, field);
+	}
+	field.relaxRedBlack(sixth, sixth, mPostSmooth);
+}
+
+template<typename T>
+inline void Multigrid3D<T> :: vcycle(Field3D<T>& field) {
+	resize(field);
+	vcycle(field, 0);
+}
+
+template<typename T>
+inline double Multigrid3D<T> :: residual(Field3D<T>& field) {
+	return residualNorm(field, 0);
+}
+
+template<typename T>
+inline double Multigrid3D<T> :: solve(Field3D<T>& field, double tolerance, unsigned maxCycles) {
+	mCycles = 0;
+	if (field.components() != 1) {
+		printf("Multigrid3D::solve() only valid for 1-component fields\n");
+		return 0;
+	}
+	const T * rhs = (const T *)field.back().data.ptr;
+	double norm = 0;
+	for (size_t i=0; i<field.mDim3; i++) norm += rhs[i]*rhs[i];
+	norm = sqrt(norm / field.mDim3);
+	if (norm == 0) return 0;
+
+	resize(field);
+	double r = residual(field) / norm;
+	while (r > tolerance && mCycles < maxCycles) {
+		vcycle(field, 0);
+		mCycles++;
+		r = residual(field) / norm;
+	}
+	return r;
+}
+
+
 }; // al
 #endif
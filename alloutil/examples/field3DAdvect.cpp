@@ -0,0 +1,69 @@
+/*
+Allocore Example: Field3D advection benchmark
+
+Description:
+This measures how many cells per second Field3D::advect moves through a
+swirling velocity field, for 3-component fields of 64^3, 128^3 and 256^3
+cells. It compares the lookups of Array::read_interp (deterministic mode,
+bit-for-bit equal to the original advect) with the default lookups, on one
+thread and on all cores, and the cost of the MacCormack and BFECC schemes.
+
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <thread>
+
+#include "allocore/system/al_Time.hpp"
+#include "alloutil/al_Field3D.hpp"
+
+using namespace al;
+
+static const int STEPS = 4;
+
+// Returns cells per second of one advection step
+double advectRate(Field3D<float>& field, const Field3D<float>& velocities,
+	Field3D<float>::AdvectionMode mode, bool deterministic, unsigned numThreads)
+{
+	field.advection(mode);
+	field.deterministic(deterministic);
+	field.numThreads(numThreads);
+	Timer timer;
+	for(int i=0; i<STEPS; ++i) field.advect(velocities.front(), 1);
+	timer.stop();
+	return double(field.dimx())*field.dimy()*field.dimz()*STEPS / timer.elapsedSec();
+}
+
+int main(){
+	unsigned cores = std::thread::hardware_concurrency();
+	printf("\n3-component fields, Mcells/s\n\n");
+	printf("dim   read_interp   read_interp %2dt   default   default %2dt   MacCormack %2dt   BFECC %2dt\n",
+		cores, cores, cores, cores);
+
+	int dims[] = {64, 128, 256};
+	for(int N : dims){
+		Field3D<float> field(3, N, N, N);
+		Field3D<float> velocities(3, N, N, N);
+		rnd::Random<> rng(1);
+		field.adduniform(rng);
+		// rotation around the z axis, up to a few cells per step
+		for(int z=0; z<N; ++z){
+		for(int y=0; y<N; ++y){
+		for(int x=0; x<N; ++x){
+			velocities.front().elem<float>(0, x, y, z) = 4.f * (y - N/2) / N;
+			velocities.front().elem<float>(1, x, y, z) = 4.f * (N/2 - x) / N;
+			velocities.front().elem<float>(2, x, y, z) = 0.5f;
+		}}}
+
+		typedef Field3D<float> F;
+		double exact1 = advectRate(field, velocities, F::SEMI_LAGRANGIAN, true, 1);
+		double exactN = advectRate(field, velocities, F::SEMI_LAGRANGIAN, true, cores);
+		double fast1 = advectRate(field, velocities, F::SEMI_LAGRANGIAN, false, 1);
+		double fastN = advectRate(field, velocities, F::SEMI_LAGRANGIAN, false, cores);
+		double mac = advectRate(field, velocities, F::MACCORMACK, false, cores);
+		double bfecc = advectRate(field, velocities, F::BFECC, false, cores);
+		printf("%3d   %11.1f   %15.1f   %7.1f   %11.1f   %14.1f   %9.1f\n", N,
+			exact1*1e-6, exactN*1e-6, fast1*1e-6, fastN*1e-6, mac*1e-6, bfecc*1e-6);
+	}
+	return 0;
+}
@@ -0,0 +1,96 @@
+/*
+Allocore Example: Field3D diffusion benchmark
+
+Description:
+This measures how many cells per second Field3D::diffuse and Field3D::relax
+update, for 3-component fields of 64^3, 128^3 and 256^3 cells. It compares
+the original lexicographic Gauss-Seidel sweep of diffuse with the red-black
+sweep on one thread and on all cores. As the sweeps visit the cells in a
+different order, it also prints the remaining residual of the implicit
+diffusion equation to show that both converge equally well.
+
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <thread>
+
+#include "allocore/system/al_Time.hpp"
+#include "alloutil/al_Field3D.hpp"
+
+using namespace al;
+
+static const unsigned PASSES = 14;
+static const float DIFFUSION = 0.5;
+
+// Largest error of (1+6d) next - d sum(neighbors of next) = prev
+double residual(Field3D<float>& field){
+	double r = 0;
+	const Array& next = field.front();
+	const Array& prev = field.back();
+	int N = field.dimx();
+	for(int z=0; z<N; ++z){
+	for(int y=0; y<N; ++y){
+	for(int x=0; x<N; ++x){
+		for(unsigned k=0; k<field.components(); ++k){
+			#define V(a, i,j,l) a.elem<float>(k, (i)&(N-1), (j)&(N-1), (l)&(N-1))
+			double sum = V(next, x-1,y,z) + V(next, x+1,y,z)
+					+ V(next, x,y-1,z) + V(next, x,y+1,z)
+					+ V(next, x,y,z-1) + V(next, x,y,z+1);
+			double e = (1. + 6.*DIFFUSION) * V(next, x,y,z) - DIFFUSION * sum - V(prev, x,y,z);
+			#undef V
+			r = std::max(r, std::fabs(e));
+		}
+	}}}
+	return r;
+}
+
+// Returns cells per second of one diffusion pass
+double diffuseRate(int N, bool redBlack, unsigned numThreads, double& res){
+	Field3D<float> field(3, N, N, N);
+	rnd::Random<> rng;
+	field.adduniformS(rng);
+	field.swap();
+	field.front().zero();
+	field.swap();
+	field.redBlack(redBlack);
+	field.numThreads(numThreads);
+
+	Timer timer;
+	field.diffuse(DIFFUSION, PASSES);
+	timer.stop();
+	res = residual(field);
+	return double(N)*N*N*PASSES / timer.elapsedSec();
+}
+
+// Returns cells per second of one relaxation iteration
+double relaxRate(int N, unsigned numThreads){
+	Field3D<float> field(3, N, N, N);
+	rnd::Random<> rng;
+	field.adduniformS(rng);
+	field.back().zero();
+	field.numThreads(numThreads);
+
+	Timer timer;
+	field.relax(DIFFUSION, PASSES);
+	timer.stop();
+	return double(N)*N*N*PASSES / timer.elapsedSec();
+}
+
+int main(){
+	unsigned cores = std::thread::hardware_concurrency();
+	printf("\n%d passes of diffusion %g on 3-component fields, Mcells/s\n\n", PASSES, DIFFUSION);
+	printf("dim   Gauss-Seidel   red-black   red-black %2dt   relax %2dt\n", cores, cores);
+
+	int dims[] = {64, 128, 256};
+	for(int N : dims){
+		double r0, r1, r2;
+		double gs = diffuseRate(N, false, 1, r0);
+		double rb1 = diffuseRate(N, true, 1, r1);
+		double rbN = diffuseRate(N, true, cores, r2);
+		double rl = relaxRate(N, cores);
+		printf("%3d   %12.1f   %9.1f   %12.1f   %8.1f\n", N, gs*1e-6, rb1*1e-6, rbN*1e-6, rl*1e-6);
+		printf("      residual %.2e   %9.2e   %12.2e\n", r0, r1, r2);
+	}
+	return 0;
+}
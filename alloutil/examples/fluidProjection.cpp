@@ -0,0 +1,97 @@
+/*
+Allocore Example: Fluid projection benchmark
+
+Description:
+This compares the two ways Fluid3D::project() can remove the divergence of
+a velocity field: diffusing the divergence with a fixed number of relaxation
+passes, and solving for the pressure with multigrid V-cycles until the
+residual is below a tolerance. For grids of 64^3, 128^3 and 256^3 cells it
+reports the time of one projection and the RMS divergence left, relative to
+the divergence of the field before projecting.
+
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "allocore/system/al_Time.hpp"
+#include "alloutil/al_Field3D.hpp"
+
+using namespace al;
+
+// RMS of the central difference divergence
+double divergence(Field3D<float>& v){
+	const Array& a = v.front();
+	int N = v.dimx(), W = N-1;
+	double sum = 0;
+	for(int z=0; z<N; ++z){
+	for(int y=0; y<N; ++y){
+	for(int x=0; x<N; ++x){
+		double d = a.elem<float>(0, (x+1)&W, y, z) - a.elem<float>(0, (x-1)&W, y, z)
+				 + a.elem<float>(1, x, (y+1)&W, z) - a.elem<float>(1, x, (y-1)&W, z)
+				 + a.elem<float>(2, x, y, (z+1)&W) - a.elem<float>(2, x, y, (z-1)&W);
+		sum += d*d;
+	}}}
+	return sqrt(sum / (double(N)*N*N));
+}
+
+// Sum of random low frequency waves
+void randomFlow(Field3D<float>& v){
+	rnd::Random<> rng(1);
+	int N = v.dimx();
+	for(int wave=0; wave<8; ++wave){
+		float k[3], amp[3];
+		for(int i=0; i<3; ++i){
+			k[i] = M_2PI * (int(rng.uniform(9.f)) - 4) / N;
+			amp[i] = rng.uniformS();
+		}
+		float phase = rng.uniform() * M_2PI;
+		for(int z=0; z<N; ++z){
+		for(int y=0; y<N; ++y){
+		for(int x=0; x<N; ++x){
+			float s = sin(k[0]*x + k[1]*y + k[2]*z + phase);
+			for(int i=0; i<3; ++i) v.front().elem<float>(i, x, y, z) += amp[i] * s;
+		}}}
+	}
+}
+
+int main(){
+	printf("\nprojection of a random low frequency velocity field\n\n");
+	printf("dim   method              ms     divergence left   cycles\n");
+
+	int dims[] = {64, 128, 256};
+	for(int N : dims){
+		Fluid3D<float> fluid(N, N, N);
+		randomFlow(fluid.velocities);
+		const double div0 = divergence(fluid.velocities);
+
+		// keep the field to project it again with each method
+		Array start;
+		start.format(fluid.velocities.front().header);
+		memcpy(start.data.ptr, fluid.velocities.front().data.ptr, start.size());
+
+		struct { const char * name; Fluid3D<float>::ProjectionMode mode; unsigned passes; double tolerance; } runs[] = {
+			{"relax 14 passes", Fluid3D<float>::RELAX, 14, 0},
+			{"relax 56 passes", Fluid3D<float>::RELAX, 56, 0},
+			{"multigrid 1e-2",  Fluid3D<float>::MULTIGRID, 0, 1e-2},
+			{"multigrid 1e-4",  Fluid3D<float>::MULTIGRID, 0, 1e-4},
+		};
+		for(auto& run : runs){
+			memcpy(fluid.velocities.front().data.ptr, start.data.ptr, start.size());
+			fluid.gradient.front().zero();
+			fluid.projection(run.mode);
+			fluid.passes = run.passes;
+			fluid.tolerance = run.tolerance;
+
+			Timer timer;
+			fluid.project();
+			timer.stop();
+
+			printf("%3d   %-16s %8.1f   %15.4f", N, run.name, timer.elapsedSec()*1e3, divergence(fluid.velocities) / div0);
+			if(run.mode == Fluid3D<float>::MULTIGRID) printf("   %6d", fluid.mMultigrid.cycles());
+			printf("\n");
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,19 @@
+#include "utAlloutil.h"
+
+int main (int argc, char * const argv[]) {
+
+	// Logical tests; these should not print anything out to the console
+	// (as it interferes with assertion error messages).
+
+	// This macro runs the unit test and prints out status info
+	// 'Name' should match the name of the unit test, utName.
+	#define RUNTEST(Name)\
+		printf("%s ", #Name);\
+		ut##Name();\
+		for(size_t i=0; i<32-strlen(#Name); ++i) printf(".");\
+		printf(" pass\n")
+
+	RUNTEST(Field3D);
+
+	return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef INCLUDE_UT_ALLOUTIL_H
+#define INCLUDE_UT_ALLOUTIL_H
+
+#undef NDEBUG
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "allocore/al_Allocore.hpp"
+
+using namespace al;
+
+int utField3D();
+
+#endif
@@ -0,0 +1,149 @@
+#include "utAlloutil.h"
+#include "alloutil/al_Field3D.hpp"
+
+#include <vector>
+
+// Copies a field array into a vector of x-fastest cells
+template<class T>
+static std::vector<T> cells(const Field3D<T>& f, bool front) {
+	const char * p = (front ? f.front() : f.back()).data.ptr;
+	std::vector<T> v;
+	for (unsigned z=0; z<f.dimz(); z++)
+	for (unsigned y=0; y<f.dimy(); y++)
+	for (unsigned x=0; x<f.dimx(); x++)
+	for (unsigned k=0; k<f.components(); k++) v.push_back(((const T *)(p + f.index(x, y, z)))[k]);
+	return v;
+}
+
+// Red-black Gauss-Seidel passes of out = a in + b (sum of the 6 neighbors),
+// visiting all cells of one color, then all cells of the other
+template<class T>
+static void relaxReference(std::vector<T>& out, const std::vector<T>& in,
+	int c, int nx, int ny, int nz, T a, T b, int passes)
+{
+	auto at = [&](int x, int y, int z){
+		return ((((z+nz)%nz)*ny + (y+ny)%ny)*nx + (x+nx)%nx)*c;
+	};
+	for (int n=0; n<passes; n++)
+	for (int color=0; color<2; color++)
+	for (int z=0; z<nz; z++)
+	for (int y=0; y<ny; y++)
+	for (int x=0; x<nx; x++) {
+		if (((x+y+z)&1) != color) continue;
+		for (int k=0; k<c; k++) {
+			out[at(x,y,z)+k] = a*in[at(x,y,z)+k] + b*(
+				out[at(x-1,y,z)+k] + out[at(x+1,y,z)+k] +
+				out[at(x,y-1,z)+k] + out[at(x,y+1,z)+k] +
+				out[at(x,y,z-1)+k] + out[at(x,y,z+1)+k]
+			);
+		}
+	}
+}
+
+int utField3D() {
+
+	// Red-black diffusion matches a cell by cell sweep on any number of threads
+	// (slabs keep at least 32768 cells per thread, so the grid allows four)
+	for (int c=1; c<=3; c+=2) {
+		for (unsigned numThreads=1; numThreads<=4; numThreads++) {
+			Field3D<float> f(c, 32, 64, 64);
+			rnd::Random<> rng(c);
+			f.adduniform(rng);
+			f.swap();
+			f.adduniform(rng);
+			f.swap();
+			std::vector<float> in = cells(f, true);
+			std::vector<float> out = cells(f, false);
+
+			const float diffusion = 0.1f;
+			f.numThreads(numThreads);
+			f.diffuse(diffusion, 5);
+
+			const float a = 1.0/((1.+6.*diffusion));
+			relaxReference(out, in, c, 32, 64, 64, a, a*diffusion, 5);
+			assert(cells(f, true) == out);
+			assert(cells(f, false) == in);
+		}
+	}
+
+	// Multigrid V-cycles reduce the residual of a Poisson problem
+	{
+		// large enough for two threads on the finest level
+		Field3D<float> f(1, 64, 32, 32);
+		f.numThreads(2);
+		// zero-mean rhs in the back array, as required on the torus
+		f.swap();
+		rnd::Random<> rng(1);
+		f.adduniformS(rng);
+		float * rhs = f.ptr();
+		double mean = 0;
+		for (unsigned i=0; i<f.length(); i++) mean += rhs[i];
+		mean /= f.length();
+		for (unsigned i=0; i<f.length(); i++) rhs[i] -= mean;
+		f.swap();
+
+		Multigrid3D<float> mg;
+		double r = mg.residual(f);
+		assert(r > 0);
+		for (int i=0; i<4; i++) {
+			mg.vcycle(f);
+			double next = mg.residual(f);
+			assert(next < 0.3*r);
+			r = next;
+		}
+
+		f.front().zero();
+		assert(mg.solve(f, 1e-4, 20) < 1e-4);
+		assert(mg.cycles() > 1 && mg.cycles() < 20);
+	}
+
+	// Advection of a sine wave by a uniform velocity along x
+	double advectionError[2];
+	for (int mode=Field3D<float>::SEMI_LAGRANGIAN; mode<=Field3D<float>::MACCORMACK; mode++) {
+		// large enough for three threads
+		const int N = 32, M = 64;
+		Field3D<float> f(1, N, M, M), v(3, N, M, M);
+		f.advection(Field3D<float>::AdvectionMode(mode));
+		f.numThreads(3);
+		for (int z=0; z<M; z++)
+		for (int y=0; y<M; y++)
+		for (int x=0; x<N; x++) {
+			*(float *)(f.front().data.ptr + f.index(x, y, z)) = sin(2*M_PI*x/N);
+		}
+
+		// returns the largest error after translating by t cells
+		auto error = [&](float t){
+			double e = 0;
+			for (int z=0; z<M; z++)
+			for (int y=0; y<M; y++)
+			for (int x=0; x<N; x++) {
+				float p = *(float *)(f.front().data.ptr + f.index(x, y, z));
+				e = std::max(e, fabs(p - sin(2*M_PI*(x-t)/N)));
+			}
+			return e;
+		};
+		auto velocity = [&](float u){
+			for (int z=0; z<M; z++)
+			for (int y=0; y<M; y++)
+			for (int x=0; x<N; x++) {
+				float * p = (float *)(v.front().data.ptr + v.index(x, y, z));
+				p[0] = u; p[1] = p[2] = 0;
+			}
+		};
+
+		// whole cells are moved exactly
+		velocity(1);
+		f.advect(v.front(), 3);
+		assert(error(3) < 1e-6);
+
+		// a quarter cell per step smears the wave
+		velocity(0.25);
+		for (int i=0; i<16; i++) f.advect(v.front());
+		advectionError[mode] = error(7);
+	}
+	// MacCormack removes most of the smearing
+	assert(advectionError[Field3D<float>::SEMI_LAGRANGIAN] > 0.02);
+	assert(advectionError[Field3D<float>::MACCORMACK] < 0.25*advectionError[Field3D<float>::SEMI_LAGRANGIAN]);
+
+	return 0;
+}